@@ -0,0 +1,241 @@
+//  Memory allocation for NEW, DISPOSE and ARENA.
+//
+//  Programs allocate many small blocks of the same few sizes, the targets of their pointer types, so blocks are not
+//  prefixed by a header: the compiler passes the size of the block to both __ceri_new and __ceri_dispose.
+//
+//  Small blocks are rounded up to a size class, each with a free list of the blocks given back by DISPOSE. New blocks
+//  are carved from slabs that are never given back to the C library, and larger blocks go to malloc() directly.
+//  Inside an ARENA, blocks are carved from chunks owned by the arena instead, which are all freed when it ends.
+//
+//  Free lists, slabs and arenas are per thread, so that no locking is needed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! Sizes of the classes are multiples of this, which is also the alignment of every block.
+#define SIZE_CLASS_GRANULARITY 8
+
+//! Larger blocks are allocated by malloc().
+#define MAX_POOLED_SIZE 256
+
+#define SIZE_CLASS_COUNT (MAX_POOLED_SIZE / SIZE_CLASS_GRANULARITY)
+
+#define SLAB_SIZE (64 * 1024)
+
+//! Size of the first chunk of an arena, doubled by each of the next ones.
+#define FIRST_ARENA_CHUNK_SIZE (64 * 1024)
+
+struct FreeBlock
+{
+	struct FreeBlock* next;
+};
+
+//! \brief Memory owned by an arena, which starts right after this header.
+struct ArenaChunk
+{
+	struct ArenaChunk* previous;
+	char*              end;
+};
+
+//! \brief Stored at the start of its first chunk.
+struct Arena
+{
+	struct Arena*      outer;
+	struct ArenaChunk* chunk;
+
+	//! Free memory left in the current chunk.
+	char *cursor, *end;
+
+	size_t next_chunk_size;
+};
+
+static _Thread_local struct FreeBlock* free_lists[SIZE_CLASS_COUNT];
+
+static _Thread_local char *slab_cursor, *slab_end;
+
+static _Thread_local struct Arena* innermost_arena;
+
+//! First chunk of the last arena that ended, kept so that arenas started in a loop do not call malloc() every time.
+static _Thread_local struct ArenaChunk* spare_chunk;
+
+static void* checked_malloc(size_t size)
+{
+	void* pointer = malloc(size);
+
+	if (pointer == NULL)
+	{
+		fputs("ceri runtime: out of memory\n", stderr);
+		abort();
+	}
+
+	return pointer;
+}
+
+static size_t round_to_granularity(uint64_t size)
+{
+	return (size + SIZE_CLASS_GRANULARITY - 1) / SIZE_CLASS_GRANULARITY * SIZE_CLASS_GRANULARITY;
+}
+
+static struct ArenaChunk* new_arena_chunk(size_t size)
+{
+	struct ArenaChunk* chunk;
+
+	if (size == FIRST_ARENA_CHUNK_SIZE && spare_chunk != NULL)
+	{
+		chunk       = spare_chunk;
+		spare_chunk = NULL;
+	}
+	else
+	{
+		chunk = checked_malloc(sizeof(struct ArenaChunk) + size);
+	}
+
+	chunk->previous = NULL;
+	chunk->end      = (char*)(chunk + 1) + size;
+	return chunk;
+}
+
+static void* arena_allocate(struct Arena* arena, size_t size)
+{
+	if ((size_t)(arena->end - arena->cursor) < size)
+	{
+		size_t chunk_size = arena->next_chunk_size;
+
+		while (chunk_size < size)
+		{
+			chunk_size *= 2;
+		}
+
+		struct ArenaChunk* chunk = new_arena_chunk(chunk_size);
+		chunk->previous          = arena->chunk;
+
+		arena->chunk           = chunk;
+		arena->cursor          = (char*)(chunk + 1);
+		arena->end             = chunk->end;
+		arena->next_chunk_size = chunk_size * 2;
+	}
+
+	void* pointer = arena->cursor;
+	arena->cursor += size;
+	return pointer;
+}
+
+//! \brief Whether \p pointer was allocated from an arena that has not ended yet.
+static int is_in_arena(const void* pointer)
+{
+	for (const struct Arena* arena = innermost_arena; arena != NULL; arena = arena->outer)
+	{
+		for (const struct ArenaChunk* chunk = arena->chunk; chunk != NULL; chunk = chunk->previous)
+		{
+			if ((const char*)pointer > (const char*)chunk && (const char*)pointer < chunk->end)
+			{
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void* __ceri_new(uint64_t size)
+{
+	const size_t rounded_size = round_to_granularity(size == 0 ? 1 : size);
+	void*        pointer;
+
+	if (innermost_arena != NULL)
+	{
+		pointer = arena_allocate(innermost_arena, rounded_size);
+	}
+	else if (rounded_size > MAX_POOLED_SIZE)
+	{
+		pointer = checked_malloc(rounded_size);
+	}
+	else
+	{
+		struct FreeBlock** free_list = &free_lists[rounded_size / SIZE_CLASS_GRANULARITY - 1];
+
+		if (*free_list != NULL)
+		{
+			pointer    = *free_list;
+			*free_list = (*free_list)->next;
+		}
+		else
+		{
+			// The end of the previous slab is lost when it is too small, which is at most one block per slab
+			if ((size_t)(slab_end - slab_cursor) < rounded_size)
+			{
+				slab_cursor = checked_malloc(SLAB_SIZE);
+				slab_end    = slab_cursor + SLAB_SIZE;
+			}
+
+			pointer = slab_cursor;
+			slab_cursor += rounded_size;
+		}
+	}
+
+	return memset(pointer, 0, rounded_size);
+}
+
+void __ceri_dispose(void* pointer, uint64_t size)
+{
+	// Blocks of an arena are only freed when it ends
+	if (pointer == NULL || is_in_arena(pointer))
+	{
+		return;
+	}
+
+	const size_t rounded_size = round_to_granularity(size == 0 ? 1 : size);
+
+	if (rounded_size > MAX_POOLED_SIZE)
+	{
+		free(pointer);
+		return;
+	}
+
+	struct FreeBlock** free_list = &free_lists[rounded_size / SIZE_CLASS_GRANULARITY - 1];
+	struct FreeBlock*  block     = pointer;
+
+	block->next = *free_list;
+	*free_list  = block;
+}
+
+void __ceri_arena_begin(void)
+{
+	struct ArenaChunk* chunk = new_arena_chunk(FIRST_ARENA_CHUNK_SIZE);
+	struct Arena*      arena = (struct Arena*)(chunk + 1);
+
+	arena->outer           = innermost_arena;
+	arena->chunk           = chunk;
+	arena->cursor          = (char*)(arena + 1);
+	arena->end             = chunk->end;
+	arena->next_chunk_size = 2 * FIRST_ARENA_CHUNK_SIZE;
+
+	innermost_arena = arena;
+}
+
+void __ceri_arena_end(void)
+{
+	struct Arena*      arena = innermost_arena;
+	struct ArenaChunk* chunk = arena->chunk;
+
+	innermost_arena = arena->outer;
+
+	// The arena itself is stored in its first chunk, which is the last one of the list
+	while (chunk != NULL)
+	{
+		struct ArenaChunk* previous = chunk->previous;
+
+		if (previous == NULL && spare_chunk == NULL)
+		{
+			spare_chunk = chunk;
+		}
+		else
+		{
+			free(chunk);
+		}
+
+		chunk = previous;
+	}
+}
@@ -0,0 +1,170 @@
+//  Output of DISPLAY.
+//
+//  DISPLAY used to call printf() with a format string for every value, paying for parsing the format and for locking
+//  stdout each time. Values are now formatted here and written with putc_unlocked(), straight into the buffer of
+//  stdout. Going through stdio keeps the output in order with the C functions that programs call through FFI, and
+//  lets it be flushed when the program exits.
+//
+//  The output is byte for byte the one of the previous format strings: "%llu\n" for integers and booleans, "%c" for
+//  characters and "%f\n" for doubles.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//! Buffer of stdout when it is not a terminal, where it would be flushed at every line. It is larger than the default
+//! of stdio, so that large outputs are written in fewer system calls.
+static char output_buffer[64 * 1024];
+
+//! Digits of 00 to 99, so that integers are formatted two digits at a time.
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+//! Digits after the decimal point, as printed by "%f".
+#define FRACTION_DIGITS 6
+#define FRACTION_SCALE  1000000
+
+__attribute__((constructor)) static void set_up_output_buffer(void)
+{
+	if (!isatty(STDOUT_FILENO))
+	{
+		setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+	}
+}
+
+//! \brief Write the digits of \p value right before \p end, returning where they start.
+static char* format_u64(uint64_t value, char* end)
+{
+	char* cursor = end;
+
+	while (value >= 100)
+	{
+		const unsigned pair = (unsigned)(value % 100) * 2;
+		value /= 100;
+
+		*--cursor = digit_pairs[pair + 1];
+		*--cursor = digit_pairs[pair];
+	}
+
+	if (value >= 10)
+	{
+		*--cursor = digit_pairs[value * 2 + 1];
+		*--cursor = digit_pairs[value * 2];
+	}
+	else
+	{
+		*--cursor = (char)('0' + value);
+	}
+
+	return cursor;
+}
+
+static void write_bytes(const char* begin, const char* end)
+{
+	for (; begin != end; ++begin)
+	{
+		putc_unlocked(*begin, stdout);
+	}
+}
+
+void __ceri_display_u64(uint64_t value)
+{
+	char  text[24];
+	char* end = text + sizeof(text);
+
+	*--end = '\n';
+	write_bytes(format_u64(value, end), text + sizeof(text));
+}
+
+void __ceri_display_char(uint64_t value) { putc_unlocked((unsigned char)value, stdout); }
+
+void __ceri_display_f64(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const int      biased_exponent = (int)(bits >> 52 & 0x7FF);
+	const uint64_t fraction_bits   = bits & ((UINT64_C(1) << 52) - 1);
+
+	// Infinities, NaNs, and values too large for their integral part to fit in 64 bits, are rare enough for printf
+	if (biased_exponent == 0x7FF || biased_exponent >= 1023 + 64)
+	{
+		printf("%f\n", value);
+		return;
+	}
+
+	// The value is mantissa * 2^exponent
+	const uint64_t mantissa = biased_exponent == 0 ? fraction_bits : fraction_bits | UINT64_C(1) << 52;
+	const int      exponent = (biased_exponent == 0 ? 1 : biased_exponent) - 1075;
+
+	uint64_t integral, fraction;
+
+	if (exponent >= 0)
+	{
+		integral = mantissa << exponent;
+		fraction = 0;
+	}
+	else
+	{
+		// Round the value times 10^6 to the nearest integer, ties to even like printf. Below 2^-75, the value is
+		// closer to 0 than the product can reach.
+		const int         shift   = -exponent;
+		unsigned __int128 rounded = 0;
+
+		if (shift <= 75)
+		{
+			const unsigned __int128 scaled    = (unsigned __int128)mantissa * FRACTION_SCALE;
+			const unsigned __int128 half      = (unsigned __int128)1 << (shift - 1);
+			const unsigned __int128 remainder = scaled & ((half << 1) - 1);
+
+			rounded = scaled >> shift;
+
+			if (remainder > half || (remainder == half && (rounded & 1) != 0))
+			{
+				++rounded;
+			}
+		}
+
+		integral = (uint64_t)(rounded / FRACTION_SCALE);
+		fraction = (uint64_t)(rounded % FRACTION_SCALE);
+	}
+
+	char  text[48];
+	char* end = text + sizeof(text);
+
+	*--end = '\n';
+
+	// Leading zeros of the fraction are kept
+	for (int i = 0; i < FRACTION_DIGITS; i += 2)
+	{
+		const unsigned pair = (unsigned)(fraction % 100) * 2;
+		fraction /= 100;
+
+		*--end = digit_pairs[pair + 1];
+		*--end = digit_pairs[pair];
+	}
+
+	*--end = '.';
+
+	char* begin = format_u64(integral, end);
+
+	// Negative values are signed even when they round to zero, as by printf
+	if (bits >> 63 != 0)
+	{
+		*--begin = '-';
+	}
+
+	write_bytes(begin, text + sizeof(text));
+}
@@ -1,150 +1,625 @@
 #include "codegen.hpp"
 
 #include "compiler.hpp"
+#include "runtime.hpp"
 #include "types.hpp"
 #include "util/enums.hpp"
 #include "variable.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <fmt/core.h>
 #include <ostream>
+#include <utility>
+
+//! Registers that may hold values of the operand stack.
+//! Instruction sequences are free to use %rax, %rcx, %rdx and %xmm0-%xmm7 as scratch registers.
+//! %rsi, %rdi, %r8 and %r9 are also used to pass parameters, which is dealt with when moving parameters for a call.
+//! Vectorized loops use every SSE register, which they free by spilling the operand stack.
+static constexpr std::array<Register, 14> allocatable_registers{{
+	Register::RSI,
+	Register::RDI,
+	Register::R8,
+	Register::R9,
+	Register::R10,
+	Register::R11,
+	Register::XMM8,
+	Register::XMM9,
+	Register::XMM10,
+	Register::XMM11,
+	Register::XMM12,
+	Register::XMM13,
+	Register::XMM14,
+	Register::XMM15,
+}};
+
+//! Alignment of the global variables that are requested to be cache-line aligned, which is 64 bytes on every current
+//! x86-64 CPU.
+static constexpr std::size_t cache_line_size = 64;
+
+//! \brief Get the memory location at \p offset bytes from the address held by \p reg, e.g. "8(%rax)".
+static std::string indirect_location(Register reg, std::size_t offset)
+{
+	return offset == 0 ? fmt::format("({})", register_name(reg).str())
+					   : fmt::format("{}({})", offset, register_name(reg).str());
+}
+
+void CodeGen::begin_program() { emit_directive("# This code was generated by ceri-compiler"); }
+
+void CodeGen::finalize_program()
+{
+	if (m_compiler.m_config.peephole_optimization)
+	{
+		PeepholeStatistics statistics;
+		optimize_peephole(m_instructions, statistics);
+
+		if (m_compiler.m_config.peephole_report)
+		{
+			print_peephole_report(statistics);
+		}
+	}
+
+	for (const Instruction& instruction : m_instructions)
+	{
+		instruction.print(m_compiler.m_output_stream);
+	}
 
-void CodeGen::begin_program() { m_compiler.m_output_stream << "# This code was generated by ceri-compiler\n"; }
-void CodeGen::finalize_program() {}
+	m_instructions.clear();
+}
 
-void CodeGen::begin_executable_section() { m_compiler.m_output_stream << ".text\n"; }
+void CodeGen::begin_executable_section() { emit_directive(".text"); }
 void CodeGen::finalize_executable_section() {}
 
-void CodeGen::begin_main_procedure()
+void CodeGen::assign_register(const Variable& variable, Register reg)
 {
-	m_compiler.m_output_stream << fmt::format(
-		".globl {mainfunc}\n"
-		"{mainfunc}:\n"
-		"\tmovq %rsp, %rbp # Save the position of the top of the stack\n",
-		fmt::arg("mainfunc", function_mangle_name("main")));
+	m_register_variables[variable.name] = reg;
+
+	if (!is_register_callee_saved(reg))
+	{
+		// The register is no longer available to operands, and nothing else clobbers it since nothing is called
+		m_register_used[underlying_cast(reg)] = true;
+	}
+	else if (std::find(m_saved_registers.begin(), m_saved_registers.end(), reg) == m_saved_registers.end())
+	{
+		m_saved_registers.push_back(reg);
+	}
 }
 
-void CodeGen::finalize_main_procedure()
+void CodeGen::assign_frame_slot(const Variable& variable) { m_frame_variables.push_back(variable); }
+
+void CodeGen::begin_main_procedure()
 {
-	m_compiler.m_output_stream << "\tmovq %rbp, %rsp # Restore the position of the top of the stack\n"
-								  "\tret\n";
+	const std::string name = function_mangle_name("main");
+
+	emit_directive(fmt::format(".globl {}", name));
+	emit_label(name);
+	emit("movq", {"%rsp", "%rbp"}, "Save the position of the top of the stack");
+	m_has_frame_pointer   = true;
+	m_frame_pointer_depth = 0;
+
+	for (const Register reg : m_saved_registers)
+	{
+		emit("pushq", {register_name(reg)}, "Save callee-saved register");
+		m_stack_depth += 8;
+	}
 }
 
-void CodeGen::begin_global_data_section()
+void CodeGen::return_from_main_procedure()
 {
-	m_compiler.m_output_stream << ".data\n"
-								  ".align 8\n"
-								  "__cc_format_string_llu: .string \"%llu\\n\"\n"
-								  "__cc_format_string_c:   .string \"%c\" # No newline; this is intended\n"
-								  "__cc_format_string_f:   .string \"%f\\n\"\n";
+	expect_empty_operand_stack("at the end of the program");
+
+	for (auto it = m_saved_registers.rbegin(); it != m_saved_registers.rend(); ++it)
+	{
+		emit("popq", {register_name(*it)}, "Restore callee-saved register");
+	}
+
+	emit("movq", {"%rbp", "%rsp"}, "Restore the position of the top of the stack");
+	emit("ret");
 }
 
-void CodeGen::finalize_global_data_section() {}
+void CodeGen::begin_procedure(string_view name, const std::vector<Variable>& parameters)
+{
+	emit_label(procedure_symbol(name));
+
+	if (!m_frame_variables.empty())
+	{
+		// Larger alignments first, so that slots are packed without padding below the 8-byte aligned frame pointer
+		std::stable_sort(m_frame_variables.begin(), m_frame_variables.end(), [&](const Variable& a, const Variable& b) {
+			return memory_layout(a.type.type).alignment > memory_layout(b.type.type).alignment;
+		});
+
+		std::size_t frame_size = 0;
+
+		for (const Variable& variable : m_frame_variables)
+		{
+			frame_size += memory_layout(variable.type.type).size;
+			m_frame_displacements[variable.name] = -std::int64_t(frame_size);
+		}
+
+		frame_size = (frame_size + 7) / 8 * 8;
+
+		// Operands are spilled below the frame, which moves %rsp, so slots are addressed from %rbp
+		emit("pushq", {"%rbp"}, "Save the frame pointer of the caller");
+		emit("movq", {"%rsp", "%rbp"});
+		emit("subq", {fmt::format("${}", frame_size), "%rsp"}, "Allocate the stack frame");
+
+		m_has_frame_pointer   = true;
+		m_frame_pointer_depth = 8;
+		m_stack_depth         = 8 + frame_size;
+	}
+
+	for (const Register reg : m_saved_registers)
+	{
+		emit("pushq", {register_name(reg)}, "Save callee-saved register");
+		m_stack_depth += 8;
+	}
+
+	std::size_t regular_index = 0, float_index = 0;
+
+	for (const Variable& parameter : parameters)
+	{
+		const Type     type   = parameter.type.type;
+		const bool     xmm    = is_function_param_type_float(type);
+		const Register source = function_call_register(xmm ? float_index++ : regular_index++, type);
+
+		const auto it = m_register_variables.find(parameter.name);
+
+		if (it != m_register_variables.end())
+		{
+			load_operand(Operand::in_register(source, type), it->second);
+		}
+		else if (m_frame_displacements.count(parameter.name) != 0)
+		{
+			store_operand(Operand::in_register(source, type), variable_memory(parameter, type).str(), value_size(type));
+		}
+	}
+}
 
-void CodeGen::define_global_variable(const Variable& variable)
+void CodeGen::return_from_procedure(Type return_type)
 {
-	m_compiler.m_output_stream << fmt::format("{}:\n\t", variable.mangled_name());
+	if (return_type != Type::VOID)
+	{
+		const Operand result = pop_operand();
+		load_operand(result, is_function_param_type_float(return_type) ? Register::XMM0 : Register::RAX);
+		release_operand(result);
+	}
 
-	// NOTE: non 64-bit loads are still loaded with 64-bit pushes.
-	//       Realistically, this does not matter, though.
-	//       This might be problematic when dealing with a C FFI for example however, since we (probably) need to clear
-	//       up the upper bits of the registers when we pass small data types.
+	expect_empty_operand_stack("at the end of a procedure");
 
-	switch (variable.type.type)
+	for (auto it = m_saved_registers.rbegin(); it != m_saved_registers.rend(); ++it)
 	{
-	case Type::BOOLEAN:
-	case Type::CHAR: m_compiler.m_output_stream << ".byte 0"; break;
-	case Type::UNSIGNED_INT: m_compiler.m_output_stream << ".quad 0"; break;
-	case Type::DOUBLE: m_compiler.m_output_stream << ".double 0.0"; break;
-	default:
-		// HACK: this is gonna break horribly with >64-bit types
-		m_compiler.m_output_stream << ".quad 0";
-		// throw UnimplementedError{"Unimplemented global variable type"};
+		emit("popq", {register_name(*it)}, "Restore callee-saved register");
+	}
+
+	if (m_has_frame_pointer)
+	{
+		emit("movq", {"%rbp", "%rsp"}, "Free the stack frame");
+		emit("popq", {"%rbp"});
+	}
+
+	emit("ret");
+}
+
+void CodeGen::finalize_procedure()
+{
+	for (const auto& it : m_register_variables)
+	{
+		m_register_used[underlying_cast(it.second)] = false;
 	}
 
-	m_compiler.m_output_stream << fmt::format(" # type: {}\n", type_name(variable.type.type).str());
+	m_register_variables.clear();
+	m_saved_registers.clear();
+	m_frame_variables.clear();
+	m_frame_displacements.clear();
+
+	m_stack_depth       = 0;
+	m_has_frame_pointer = false;
+}
+
+void CodeGen::begin_global_data_section()
+{
+	emit_directive(".data");
+	emit_directive(".balign 8");
 }
 
-void CodeGen::load_variable(const Variable& variable)
+void CodeGen::finalize_global_data_section()
 {
-	m_compiler.m_output_stream << fmt::format("\tpushq {}(%rip)\n", variable.mangled_name());
+	struct Layout
+	{
+		const Variable* variable;
+		std::size_t     alignment, size;
+	};
+
+	std::vector<Layout> layouts;
+
+	for (const Variable& variable : m_global_variables)
+	{
+		const MemoryLayout layout = memory_layout(variable.type.type);
+
+		if (variable.type.cache_aligned)
+		{
+			// Padded to a whole cache line, so that no other variable shares it
+			const std::size_t padded_size = (layout.size + cache_line_size - 1) / cache_line_size * cache_line_size;
+			layouts.push_back({&variable, cache_line_size, padded_size});
+		}
+		else
+		{
+			layouts.push_back({&variable, layout.alignment, layout.size});
+		}
+	}
+
+	std::sort(layouts.begin(), layouts.end(), [](const Layout& a, const Layout& b) {
+		if (a.alignment != b.alignment)
+		{
+			return a.alignment > b.alignment;
+		}
+
+		if (a.size != b.size)
+		{
+			return a.size > b.size;
+		}
+
+		return a.variable->name < b.variable->name;
+	});
+
+	// Every variable is zero-initialized, so none of them takes space in the executable
+	emit_directive(".bss");
+
+	std::size_t alignment = 0;
+
+	for (const Layout& layout : layouts)
+	{
+		// Sizes are multiples of the alignment, so this only emits padding before the first variable of each group
+		if (layout.alignment != alignment)
+		{
+			alignment = layout.alignment;
+
+			if (alignment > 1)
+			{
+				emit_directive(fmt::format(".balign {}", alignment));
+			}
+		}
+
+		emit_label(mangled_name(*layout.variable));
+		emit_directive(fmt::format(
+			"\t.zero {} # type: {}{}",
+			layout.size,
+			m_compiler.type_name(layout.variable->type.type),
+			layout.variable->type.cache_aligned ? ", cache-line aligned" : ""));
+	}
+
+	m_global_variables.clear();
+
+	emit_constant_pool();
 }
-void CodeGen::load_i64(uint64_t value)
+
+void CodeGen::define_global_variable(const Variable& variable) { m_global_variables.push_back(variable); }
+
+Symbol CodeGen::intern_variable_name(string_view name) { return m_compiler.m_symbols.intern(name); }
+
+void CodeGen::load_variable(const Variable& variable, bool last_use)
 {
-	if ((value >> 32) != 0)
+	const auto it = m_register_variables.find(variable.name);
+
+	if (it == m_register_variables.end())
+	{
+		push_operand(variable_memory(variable, variable.type.type));
+	}
+	else if (last_use)
 	{
-		// The value does not fit into an imm32, so we cannot use push directly.
-		m_compiler.m_output_stream << fmt::format(
-			"\tmovq $0x{:016x}, %rax\n"
-			"\tpushq %rax\n",
-			value);
+		// Nothing reads the register until the variable is written again, so the operand may take it over
+		push_operand(Operand::in_register(it->second, variable.type.type));
 	}
 	else
 	{
-		m_compiler.m_output_stream << fmt::format("\tpushq $0x{:016x}\n", value);
+		push_operand(Operand::register_variable(it->second, variable.type.type));
 	}
 }
 
+void CodeGen::load_i64(uint64_t value) { push_operand(Operand::immediate(value, Type::UNSIGNED_INT)); }
+
+void CodeGen::load_f64(double value)
+{
+	static_assert(sizeof(double) == sizeof(std::uint64_t), "double must be 64-bit on the compiler platform");
+
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	push_operand(Operand::memory(f64_constant_label(bits), Type::DOUBLE, true));
+}
+
 void CodeGen::load_pointer_to_variable(const Variable& variable)
 {
-	m_compiler.m_output_stream << fmt::format(
-		"\tleaq {}(%rip), %rax\n"
-		"\tpushq %rax\n",
-		variable.mangled_name());
+	if (m_register_variables.count(variable.name) != 0)
+	{
+		m_compiler.bug("cannot take the address of a variable kept in a register");
+	}
+
+	Operand address = variable_memory(variable, Type::UNSIGNED_INT);
+	address.kind    = Operand::Kind::ADDRESS;
+	push_operand(address);
+}
+
+void CodeGen::load_value_from_pointer(Type dereferenced_type, std::size_t offset)
+{
+	Operand pointer = pop_operand();
+
+	if (pointer.is(Operand::Kind::ADDRESS))
+	{
+		// Dereferencing the address of a variable is reading the variable itself
+		push_operand(pointer.dereference(dereferenced_type, offset));
+		return;
+	}
+
+	const Register    pointer_register = to_register(pointer, false);
+	const std::string source           = indirect_location(pointer_register, offset);
+
+	if (is_function_param_type_float(dereferenced_type))
+	{
+		const Register value_register = allocate_register(true);
+
+		emit("movsd", {source, register_name(value_register)});
+
+		release_operand(pointer);
+		push_operand(Operand::in_register(value_register, dereferenced_type));
+		return;
+	}
+
+	if (value_size(dereferenced_type) == 8)
+	{
+		emit("movq", {source, register_name(pointer_register)});
+	}
+	else
+	{
+		load_narrow(source, dereferenced_type, pointer_register);
+	}
+
+	pointer.type = dereferenced_type;
+	push_operand(pointer);
+}
+
+void CodeGen::swap_operands()
+{
+	if (m_operands.size() < 2)
+	{
+		m_compiler.bug("operand stack underflow");
+	}
+
+	Operand& top   = m_operands[m_operands.size() - 1];
+	Operand& below = m_operands[m_operands.size() - 2];
+
+	if (!below.is(Operand::Kind::STACK))
+	{
+		std::swap(top, below);
+		return;
+	}
+
+	// Spilled operands have to stay at the bottom of the operand stack, so swap them on the machine stack instead
+	spill_operand(top);
+
+	emit("movq", {"(%rsp)", "%rax"});
+	emit("movq", {"8(%rsp)", "%rcx"});
+	emit("movq", {"%rax", "8(%rsp)"});
+	emit("movq", {"%rcx", "(%rsp)"});
+
+	std::swap(top.type, below.type);
 }
 
-void CodeGen::load_value_from_pointer([[maybe_unused]] Type dereferenced_type)
+void CodeGen::discard_value()
 {
-	m_compiler.m_output_stream << "\tpopq %rax\n"
-								  "\tpushq (%rax)\n";
+	Operand operand = std::move(m_operands.back());
+	m_operands.pop_back();
+
+	if (operand.is(Operand::Kind::STACK))
+	{
+		emit("addq", {"$8", "%rsp"});
+		m_stack_depth -= 8;
+	}
+
+	release_operand(operand);
 }
 
 void CodeGen::store_variable(const Variable& variable)
 {
-	m_compiler.m_output_stream << fmt::format("\tpopq {}(%rip)\n", variable.mangled_name());
+	const Operand value = pop_operand();
+	const auto    it    = m_register_variables.find(variable.name);
+
+	if (it != m_register_variables.end())
+	{
+		detach_register_variable(it->second);
+		load_operand(value, it->second);
+		release_operand(value);
+		return;
+	}
+
+	spill_clobbered_operands(m_operands.size(), false);
+
+	store_operand(value, variable_memory(variable, variable.type.type).str(), value_size(variable.type.type));
+	release_operand(value);
+}
+
+void CodeGen::store_value_to_pointer(Type value_type, std::size_t offset)
+{
+	Operand       pointer = pop_operand();
+	const Operand value   = pop_operand();
+	spill_clobbered_operands(m_operands.size(), false);
+
+	if (pointer.is(Operand::Kind::ADDRESS))
+	{
+		store_operand(value, pointer.dereference(value_type, offset).str(), value_size(value_type));
+	}
+	else
+	{
+		const Register pointer_register = to_readable_register(pointer, false);
+		store_operand(value, indirect_location(pointer_register, offset), value_size(value_type));
+	}
+
+	release_operand(pointer);
+	release_operand(value);
+}
+
+void CodeGen::load_field(const Variable& record, Type field_type, std::size_t offset)
+{
+	push_operand(variable_memory(record, field_type, std::int64_t(offset)));
 }
 
-void CodeGen::store_value_to_pointer([[maybe_unused]] Type value_type)
+void CodeGen::store_field(const Variable& record, Type value_type, std::size_t offset)
 {
-	m_compiler.m_output_stream << "\tpopq %rax\n"
-								  "\tpopq %rbx\n"
-								  "\tmovq %rbx, (%rax)\n";
+	const Operand value = pop_operand();
+	spill_clobbered_operands(m_operands.size(), false);
+
+	store_operand(value, variable_memory(record, value_type, std::int64_t(offset)).str(), value_size(value_type));
+	release_operand(value);
 }
 
-void CodeGen::alu_and_bool()
+Operand CodeGen::variable_memory(const Variable& variable, Type type, std::int64_t offset) const
 {
-	alu_load_binop(Type::BOOLEAN);
+	const auto it = m_frame_displacements.find(variable.name);
+
+	if (it != m_frame_displacements.end())
+	{
+		return Operand::frame_memory(it->second + offset, type);
+	}
+
+	const std::string& name = mangled_name(variable);
+	return Operand::memory(offset == 0 ? name : fmt::format("{}{:+}", name, offset), type);
+}
 
-	m_compiler.m_output_stream << "\tandq %rax, %rbx\n"
-								  "\tpushq %rax\n";
+const std::string& CodeGen::mangled_name(const Variable& variable) const
+{
+	return m_compiler.m_symbols.mangled_name(variable.symbol);
 }
 
-void CodeGen::alu_or_bool()
+CodeGen::MemoryLayout CodeGen::memory_layout(Type type) const
 {
-	alu_load_binop(Type::BOOLEAN);
+	// Arrays are aligned like their elements, which are stored contiguously
+	const UserType::ArrayType*  array   = m_compiler.find_array_type(type);
+	const Type                  element = array != nullptr ? array->element : type;
+	const UserType::RecordType* record  = m_compiler.find_record_type(element);
+
+	const std::size_t alignment    = record != nullptr ? record->alignment : value_size(element);
+	const std::size_t element_size = record != nullptr ? record->size : alignment;
 
-	m_compiler.m_output_stream << "\torq %rbx, %rax\n"
-								  "\tpushq %rax\n";
+	return {alignment, array != nullptr ? element_size * array->length() : element_size};
 }
 
-void CodeGen::alu_not_bool() { m_compiler.m_output_stream << "\tnotq (%rsp)\n"; }
+void CodeGen::load_element(const Variable& array, Type element_type, std::size_t stride, std::size_t offset)
+{
+	Operand           index        = pop_operand();
+	const std::size_t element_size = value_size(element_type);
 
-void CodeGen::alu_add(Type type)
+	if (index.is(Operand::Kind::IMMEDIATE))
+	{
+		// The element is at a fixed address, which can be read like a variable
+		const std::int64_t byte = std::int64_t(index.value * stride + offset);
+		push_operand(variable_memory(array, element_type, byte));
+		return;
+	}
+
+	const std::string source = element_location(array, index, stride, offset);
+	release_operand(index);
+
+	// The index register may be reused for the element, which is only written once the address was computed
+	const bool     xmm            = is_function_param_type_float(element_type);
+	const Register value_register = allocate_register(xmm);
+
+	if (xmm)
+	{
+		emit("movsd", {source, register_name(value_register)});
+	}
+	else if (element_size == 8)
+	{
+		emit("movq", {source, register_name(value_register)});
+	}
+	else
+	{
+		load_narrow(source, element_type, value_register);
+	}
+
+	push_operand(Operand::in_register(value_register, element_type));
+}
+
+void CodeGen::store_element(const Variable& array, Type value_type, std::size_t stride, std::size_t offset)
+{
+	Operand value = pop_operand();
+	Operand index = pop_operand();
+	spill_clobbered_operands(m_operands.size(), false);
+
+	// Computing the address of the element may clobber the flags, which the stored value may be held in
+	if (!index.is(Operand::Kind::IMMEDIATE) && value.is(Operand::Kind::FLAGS))
+	{
+		to_register(value, false);
+	}
+
+	store_operand(value, element_location(array, index, stride, offset), value_size(value_type));
+
+	release_operand(index);
+	release_operand(value);
+}
+
+void CodeGen::check_bounds(std::uint64_t length)
 {
-	alu_load_binop(type);
+	materialize_flags();
+
+	Operand           index          = pop_operand();
+	const Register    index_register = to_readable_register(index, false);
+	const std::size_t tag            = ++m_label_tag;
+
+	// An unsigned comparison also catches indices below the low bound, which wrapped around when rebasing them
+	if (fits_imm32(length))
+	{
+		emit("cmpq", {fmt::format("${}", length), register_name(index_register)}, "check bounds");
+	}
+	else
+	{
+		emit("movabsq", {fmt::format("${}", length), "%rax"});
+		emit("cmpq", {"%rax", register_name(index_register)}, "check bounds");
+	}
+
+	emit("jb", {fmt::format("__bounds_ok{}", tag)});
+	emit("ud2");
+	emit_label(fmt::format("__bounds_ok{}", tag));
+
+	push_operand(index);
+}
+
+void CodeGen::alu_and_bool() { alu_binop_gpr("andq", true); }
+
+void CodeGen::alu_or_bool() { alu_binop_gpr("orq", true); }
+
+void CodeGen::alu_not_bool()
+{
+	Operand operand = pop_operand();
+
+	if (operand.is(Operand::Kind::IMMEDIATE))
+	{
+		operand.value = ~operand.value;
+	}
+	else if (operand.is(Operand::Kind::FLAGS))
+	{
+		operand.condition = negate_condition(operand.condition);
+	}
+	else
+	{
+		emit("notq", {register_name(to_register(operand, false))});
+	}
+
+	push_operand(operand);
+}
 
+void CodeGen::alu_add(Type type)
+{
 	switch (type)
 	{
 	case Type::UNSIGNED_INT:
 	{
-		m_compiler.m_output_stream << "\taddq %rbx, %rax\n"
-									  "\tpushq %rax\n";
+		alu_binop_gpr("addq", true);
 		break;
 	}
 
 	case Type::DOUBLE:
 	{
-		m_compiler.m_output_stream << "\tfaddp %st(0), %st(1)\n";
-		alu_store_f64();
+		uses_x87() ? alu_binop_x87("faddp") : alu_binop_xmm("addsd", true);
 		break;
 	}
 
@@ -157,21 +632,17 @@ void CodeGen::alu_add(Type type)
 
 void CodeGen::alu_sub(Type type)
 {
-	alu_load_binop(type);
-
 	switch (type)
 	{
 	case Type::UNSIGNED_INT:
 	{
-		m_compiler.m_output_stream << "\tsubq %rbx, %rax\n"
-									  "\tpushq %rax\n";
+		alu_binop_gpr("subq", false);
 		break;
 	}
 
 	case Type::DOUBLE:
 	{
-		m_compiler.m_output_stream << "\tfsubp %st(0), %st(1)\n";
-		alu_store_f64();
+		uses_x87() ? alu_binop_x87("fsubp") : alu_binop_xmm("subsd", false);
 		break;
 	}
 
@@ -184,21 +655,22 @@ void CodeGen::alu_sub(Type type)
 
 void CodeGen::alu_multiply(Type type)
 {
-	alu_load_binop(type);
-
 	switch (type)
 	{
 	case Type::UNSIGNED_INT:
 	{
-		m_compiler.m_output_stream << "\tmulq %rbx\n"
-									  "\tpushq %rax\n";
+		if (!alu_multiply_constant())
+		{
+			// The lower 64 bits of the product are the same for signed and unsigned multiplication
+			alu_binop_gpr("imulq", true);
+		}
+
 		break;
 	}
 
 	case Type::DOUBLE:
 	{
-		m_compiler.m_output_stream << "\tfmulp %st(0), %st(1)\n";
-		alu_store_f64();
+		uses_x87() ? alu_binop_x87("fmulp") : alu_binop_xmm("mulsd", true);
 		break;
 	}
 
@@ -211,22 +683,21 @@ void CodeGen::alu_multiply(Type type)
 
 void CodeGen::alu_divide(Type type)
 {
-	alu_load_binop(type);
-
 	switch (type)
 	{
 	case Type::UNSIGNED_INT:
 	{
-		m_compiler.m_output_stream << "\tmovq $0, %rdx # Higher part of numerator\n"
-									  "\tdiv %rbx # Quotient goes to %rax\n"
-									  "\tpushq %rax\n";
+		if (!alu_divmod_constant(false))
+		{
+			alu_divmod_gpr(Register::RAX);
+		}
+
 		break;
 	}
 
 	case Type::DOUBLE:
 	{
-		m_compiler.m_output_stream << "\tfdivp %st(0), %st(1)\n";
-		alu_store_f64();
+		uses_x87() ? alu_binop_x87("fdivp") : alu_binop_xmm("divsd", false);
 		break;
 	}
 
@@ -243,32 +714,17 @@ void CodeGen::alu_modulus(Type type)
 	{
 	case Type::UNSIGNED_INT:
 	{
-		alu_load_binop(type);
-		m_compiler.m_output_stream << "\tmovq $0, %rdx # Higher part of numerator\n"
-									  "\tdiv %rbx # Remainder goes to %rdx\n"
-									  "\tpushq %rax\n";
+		if (!alu_divmod_constant(true))
+		{
+			alu_divmod_gpr(Register::RDX);
+		}
+
 		break;
 	}
 
 	case Type::DOUBLE:
 	{
-		FunctionCall call;
-		call.variadic      = false;
-		call.return_type   = Type::DOUBLE;
-		call.function_name = "fmod";
-
-		function_call_prepare(call);
-		function_call_param(call, Type::DOUBLE);
-		function_call_param(call, Type::DOUBLE);
-
-		m_compiler.m_output_stream
-			<< "\t# HACK: swap float operands for modulus '%', as they are pushed the opposite way\n"
-			   "\tpxor %xmm0, %xmm1\n"
-			   "\tpxor %xmm1, %xmm0\n"
-			   "\tpxor %xmm0, %xmm1\n";
-
-		function_call_finalize(call);
-
+		alu_fmod_fprem();
 		break;
 	}
 
@@ -279,13 +735,6 @@ void CodeGen::alu_modulus(Type type)
 	}
 }
 
-void CodeGen::alu_equal(Type type) { alu_compare(type, "je"); }
-void CodeGen::alu_not_equal(Type type) { alu_compare(type, "jne"); }
-void CodeGen::alu_greater_equal(Type type) { alu_compare(type, "jae"); }
-void CodeGen::alu_lower_equal(Type type) { alu_compare(type, "jbe"); }
-void CodeGen::alu_greater(Type type) { alu_compare(type, "ja"); }
-void CodeGen::alu_lower(Type type) { alu_compare(type, "jb"); }
-
 void CodeGen::convert(Type source, Type destination)
 {
 	if (source == destination)
@@ -304,171 +753,192 @@ void CodeGen::convert(Type source, Type destination)
 
 		if (destination == Type::DOUBLE)
 		{
-			m_compiler.m_output_stream << "\tfildq (%rsp)\n"
-										  "\tfstpl (%rsp)\n";
+			if (uses_x87())
+			{
+				materialize_flags();
+				spill_all_operands();
+				m_operands.back().type = destination;
 
-			return;
-		}
-	}
+				emit("fildq", {"(%rsp)"});
+				emit("fstpl", {"(%rsp)"});
 
-	if (check_enum_range(source, Type::FIRST_FLOATING, Type::LAST_FLOATING))
-	{
+				return;
+			}
+
+			Operand value = pop_operand();
+
+			if (!value.is_memory64())
+			{
+				to_readable_register(value, false);
+			}
+
+			const Register result = allocate_register(true);
+
+			emit("cvtsi2sdq", {value.str(), register_name(result)});
+
+			release_operand(value);
+			push_operand(Operand::in_register(result, destination));
+
+			return;
+		}
+	}
+
+	if (check_enum_range(source, Type::FIRST_FLOATING, Type::LAST_FLOATING))
+	{
 		if (check_enum_range(destination, Type::FIRST_INTEGRAL, Type::LAST_INTEGRAL) || destination == Type::CHAR)
 		{
-			m_compiler.m_output_stream << "\tfldl (%rsp)\n"
-										  "\tfistpq (%rsp)\n";
+			// Conversions truncate towards zero. x87 rounds to nearest by default, so temporarily switch its rounding
+			// control to truncation.
+			if (uses_x87())
+			{
+				materialize_flags();
+				spill_all_operands();
+				m_operands.back().type = destination;
+
+				emit("fldl", {"(%rsp)"});
+				emit("fnstcw", {"-8(%rsp)"}, "Save the FPU control word");
+				emit("movzwl", {"-8(%rsp)", "%eax"});
+				emit("orl", {"$0x0C00", "%eax"}, "Rounding control: truncate");
+				emit("movw", {"%ax", "-6(%rsp)"});
+				emit("fldcw", {"-6(%rsp)"});
+				emit("fistpq", {"(%rsp)"});
+				emit("fldcw", {"-8(%rsp)"}, "Restore the FPU control word");
+
+				return;
+			}
+
+			Operand value = pop_operand();
+
+			if (!value.is(Operand::Kind::MEMORY))
+			{
+				to_register(value, true);
+			}
+
+			const Register result = allocate_register(false);
+
+			emit("cvttsd2siq", {value.str(), register_name(result)});
+
+			release_operand(value);
+			push_operand(Operand::in_register(result, destination));
 
 			return;
 		}
 	}
 
 	m_compiler.bug(fmt::format(
-		"unsupported type conversion occured: {} -> {}", type_name(source).str(), type_name(destination).str()));
-}
-
-void CodeGen::statement_if_prepare(IfStatement& statement) { statement.saved_tag = ++m_label_tag; }
-
-void CodeGen::statement_if_post_check(IfStatement& statement)
-{
-	m_compiler.m_output_stream << fmt::format(
-		"\tpopq %rax\n"
-		"\ttest %rax, %rax\n"
-		"\tjz __false{tag}\n"
-		"__true{tag}:\n",
-		fmt::arg("tag", statement.saved_tag));
+		"unsupported type conversion occured: {} -> {}",
+		m_compiler.type_name(source),
+		m_compiler.type_name(destination)));
 }
 
-void CodeGen::statement_if_with_else(IfStatement& statement)
+void CodeGen::begin_block(string_view label)
 {
-	m_compiler.m_output_stream << fmt::format(
-		"\tjmp __next{tag}\n"
-		"__false{tag}:\n",
-		fmt::arg("tag", statement.saved_tag));
+	expect_empty_operand_stack("when entering a block");
+	emit_label(label);
 }
 
-void CodeGen::statement_if_without_else(IfStatement& statement)
+void CodeGen::jump(string_view label)
 {
-	m_compiler.m_output_stream << fmt::format("__false{}:\n", statement.saved_tag);
+	expect_empty_operand_stack("at the end of a block");
+	emit("jmp", {label});
 }
 
-void CodeGen::statement_if_finalize(IfStatement& statement)
+void CodeGen::branch_if_false(string_view label)
 {
-	m_compiler.m_output_stream << fmt::format("__next{}:\n", statement.saved_tag);
-}
+	Operand condition = pop_operand();
+	expect_empty_operand_stack("at the end of a block");
 
-void CodeGen::statement_while_prepare(WhileStatement& statement)
-{
-	statement.saved_tag = ++m_label_tag;
-	m_compiler.m_output_stream << fmt::format("__while{}:\n", statement.saved_tag);
+	branch_on_condition(condition, false, label);
+	release_operand(condition);
 }
 
-void CodeGen::statement_while_post_check(WhileStatement& statement)
+void CodeGen::branch_if_true(string_view label)
 {
-	m_compiler.m_output_stream << fmt::format(
-		"\tpopq %rax\n"
-		"\ttest %rax, %rax\n"
-		"\tjz __next{tag}\n",
-		fmt::arg("tag", statement.saved_tag));
-}
+	Operand condition = pop_operand();
+	expect_empty_operand_stack("at the end of a block");
 
-void CodeGen::statement_while_finalize(WhileStatement& statement)
-{
-	m_compiler.m_output_stream << fmt::format(
-		"\tjmp __while{tag}\n"
-		"__next{tag}:\n",
-		fmt::arg("tag", statement.saved_tag));
+	branch_on_condition(condition, true, label);
+	release_operand(condition);
 }
 
-void CodeGen::statement_for_prepare(ForStatement& statement, const Variable& assignement_variable)
+void CodeGen::function_call(FunctionCall& call, const std::vector<Type>& parameter_types)
 {
-	statement.variable  = &assignement_variable;
-	statement.saved_tag = ++m_label_tag;
-}
+	if (m_operands.size() < parameter_types.size())
+	{
+		m_compiler.bug("operand stack underflow");
+	}
 
-void CodeGen::statement_for_post_assignment(ForStatement& statement)
-{
-	m_compiler.m_output_stream << fmt::format("__for{}:\n", statement.saved_tag);
-}
+	call.operand_base = m_operands.size() - parameter_types.size();
 
-void CodeGen::statement_for_post_check(ForStatement& statement)
-{
-	// we branch *out* if var < %rax, mind the op order in at&t
-	m_compiler.m_output_stream << fmt::format(
-		"\tpopq %rax\n"
-		"\tcmpq {name}(%rip), %rax\n"
-		"\tjl __next{tag}\n",
-		fmt::arg("name", statement.variable->mangled_name()),
-		fmt::arg("tag", statement.saved_tag));
-}
+	for (const Type type : parameter_types)
+	{
+		function_call_param(call, type);
+	}
 
-void CodeGen::statement_for_finalize(ForStatement& statement)
-{
-	m_compiler.m_output_stream << fmt::format(
-		"\taddq $1, {name}(%rip)\n"
-		"\tjmp __for{tag}\n"
-		"__next{tag}:\n",
-		fmt::arg("name", statement.variable->mangled_name()),
-		fmt::arg("tag", statement.saved_tag));
+	function_call_finalize(call);
 }
 
-void CodeGen::function_call_prepare([[maybe_unused]] FunctionCall& call) {}
+void CodeGen::function_call_prepare(FunctionCall& call) { call.operand_base = m_operands.size(); }
 
 void CodeGen::function_call_param(FunctionCall& call, Type type)
 {
-	if (type == Type::BOOLEAN)
-	{
-		// Be careful to handle this first: bool is considered regular but we handle it specially anyway!
-		m_compiler.m_output_stream << fmt::format(
-			"\tpopq {paramreg}\n"
-			"\tandq $1, {paramreg}\n",
-			fmt::arg("paramreg", function_call_register(call, type).str()));
-		++call.regular_count;
-	}
-	else if (is_function_param_type_regular(type))
+	// Parameters are left on the operand stack until the call is finalized, so that evaluating the next parameters
+	// cannot clobber the registers they are passed in.
+	if (is_function_param_type_regular(type))
 	{
-		m_compiler.m_output_stream << fmt::format(
-			"\tpopq {paramreg}\n", fmt::arg("paramreg", function_call_register(call, type).str()));
 		++call.regular_count;
 	}
 	else if (is_function_param_type_float(type))
 	{
-		m_compiler.m_output_stream << fmt::format(
-			"\tmovsd (%rsp), {paramreg}\n"
-			"\taddq $8, %rsp # Effectively pop the float from the stack.\n",
-			fmt::arg("paramreg", function_call_register(call, type).str()));
 		++call.float_count;
 	}
 	else
 	{
 		m_compiler.bug("unimplemented parameter type");
 	}
+
+	call.parameter_types.push_back(type);
 }
 
 void CodeGen::function_call_finalize(FunctionCall& call)
 {
+	materialize_flags();
+
+	if (call.foreign && function_call_intrinsic(call))
+	{
+		return;
+	}
+
+	// Caller-saved registers are clobbered by the call, and the callee may write to any variable
+	spill_clobbered_operands(call.operand_base, true);
+
+	function_call_move_parameters(call);
+
+	const std::size_t padding = align_stack();
+
 	if (call.variadic)
 	{
-		m_compiler.m_output_stream << fmt::format(
-			"\tmovb ${floatcount}, %al\n", fmt::arg("floatcount", call.float_count));
+		emit("movb", {fmt::format("${}", call.float_count), "%al"});
 	}
 
-	align_stack();
-	m_compiler.m_output_stream << fmt::format(
-		"\tcall {function}\n", fmt::arg("function", function_mangle_name(call.function_name)));
-	unalign_stack();
+	emit("call", {call.foreign ? function_mangle_name(call.function_name) : procedure_symbol(call.function_name)});
+	unalign_stack(padding);
 
-	if (call.return_type == Type::BOOLEAN)
+	if (call.foreign && call.return_type == Type::BOOLEAN)
 	{
 		m_compiler.bug("unimplemented return type");
 	}
 	else if (is_function_param_type_regular(call.return_type))
 	{
-		m_compiler.m_output_stream << "\tpushq %rax\n";
+		const Register result = allocate_register(false);
+		emit("movq", {"%rax", register_name(result)});
+		push_operand(Operand::in_register(result, call.return_type));
 	}
 	else if (is_function_param_type_float(call.return_type))
 	{
-		m_compiler.m_output_stream << "\taddq $-8, %rsp\n"
-									  "\tmovsd %xmm0, (%rsp)\n";
+		const Register result = allocate_register(true);
+		emit("movapd", {"%xmm0", register_name(result)});
+		push_operand(Operand::in_register(result, call.return_type));
 	}
 	else if (call.return_type != Type::VOID)
 	{
@@ -476,176 +946,1421 @@ void CodeGen::function_call_finalize(FunctionCall& call)
 	}
 }
 
-void CodeGen::debug_display(Type type)
+bool CodeGen::function_call_intrinsic(const FunctionCall& call)
 {
-	FunctionCall call;
-	call.variadic      = true;
-	call.function_name = "printf";
-	function_call_prepare(call);
+	const std::size_t parameter_count = call.parameter_types.size();
 
-	switch (type)
+	// Only the C library signatures are recognized, e.g. not "FFI sqrt(INTEGER): INTEGER"
+	const bool double_signature
+		= call.return_type == Type::DOUBLE
+		  && std::all_of(call.parameter_types.begin(), call.parameter_types.end(), [](Type type) {
+				 return type == Type::DOUBLE;
+			 });
+
+	if (!double_signature || m_operands.size() != call.operand_base + parameter_count)
 	{
-	case Type::UNSIGNED_INT:
-	case Type::BOOLEAN: function_call_label_param(call, "__cc_format_string_llu"); break;
-	case Type::CHAR: function_call_label_param(call, "__cc_format_string_c"); break;
-	case Type::DOUBLE: function_call_label_param(call, "__cc_format_string_f"); break;
-	default: m_compiler.bug("unimplemented display statement for this type");
+		return false;
 	}
 
-	function_call_param(call, type);
-	function_call_finalize(call);
-}
+	const string_view name = call.function_name;
 
-void CodeGen::align_stack()
-{
-	m_compiler.m_output_stream << "\t# align stack: save lower nibble of %rsp to %r12 (non-volatile) and round down\n"
-								  "\tmovq %rsp, %r12\n"
-								  "\tandq $0xF, %r12\n"
-								  "\tandq $0xFFFFFFFFFFFFFFF0, %rsp\n";
-}
+	if (parameter_count == 2 && name == "fmod")
+	{
+		alu_fmod_fprem();
+		return true;
+	}
 
-void CodeGen::unalign_stack() { m_compiler.m_output_stream << "\torq %r12, %rsp # unalign stack: restore from %r1\n"; }
+	// The other intrinsics use SSE instructions on the operands
+	if (uses_x87())
+	{
+		return false;
+	}
 
-void CodeGen::alu_load_binop(Type type)
-{
-	switch (type)
+	if (parameter_count == 1 && name == "sqrt")
 	{
-	case Type::UNSIGNED_INT:
-	case Type::BOOLEAN:
+		intrinsic_unary_xmm("sqrtsd");
+		return true;
+	}
+
+	if (parameter_count == 1 && name == "fabs")
 	{
-		m_compiler.m_output_stream << "\tpopq %rbx\n"
-									  "\tpopq %rax\n";
+		Operand operand = pop_operand();
+		const auto reg  = register_name(to_register(operand, true));
 
-		break;
+		// All bits set but the sign bit
+		emit("pcmpeqd", {"%xmm0", "%xmm0"});
+		emit("psrlq", {"$1", "%xmm0"});
+		emit("andpd", {"%xmm0", reg});
+
+		push_operand(operand);
+		return true;
 	}
 
-	case Type::DOUBLE:
+	if (parameter_count == 2 && (name == "fmin" || name == "fmax"))
 	{
-		m_compiler.m_output_stream << "\tfldl (%rsp)\n"
-									  "\tfldl 8(%rsp)\n"
-									  "\taddq $16, %rsp\n";
-		break;
+		intrinsic_min_max(name == "fmin" ? "minsd" : "maxsd");
+		return true;
 	}
 
-	default:
+	if (parameter_count == 3 && name == "fma" && has_fma())
 	{
-		alu_unimplemented();
+		Operand addend = pop_operand();
+		Operand factor = pop_operand();
+		Operand result = pop_operand();
+
+		to_register(result, true);
+		to_register(factor, true);
+
+		if (!addend.is(Operand::Kind::MEMORY))
+		{
+			to_register(addend, true);
+		}
+
+		// result = factor * result + addend, rounded once
+		emit("vfmadd213sd", {addend.str(), factor.str(), result.str()});
+
+		release_operand(addend);
+		release_operand(factor);
+		push_operand(result);
+		return true;
+	}
+
+	if (parameter_count == 1 && has_sse4_1())
+	{
+		// Rounding modes for roundsd, with bit 3 set to suppress the precision exception like the C functions do
+		if (name == "floor")
+		{
+			intrinsic_unary_xmm("roundsd", "$9");
+			return true;
+		}
+
+		if (name == "ceil")
+		{
+			intrinsic_unary_xmm("roundsd", "$10");
+			return true;
+		}
+
+		if (name == "trunc")
+		{
+			intrinsic_unary_xmm("roundsd", "$11");
+			return true;
+		}
+
+		if (name == "round")
+		{
+			// Halfway cases are rounded away from zero, which no rounding mode does: compute
+			// trunc(x + copysign(0.49999999999999994, x)). The largest double below 0.5 is used so that e.g.
+			// 0.49999999999999994 is not rounded up by the addition.
+			Operand operand = pop_operand();
+			const auto reg  = register_name(to_register(operand, true));
+
+			emit("pcmpeqd", {"%xmm0", "%xmm0"});
+			emit("psllq", {"$63", "%xmm0"});
+			emit("andpd", {reg, "%xmm0"});
+			emit("movsd", {fmt::format("{}(%rip)", f64_constant_label(0x3FDFFFFFFFFFFFFF)), "%xmm1"});
+			emit("orpd", {"%xmm1", "%xmm0"});
+			emit("addsd", {"%xmm0", reg});
+			emit("roundsd", {"$11", reg, reg});
+
+			push_operand(operand);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CodeGen::intrinsic_unary_xmm(string_view instruction, string_view immediate)
+{
+	Operand operand = pop_operand();
+
+	if (!operand.is(Operand::Kind::MEMORY))
+	{
+		to_register(operand, true);
 	}
+
+	// The result may reuse the register of the operand
+	release_operand(operand);
+	const Register result = allocate_register(true);
+
+	if (immediate.size() == 0)
+	{
+		emit(instruction, {operand.str(), register_name(result)});
+	}
+	else
+	{
+		emit(instruction, {immediate, operand.str(), register_name(result)});
 	}
+
+	push_operand(Operand::in_register(result, Type::DOUBLE));
+}
+
+void CodeGen::intrinsic_min_max(string_view instruction)
+{
+	Operand right = pop_operand();
+	Operand left  = pop_operand();
+
+	const auto left_reg  = register_name(to_register(left, true));
+	const auto right_reg = register_name(to_register(right, true));
+
+	// minsd and maxsd return their source operand if either operand is NaN, but fmin and fmax only return NaN if both
+	// operands are: select the left operand instead when the right one is NaN
+	emit("movapd", {left_reg, "%xmm0"});
+	emit(instruction, {right_reg, "%xmm0"});
+	emit("movapd", {right_reg, "%xmm1"});
+	emit("cmpunordsd", {"%xmm1", "%xmm1"});
+	emit("movapd", {left_reg, "%xmm2"});
+	emit("andpd", {"%xmm1", "%xmm2"});
+	emit("andnpd", {"%xmm0", "%xmm1"});
+	emit("orpd", {"%xmm2", "%xmm1"});
+	emit("movapd", {"%xmm1", left_reg});
+
+	release_operand(right);
+	push_operand(left);
+}
+
+void CodeGen::allocate(Type pointer_type, std::uint64_t size)
+{
+	FunctionCall call;
+	call.function_name = runtime::new_function;
+	call.return_type   = pointer_type;
+	call.foreign       = true;
+
+	load_i64(size);
+	function_call(call, {Type::UNSIGNED_INT});
 }
 
-void CodeGen::alu_store_f64()
+void CodeGen::dispose(Type pointer_type, std::uint64_t size)
 {
-	m_compiler.m_output_stream << "\taddq $-8, %rsp\n"
-								  "\tfstpl (%rsp)\n";
+	// Blocks are not prefixed by their size, which is passed instead
+	FunctionCall call;
+	call.function_name = runtime::dispose_function;
+	call.foreign       = true;
+
+	load_i64(size);
+	function_call(call, {pointer_type, Type::UNSIGNED_INT});
 }
 
-void CodeGen::alu_compare(Type type, string_view instruction)
+void CodeGen::debug_display(Type type)
 {
-	alu_load_binop(type);
+	FunctionCall call;
+	call.foreign = true;
 
 	switch (type)
 	{
 	case Type::UNSIGNED_INT:
+	case Type::BOOLEAN: call.function_name = runtime::display_u64_function; break;
+	case Type::CHAR: call.function_name = runtime::display_char_function; break;
+	case Type::DOUBLE: call.function_name = runtime::display_f64_function; break;
+	default: m_compiler.bug("unimplemented display statement for this type");
+	}
+
+	function_call(call, {type});
+}
+
+std::size_t CodeGen::align_stack()
+{
+	// %rsp is 8 bytes off a 16-byte boundary when entering a procedure, because of the return address
+	const std::size_t padding = (m_stack_depth + 8) % 16;
+
+	if (padding != 0)
 	{
-		m_compiler.m_output_stream << "\tcmpq %rbx, %rax\n";
-		break;
+		emit("subq", {fmt::format("${}", padding), "%rsp"}, "align stack");
+		m_stack_depth += padding;
 	}
 
-	case Type::DOUBLE:
+	if (m_compiler.m_config.check_stack_depth)
 	{
-		m_compiler.m_output_stream << "\tfcomip\n"
-									  "\tfstp %st(0) # Clear fp stack\n";
-		break;
+		const std::size_t tag = ++m_label_tag;
+
+		if (m_has_frame_pointer)
+		{
+			emit(
+				"leaq", {fmt::format("{}(%rsp)", m_stack_depth - m_frame_pointer_depth), "%rax"}, "check stack depth");
+			emit("cmpq", {"%rax", "%rbp"});
+		}
+		else
+		{
+			emit("testq", {"$15", "%rsp"}, "check stack alignment");
+		}
+
+		emit("je", {fmt::format("__stack_ok{}", tag)});
+		emit("ud2");
+		emit_label(fmt::format("__stack_ok{}", tag));
 	}
 
-	default:
+	return padding;
+}
+
+void CodeGen::unalign_stack(std::size_t padding)
+{
+	if (padding != 0)
 	{
-		alu_unimplemented();
+		emit("addq", {fmt::format("${}", padding), "%rsp"}, "unalign stack");
+		m_stack_depth -= padding;
 	}
+}
+
+void CodeGen::push_operand(Operand operand) { m_operands.push_back(std::move(operand)); }
+
+Operand CodeGen::pop_operand()
+{
+	if (m_operands.empty())
+	{
+		m_compiler.bug("operand stack underflow");
 	}
 
-	++m_label_tag;
+	Operand operand = std::move(m_operands.back());
+	m_operands.pop_back();
+
+	if (operand.is(Operand::Kind::STACK))
+	{
+		// Only the bottom of the operand stack can be spilled, so this is the top of the machine stack.
+		const bool     xmm = is_function_param_type_float(operand.type);
+		const Register reg = allocate_register(xmm);
+
+		if (xmm)
+		{
+			emit("movsd", {"(%rsp)", register_name(reg)});
+			emit("addq", {"$8", "%rsp"});
+		}
+		else
+		{
+			emit("popq", {register_name(reg)});
+		}
 
-	m_compiler.m_output_stream << fmt::format(
-		"\t{jumpinstruction} __true{tag}\n"
-		"\tpushq $0x0 # No branching: push false\n"
-		"\tjmp __next{tag}\n"
-		"__true{tag}:\n"
-		"\tpushq $0xFFFFFFFFFFFFFFFF\n"
-		"__next{tag}:\n",
-		fmt::arg("jumpinstruction", instruction.str()),
-		fmt::arg("tag", m_label_tag));
+		m_stack_depth -= 8;
+		operand = Operand::in_register(reg, operand.type);
+	}
+
+	return operand;
 }
 
-void CodeGen::function_call_label_param(FunctionCall& call, string_view label)
+void CodeGen::release_operand(const Operand& operand)
+{
+	if (operand.is(Operand::Kind::REGISTER) && !operand.pinned)
+	{
+		m_register_used[underlying_cast(operand.reg)] = false;
+	}
+}
+
+Register CodeGen::allocate_register(bool xmm)
 {
-	// HACK: type passed to function_call_register should be a pointer or something
-	m_compiler.m_output_stream << fmt::format(
-		"\tleaq {label}(%rip), {paramreg}\n",
-		fmt::arg("label", label.str()),
-		fmt::arg("paramreg", function_call_register(call, Type::UNSIGNED_INT).str()));
+	for (;;)
+	{
+		for (const Register reg : allocatable_registers)
+		{
+			if (is_register_xmm(reg) == xmm && !m_register_used[underlying_cast(reg)])
+			{
+				m_register_used[underlying_cast(reg)] = true;
+				return reg;
+			}
+		}
+
+		// Spill the oldest operand holding a register of this class, and thus the ones below it
+		const auto it = std::find_if(m_operands.begin(), m_operands.end(), [&](const Operand& operand) {
+			return operand.is(Operand::Kind::REGISTER) && !operand.pinned && is_register_xmm(operand.reg) == xmm;
+		});
 
-	++call.regular_count;
+		if (it == m_operands.end())
+		{
+			m_compiler.bug("ran out of registers for operands");
+		}
+
+		spill_operands_until(std::size_t(it - m_operands.begin()));
+	}
 }
 
-string_view CodeGen::function_call_register(FunctionCall& call, Type type)
+Register CodeGen::to_register(Operand& operand, bool xmm)
 {
-	if (is_function_param_type_regular(type))
+	if (operand.is(Operand::Kind::REGISTER) && !operand.pinned && is_register_xmm(operand.reg) == xmm)
+	{
+		return operand.reg;
+	}
+
+	const Register reg = allocate_register(xmm);
+	load_operand(operand, reg);
+	release_operand(operand);
+
+	operand = Operand::in_register(reg, operand.type);
+	return reg;
+}
+
+Register CodeGen::to_readable_register(Operand& operand, bool xmm)
+{
+	if (operand.is(Operand::Kind::REGISTER) && is_register_xmm(operand.reg) == xmm)
+	{
+		return operand.reg;
+	}
+
+	return to_register(operand, xmm);
+}
+
+void CodeGen::load_operand(const Operand& operand, Register reg)
+{
+	const std::string destination = register_name(reg);
+
+	// NOTE: the instructions emitted here must not modify the flags, so that a FLAGS operand stays valid.
+
+	switch (operand.kind)
+	{
+	case Operand::Kind::IMMEDIATE:
+	{
+		if (is_register_xmm(reg))
+		{
+			load_operand(operand, Register::RAX);
+			emit("movq", {"%rax", destination});
+		}
+		else
+		{
+			emit(fits_imm32(operand.value) ? "movq" : "movabsq", {operand.str(), destination});
+		}
+
+		break;
+	}
+
+	case Operand::Kind::MEMORY:
 	{
-		switch (call.regular_count)
+		if (operand.size != 8)
 		{
-		case 0: return "%rdi";
-		case 1: return "%rsi";
-		case 2: return "%rdx";
-		case 3: return "%rcx";
-		case 4: return "%r8";
-		case 5: return "%r9";
-		default: break;
+			if (is_register_xmm(reg))
+			{
+				m_compiler.bug("cannot load a narrow memory operand to an SSE register");
+			}
+
+			load_narrow(operand.str(), operand.type, reg);
+			break;
 		}
+
+		emit(is_register_xmm(reg) ? "movsd" : "movq", {operand.str(), destination});
+		break;
 	}
-	else if (is_function_param_type_float(type))
+
+	case Operand::Kind::ADDRESS:
 	{
-		switch (call.float_count)
+		if (is_register_xmm(reg))
+		{
+			load_operand(operand, Register::RAX);
+			emit("movq", {"%rax", destination});
+		}
+		else
 		{
-		case 0: return "%xmm0";
-		case 1: return "%xmm1";
-		case 2: return "%xmm2";
-		case 3: return "%xmm3";
-		case 4: return "%xmm4";
-		case 5: return "%xmm5";
-		case 6: return "%xmm6";
-		case 7: return "%xmm7";
-		default: break;
+			emit("leaq", {operand.location(), destination});
 		}
+
+		break;
 	}
-	else
+
+	case Operand::Kind::REGISTER:
 	{
-		m_compiler.bug("unimplemented parameter type: could not determine register");
+		if (operand.reg == reg)
+		{
+			break;
+		}
+
+		const bool both_xmm = is_register_xmm(operand.reg) && is_register_xmm(reg);
+
+		emit(both_xmm ? "movapd" : "movq", {register_name(operand.reg), destination});
+
+		break;
 	}
 
-	m_compiler.bug("unimplemented parameter pushing on stack");
+	case Operand::Kind::FLAGS:
+	{
+		// Unlike neg, lea does not modify the flags: 1 - 1 = 0 when the condition does not hold, 0 - 1 = -1 otherwise
+		const string_view inverse_suffix = condition_suffix(negate_condition(operand.condition));
+
+		emit(fmt::format("set{}", inverse_suffix.str()), {register_name(reg, 1)});
+		emit("movzbl", {register_name(reg, 1), register_name(reg, 4)});
+		emit("leaq", {fmt::format("-1({})", destination), destination});
+		break;
+	}
+
+	default:
+	{
+		m_compiler.bug("cannot load operand from the machine stack to a fixed register");
+	}
+	}
 }
 
-std::string CodeGen::function_mangle_name(string_view name) const
+std::string CodeGen::element_location(const Variable& array, Operand& index, std::size_t stride, std::size_t offset)
 {
-	switch (m_compiler.m_config.target)
+	if (index.is(Operand::Kind::IMMEDIATE))
 	{
-	case Compiler::Target::LINUX: return name;
-	case Compiler::Target::APPLE_DARWIN: return fmt::format("_{}", name.str());
-	default: m_compiler.bug("unimplemented function calls for this target");
-	};
+		return variable_memory(array, Type::UNSIGNED_INT, std::int64_t(index.value * stride + offset)).str();
+	}
+
+	// Strides that are not a scaled lea are multiplied by imul, which clobbers the flags
+	materialize_flags();
+
+	// RIP-relative addressing cannot be combined with an index register, so the address is loaded first
+	const Register    index_register = to_readable_register(index, false);
+	const std::string displacement   = offset == 0 ? "" : std::to_string(offset);
+	emit("leaq", {variable_memory(array, Type::UNSIGNED_INT).str(), "%rcx"});
+
+	if (stride == 1 || stride == 2 || stride == 4 || stride == 8)
+	{
+		return fmt::format("{}(%rcx,{},{})", displacement, register_name(index_register).str(), stride);
+	}
+
+	// Records are often 3, 5 or 9 times a valid scale factor large (e.g. 24 bytes), whose index a single lea multiplies
+	for (const std::size_t scale : {8, 4, 2, 1})
+	{
+		const std::size_t factor = stride / scale;
+
+		if (stride % scale == 0 && (factor == 3 || factor == 5 || factor == 9))
+		{
+			const std::string name = register_name(index_register).str();
+			emit("leaq", {fmt::format("({},{},{})", name, name, factor - 1), "%rdx"});
+
+			return fmt::format("{}(%rcx,%rdx,{})", displacement, scale);
+		}
+	}
+
+	emit("imulq", {fmt::format("${}", stride), register_name(index_register), "%rdx"});
+
+	return fmt::format("{}(%rcx,%rdx)", displacement);
 }
 
-bool CodeGen::is_function_param_type_regular(Type type) const
+void CodeGen::load_narrow(string_view source, Type type, Register reg)
 {
-	return check_enum_range(type, Type::FIRST_INTEGRAL, Type::LAST_INTEGRAL) || type == Type::CHAR
-		|| type == Type::BOOLEAN;
+	// A true BOOLEAN is all ones, so its byte is sign-extended. Writing to the 32-bit register clears the upper half.
+	if (type == Type::BOOLEAN)
+	{
+		emit("movsbq", {source, register_name(reg)});
+	}
+	else
+	{
+		emit("movzbl", {source, register_name(reg, 4)});
+	}
 }
 
-bool CodeGen::is_function_param_type_float(Type type) const
+void CodeGen::store_operand(const Operand& operand, string_view destination, std::size_t size)
+{
+	if (size == 1)
+	{
+		if (operand.is(Operand::Kind::REGISTER) && !is_register_xmm(operand.reg))
+		{
+			emit("movb", {register_name(operand.reg, 1), destination});
+		}
+		else if (operand.is(Operand::Kind::IMMEDIATE))
+		{
+			emit("movb", {fmt::format("${}", operand.value & 0xFF), destination});
+		}
+		else
+		{
+			load_operand(operand, Register::RAX);
+			emit("movb", {"%al", destination});
+		}
+	}
+	else if (operand.is(Operand::Kind::REGISTER))
+	{
+		emit(is_register_xmm(operand.reg) ? "movsd" : "movq", {register_name(operand.reg), destination});
+	}
+	else if (operand.is(Operand::Kind::IMMEDIATE) && fits_imm32(operand.value))
+	{
+		emit("movq", {operand.str(), destination});
+	}
+	else
+	{
+		load_operand(operand, Register::RAX);
+		emit("movq", {"%rax", destination});
+	}
+}
+
+void CodeGen::spill_operand(Operand& operand)
+{
+	// NOTE: the instructions emitted here must not modify the flags.
+
+	switch (operand.kind)
+	{
+	case Operand::Kind::IMMEDIATE:
+	case Operand::Kind::MEMORY:
+	case Operand::Kind::ADDRESS:
+	case Operand::Kind::FLAGS:
+	{
+		if (operand.is_direct_source())
+		{
+			emit("pushq", {operand.str()});
+			break;
+		}
+
+		load_operand(operand, Register::RAX);
+		emit("pushq", {"%rax"});
+		break;
+	}
+
+	case Operand::Kind::REGISTER:
+	{
+		if (is_register_xmm(operand.reg))
+		{
+			emit("leaq", {"-8(%rsp)", "%rsp"});
+			emit("movsd", {register_name(operand.reg), "(%rsp)"});
+		}
+		else
+		{
+			emit("pushq", {register_name(operand.reg)});
+		}
+
+		break;
+	}
+
+	case Operand::Kind::STACK:
+	{
+		return;
+	}
+	}
+
+	m_stack_depth += 8;
+	release_operand(operand);
+	operand = Operand::stack(operand.type);
+}
+
+void CodeGen::spill_operands_until(std::size_t index)
+{
+	for (std::size_t i = 0; i <= index; ++i)
+	{
+		spill_operand(m_operands[i]);
+	}
+}
+
+void CodeGen::spill_all_operands()
+{
+	if (!m_operands.empty())
+	{
+		spill_operands_until(m_operands.size() - 1);
+	}
+}
+
+void CodeGen::detach_register_variable(Register reg)
+{
+	for (Operand& operand : m_operands)
+	{
+		if (operand.is(Operand::Kind::REGISTER) && operand.pinned && operand.reg == reg)
+		{
+			to_register(operand, is_register_xmm(reg));
+		}
+	}
+}
+
+void CodeGen::spill_clobbered_operands(std::size_t index, bool across_call)
+{
+	for (std::size_t i = index; i-- > 0;)
+	{
+		const Operand& operand = m_operands[i];
+
+		// Register variables live in callee-saved registers, which calls preserve
+		const bool clobbered = (operand.is(Operand::Kind::MEMORY) && !operand.read_only)
+			|| (across_call && operand.is(Operand::Kind::REGISTER) && !operand.pinned);
+
+		if (clobbered)
+		{
+			spill_operands_until(i);
+			return;
+		}
+	}
+}
+
+void CodeGen::alu_binop_gpr(string_view instruction, bool commutative)
+{
+	materialize_flags();
+
+	Operand right = pop_operand();
+	Operand left  = pop_operand();
+
+	if (commutative && !left.is(Operand::Kind::REGISTER) && right.is(Operand::Kind::REGISTER) && !right.pinned)
+	{
+		std::swap(left, right);
+	}
+
+	const Register destination = to_register(left, false);
+
+	if (!right.is_direct_source() || (right.is(Operand::Kind::REGISTER) && is_register_xmm(right.reg)))
+	{
+		to_register(right, false);
+	}
+
+	emit(instruction, {right.str(), register_name(destination)});
+
+	release_operand(right);
+	push_operand(left);
+}
+
+void CodeGen::alu_binop_xmm(string_view instruction, bool commutative)
+{
+	materialize_flags();
+
+	Operand right = pop_operand();
+	Operand left  = pop_operand();
+
+	if (commutative && !left.is(Operand::Kind::REGISTER) && right.is(Operand::Kind::REGISTER) && !right.pinned)
+	{
+		std::swap(left, right);
+	}
+
+	const Register destination = to_register(left, true);
+
+	if (!right.is_memory64())
+	{
+		to_register(right, true);
+	}
+
+	emit(instruction, {right.str(), register_name(destination)});
+
+	release_operand(right);
+	push_operand(left);
+}
+
+void CodeGen::alu_binop_x87(string_view instruction)
+{
+	// The x87 FPU cannot load from general purpose or SSE registers: work on the machine stack
+	materialize_flags();
+	spill_all_operands();
+	m_operands.pop_back();
+
+	emit("fldl", {"(%rsp)"});
+	emit("fldl", {"8(%rsp)"});
+	emit(instruction, {"%st(0)", "%st(1)"});
+	emit("addq", {"$8", "%rsp"});
+	emit("fstpl", {"(%rsp)"});
+	m_stack_depth -= 8;
+}
+
+void CodeGen::alu_divmod_gpr(Register result)
+{
+	materialize_flags();
+
+	Operand right = pop_operand();
+	Operand left  = pop_operand();
+
+	// div does not accept an immediate divisor
+	if (!right.is(Operand::Kind::MEMORY))
+	{
+		to_readable_register(right, false);
+	}
+
+	// The result may reuse the register of the dividend, which is read before the result is written
+	release_operand(left);
+	const Register destination = allocate_register(false);
+
+	load_operand(left, Register::RAX);
+
+	// 32-bit division is much faster than 64-bit division on most CPUs, so use it when both operands fit
+	const std::size_t tag = ++m_label_tag;
+
+	emit("movq", {"%rax", "%rcx"});
+	emit("orq", {right.str(), "%rcx"});
+	emit("shrq", {"$32", "%rcx"});
+	emit("jnz", {fmt::format("__divq{}", tag)});
+
+	const std::string divisor32
+		= right.is(Operand::Kind::REGISTER) ? std::string(register_name(right.reg, 4)) : right.str();
+
+	emit("xorl", {"%edx", "%edx"}, "Higher part of numerator");
+	emit("divl", {divisor32}, "Quotient goes to %eax, remainder to %edx");
+	emit("jmp", {fmt::format("__divnext{}", tag)});
+
+	emit_label(fmt::format("__divq{}", tag));
+	emit("xorl", {"%edx", "%edx"}, "Higher part of numerator");
+	emit("divq", {right.str()}, "Quotient goes to %rax, remainder to %rdx");
+
+	emit_label(fmt::format("__divnext{}", tag));
+	emit("movq", {register_name(result), register_name(destination)});
+
+	release_operand(right);
+	push_operand(Operand::in_register(destination, left.type));
+}
+
+//! \brief Constants to divide by an invariant integer using a multiplication, as described in "Division by Invariant
+//! Integers using Multiplication" (Granlund and Montgomery, 1994).
+//!
+//! \details
+//!		The quotient is the upper half of the 128-bit product of the dividend and \ref multiplier, shifted right
+//!		by \ref shift. If \ref add is set, the multiplier does not fit in 64 bits: its implicit 65th bit is
+//!		accounted for by adding the dividend back to the high product, halving the sum to avoid an overflow.
+struct DivisionMagic
+{
+	std::uint64_t multiplier;
+	unsigned      shift;
+	bool          add;
+};
+
+static bool is_power_of_two(std::uint64_t value) { return value != 0 && (value & (value - 1)) == 0; }
+
+static unsigned floor_log2(std::uint64_t value)
+{
+	unsigned result = 0;
+
+	while (value >>= 1)
+	{
+		++result;
+	}
+
+	return result;
+}
+
+//! \brief Compute the magic constants for \p divisor, which must be neither 0 nor a power of two.
+static DivisionMagic division_magic(std::uint64_t divisor)
+{
+	const unsigned log2 = floor_log2(divisor);
+
+	// Long division of 2^(64 + log2) by the divisor. The quotient fits in 64 bits because divisor > 2^log2.
+	std::uint64_t quotient = 0, remainder = std::uint64_t(1) << log2;
+
+	for (int bit = 0; bit < 64; ++bit)
+	{
+		const bool carry = (remainder >> 63) != 0;
+
+		remainder <<= 1;
+		quotient <<= 1;
+
+		if (carry || remainder >= divisor)
+		{
+			remainder -= divisor;
+			quotient |= 1;
+		}
+	}
+
+	// The rounded up multiplier is precise enough for all 64-bit dividends if its error is below 2^log2
+	if (divisor - remainder < (std::uint64_t(1) << log2))
+	{
+		return {quotient + 1, log2, false};
+	}
+
+	// Otherwise, use one more bit of precision: this is 2^(65 + log2) / divisor, minus 2^64
+	const std::uint64_t twice_remainder = remainder * 2;
+	quotient *= 2;
+
+	if (twice_remainder >= divisor || twice_remainder < remainder)
+	{
+		++quotient;
+	}
+
+	return {quotient + 1, log2, true};
+}
+
+bool CodeGen::alu_multiply_constant()
+{
+	Operand& right = m_operands.back();
+	Operand& left  = m_operands[m_operands.size() - 2];
+
+	if (!right.is(Operand::Kind::IMMEDIATE))
+	{
+		if (!left.is(Operand::Kind::IMMEDIATE))
+		{
+			return false;
+		}
+
+		std::swap(left, right);
+	}
+
+	const std::uint64_t factor = right.value;
+
+	if (factor == 0)
+	{
+		m_operands.pop_back();
+		release_operand(pop_operand());
+		push_operand(Operand::immediate(0, Type::UNSIGNED_INT));
+		return true;
+	}
+
+	if (is_power_of_two(factor))
+	{
+		m_operands.pop_back();
+
+		if (factor != 1)
+		{
+			push_operand(Operand::immediate(floor_log2(factor), Type::UNSIGNED_INT));
+			alu_binop_gpr("shlq", false);
+		}
+
+		return true;
+	}
+
+	// Factors of the form {3, 5, 9} * 2^n are computed with lea, followed by a shift
+	for (const std::uint64_t scale : {std::uint64_t(2), std::uint64_t(4), std::uint64_t(8)})
+	{
+		const std::uint64_t lea_factor = scale + 1;
+
+		if (factor % lea_factor != 0 || !is_power_of_two(factor / lea_factor))
+		{
+			continue;
+		}
+
+		materialize_flags();
+		m_operands.pop_back();
+
+		Operand        operand = pop_operand();
+		const Register reg     = to_register(operand, false);
+		const auto     name    = register_name(reg);
+
+		emit("leaq", {fmt::format("({},{},{})", name.str(), name.str(), scale), name});
+
+		if (factor != lea_factor)
+		{
+			emit("shlq", {fmt::format("${}", floor_log2(factor / lea_factor)), name});
+		}
+
+		push_operand(operand);
+		return true;
+	}
+
+	return false;
+}
+
+bool CodeGen::alu_divmod_constant(bool modulus)
+{
+	const Operand& right = m_operands.back();
+
+	// Dividing by zero is left to the div instruction, which raises the expected exception
+	if (!right.is(Operand::Kind::IMMEDIATE) || right.value == 0)
+	{
+		return false;
+	}
+
+	const std::uint64_t divisor = right.value;
+
+	if (is_power_of_two(divisor))
+	{
+		m_operands.pop_back();
+
+		if (modulus)
+		{
+			push_operand(Operand::immediate(divisor - 1, Type::UNSIGNED_INT));
+			alu_binop_gpr("andq", true);
+		}
+		else if (divisor != 1)
+		{
+			push_operand(Operand::immediate(floor_log2(divisor), Type::UNSIGNED_INT));
+			alu_binop_gpr("shrq", false);
+		}
+
+		return true;
+	}
+
+	materialize_flags();
+	m_operands.pop_back();
+
+	Operand left = pop_operand();
+
+	// mul needs a register or memory operand
+	if (!left.is(Operand::Kind::REGISTER) && !left.is_memory64())
+	{
+		to_register(left, false);
+	}
+
+	// The result may reuse the register of the dividend, which is only read before the result is written
+	release_operand(left);
+	const Register destination = allocate_register(false);
+	const auto     dividend    = left.str();
+
+	const DivisionMagic magic = division_magic(divisor);
+
+	emit("movabsq", {fmt::format("$0x{:016x}", magic.multiplier), "%rax"});
+	emit("mulq", {dividend}, "High part of the product goes to %rdx");
+
+	Register quotient = Register::RDX;
+
+	if (magic.add)
+	{
+		emit("movq", {dividend, "%rax"});
+		emit("subq", {"%rdx", "%rax"});
+		emit("shrq", {"%rax"});
+		emit("addq", {"%rdx", "%rax"});
+		quotient = Register::RAX;
+	}
+
+	if (magic.shift != 0)
+	{
+		emit("shrq", {fmt::format("${}", magic.shift), register_name(quotient)});
+	}
+
+	if (modulus)
+	{
+		// remainder = dividend - quotient * divisor
+		if (fits_imm32(divisor))
+		{
+			emit("imulq", {fmt::format("${}", divisor), register_name(quotient), register_name(quotient)});
+		}
+		else
+		{
+			emit("movabsq", {fmt::format("$0x{:016x}", divisor), "%rcx"});
+			emit("imulq", {"%rcx", register_name(quotient)});
+		}
+
+		if (!left.is(Operand::Kind::REGISTER) || left.reg != destination)
+		{
+			emit("movq", {dividend, register_name(destination)});
+		}
+
+		emit("subq", {register_name(quotient), register_name(destination)});
+	}
+	else
+	{
+		emit("movq", {register_name(quotient), register_name(destination)});
+	}
+
+	push_operand(Operand::in_register(destination, Type::UNSIGNED_INT));
+	return true;
+}
+
+void CodeGen::alu_fmod_fprem()
+{
+	// fprem computes the exact remainder of the truncated division like fmod, unlike the IEEE remainder of fprem1.
+	// It only reduces the exponent by up to 63 per iteration, so it is repeated until the C2 flag is cleared.
+	materialize_flags();
+
+	Operand right = pop_operand();
+	Operand left  = pop_operand();
+
+	for (Operand* operand : {&left, &right})
+	{
+		if (!operand->is(Operand::Kind::MEMORY))
+		{
+			to_register(*operand, true);
+		}
+	}
+
+	release_operand(left);
+	release_operand(right);
+	const Register result = allocate_register(true);
+
+	emit("subq", {"$16", "%rsp"});
+	m_stack_depth += 16;
+
+	const std::string right_location = right.is(Operand::Kind::MEMORY) ? right.str() : "8(%rsp)";
+	const std::string left_location  = left.is(Operand::Kind::MEMORY) ? left.str() : "(%rsp)";
+
+	if (!right.is(Operand::Kind::MEMORY))
+	{
+		emit("movsd", {right.str(), right_location});
+	}
+
+	if (!left.is(Operand::Kind::MEMORY))
+	{
+		emit("movsd", {left.str(), left_location});
+	}
+
+	const std::size_t tag = ++m_label_tag;
+
+	emit("fldl", {right_location});
+	emit("fldl", {left_location});
+	emit_label(fmt::format("__fprem{}", tag));
+	emit("fprem");
+	emit("fnstsw", {"%ax"});
+	emit("testw", {"$0x400", "%ax"}, "C2 is set if the reduction is incomplete");
+	emit("jnz", {fmt::format("__fprem{}", tag)});
+	emit("fstp", {"%st(1)"});
+	emit("fstpl", {"(%rsp)"});
+	emit("movsd", {"(%rsp)", register_name(result)});
+	emit("addq", {"$16", "%rsp"});
+	m_stack_depth -= 16;
+
+	push_operand(Operand::in_register(result, Type::DOUBLE));
+}
+
+void CodeGen::alu_compare(Type type, Condition condition)
+{
+	// The comparison overwrites the flags
+	materialize_flags();
+
+	switch (type)
+	{
+	case Type::UNSIGNED_INT:
+	{
+		Operand right = pop_operand();
+		Operand left  = pop_operand();
+
+		// cmp needs a register or memory as its first operand
+		if (left.is(Operand::Kind::IMMEDIATE))
+		{
+			std::swap(left, right);
+			condition = swap_condition(condition);
+		}
+
+		if (!left.is_memory64())
+		{
+			to_readable_register(left, false);
+		}
+
+		if (!right.is_direct_source() || (left.is_memory64() && right.is_memory64()))
+		{
+			to_readable_register(right, false);
+		}
+
+		emit("cmpq", {right.str(), left.str()});
+
+		release_operand(left);
+		release_operand(right);
+		break;
+	}
+
+	case Type::DOUBLE:
+	{
+		if (check_enum_range(condition, Condition::LESS, Condition::GREATER_EQUAL))
+		{
+			m_compiler.bug("signed comparison of DOUBLE operands");
+		}
+
+		// Both set CF/ZF like an unsigned integer comparison, so the same jump instructions can be used
+		if (uses_x87())
+		{
+			spill_all_operands();
+			m_operands.resize(m_operands.size() - 2);
+
+			emit("fldl", {"(%rsp)"});
+			emit("fldl", {"8(%rsp)"});
+			emit("addq", {"$16", "%rsp"});
+			m_stack_depth -= 16;
+			emit("fcomip");
+			emit("fstp", {"%st(0)"}, "Clear fp stack");
+			break;
+		}
+
+		Operand right = pop_operand();
+		Operand left  = pop_operand();
+
+		// ucomisd needs a register as its first operand
+		if (!left.is(Operand::Kind::REGISTER) && right.is(Operand::Kind::REGISTER))
+		{
+			std::swap(left, right);
+			condition = swap_condition(condition);
+		}
+
+		to_register(left, true);
+
+		if (!right.is(Operand::Kind::MEMORY))
+		{
+			to_register(right, true);
+		}
+
+		emit("ucomisd", {right.str(), left.str()});
+
+		release_operand(left);
+		release_operand(right);
+		break;
+	}
+
+	default:
+	{
+		alu_unimplemented();
+	}
+	}
+
+	push_operand(Operand::flags(condition));
+}
+
+void CodeGen::materialize_flags()
+{
+	for (std::size_t i = 0; i < m_operands.size(); ++i)
+	{
+		if (m_operands[i].is(Operand::Kind::FLAGS))
+		{
+			to_register(m_operands[i], false);
+		}
+	}
+}
+
+void CodeGen::branch_on_condition(Operand& condition, bool value, string_view label)
+{
+	if (condition.is(Operand::Kind::FLAGS))
+	{
+		const Condition jump_condition = value ? condition.condition : negate_condition(condition.condition);
+		emit(fmt::format("j{}", condition_suffix(jump_condition).str()), {label});
+		return;
+	}
+
+	if (condition.is(Operand::Kind::IMMEDIATE))
+	{
+		// Constant conditions (e.g. folded by the parser) never need to be tested at runtime
+		if ((condition.value != 0) == value)
+		{
+			emit("jmp", {label});
+		}
+
+		return;
+	}
+
+	if (condition.is(Operand::Kind::MEMORY) && condition.size == 1)
+	{
+		// A BOOLEAN variable can be tested in place
+		emit("cmpb", {"$0", condition.str()});
+		emit(value ? "jne" : "je", {label});
+		return;
+	}
+
+	const string_view condition_register = register_name(to_readable_register(condition, false));
+
+	emit("test", {condition_register, condition_register});
+	emit(value ? "jnz" : "jz", {label});
+}
+
+void CodeGen::expect_empty_operand_stack(string_view context)
+{
+	// Every instruction consumes the values it pushes, which the static stack depth relies on
+	if (!m_operands.empty())
+	{
+		m_compiler.bug(fmt::format("values left on the operand stack {}", context.str()));
+	}
+}
+
+void CodeGen::function_call_label_param(FunctionCall& call, string_view label)
+{
+	// HACK: type passed to function_call_param should be a pointer or something
+	push_operand(Operand::address(label, Type::UNSIGNED_INT));
+	function_call_param(call, Type::UNSIGNED_INT);
+}
+
+Register CodeGen::function_call_register(std::size_t index, Type type)
+{
+	static constexpr std::array<Register, 6> regular_registers{
+		{Register::RDI, Register::RSI, Register::RDX, Register::RCX, Register::R8, Register::R9}};
+
+	if (is_function_param_type_regular(type))
+	{
+		if (index < regular_registers.size())
+		{
+			return regular_registers[index];
+		}
+	}
+	else if (is_function_param_type_float(type))
+	{
+		// %xmm0-%xmm7
+		if (index < 8)
+		{
+			return Register(underlying_cast(Register::XMM0) + index);
+		}
+	}
+	else
+	{
+		m_compiler.bug("unimplemented parameter type: could not determine register");
+	}
+
+	m_compiler.bug("unimplemented parameter pushing on stack");
+}
+
+void CodeGen::function_call_move_parameters(FunctionCall& call)
+{
+	struct Move
+	{
+		Register    source, destination;
+		std::size_t operand_index;
+	};
+
+	const std::size_t parameter_count = m_operands.size() - call.operand_base;
+
+	if (parameter_count != call.parameter_types.size())
+	{
+		m_compiler.bug("mismatched parameter count on the operand stack");
+	}
+
+	std::vector<Register> destinations;
+	std::size_t           regular_index = 0, float_index = 0;
+
+	for (const Type type : call.parameter_types)
+	{
+		const bool is_float = is_function_param_type_float(type);
+		destinations.push_back(function_call_register(is_float ? float_index++ : regular_index++, type));
+	}
+
+	// Parameters already held in registers are moved first, because parameter registers may also hold operands.
+	// This is a parallel move: a register can only be overwritten once no other move reads it.
+	std::vector<Move> moves;
+
+	for (std::size_t i = 0; i < parameter_count; ++i)
+	{
+		const Operand& operand = m_operands[call.operand_base + i];
+
+		if (operand.is(Operand::Kind::REGISTER) && operand.reg != destinations[i])
+		{
+			moves.push_back({operand.reg, destinations[i], i});
+		}
+	}
+
+	while (!moves.empty())
+	{
+		const auto ready = std::find_if(moves.begin(), moves.end(), [&](const Move& move) {
+			return std::none_of(moves.begin(), moves.end(), [&](const Move& other) {
+				return other.source == move.destination;
+			});
+		});
+
+		if (ready == moves.end())
+		{
+			// Every remaining move belongs to a cycle: break it by saving one of the sources to a scratch register.
+			// Cycles only occur between general purpose registers.
+			const Register cycle_source = moves.front().source;
+			emit("movq", {register_name(cycle_source), "%rax"});
+
+			for (Move& move : moves)
+			{
+				if (move.source == cycle_source)
+				{
+					move.source = Register::RAX;
+				}
+			}
+
+			continue;
+		}
+
+		const Operand& operand = m_operands[call.operand_base + ready->operand_index];
+		load_operand(Operand::in_register(ready->source, operand.type), ready->destination);
+		moves.erase(ready);
+	}
+
+	// Then the operands that do not depend on any register, and finally the ones spilled to the machine stack, which
+	// are at the bottom of the parameter list.
+	for (std::size_t i = 0; i < parameter_count; ++i)
+	{
+		const Operand& operand = m_operands[call.operand_base + i];
+
+		if (!operand.is(Operand::Kind::REGISTER) && !operand.is(Operand::Kind::STACK))
+		{
+			load_operand(operand, destinations[i]);
+		}
+	}
+
+	for (std::size_t i = parameter_count; i-- > 0;)
+	{
+		const Operand& operand = m_operands[call.operand_base + i];
+
+		if (!operand.is(Operand::Kind::STACK))
+		{
+			continue;
+		}
+
+		if (is_register_xmm(destinations[i]))
+		{
+			emit("movsd", {"(%rsp)", register_name(destinations[i])});
+			emit("addq", {"$8", "%rsp"}, "Effectively pop the float from the stack.");
+		}
+		else
+		{
+			emit("popq", {register_name(destinations[i])});
+		}
+
+		m_stack_depth -= 8;
+	}
+
+	for (std::size_t i = 0; i < parameter_count; ++i)
+	{
+		if (call.foreign && call.parameter_types[i] == Type::BOOLEAN)
+		{
+			// Booleans are all ones when true, while C expects 1
+			emit("andq", {"$1", register_name(destinations[i])});
+		}
+
+		release_operand(m_operands[call.operand_base + i]);
+	}
+
+	m_operands.resize(call.operand_base);
+}
+
+std::string CodeGen::procedure_symbol(string_view name) const
+{
+	return function_mangle_name(fmt::format("_ceri_proc_{}", name.str()));
+}
+
+std::string CodeGen::function_mangle_name(string_view name) const
+{
+	switch (m_compiler.m_config.target)
+	{
+	case Compiler::Target::LINUX: return name;
+	case Compiler::Target::APPLE_DARWIN: return fmt::format("_{}", name.str());
+	default: m_compiler.bug("unimplemented function calls for this target");
+	};
+}
+
+bool CodeGen::uses_x87() const
+{
+	return m_compiler.m_config.floating_point_unit == Compiler::FloatingPointUnit::X87;
+}
+
+bool CodeGen::has_sse4_1() const
+{
+	return m_compiler.m_config.micro_architecture >= Compiler::MicroArchitecture::X86_64_V2;
+}
+
+bool CodeGen::has_fma() const
+{
+	return m_compiler.m_config.micro_architecture >= Compiler::MicroArchitecture::X86_64_V3;
+}
+
+std::string CodeGen::f64_constant_label(std::uint64_t bits)
+{
+	const auto emplace_result = m_f64_constant_indices.emplace(bits, m_f64_constants.size());
+	const bool inserted       = emplace_result.second;
+
+	if (inserted)
+	{
+		m_f64_constants.push_back(bits);
+	}
+
+	return fmt::format("__cc_f64_constant{}", emplace_result.first->second);
+}
+
+void CodeGen::emit_constant_pool()
+{
+	if (m_f64_constants.empty())
+	{
+		return;
+	}
+
+	switch (m_compiler.m_config.target)
+	{
+	case Compiler::Target::LINUX: emit_directive(".section .rodata"); break;
+	case Compiler::Target::APPLE_DARWIN: emit_directive(".const"); break;
+	default: m_compiler.bug("unimplemented constant pool for this target");
+	}
+
+	emit_directive(".align 8");
+
+	for (std::size_t i = 0; i < m_f64_constants.size(); ++i)
+	{
+		emit_directive(fmt::format("__cc_f64_constant{}: .quad 0x{:016x}", i, m_f64_constants[i]));
+	}
+}
+
+bool CodeGen::is_function_param_type_regular(Type type) const
+{
+	return check_enum_range(type, Type::FIRST_INTEGRAL, Type::LAST_INTEGRAL) || type == Type::CHAR
+		|| type == Type::BOOLEAN || m_compiler.find_pointer_type(type) != nullptr;
+}
+
+bool CodeGen::is_function_param_type_float(Type type) const
 {
 	return check_enum_range(type, Type::FIRST_FLOATING, Type::LAST_FLOATING);
 }
 
+void CodeGen::emit(string_view opcode, std::vector<std::string> operands, string_view comment)
+{
+	m_instructions.push_back(Instruction::instruction(opcode, std::move(operands), comment));
+}
+
+void CodeGen::emit_label(string_view name) { m_instructions.push_back(Instruction::label(name)); }
+
+void CodeGen::emit_directive(string_view text) { m_instructions.push_back(Instruction::directive(text)); }
+
+void CodeGen::print_peephole_report(const PeepholeStatistics& statistics) const
+{
+	std::size_t total = 0;
+
+	for (const std::size_t removed : statistics.removed_instructions)
+	{
+		total += removed;
+	}
+
+	std::ostream& report = m_compiler.m_diagnostic_stream;
+
+	report << fmt::format("peephole: removed {} instructions\n", total);
+
+	for (std::size_t i = 0; i < statistics.removed_instructions.size(); ++i)
+	{
+		report << fmt::format(
+			"peephole: {:<20} {}\n",
+			peephole_rule_name(PeepholeRule(i)).str(),
+			statistics.removed_instructions[i]);
+	}
+}
+
 void CodeGen::alu_unimplemented() { m_compiler.bug("unimplemented ALU operation for this type"); }
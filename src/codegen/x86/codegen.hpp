@@ -1,39 +1,22 @@
 #pragma once
 
+#include "codegen/x86/instruction.hpp"
+#include "codegen/x86/operand.hpp"
+#include "codegen/x86/peephole.hpp"
 #include "exceptions.hpp"
+#include "ir/ir.hpp"
 #include "types.hpp"
 #include "util/string_view.hpp"
+#include "variable.hpp"
 
+#include <array>
 #include <cstdint>
 #include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 class Compiler;
-struct Variable;
-
-class IfStatement
-{
-	friend class CodeGen;
-
-	private:
-	std::size_t saved_tag;
-};
-
-class WhileStatement
-{
-	friend class CodeGen;
-
-	private:
-	std::size_t saved_tag;
-};
-
-class ForStatement
-{
-	friend class CodeGen;
-
-	private:
-	std::size_t     saved_tag;
-	const Variable* variable;
-};
 
 struct FunctionCall
 {
@@ -42,15 +25,38 @@ struct FunctionCall
 	private:
 	std::size_t regular_count = 0, float_count = 0;
 
+	//! Index of the first parameter on the operand stack.
+	std::size_t operand_base = 0;
+
+	std::vector<Type> parameter_types;
+
 	public:
 	std::string function_name;
 	Type        return_type = Type::VOID;
 	bool        variadic    = false;
+
+	//! Whether the callee is a C function, which may be replaced by inline code if its name is well-known.
+	bool foreign = false;
 };
 
+//! \brief x86-64 code generator.
+//!
+//! \details
+//!		The interface is the one of a stack machine: loads push a value, operations pop their operands and push their
+//!		result. However, values are not pushed to the machine stack directly: they are tracked on a compile-time
+//!		operand stack, where they may stay as pending immediates, memory operands or registers until an instruction
+//!		actually needs them.
+//!		Operands are only spilled to the machine stack when running out of registers and before function calls. The
+//!		operand stack is always empty between basic blocks, so that every path into a block leaves the same state.
+//!
+//!		Instructions are buffered rather than written out directly, so that a peephole pass can rewrite them once the
+//!		whole program was generated.
 class CodeGen
 {
 	public:
+	//! SSE registers available to the values of a vectorized loop, %xmm3 to %xmm15, the others being scratch.
+	static constexpr std::size_t vector_kernel_registers = 13;
+
 	CodeGen(Compiler& compiler) : m_compiler{compiler} {}
 
 	void begin_program();
@@ -59,21 +65,90 @@ class CodeGen
 	void begin_executable_section();
 	void finalize_executable_section();
 
+	//! \brief Keep \p variable in the register \p reg rather than in memory, for the next procedure.
+	//! Registers have to be assigned before the procedure begins, so that callee-saved ones can be saved by its
+	//! prologue. Other registers are only preserved by procedures that call no function at all.
+	void assign_register(const Variable& variable, Register reg);
+
+	//! \brief Keep \p variable in the stack frame of the next procedure, rather than in global memory.
+	void assign_frame_slot(const Variable& variable);
+
 	void begin_main_procedure();
-	void finalize_main_procedure();
+
+	//! \brief Return from the main procedure, which may only happen once every operand was consumed.
+	void return_from_main_procedure();
+
+	//! \brief Begin the procedure \p name of the program, moving its \p parameters from the registers they are passed
+	//! in to the register or frame slot of their variable. Parameters which were assigned neither are never read.
+	//!
+	//! \details
+	//!		Procedures pass parameters and results like C functions do, except that BOOLEAN values keep being all ones
+	//!		when true. A frame pointer is only set up if the procedure has frame slots.
+	void begin_procedure(string_view name, const std::vector<Variable>& parameters);
+
+	//! \brief Return from the current procedure, popping its result unless \p return_type is VOID.
+	void return_from_procedure(Type return_type);
+
+	//! \brief Forget the registers and frame slots assigned to the variables of the procedure that was generated.
+	void finalize_procedure();
 
 	void begin_global_data_section();
+
+	//! \brief Lay out the global variables that were defined in the .bss section, followed by the constant pool.
+	//! Variables are sorted by decreasing alignment then size, so that they are packed without padding, and by name
+	//! so that the layout does not depend on the order of definition.
 	void finalize_global_data_section();
 
 	void define_global_variable(const Variable& variable);
 
-	void load_variable(const Variable& variable);
+	//! \brief Symbol of a variable the code generator creates, e.g. a temporary, so that its label is built once.
+	Symbol intern_variable_name(string_view name);
+
+	//! \param last_use Whether the value of \p variable is not read again before being written to, which allows a
+	//! variable kept in a register to be modified in place.
+	void load_variable(const Variable& variable, bool last_use = false);
 	void load_i64(uint64_t value);
+	void load_f64(double value);
 	void load_pointer_to_variable(const Variable& variable);
-	void load_value_from_pointer(Type dereferenced_type);
+
+	//! \brief Pop a pointer and push the value at \p offset bytes from where it points, e.g. a field of a record.
+	void load_value_from_pointer(Type dereferenced_type, std::size_t offset = 0);
+
+	//! \brief Push the field at \p offset bytes from the start of the record variable \p record.
+	void load_field(const Variable& record, Type field_type, std::size_t offset);
+
+	//! \brief Swap the two values on top of the stack.
+	void swap_operands();
+
+	//! \brief Pop the value on top of the stack without using it, e.g. the result of a function called as a statement.
+	void discard_value();
 
 	void store_variable(const Variable& variable);
-	void store_value_to_pointer(Type value_type);
+
+	//! \brief Pop a pointer, then the value to write at \p offset bytes from where it points.
+	void store_value_to_pointer(Type value_type, std::size_t offset = 0);
+
+	//! \brief Pop a value and write it to the field at \p offset bytes from the start of the record variable \p record.
+	void store_field(const Variable& record, Type value_type, std::size_t offset);
+
+	//! \brief Pop a zero-based index and push the element of \p array it refers to.
+	//! \param stride Distance between the elements in bytes.
+	//! \param offset Bytes from the start of the element to the accessed field, for arrays of records.
+	void load_element(const Variable& array, Type element_type, std::size_t stride, std::size_t offset = 0);
+
+	//! \brief Pop a value, then the zero-based index of the element of \p array to write it to.
+	//! \param stride Distance between the elements in bytes.
+	//! \param offset Bytes from the start of the element to the accessed field, for arrays of records.
+	void store_element(const Variable& array, Type value_type, std::size_t stride, std::size_t offset = 0);
+
+	//! \brief Trap unless the index on top of the stack is lower than \p length, as an unsigned integer.
+	void check_bounds(std::uint64_t length);
+
+	//! \brief Pop the inputs of \p kernel, the bound and the first iteration of a FOR loop, run the kernel on as many
+	//! iterations as it can, and push the first iteration left.
+	//! Iterations run in groups of \p kernel.lanes times \p kernel.unroll, with packed SSE2 instructions, or AVX2 ones
+	//! if the kernel uses 4 lanes.
+	void vector_loop(const ir::VectorKernel& kernel);
 
 	void alu_and_bool();
 	void alu_or_bool();
@@ -85,56 +160,201 @@ class CodeGen
 	void alu_divide(Type type);
 	void alu_modulus(Type type);
 
-	void alu_equal(Type type);
-	void alu_not_equal(Type type);
-	void alu_greater_equal(Type type);
-	void alu_lower_equal(Type type);
-	void alu_greater(Type type);
-	void alu_lower(Type type);
+	//! \brief Compare the two topmost operands, leaving the result as a FLAGS operand.
+	void alu_compare(Type type, Condition condition);
 
 	void convert(Type source, Type destination);
 
-	void statement_if_prepare(IfStatement& statement);
-	void statement_if_post_check(IfStatement& statement);
-	void statement_if_with_else(IfStatement& statement);
-	void statement_if_without_else(IfStatement& statement);
-	void statement_if_finalize(IfStatement& statement);
+	//! \brief Emit the label of a basic block, which may only be entered with an empty operand stack.
+	void begin_block(string_view label);
 
-	void statement_while_prepare(WhileStatement& statement);
-	void statement_while_post_check(WhileStatement& statement);
-	void statement_while_finalize(WhileStatement& statement);
+	void jump(string_view label);
 
-	void statement_for_prepare(ForStatement& statement, const Variable& assignement_variable);
-	void statement_for_post_assignment(ForStatement& statement);
-	void statement_for_post_check(ForStatement& statement);
-	void statement_for_finalize(ForStatement& statement);
+	//! \brief Pop a boolean and jump to \p label if it is false, branching on the flags directly if possible.
+	void branch_if_false(string_view label);
 
-	void function_call_prepare(FunctionCall& call);
-	void function_call_param(FunctionCall& call, Type type);
-	void function_call_finalize(FunctionCall& call);
+	//! \brief Pop a boolean and jump to \p label if it is true, branching on the flags directly if possible.
+	void branch_if_true(string_view label);
+
+	//! \brief Call a function, whose parameters are the topmost operands, of types \p parameter_types.
+	void function_call(FunctionCall& call, const std::vector<Type>& parameter_types);
+
+	//! \brief Push a pointer of type \p pointer_type to a new block of \p size bytes from the runtime library.
+	void allocate(Type pointer_type, std::uint64_t size);
 
+	//! \brief Pop a pointer of type \p pointer_type and give the block of \p size bytes it points to back to the
+	//! runtime library.
+	void dispose(Type pointer_type, std::uint64_t size);
+
+	//! \brief Pop a value of type \p type and print it through the runtime library, which buffers the output.
 	void debug_display(Type type);
 
+	//! \brief Whether values of type \p type are passed in general purpose registers, e.g. INTEGER or pointers.
+	bool is_function_param_type_regular(Type type) const;
+
 	private:
-	void align_stack();
-	void unalign_stack();
+	//! \brief Pad the machine stack so that it is 16-byte aligned for a call.
+	//! \returns The padding, which has to be passed to unalign_stack after the call.
+	std::size_t align_stack();
+	void        unalign_stack(std::size_t padding);
+
+	void    push_operand(Operand operand);
+	Operand pop_operand();
+	void    release_operand(const Operand& operand);
+
+	//! \brief Find a free register among the allocatable SSE (if \p xmm is set) or general purpose registers.
+	//! Older operands are spilled to the machine stack if none are available.
+	Register allocate_register(bool xmm);
+
+	//! \brief Ensure \p operand is held in a register of the requested class that may be modified, loading it if
+	//! needed.
+	Register to_register(Operand& operand, bool xmm);
+
+	//! \brief Like to_register, but a register holding a variable is used as is, since it is only read.
+	Register to_readable_register(Operand& operand, bool xmm);
+
+	//! \brief Load \p operand into \p reg, without modifying the flags.
+	void load_operand(const Operand& operand, Register reg);
+
+	//! \brief Get the memory operand of type \p type at \p offset bytes from the start of \p variable, which is
+	//! either a global or in the stack frame.
+	Operand variable_memory(const Variable& variable, Type type, std::int64_t offset = 0) const;
+
+	//! \brief Label of the global \p variable, which was built by the symbol table of the compiler when its name was
+	//! interned.
+	const std::string& mangled_name(const Variable& variable) const;
+
+	//! \brief Size and alignment of the memory taken by a variable of type \p type.
+	struct MemoryLayout
+	{
+		std::size_t alignment, size;
+	};
+
+	MemoryLayout memory_layout(Type type) const;
+
+	//! \brief Get the memory location of the byte \p offset of the element of \p array at the index \p index, whose
+	//! elements are \p stride bytes apart. Variable indices are scaled from %rcx, which holds the address of the array,
+	//! through %rdx if the stride is not a valid scale factor, which clobbers the flags: the comparisons pending on
+	//! the operand stack are materialized first.
+	std::string element_location(const Variable& array, Operand& index, std::size_t stride, std::size_t offset = 0);
+
+	//! \brief Load the BOOLEAN or CHAR at \p source to \p reg, widening it like it is represented in registers.
+	void load_narrow(string_view source, Type type, Register reg);
+
+	//! \brief Write \p operand to the memory location \p destination, e.g. "var(%rip)" or "(%rax)".
+	//! \param size Access size in bytes, as given by value_size().
+	void store_operand(const Operand& operand, string_view destination, std::size_t size = 8);
+
+	void spill_operand(Operand& operand);
+
+	//! \brief Spill the operand at \p index and every operand below it to the machine stack.
+	void spill_operands_until(std::size_t index);
+	void spill_all_operands();
+
+	//! \brief Copy the operands reading the register variable \p reg to other registers, before it is written to.
+	void detach_register_variable(Register reg);
+
+	//! \brief Spill the operands below \p index whose value could be modified by a store to memory, or by a function
+	//! call if \p across_call is set.
+	void spill_clobbered_operands(std::size_t index, bool across_call);
+
+	void alu_binop_gpr(string_view instruction, bool commutative);
+	void alu_binop_xmm(string_view instruction, bool commutative);
+	void alu_binop_x87(string_view instruction);
+	void alu_divmod_gpr(Register result);
+
+	//! \brief Lower a multiplication by an immediate to shifts or lea, if the factor allows it.
+	//! \returns Whether code was generated.
+	bool alu_multiply_constant();
+
+	//! \brief Lower a division or modulus by an immediate to shifts, masks or a multiplication by a magic number.
+	//! \returns Whether code was generated.
+	bool alu_divmod_constant(bool modulus);
+
+	//! \brief Compute the fmod of the two topmost operands inline, using the x87 fprem instruction.
+	void alu_fmod_fprem();
 
-	void alu_load_binop(Type type);
-	void alu_store_f64();
+	bool uses_x87() const;
+	bool has_sse4_1() const;
+	bool has_fma() const;
 
-	void alu_compare(Type type, string_view instruction);
+	//! \brief Get the label of the read-only constant holding the bit pattern \p bits, adding it to the pool if needed.
+	std::string f64_constant_label(std::uint64_t bits);
+	void        emit_constant_pool();
+
+	//! \brief Move a pending FLAGS operand to a register, which must be done before modifying the flags.
+	void materialize_flags();
+
+	//! \brief Jump to \p label if the boolean \p condition equals \p value, branching on the flags directly if
+	//! possible.
+	void branch_on_condition(Operand& condition, bool value, string_view label);
+
+	void expect_empty_operand_stack(string_view context);
+
+	void function_call_prepare(FunctionCall& call);
+	void function_call_param(FunctionCall& call, Type type);
+	void function_call_finalize(FunctionCall& call);
+
+	//! \brief Generate inline code for a call to a well-known C math function, if the target allows it.
+	//! \returns Whether code was generated, in which case the parameters were replaced by the result.
+	bool function_call_intrinsic(const FunctionCall& call);
+
+	//! \brief Replace the topmost DOUBLE operand by the result of an SSE instruction taking it as its source.
+	void intrinsic_unary_xmm(string_view instruction, string_view immediate = "");
+	void intrinsic_min_max(string_view instruction);
 
 	void        function_call_label_param(FunctionCall& call, string_view label);
-	string_view function_call_register(FunctionCall& call, Type type);
+	Register    function_call_register(std::size_t index, Type type);
+	void        function_call_move_parameters(FunctionCall& call);
 	std::string function_mangle_name(string_view name) const;
 
-	bool is_function_param_type_regular(Type type) const;
+	//! \brief Get the symbol of the procedure \p name of the program, which cannot clash with C functions.
+	std::string procedure_symbol(string_view name) const;
+
 	bool is_function_param_type_float(Type type) const;
 
+	void emit(string_view opcode, std::vector<std::string> operands = {}, string_view comment = "");
+	void emit_label(string_view name);
+	void emit_directive(string_view text);
+
+	void print_peephole_report(const PeepholeStatistics& statistics) const;
+
 	[[noreturn]] void alu_unimplemented();
 
 	std::size_t m_label_tag = 0;
 
+	//! Bytes pushed to the machine stack since entering the current procedure, which is always known at compile time.
+	std::size_t m_stack_depth = 0;
+
+	//! Value of m_stack_depth for which %rsp equals %rbp, if the current procedure has a frame pointer.
+	std::size_t m_frame_pointer_depth = 0;
+	bool        m_has_frame_pointer   = false;
+
+	//! Compile-time operand stack, from the bottom to the top. Spilled operands always form a prefix.
+	std::vector<Operand>                           m_operands;
+	std::array<bool, std::size_t(Register::TOTAL)> m_register_used{};
+
+	//! Variables of the current procedure that are kept in registers, by name.
+	std::unordered_map<std::string, Register> m_register_variables;
+
+	//! Callee-saved registers pushed by the prologue of the current procedure, in order.
+	std::vector<Register> m_saved_registers;
+
+	//! Variables of the current procedure that are kept in its stack frame, and the displacement of each of them from
+	//! the frame pointer once laid out by begin_procedure.
+	std::vector<Variable>                         m_frame_variables;
+	std::unordered_map<std::string, std::int64_t> m_frame_displacements;
+
+	//! Global variables to lay out by finalize_global_data_section.
+	std::vector<Variable> m_global_variables;
+
+	//! Program being generated, written out by finalize_program.
+	std::vector<Instruction> m_instructions;
+
+	//! DOUBLE constants emitted to the read-only data section, indexed by label number.
+	std::vector<std::uint64_t>                     m_f64_constants;
+	std::unordered_map<std::uint64_t, std::size_t> m_f64_constant_indices;
+
 	FunctionCall m_current_function;
 
 	Compiler& m_compiler;
@@ -0,0 +1,60 @@
+#include "instruction.hpp"
+
+#include <fmt/core.h>
+#include <ostream>
+
+Instruction Instruction::instruction(string_view opcode, std::vector<std::string> operands, string_view comment)
+{
+	Instruction instruction;
+	instruction.kind     = Kind::INSTRUCTION;
+	instruction.opcode   = opcode;
+	instruction.operands = std::move(operands);
+	instruction.comment  = comment;
+	return instruction;
+}
+
+Instruction Instruction::label(string_view name)
+{
+	Instruction instruction;
+	instruction.kind   = Kind::LABEL;
+	instruction.opcode = name;
+	return instruction;
+}
+
+Instruction Instruction::directive(string_view text)
+{
+	Instruction instruction;
+	instruction.kind   = Kind::DIRECTIVE;
+	instruction.opcode = text;
+	return instruction;
+}
+
+bool Instruction::is_jump() const { return kind == Kind::INSTRUCTION && opcode.front() == 'j' && operands.size() == 1; }
+
+void Instruction::print(std::ostream& stream) const
+{
+	switch (kind)
+	{
+	case Kind::INSTRUCTION:
+	{
+		stream << '\t' << opcode;
+
+		for (std::size_t i = 0; i < operands.size(); ++i)
+		{
+			stream << (i == 0 ? " " : ", ") << operands[i];
+		}
+
+		break;
+	}
+
+	case Kind::LABEL: stream << opcode << ':'; break;
+	case Kind::DIRECTIVE: stream << opcode; break;
+	}
+
+	if (!comment.empty())
+	{
+		stream << " # " << comment;
+	}
+
+	stream << '\n';
+}
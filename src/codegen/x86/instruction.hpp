@@ -0,0 +1,49 @@
+#pragma once
+
+#include "util/string_view.hpp"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+//! \brief Line of assembly buffered by the code generator before being written out.
+struct Instruction
+{
+	enum class Kind
+	{
+		//! Machine instruction, e.g. "addq $1, %rax".
+		INSTRUCTION,
+
+		//! Label definition, e.g. "__next1:".
+		LABEL,
+
+		//! Assembler directive or data definition, kept as-is.
+		DIRECTIVE
+	};
+
+	Kind kind = Kind::INSTRUCTION;
+
+	//! Mnemonic for INSTRUCTION, name for LABEL and full text for DIRECTIVE.
+	std::string opcode;
+
+	//! AT&T operands of an INSTRUCTION, in source to destination order.
+	std::vector<std::string> operands;
+
+	std::string comment;
+
+	[[nodiscard]] static Instruction
+		instruction(string_view opcode, std::vector<std::string> operands = {}, string_view comment = "");
+	[[nodiscard]] static Instruction label(string_view name);
+	[[nodiscard]] static Instruction directive(string_view text);
+
+	[[nodiscard]] bool is(Kind other) const { return kind == other; }
+	[[nodiscard]] bool is(Kind other, string_view mnemonic) const { return kind == other && opcode == mnemonic; }
+
+	//! \brief Whether the instruction is a conditional or unconditional jump to a label.
+	[[nodiscard]] bool is_jump() const;
+
+	//! \brief Label referenced by a jump instruction.
+	[[nodiscard]] const std::string& jump_target() const { return operands.front(); }
+
+	void print(std::ostream& stream) const;
+};
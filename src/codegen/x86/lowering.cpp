@@ -0,0 +1,960 @@
+#include "lowering.hpp"
+
+#include "codegen/x86/codegen.hpp"
+#include "ir/loops.hpp"
+#include "variable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fmt/core.h>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+using ir::BlockId;
+using ir::Opcode;
+using ir::ValueId;
+
+//! Callee-saved registers that may hold temporaries and variables for a whole procedure, which calls preserve.
+static constexpr std::array<Register, 5> temporary_registers{{
+	Register::RBX,
+	Register::R12,
+	Register::R13,
+	Register::R14,
+	Register::R15,
+}};
+
+//! Caller-saved registers that may also be kept for a whole procedure if it calls no function, which saves pushing and
+//! popping callee-saved ones. They are the last ones handed out to operands.
+static constexpr std::array<Register, 2> leaf_registers{{Register::R10, Register::R11}};
+
+static Condition lower_comparison(ir::Comparison comparison)
+{
+	switch (comparison)
+	{
+	case ir::Comparison::EQUAL: return Condition::EQUAL;
+	case ir::Comparison::NOT_EQUAL: return Condition::NOT_EQUAL;
+	case ir::Comparison::LOWER: return Condition::BELOW;
+	case ir::Comparison::LOWER_EQUAL: return Condition::BELOW_EQUAL;
+	case ir::Comparison::GREATER: return Condition::ABOVE;
+	case ir::Comparison::GREATER_EQUAL: return Condition::ABOVE_EQUAL;
+	case ir::Comparison::SIGNED_LOWER: return Condition::LESS;
+	case ir::Comparison::SIGNED_LOWER_EQUAL: return Condition::LESS_EQUAL;
+	case ir::Comparison::SIGNED_GREATER: return Condition::GREATER;
+	case ir::Comparison::SIGNED_GREATER_EQUAL: return Condition::GREATER_EQUAL;
+	default: throw std::runtime_error("unknown comparison");
+	}
+}
+
+class FunctionLowering
+{
+	public:
+	FunctionLowering(const ir::Function& function, CodeGen& codegen, std::vector<Variable>& temporaries) :
+		m_function{function},
+		m_codegen{codegen},
+		m_temporaries{temporaries}
+	{
+	}
+
+	void operator()();
+
+	private:
+	//! \brief Count the uses of every value, and make the values that cannot live on the operand stack temporaries.
+	void analyze_uses();
+
+	//! \brief Find the variables of the function that are accessed, and the ones that have to stay in memory.
+	void analyze_variables();
+
+	//! \brief Keep the integral temporaries and variables of the function that are used the most, weighted by loop
+	//! depth, in registers. An incoming value of a phi shares the register of the phi when possible, which makes the
+	//! copy a no-op.
+	void assign_registers();
+
+	//! \brief Whether \p value may share its register with the phi \p phi of \p phi_block: their lifetimes must not
+	//! overlap, which means that the phi is never read after \p value is defined.
+	bool can_coalesce(ValueId value, const ir::Instruction& phi, BlockId phi_block) const;
+
+	//! \brief Whether \p value is kept in the same register as the result of \p instruction, which may then overwrite
+	//! it in place.
+	bool is_last_use(ValueId value, const ir::Instruction& instruction) const;
+
+	//! \brief Simulate the operand stack through \p block, generating its code if m_emit is set.
+	//! \returns false if a value was not found where expected, in which case it was made a temporary.
+	bool replay_block(BlockId block, BlockId next);
+
+	//! \brief Bring the operands of \p instruction on top of the operand stack, in order.
+	bool prepare_operands(const ir::Instruction& instruction);
+
+	void lower_instruction(const ir::Instruction& instruction);
+	void lower_terminator(const ir::Instruction& instruction, BlockId block, BlockId next);
+
+	//! \brief Copy the incoming values of the phis of \p successor when coming from \p block.
+	void emit_phi_copies(BlockId block, BlockId successor);
+
+	//! \brief Label to jump to for the edge from \p block to \p successor, which goes through an intermediate block
+	//! when phi copies are needed.
+	std::string edge_label(BlockId block, BlockId successor);
+
+	bool has_phis(BlockId block) const;
+
+	//! \brief Name the temporaries once they are all known. The ones of main live in global memory, so their names
+	//! are interned for their labels.
+	void create_temporaries();
+
+	std::string     block_label(BlockId block) const;
+	const Variable& temporary(ValueId value) const { return m_temporary_variables[value]; }
+	Type            value_type(ValueId value) const { return m_function.value_types[value]; }
+	bool            is_main() const { return m_function.name == "main"; }
+
+	const ir::Function&    m_function;
+	CodeGen&               m_codegen;
+	std::vector<Variable>& m_temporaries;
+
+	std::vector<BlockId>     m_order;
+	std::vector<std::size_t> m_use_counts;
+	std::vector<bool>        m_is_temporary;
+
+	//! Variables holding the temporaries, by value.
+	std::vector<Variable> m_temporary_variables;
+
+	//! Temporaries kept in registers rather than in memory.
+	std::map<ValueId, Register> m_registers;
+
+	//! Parameters and locals of the function that are accessed at all, and the ones that have to stay in memory
+	//! because they are not accessed as a whole, their address is taken, or a vectorized loop accesses them.
+	std::unordered_set<std::string> m_accessed_variables, m_memory_variables;
+
+	//! Parameters and locals kept in registers rather than in memory.
+	std::map<std::string, Register> m_variable_registers;
+
+	//! Whether the function calls no function at all, not even the runtime library.
+	bool m_is_leaf = true;
+
+	//! Simulated operand stack of the code generator, only tracking values that are not temporaries.
+	std::vector<ValueId> m_stack;
+
+	//! Whether code is generated while replaying blocks, rather than only checking where values are.
+	bool m_emit = false;
+
+	//! Edges whose phi copies are generated in an intermediate block, after the blocks of the function.
+	std::vector<std::pair<BlockId, BlockId>> m_split_edges;
+};
+
+void FunctionLowering::operator()()
+{
+	m_order = m_function.reverse_postorder();
+	analyze_uses();
+	analyze_variables();
+
+	const auto next_block = [&](std::size_t index) {
+		return index + 1 < m_order.size() ? m_order[index + 1] : ir::no_value;
+	};
+
+	// Every failed replay adds a temporary, so this terminates
+	for (bool replayed = false; !replayed;)
+	{
+		replayed = true;
+
+		for (std::size_t i = 0; i < m_order.size() && replayed; ++i)
+		{
+			replayed = replay_block(m_order[i], next_block(i));
+		}
+	}
+
+	assign_registers();
+	create_temporaries();
+
+	for (const auto& it : m_registers)
+	{
+		m_codegen.assign_register(temporary(it.first), it.second);
+	}
+
+	for (const auto& it : m_variable_registers)
+	{
+		m_codegen.assign_register(*m_function.find_local(it.first), it.second);
+	}
+
+	m_emit = true;
+
+	if (is_main())
+	{
+		m_codegen.begin_main_procedure();
+	}
+	else
+	{
+		// The temporaries and variables of procedures that are not in registers live in their stack frame, which
+		// recursive calls need
+		for (const std::vector<Variable>* variables : {&m_function.parameters, &m_function.locals})
+		{
+			for (const Variable& variable : *variables)
+			{
+				if (m_accessed_variables.count(variable.name) != 0 && m_variable_registers.count(variable.name) == 0)
+				{
+					m_codegen.assign_frame_slot(variable);
+				}
+			}
+		}
+
+		for (ValueId value = 0; value < m_function.value_types.size(); ++value)
+		{
+			if (m_is_temporary[value] && m_registers.count(value) == 0)
+			{
+				m_codegen.assign_frame_slot(temporary(value));
+			}
+		}
+
+		m_codegen.begin_procedure(m_function.name, m_function.parameters);
+	}
+
+	for (std::size_t i = 0; i < m_order.size(); ++i)
+	{
+		if (!replay_block(m_order[i], next_block(i)))
+		{
+			throw std::runtime_error("operand stack mismatch while lowering");
+		}
+	}
+
+	for (const auto& edge : m_split_edges)
+	{
+		m_codegen.begin_block(fmt::format("{}_to_bb{}", block_label(edge.first), edge.second));
+		emit_phi_copies(edge.first, edge.second);
+		m_codegen.jump(block_label(edge.second));
+	}
+
+	for (ValueId value = 0; value < m_function.value_types.size() && is_main(); ++value)
+	{
+		if (m_is_temporary[value] && m_registers.count(value) == 0)
+		{
+			m_temporaries.push_back(temporary(value));
+		}
+	}
+
+	// The locals of main come from inlined procedures, and live with its temporaries since main never recurses
+	for (const Variable& variable : m_function.locals)
+	{
+		if (is_main() && m_accessed_variables.count(variable.name) != 0
+			&& m_variable_registers.count(variable.name) == 0)
+		{
+			m_temporaries.push_back(variable);
+		}
+	}
+
+	m_codegen.finalize_procedure();
+}
+
+void FunctionLowering::analyze_uses()
+{
+	const std::size_t value_count = m_function.value_types.size();
+
+	std::vector<BlockId> definition_blocks(value_count, ir::no_value);
+	m_use_counts.assign(value_count, 0);
+	m_is_temporary.assign(value_count, false);
+
+	for (const BlockId block : m_order)
+	{
+		for (const ir::Instruction& instruction : m_function.blocks[block].instructions)
+		{
+			if (instruction.has_result())
+			{
+				definition_blocks[instruction.result] = block;
+				m_is_temporary[instruction.result]    = instruction.is(Opcode::PHI);
+			}
+		}
+	}
+
+	for (const BlockId block : m_order)
+	{
+		for (const ir::Instruction& instruction : m_function.blocks[block].instructions)
+		{
+			for (const ValueId operand : instruction.operands)
+			{
+				++m_use_counts[operand];
+
+				if (instruction.is(Opcode::PHI) || definition_blocks[operand] != block || m_use_counts[operand] > 1)
+				{
+					m_is_temporary[operand] = true;
+				}
+			}
+		}
+	}
+}
+
+void FunctionLowering::analyze_variables()
+{
+	for (const ir::BasicBlock& block : m_function.blocks)
+	{
+		for (const ir::Instruction& instruction : block.instructions)
+		{
+			switch (instruction.opcode)
+			{
+			case Opcode::LOAD_GLOBAL:
+			case Opcode::STORE_GLOBAL:
+			{
+				m_accessed_variables.insert(instruction.symbol);
+
+				if (instruction.field.is_set())
+				{
+					m_memory_variables.insert(instruction.symbol);
+				}
+
+				break;
+			}
+
+			case Opcode::GLOBAL_ADDRESS:
+			case Opcode::LOAD_ELEMENT:
+			case Opcode::STORE_ELEMENT:
+			{
+				m_accessed_variables.insert(instruction.symbol);
+				m_memory_variables.insert(instruction.symbol);
+				break;
+			}
+
+			case Opcode::VECTOR_LOOP:
+			{
+				for (const ir::Instruction& kernel_instruction : instruction.kernel->instructions)
+				{
+					if (!kernel_instruction.symbol.empty())
+					{
+						m_accessed_variables.insert(kernel_instruction.symbol);
+						m_memory_variables.insert(kernel_instruction.symbol);
+					}
+				}
+
+				for (const ir::VectorReduction& reduction : instruction.kernel->reductions)
+				{
+					m_accessed_variables.insert(reduction.variable);
+					m_memory_variables.insert(reduction.variable);
+				}
+
+				break;
+			}
+
+			case Opcode::CALL:
+			case Opcode::NEW:
+			case Opcode::DISPOSE:
+			case Opcode::DISPLAY: m_is_leaf = false; break;
+
+			default: break;
+			}
+		}
+	}
+}
+
+void FunctionLowering::assign_registers()
+{
+	const std::vector<std::size_t> depths = ir::loop_depths(m_function);
+
+	// Temporaries sharing a register, each represented by its first value
+	std::vector<ValueId>     group(m_function.value_types.size());
+	std::vector<std::size_t> weights(m_function.value_types.size(), 0);
+
+	for (ValueId value = 0; value < group.size(); ++value)
+	{
+		group[value] = value;
+	}
+
+	for (const BlockId block : m_order)
+	{
+		for (const ir::Instruction& instruction : m_function.blocks[block].instructions)
+		{
+			if (!instruction.is(Opcode::PHI))
+			{
+				continue;
+			}
+
+			for (std::size_t i = 0; i < instruction.operands.size(); ++i)
+			{
+				const ValueId operand = instruction.operands[i];
+
+				if (can_coalesce(operand, instruction, block) && group[operand] == operand)
+				{
+					group[operand] = instruction.result;
+				}
+			}
+		}
+	}
+
+	// Parameters and locals only accessed as a whole may be kept in registers too
+	std::map<std::string, std::size_t> variable_weights;
+
+	for (const std::vector<Variable>* variables : {&m_function.parameters, &m_function.locals})
+	{
+		for (const Variable& variable : *variables)
+		{
+			const bool accessed = m_accessed_variables.count(variable.name) != 0;
+			const bool memory   = m_memory_variables.count(variable.name) != 0;
+
+			if (accessed && !memory && m_codegen.is_function_param_type_regular(variable.type.type))
+			{
+				variable_weights[variable.name] = 0;
+			}
+		}
+	}
+
+	// Each definition and use counts for 8 times more per level of loop nesting
+	const auto depth_weight = [&](BlockId block) {
+		return std::size_t(1) << (3 * std::min<std::size_t>(depths[block], 6));
+	};
+
+	for (const BlockId block : m_order)
+	{
+		for (const ir::Instruction& instruction : m_function.blocks[block].instructions)
+		{
+			if (instruction.has_result())
+			{
+				weights[group[instruction.result]] += depth_weight(block);
+			}
+
+			for (const ValueId operand : instruction.operands)
+			{
+				weights[group[operand]] += depth_weight(block);
+			}
+
+			const auto it = variable_weights.find(instruction.symbol);
+
+			if ((instruction.is(Opcode::LOAD_GLOBAL) || instruction.is(Opcode::STORE_GLOBAL))
+				&& it != variable_weights.end())
+			{
+				it->second += depth_weight(block);
+			}
+		}
+	}
+
+	// Either a temporary or a variable
+	struct Candidate
+	{
+		std::size_t weight;
+		ValueId     value;
+		std::string variable;
+	};
+
+	std::vector<Candidate> candidates;
+
+	for (ValueId value = 0; value < group.size(); ++value)
+	{
+		const Type type = value_type(value);
+
+		// There are no callee-saved SSE registers
+		const bool integral = type == Type::UNSIGNED_INT || type == Type::BOOLEAN || type == Type::CHAR;
+
+		if (group[value] == value && m_is_temporary[value] && integral)
+		{
+			candidates.push_back({weights[value], value, ""});
+		}
+	}
+
+	for (const auto& it : variable_weights)
+	{
+		candidates.push_back({it.second, ir::no_value, it.first});
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end(), [&](const Candidate& a, const Candidate& b) {
+		return a.weight > b.weight;
+	});
+
+	std::vector<Register> registers;
+
+	if (m_is_leaf)
+	{
+		registers.insert(registers.end(), leaf_registers.begin(), leaf_registers.end());
+	}
+
+	registers.insert(registers.end(), temporary_registers.begin(), temporary_registers.end());
+	candidates.resize(std::min(candidates.size(), registers.size()));
+
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (candidates[i].value != ir::no_value)
+		{
+			m_registers[candidates[i].value] = registers[i];
+		}
+		else
+		{
+			m_variable_registers[candidates[i].variable] = registers[i];
+		}
+	}
+
+	for (ValueId value = 0; value < group.size(); ++value)
+	{
+		const auto it = m_registers.find(group[value]);
+
+		if (it != m_registers.end())
+		{
+			m_registers[value] = it->second;
+		}
+	}
+}
+
+bool FunctionLowering::can_coalesce(ValueId value, const ir::Instruction& phi, BlockId phi_block) const
+{
+	const auto    it           = std::find(phi.operands.begin(), phi.operands.end(), value);
+	const BlockId block        = phi.blocks[std::size_t(it - phi.operands.begin())];
+	const auto&   instructions = m_function.blocks[block].instructions;
+	const ValueId phi_value    = phi.result;
+
+	if (m_use_counts[value] != 1 || value_type(value) != value_type(phi_value)
+		|| !instructions.back().is(Opcode::JUMP))
+	{
+		return false;
+	}
+
+	// The value must be defined by a regular instruction of the predecessor, after which the phi is dead: the
+	// predecessor jumps to the block of the phi, which defines it again
+	const auto definition = std::find_if(instructions.begin(), instructions.end(), [&](const ir::Instruction& other) {
+		return other.result == value;
+	});
+
+	if (definition == instructions.end() || definition->is(Opcode::PHI))
+	{
+		return false;
+	}
+
+	for (auto other = std::next(definition); other != instructions.end(); ++other)
+	{
+		if (std::find(other->operands.begin(), other->operands.end(), phi_value) != other->operands.end())
+		{
+			return false;
+		}
+	}
+
+	// The other phis of the block read their incoming values at the end of the predecessor too
+	for (const ir::Instruction& other : m_function.blocks[phi_block].instructions)
+	{
+		if (!other.is(Opcode::PHI))
+		{
+			break;
+		}
+
+		for (std::size_t i = 0; i < other.operands.size(); ++i)
+		{
+			if (other.blocks[i] == block && other.operands[i] == phi_value)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FunctionLowering::is_last_use(ValueId value, const ir::Instruction& instruction) const
+{
+	if (!instruction.has_result() || std::count(instruction.operands.begin(), instruction.operands.end(), value) != 1)
+	{
+		return false;
+	}
+
+	const auto value_register  = m_registers.find(value);
+	const auto result_register = m_registers.find(instruction.result);
+
+	return value_register != m_registers.end() && result_register != m_registers.end()
+		&& value_register->second == result_register->second;
+}
+
+bool FunctionLowering::replay_block(BlockId block, BlockId next)
+{
+	m_stack.clear();
+
+	if (m_emit)
+	{
+		m_codegen.begin_block(block_label(block));
+	}
+
+	for (const ir::Instruction& instruction : m_function.blocks[block].instructions)
+	{
+		// Phi results are written by the predecessors
+		if (instruction.is(Opcode::PHI))
+		{
+			continue;
+		}
+
+		if (!prepare_operands(instruction))
+		{
+			return false;
+		}
+
+		if (ir::is_terminator(instruction.opcode))
+		{
+			// Every value pushed in the block must have been consumed by now
+			if (!m_stack.empty())
+			{
+				for (const ValueId value : m_stack)
+				{
+					m_is_temporary[value] = true;
+				}
+
+				return false;
+			}
+
+			if (m_emit)
+			{
+				lower_terminator(instruction, block, next);
+			}
+
+			continue;
+		}
+
+		if (m_emit)
+		{
+			lower_instruction(instruction);
+		}
+
+		if (!instruction.has_result())
+		{
+			continue;
+		}
+
+		if (m_is_temporary[instruction.result])
+		{
+			if (m_emit)
+			{
+				m_codegen.store_variable(temporary(instruction.result));
+			}
+		}
+		else if (m_use_counts[instruction.result] == 0)
+		{
+			if (m_emit)
+			{
+				m_codegen.discard_value();
+			}
+		}
+		else
+		{
+			m_stack.push_back(instruction.result);
+		}
+	}
+
+	return true;
+}
+
+bool FunctionLowering::prepare_operands(const ir::Instruction& instruction)
+{
+	const std::vector<ValueId>& operands = instruction.operands;
+
+	// Operands that live on the operand stack, which the code generator pops in order
+	std::vector<ValueId> stacked;
+	std::copy_if(operands.begin(), operands.end(), std::back_inserter(stacked), [&](ValueId value) {
+		return !m_is_temporary[value];
+	});
+
+	const auto fail = [&] {
+		for (const ValueId value : stacked)
+		{
+			m_is_temporary[value] = true;
+		}
+
+		return false;
+	};
+
+	if (stacked.size() > m_stack.size())
+	{
+		return fail();
+	}
+
+	const auto top         = m_stack.end() - stacked.size();
+	const bool in_order    = std::equal(stacked.begin(), stacked.end(), top);
+	const bool swapped     = stacked.size() == 2 && std::equal(stacked.rbegin(), stacked.rend(), top);
+	const bool prefix      = std::equal(stacked.begin(), stacked.end(), operands.begin());
+	const bool late_single = operands.size() == 2 && stacked.size() == 1 && operands[1] == stacked[0];
+
+	if ((!in_order && !swapped) || (!prefix && !late_single))
+	{
+		return fail();
+	}
+
+	m_stack.erase(top, m_stack.end());
+
+	if (!m_emit)
+	{
+		return true;
+	}
+
+	if (swapped && !in_order)
+	{
+		m_codegen.swap_operands();
+	}
+
+	for (std::size_t i = stacked.size(); i < operands.size(); ++i)
+	{
+		const ValueId operand = operands[late_single ? 0 : i];
+		m_codegen.load_variable(temporary(operand), is_last_use(operand, instruction));
+	}
+
+	if (late_single)
+	{
+		// The temporary was loaded above the value that was already on the stack
+		m_codegen.swap_operands();
+	}
+
+	return true;
+}
+
+void FunctionLowering::lower_instruction(const ir::Instruction& instruction)
+{
+	const Variable         variable{instruction.symbol, {instruction.type}, instruction.variable};
+	const ir::FieldAccess& field = instruction.field;
+
+	// Elements of an array of records are as large as the record, whatever field is accessed
+	const std::size_t stride = field.is_set() ? field.record_size : value_size(instruction.type);
+
+	switch (instruction.opcode)
+	{
+	case Opcode::CONSTANT:
+	{
+		if (instruction.type == Type::DOUBLE)
+		{
+			double value;
+			std::memcpy(&value, &instruction.constant, sizeof(value));
+			m_codegen.load_f64(value);
+		}
+		else
+		{
+			m_codegen.load_i64(instruction.constant);
+		}
+
+		break;
+	}
+
+	case Opcode::LOAD_GLOBAL:
+	{
+		if (field.is_set())
+		{
+			m_codegen.load_field(variable, instruction.type, field.offset);
+		}
+		else
+		{
+			m_codegen.load_variable(variable);
+		}
+
+		break;
+	}
+
+	case Opcode::STORE_GLOBAL:
+	{
+		if (field.is_set())
+		{
+			m_codegen.store_field(variable, instruction.type, field.offset);
+		}
+		else
+		{
+			m_codegen.store_variable(variable);
+		}
+
+		break;
+	}
+
+	case Opcode::GLOBAL_ADDRESS: m_codegen.load_pointer_to_variable(variable); break;
+	case Opcode::LOAD: m_codegen.load_value_from_pointer(instruction.type, field.offset); break;
+	case Opcode::STORE: m_codegen.store_value_to_pointer(instruction.type, field.offset); break;
+	case Opcode::LOAD_ELEMENT: m_codegen.load_element(variable, instruction.type, stride, field.offset); break;
+	case Opcode::STORE_ELEMENT: m_codegen.store_element(variable, instruction.type, stride, field.offset); break;
+	case Opcode::CHECK_BOUNDS: m_codegen.check_bounds(instruction.constant); break;
+	case Opcode::VECTOR_LOOP: m_codegen.vector_loop(*instruction.kernel); break;
+	case Opcode::NOT: m_codegen.alu_not_bool(); break;
+	case Opcode::AND: m_codegen.alu_and_bool(); break;
+	case Opcode::OR: m_codegen.alu_or_bool(); break;
+	case Opcode::ADD: m_codegen.alu_add(instruction.type); break;
+	case Opcode::SUB: m_codegen.alu_sub(instruction.type); break;
+	case Opcode::MUL: m_codegen.alu_multiply(instruction.type); break;
+	case Opcode::DIV: m_codegen.alu_divide(instruction.type); break;
+	case Opcode::MOD: m_codegen.alu_modulus(instruction.type); break;
+
+	case Opcode::COMPARE:
+	{
+		m_codegen.alu_compare(value_type(instruction.operands[0]), lower_comparison(instruction.comparison));
+		break;
+	}
+
+	case Opcode::CONVERT: m_codegen.convert(value_type(instruction.operands[0]), instruction.type); break;
+
+	case Opcode::CALL:
+	{
+		FunctionCall call;
+		call.function_name = instruction.symbol;
+		call.return_type   = instruction.type;
+		call.variadic      = instruction.variadic;
+		call.foreign       = instruction.foreign;
+
+		std::vector<Type> parameter_types;
+
+		for (const ValueId operand : instruction.operands)
+		{
+			parameter_types.push_back(value_type(operand));
+		}
+
+		m_codegen.function_call(call, parameter_types);
+		break;
+	}
+
+	case Opcode::NEW: m_codegen.allocate(instruction.type, instruction.constant); break;
+	case Opcode::DISPOSE: m_codegen.dispose(value_type(instruction.operands[0]), instruction.constant); break;
+	case Opcode::DISPLAY: m_codegen.debug_display(value_type(instruction.operands[0])); break;
+
+	default: throw std::runtime_error(fmt::format("cannot lower '{}'", ir::opcode_name(instruction.opcode).str()));
+	}
+}
+
+void FunctionLowering::lower_terminator(const ir::Instruction& instruction, BlockId block, BlockId next)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::JUMP:
+	{
+		const BlockId target = instruction.blocks[0];
+		emit_phi_copies(block, target);
+
+		if (target != next)
+		{
+			m_codegen.jump(block_label(target));
+		}
+
+		break;
+	}
+
+	case Opcode::BRANCH:
+	{
+		const BlockId if_true  = instruction.blocks[0];
+		const BlockId if_false = instruction.blocks[1];
+
+		// Fall through to the next block when possible
+		if (if_true == next && !has_phis(if_true))
+		{
+			m_codegen.branch_if_false(edge_label(block, if_false));
+		}
+		else if (if_false == next && !has_phis(if_false))
+		{
+			m_codegen.branch_if_true(edge_label(block, if_true));
+		}
+		else
+		{
+			m_codegen.branch_if_false(edge_label(block, if_false));
+			m_codegen.jump(edge_label(block, if_true));
+		}
+
+		break;
+	}
+
+	case Opcode::RETURN:
+	{
+		if (is_main())
+		{
+			m_codegen.return_from_main_procedure();
+		}
+		else
+		{
+			m_codegen.return_from_procedure(m_function.return_type);
+		}
+
+		break;
+	}
+
+	default: throw std::runtime_error("unknown terminator");
+	}
+}
+
+void FunctionLowering::emit_phi_copies(BlockId block, BlockId successor)
+{
+	std::vector<ValueId> destinations;
+
+	// Phis read their incoming values all at once, so load them all before writing any
+	for (const ir::Instruction& instruction : m_function.blocks[successor].instructions)
+	{
+		if (!instruction.is(Opcode::PHI))
+		{
+			break;
+		}
+
+		const auto it = std::find(instruction.blocks.begin(), instruction.blocks.end(), block);
+		m_codegen.load_variable(temporary(instruction.operands[it - instruction.blocks.begin()]));
+		destinations.push_back(instruction.result);
+	}
+
+	for (auto it = destinations.rbegin(); it != destinations.rend(); ++it)
+	{
+		m_codegen.store_variable(temporary(*it));
+	}
+}
+
+std::string FunctionLowering::edge_label(BlockId block, BlockId successor)
+{
+	if (!has_phis(successor))
+	{
+		return block_label(successor);
+	}
+
+	const auto edge = std::make_pair(block, successor);
+
+	if (std::find(m_split_edges.begin(), m_split_edges.end(), edge) == m_split_edges.end())
+	{
+		m_split_edges.push_back(edge);
+	}
+
+	return fmt::format("{}_to_bb{}", block_label(block), successor);
+}
+
+bool FunctionLowering::has_phis(BlockId block) const
+{
+	const auto& instructions = m_function.blocks[block].instructions;
+	return !instructions.empty() && instructions.front().is(Opcode::PHI);
+}
+
+std::string FunctionLowering::block_label(BlockId block) const
+{
+	return fmt::format("__{}_bb{}", m_function.name, block);
+}
+
+void FunctionLowering::create_temporaries()
+{
+	m_temporary_variables.resize(m_function.value_types.size());
+
+	for (ValueId value = 0; value < m_function.value_types.size(); ++value)
+	{
+		if (!m_is_temporary[value])
+		{
+			continue;
+		}
+
+		Variable& variable = m_temporary_variables[value];
+		variable.name      = fmt::format(".{}.tmp{}", m_function.name, value);
+		variable.type      = {value_type(value)};
+
+		if (is_main() && m_registers.count(value) == 0)
+		{
+			variable.symbol = m_codegen.intern_variable_name(variable.name);
+		}
+	}
+}
+
+void lower_program(const ir::Program& program, CodeGen& codegen)
+{
+	std::vector<Variable> temporaries;
+
+	codegen.begin_program();
+	codegen.begin_executable_section();
+
+	for (const ir::Function& function : program.functions)
+	{
+		FunctionLowering{function, codegen, temporaries}();
+	}
+
+	codegen.finalize_executable_section();
+
+	codegen.begin_global_data_section();
+
+	for (const Variable& variable : program.globals)
+	{
+		codegen.define_global_variable(variable);
+	}
+
+	for (const Variable& variable : temporaries)
+	{
+		codegen.define_global_variable(variable);
+	}
+
+	codegen.finalize_global_data_section();
+	codegen.finalize_program();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ir/ir.hpp"
+
+class CodeGen;
+
+//! \brief Generate the whole assembly of \p program through \p codegen.
+//!
+//! \details
+//!		Instructions are replayed onto the operand stack of the code generator in order. A value stays on the operand
+//!		stack from its definition to its use when it has a single use in the same block and is found on top of the
+//!		stack by then, which is the case of every expression as written in the source. Other values (e.g. used by
+//!		several instructions or across blocks) are written to a temporary variable instead. The integral temporaries
+//!		used the most, such as the variables of FOR loops, are kept in callee-saved registers rather than in memory,
+//!		along with the most used parameters and locals of procedures. Procedures that call nothing also use the
+//!		caller-saved registers that no parameter is passed in.
+void lower_program(const ir::Program& program, CodeGen& codegen);
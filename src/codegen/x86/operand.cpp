@@ -0,0 +1,272 @@
+#include "operand.hpp"
+
+#include "util/enums.hpp"
+
+#include <array>
+#include <fmt/core.h>
+#include <stdexcept>
+#include <string>
+
+static constexpr std::array<std::array<string_view, 3>, 16> gpr_names{{
+	{{"%rax", "%eax", "%al"}},
+	{{"%rbx", "%ebx", "%bl"}},
+	{{"%rcx", "%ecx", "%cl"}},
+	{{"%rdx", "%edx", "%dl"}},
+	{{"%rsi", "%esi", "%sil"}},
+	{{"%rdi", "%edi", "%dil"}},
+	{{"%rbp", "%ebp", "%bpl"}},
+	{{"%rsp", "%esp", "%spl"}},
+	{{"%r8", "%r8d", "%r8b"}},
+	{{"%r9", "%r9d", "%r9b"}},
+	{{"%r10", "%r10d", "%r10b"}},
+	{{"%r11", "%r11d", "%r11b"}},
+	{{"%r12", "%r12d", "%r12b"}},
+	{{"%r13", "%r13d", "%r13b"}},
+	{{"%r14", "%r14d", "%r14b"}},
+	{{"%r15", "%r15d", "%r15b"}},
+}};
+
+static constexpr std::array<string_view, 16> xmm_names{{
+	"%xmm0",
+	"%xmm1",
+	"%xmm2",
+	"%xmm3",
+	"%xmm4",
+	"%xmm5",
+	"%xmm6",
+	"%xmm7",
+	"%xmm8",
+	"%xmm9",
+	"%xmm10",
+	"%xmm11",
+	"%xmm12",
+	"%xmm13",
+	"%xmm14",
+	"%xmm15",
+}};
+
+static_assert(
+	std::size_t(Register::TOTAL) == gpr_names.size() + xmm_names.size(),
+	"Please update register names when modifying the enum");
+
+string_view register_name(Register reg, std::size_t size)
+{
+	if (is_register_xmm(reg))
+	{
+		return xmm_names[underlying_cast(reg) - underlying_cast(Register::FIRST_XMM)];
+	}
+
+	const auto& names = gpr_names[underlying_cast(reg)];
+
+	switch (size)
+	{
+	case 8: return names[0];
+	case 4: return names[1];
+	case 1: return names[2];
+	default: throw std::runtime_error("unsupported register access size");
+	}
+}
+
+string_view condition_suffix(Condition condition)
+{
+	switch (condition)
+	{
+	case Condition::EQUAL: return "e";
+	case Condition::NOT_EQUAL: return "ne";
+	case Condition::ABOVE: return "a";
+	case Condition::ABOVE_EQUAL: return "ae";
+	case Condition::BELOW: return "b";
+	case Condition::BELOW_EQUAL: return "be";
+	case Condition::LESS: return "l";
+	case Condition::LESS_EQUAL: return "le";
+	case Condition::GREATER: return "g";
+	case Condition::GREATER_EQUAL: return "ge";
+	default: throw std::runtime_error("unknown condition");
+	}
+}
+
+Condition swap_condition(Condition condition)
+{
+	switch (condition)
+	{
+	case Condition::ABOVE: return Condition::BELOW;
+	case Condition::ABOVE_EQUAL: return Condition::BELOW_EQUAL;
+	case Condition::BELOW: return Condition::ABOVE;
+	case Condition::BELOW_EQUAL: return Condition::ABOVE_EQUAL;
+	case Condition::LESS: return Condition::GREATER;
+	case Condition::LESS_EQUAL: return Condition::GREATER_EQUAL;
+	case Condition::GREATER: return Condition::LESS;
+	case Condition::GREATER_EQUAL: return Condition::LESS_EQUAL;
+	default: return condition;
+	}
+}
+
+Condition negate_condition(Condition condition)
+{
+	switch (condition)
+	{
+	case Condition::EQUAL: return Condition::NOT_EQUAL;
+	case Condition::NOT_EQUAL: return Condition::EQUAL;
+	case Condition::ABOVE: return Condition::BELOW_EQUAL;
+	case Condition::ABOVE_EQUAL: return Condition::BELOW;
+	case Condition::BELOW: return Condition::ABOVE_EQUAL;
+	case Condition::BELOW_EQUAL: return Condition::ABOVE;
+	case Condition::LESS: return Condition::GREATER_EQUAL;
+	case Condition::LESS_EQUAL: return Condition::GREATER;
+	case Condition::GREATER: return Condition::LESS_EQUAL;
+	case Condition::GREATER_EQUAL: return Condition::LESS;
+	default: throw std::runtime_error("unknown condition");
+	}
+}
+
+bool is_register_xmm(Register reg) { return check_enum_range(reg, Register::FIRST_XMM, Register::LAST_XMM); }
+
+bool is_register_callee_saved(Register reg)
+{
+	switch (reg)
+	{
+	case Register::RBX:
+	case Register::RBP:
+	case Register::R12:
+	case Register::R13:
+	case Register::R14:
+	case Register::R15: return true;
+	default: return false;
+	}
+}
+
+bool fits_imm32(std::uint64_t value)
+{
+	const auto signed_value = static_cast<std::int64_t>(value);
+	return signed_value >= INT32_MIN && signed_value <= INT32_MAX;
+}
+
+std::size_t value_size(Type type)
+{
+	switch (type)
+	{
+	case Type::BOOLEAN:
+	case Type::CHAR: return 1;
+	default: return 8;
+	}
+}
+
+Operand Operand::immediate(std::uint64_t value, Type type)
+{
+	Operand operand;
+	operand.kind  = Kind::IMMEDIATE;
+	operand.value = value;
+	operand.type  = type;
+	return operand;
+}
+
+Operand Operand::memory(string_view label, Type type, bool read_only)
+{
+	Operand operand;
+	operand.kind      = Kind::MEMORY;
+	operand.label     = label;
+	operand.type      = type;
+	operand.read_only = read_only;
+	operand.size      = value_size(type);
+	return operand;
+}
+
+Operand Operand::frame_memory(std::int64_t displacement, Type type)
+{
+	Operand operand = memory(std::to_string(displacement), type);
+	operand.frame   = true;
+	return operand;
+}
+
+Operand Operand::address(string_view label, Type type)
+{
+	Operand operand;
+	operand.kind  = Kind::ADDRESS;
+	operand.label = label;
+	operand.type  = type;
+	return operand;
+}
+
+Operand Operand::in_register(Register reg, Type type)
+{
+	Operand operand;
+	operand.kind = Kind::REGISTER;
+	operand.reg  = reg;
+	operand.type = type;
+	return operand;
+}
+
+Operand Operand::register_variable(Register reg, Type type)
+{
+	Operand operand = in_register(reg, type);
+	operand.pinned  = true;
+	return operand;
+}
+
+Operand Operand::stack(Type type)
+{
+	Operand operand;
+	operand.kind = Kind::STACK;
+	operand.type = type;
+	return operand;
+}
+
+Operand Operand::flags(Condition condition)
+{
+	Operand operand;
+	operand.kind      = Kind::FLAGS;
+	operand.condition = condition;
+	operand.type      = Type::BOOLEAN;
+	return operand;
+}
+
+bool Operand::is_direct_source() const
+{
+	switch (kind)
+	{
+	case Kind::IMMEDIATE: return fits_imm32(value);
+	case Kind::MEMORY: return size == 8;
+	case Kind::REGISTER: return true;
+	default: return false;
+	}
+}
+
+std::string Operand::str() const
+{
+	switch (kind)
+	{
+	case Kind::IMMEDIATE:
+	{
+		// Sign-extended immediates are written in decimal, which makes e.g. "$-1" more readable
+		return fits_imm32(value) ? fmt::format("${}", static_cast<std::int64_t>(value))
+								 : fmt::format("$0x{:016x}", value);
+	}
+
+	case Kind::MEMORY: return location();
+	case Kind::REGISTER: return register_name(reg);
+	default: throw std::runtime_error("operand kind cannot be used as an instruction operand");
+	}
+}
+
+Operand Operand::dereference(Type type, std::size_t offset) const
+{
+	if (kind != Kind::ADDRESS)
+	{
+		throw std::runtime_error("only ADDRESS operands can be dereferenced at compile time");
+	}
+
+	// Displacements from the frame pointer are numbers, which the assembler adds up like symbols
+	Operand operand = memory(offset == 0 ? label : fmt::format("{}+{}", label, offset), type);
+	operand.frame   = frame;
+	return operand;
+}
+
+std::string Operand::location() const
+{
+	if (kind != Kind::MEMORY && kind != Kind::ADDRESS)
+	{
+		throw std::runtime_error("operand kind does not refer to memory");
+	}
+
+	return fmt::format("{}({})", label, frame ? "%rbp" : "%rip");
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "types.hpp"
+#include "util/string_view.hpp"
+
+#include <cstdint>
+#include <string>
+
+enum class Register
+{
+	// General purpose registers
+	RAX,
+	RBX,
+	RCX,
+	RDX,
+	RSI,
+	RDI,
+	RBP,
+	RSP,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15,
+
+	// SSE registers
+	FIRST_XMM,
+	XMM0 = FIRST_XMM,
+	XMM1,
+	XMM2,
+	XMM3,
+	XMM4,
+	XMM5,
+	XMM6,
+	XMM7,
+	XMM8,
+	XMM9,
+	XMM10,
+	XMM11,
+	XMM12,
+	XMM13,
+	XMM14,
+	XMM15,
+	LAST_XMM = XMM15,
+
+	TOTAL
+};
+
+//! \brief Get the AT&T name of \p reg, e.g. "%rax".
+//! \param size Access size in bytes (1, 4 or 8) for general purpose registers, ignored for SSE registers.
+string_view register_name(Register reg, std::size_t size = 8);
+
+[[nodiscard]] bool is_register_xmm(Register reg);
+
+//! \brief Whether procedures have to preserve \p reg for their caller: %rbx, %rbp and %r12-%r15.
+[[nodiscard]] bool is_register_callee_saved(Register reg);
+
+//! \brief Condition of a comparison, as evaluated by a conditional jump after a cmp or ucomisd instruction.
+//! Conditions are unsigned unless stated otherwise, which matches both the INTEGER type and the flags set by ucomisd.
+enum class Condition
+{
+	EQUAL,
+	NOT_EQUAL,
+	ABOVE,
+	ABOVE_EQUAL,
+	BELOW,
+	BELOW_EQUAL,
+
+	// Signed, only valid after an integer comparison
+	LESS,
+	LESS_EQUAL,
+	GREATER,
+	GREATER_EQUAL
+};
+
+//! \brief Get the suffix for \p condition of conditional instructions, e.g. "ae" for jae/setae.
+string_view condition_suffix(Condition condition);
+
+//! \brief Get the condition to use if the operands of the comparison are swapped, e.g. ABOVE for BELOW.
+[[nodiscard]] Condition swap_condition(Condition condition);
+
+//! \brief Get the condition that holds exactly when \p condition does not, e.g. ABOVE_EQUAL for BELOW.
+[[nodiscard]] Condition negate_condition(Condition condition);
+
+//! \brief Check whether \p value can be encoded as a sign-extended 32-bit immediate.
+[[nodiscard]] bool fits_imm32(std::uint64_t value);
+
+//! \brief Size in bytes of a value of type \p type in memory: 1 for BOOLEAN and CHAR, 8 otherwise.
+//! Values are always widened to 64 bits once loaded to a register.
+[[nodiscard]] std::size_t value_size(Type type);
+
+//! \brief Location of a value that lives on the compile-time operand stack of the code generator.
+struct Operand
+{
+	enum class Kind
+	{
+		//! Constant value that was not materialized yet.
+		IMMEDIATE,
+
+		//! Value stored at a RIP-relative label, e.g. a global variable or a pooled constant, or in the stack frame.
+		MEMORY,
+
+		//! Address of a RIP-relative label, e.g. a pointer to a global variable, or of a slot of the stack frame.
+		ADDRESS,
+
+		//! Value held in a register.
+		REGISTER,
+
+		//! Value that was spilled to the machine stack.
+		STACK,
+
+		//! Boolean held by the CPU flags, as set by the last comparison. There is at most one such operand, and it is
+		//! only materialized to a register if it is not directly consumed by a conditional branch.
+		FLAGS
+	};
+
+	Kind kind = Kind::IMMEDIATE;
+	Type type = Type::VOID;
+
+	//! Value for IMMEDIATE operands.
+	std::uint64_t value = 0;
+
+	//! Label for MEMORY and ADDRESS operands.
+	std::string label;
+
+	//! Whether the label of a MEMORY or ADDRESS operand is a displacement from the frame pointer %rbp, e.g. "-8" for
+	//! a local variable of a procedure, rather than a RIP-relative symbol.
+	bool frame = false;
+
+	//! Whether the memory referred to by a MEMORY operand may never be written to, e.g. the constant pool.
+	bool read_only = false;
+
+	//! Access size in bytes for MEMORY operands, as given by value_size().
+	std::size_t size = 8;
+
+	//! Register for REGISTER operands.
+	Register reg = Register::RAX;
+
+	//! Whether the register of a REGISTER operand holds a variable: it must be copied before being modified, and is
+	//! never freed.
+	bool pinned = false;
+
+	//! Condition for FLAGS operands.
+	Condition condition = Condition::EQUAL;
+
+	[[nodiscard]] static Operand immediate(std::uint64_t value, Type type);
+	[[nodiscard]] static Operand memory(string_view label, Type type, bool read_only = false);
+	[[nodiscard]] static Operand frame_memory(std::int64_t displacement, Type type);
+	[[nodiscard]] static Operand address(string_view label, Type type);
+	[[nodiscard]] static Operand in_register(Register reg, Type type);
+	[[nodiscard]] static Operand register_variable(Register reg, Type type);
+	[[nodiscard]] static Operand stack(Type type);
+	[[nodiscard]] static Operand flags(Condition condition);
+
+	[[nodiscard]] bool is(Kind other) const { return kind == other; }
+
+	//! \brief Whether the operand may be used as a source operand for most instructions, e.g. "$1" or "%rax".
+	//! Immediates only qualify if they can be encoded as a sign-extended 32-bit immediate, and memory only if it is
+	//! 64-bit wide.
+	[[nodiscard]] bool is_direct_source() const;
+
+	//! \brief Whether the operand is a MEMORY operand that 64-bit instructions can access directly, e.g. "x(%rip)".
+	//! Narrower memory has to be widened to a register first.
+	[[nodiscard]] bool is_memory64() const { return kind == Kind::MEMORY && size == 8; }
+
+	//! \brief Get the MEMORY operand of type \p type at \p offset bytes from where an ADDRESS operand points.
+	[[nodiscard]] Operand dereference(Type type, std::size_t offset = 0) const;
+
+	//! \brief AT&T syntax for the memory a MEMORY or ADDRESS operand refers to, e.g. "x(%rip)" or "-8(%rbp)".
+	[[nodiscard]] std::string location() const;
+
+	//! \brief AT&T syntax for the operand. Only valid for IMMEDIATE, MEMORY and REGISTER operands.
+	[[nodiscard]] std::string str() const;
+};
@@ -0,0 +1,238 @@
+#include "peephole.hpp"
+
+#include "util/enums.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static bool is_register(const std::string& operand) { return !operand.empty() && operand.front() == '%'; }
+static bool is_memory(const std::string& operand) { return operand.find('(') != std::string::npos; }
+
+static bool mentions_rax(const std::string& operand)
+{
+	for (const char* name : {"%rax", "%eax", "%ax", "%al", "%ah"})
+	{
+		if (operand.find(name) != std::string::npos)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//! \brief Check whether the value of %rax is overwritten before being read when starting execution at \p index.
+//! Conservative: control flow is not followed.
+static bool is_rax_dead_from(const std::vector<Instruction>& instructions, std::size_t index)
+{
+	for (std::size_t i = index; i < instructions.size(); ++i)
+	{
+		const Instruction& instruction = instructions[i];
+
+		if (!instruction.is(Instruction::Kind::INSTRUCTION) || instruction.is_jump() || instruction.opcode == "ret")
+		{
+			return false;
+		}
+
+		// %rax is caller-saved. Variadic calls read %al, but only after it was set separately.
+		if (instruction.opcode == "call")
+		{
+			return true;
+		}
+
+		// Instructions reading %rax implicitly
+		for (const char* opcode : {"divq", "idivq", "mulq", "cqto", "cltq"})
+		{
+			if (instruction.opcode == opcode)
+			{
+				return false;
+			}
+		}
+
+		const auto& operands = instruction.operands;
+
+		if (operands.empty())
+		{
+			continue;
+		}
+
+		const bool is_full_write = (instruction.opcode == "movq" || instruction.opcode == "movabsq"
+									|| instruction.opcode == "leaq" || instruction.opcode == "movl"
+									|| instruction.opcode == "movzbl" || instruction.opcode == "movsbq")
+			&& (operands.back() == "%rax" || operands.back() == "%eax");
+
+		const bool reads_rax = std::any_of(operands.begin(), operands.end() - (is_full_write ? 1 : 0), mentions_rax);
+
+		if (reads_rax)
+		{
+			return false;
+		}
+
+		const bool is_zeroing = instruction.opcode == "xorl" && operands[0] == "%eax" && operands[1] == "%eax";
+
+		if (is_full_write || is_zeroing)
+		{
+			return true;
+		}
+
+		// Partial writes such as "movb $1, %al" neither read nor kill %rax
+	}
+
+	return true;
+}
+
+//! \brief Check whether the flags set by \p instruction are the same as the ones "test %r, %r" would set on its
+//! destination register, as far as they are consumed by \p consumer.
+static bool sets_flags_like_test(const Instruction& instruction, const Instruction& consumer)
+{
+	const std::string& opcode = instruction.opcode;
+
+	// Logical operations set ZF/SF from the result and clear CF/OF, exactly like test
+	if (opcode == "andq" || opcode == "orq" || opcode == "xorq")
+	{
+		return true;
+	}
+
+	// Arithmetic operations set ZF/SF from the result, but CF/OF differ
+	if (opcode == "addq" || opcode == "subq")
+	{
+		const std::string& jump = consumer.opcode;
+		return consumer.is_jump()
+			&& (jump == "je" || jump == "jz" || jump == "jne" || jump == "jnz" || jump == "js" || jump == "jns");
+	}
+
+	return false;
+}
+
+static bool rule_push_pop_pair(std::vector<Instruction>& instructions, std::size_t i, PeepholeStatistics& statistics)
+{
+	const Instruction& push = instructions[i];
+	const Instruction& pop  = instructions[i + 1];
+
+	if (!push.is(Instruction::Kind::INSTRUCTION, "pushq") || !pop.is(Instruction::Kind::INSTRUCTION, "popq"))
+	{
+		return false;
+	}
+
+	const std::string& source      = push.operands[0];
+	const std::string& destination = pop.operands[0];
+
+	if (source == destination && is_register(source))
+	{
+		instructions.erase(instructions.begin() + i, instructions.begin() + i + 2);
+		statistics.removed_instructions[underlying_cast(PeepholeRule::PUSH_POP_PAIR)] += 2;
+		return true;
+	}
+
+	if (!is_register(destination) || (is_memory(source) && is_memory(destination)))
+	{
+		return false;
+	}
+
+	instructions[i] = Instruction::instruction("movq", {source, destination});
+	instructions.erase(instructions.begin() + i + 1);
+	++statistics.removed_instructions[underlying_cast(PeepholeRule::PUSH_POP_PAIR)];
+	return true;
+}
+
+static bool rule_redundant_test(std::vector<Instruction>& instructions, std::size_t i, PeepholeStatistics& statistics)
+{
+	if (i + 2 >= instructions.size())
+	{
+		return false;
+	}
+
+	const Instruction& producer = instructions[i];
+	const Instruction& test     = instructions[i + 1];
+	const Instruction& consumer = instructions[i + 2];
+
+	if (!producer.is(Instruction::Kind::INSTRUCTION) || producer.operands.size() != 2
+		|| !test.is(Instruction::Kind::INSTRUCTION, "test") || test.operands[0] != test.operands[1]
+		|| test.operands[0] != producer.operands[1] || !sets_flags_like_test(producer, consumer))
+	{
+		return false;
+	}
+
+	instructions.erase(instructions.begin() + i + 1);
+	++statistics.removed_instructions[underlying_cast(PeepholeRule::REDUNDANT_TEST)];
+	return true;
+}
+
+static bool rule_push_immediate(std::vector<Instruction>& instructions, std::size_t i, PeepholeStatistics& statistics)
+{
+	const Instruction& move = instructions[i];
+	const Instruction& push = instructions[i + 1];
+
+	// Only immediates written as "movq $imm" fit in a sign-extended 32-bit immediate, movabsq is used otherwise
+	if (!move.is(Instruction::Kind::INSTRUCTION, "movq") || move.operands[0].front() != '$'
+		|| move.operands[1] != "%rax" || !push.is(Instruction::Kind::INSTRUCTION, "pushq")
+		|| push.operands[0] != "%rax" || !is_rax_dead_from(instructions, i + 2))
+	{
+		return false;
+	}
+
+	instructions[i] = Instruction::instruction("pushq", {move.operands[0]});
+	instructions.erase(instructions.begin() + i + 1);
+	++statistics.removed_instructions[underlying_cast(PeepholeRule::PUSH_IMMEDIATE)];
+	return true;
+}
+
+static bool rule_jump_to_next(std::vector<Instruction>& instructions, std::size_t i, PeepholeStatistics& statistics)
+{
+	const Instruction& jump = instructions[i];
+
+	if (!jump.is_jump())
+	{
+		return false;
+	}
+
+	for (std::size_t j = i + 1; j < instructions.size() && instructions[j].is(Instruction::Kind::LABEL); ++j)
+	{
+		if (instructions[j].opcode == jump.jump_target())
+		{
+			instructions.erase(instructions.begin() + i);
+			++statistics.removed_instructions[underlying_cast(PeepholeRule::JUMP_TO_NEXT)];
+			return true;
+		}
+	}
+
+	return false;
+}
+string_view peephole_rule_name(PeepholeRule rule)
+{
+	switch (rule)
+	{
+	case PeepholeRule::PUSH_POP_PAIR: return "push/pop pair";
+	case PeepholeRule::REDUNDANT_TEST: return "redundant test";
+	case PeepholeRule::PUSH_IMMEDIATE: return "push immediate";
+	case PeepholeRule::JUMP_TO_NEXT: return "jump to next label";
+	default: throw std::runtime_error("unknown peephole rule");
+	}
+}
+
+void optimize_peephole(std::vector<Instruction>& instructions, PeepholeStatistics& statistics)
+{
+	bool changed = true;
+
+	while (changed)
+	{
+		changed = false;
+
+		for (std::size_t i = 0; i < instructions.size(); ++i)
+		{
+			if (rule_jump_to_next(instructions, i, statistics))
+			{
+				changed = true;
+				continue;
+			}
+
+			if (i + 1 >= instructions.size())
+			{
+				continue;
+			}
+
+			changed |= rule_push_pop_pair(instructions, i, statistics)
+				|| rule_redundant_test(instructions, i, statistics) || rule_push_immediate(instructions, i, statistics);
+		}
+	}
+}
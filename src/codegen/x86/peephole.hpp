@@ -0,0 +1,36 @@
+#pragma once
+
+#include "codegen/x86/instruction.hpp"
+#include "util/string_view.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+enum class PeepholeRule
+{
+	//! "pushq X; popq Y" becomes "movq X, Y", or nothing if X and Y are the same register.
+	PUSH_POP_PAIR,
+
+	//! "test %r, %r" is dropped after an instruction that already set the flags from %r.
+	REDUNDANT_TEST,
+
+	//! "movq $imm, %rax; pushq %rax" becomes "pushq $imm" if %rax is not read afterwards.
+	PUSH_IMMEDIATE,
+
+	//! Jumps to a label that immediately follows are deleted.
+	JUMP_TO_NEXT,
+
+	TOTAL
+};
+
+[[nodiscard]] string_view peephole_rule_name(PeepholeRule rule);
+
+struct PeepholeStatistics
+{
+	//! Count of instructions removed by each rule.
+	std::array<std::size_t, std::size_t(PeepholeRule::TOTAL)> removed_instructions{};
+};
+
+//! \brief Rewrite \p instructions until no rule applies anymore.
+void optimize_peephole(std::vector<Instruction>& instructions, PeepholeStatistics& statistics);
@@ -0,0 +1,446 @@
+#include "codegen.hpp"
+
+#include "compiler.hpp"
+#include "util/enums.hpp"
+#include "variable.hpp"
+
+#include <array>
+#include <fmt/core.h>
+#include <utility>
+#include <vector>
+
+//! \brief Get the AT&T name of the SSE register \p index, or of the AVX register aliasing it if \p wide is set.
+static std::string vector_register_name(std::size_t index, bool wide)
+{
+	return fmt::format("%{}mm{}", wide ? 'y' : 'x', index);
+}
+
+void CodeGen::vector_loop(const ir::VectorKernel& kernel)
+{
+	using ir::Opcode;
+
+	constexpr std::size_t first_register = 3, no_register = std::size_t(-1);
+
+	const bool        avx       = kernel.lanes == 4;
+	const bool        is_double = kernel.type == Type::DOUBLE;
+	const std::size_t step      = kernel.lanes * kernel.unroll;
+	const std::size_t tag       = ++m_label_tag;
+
+	// VEX-encoded instructions have a separate destination, and do not mix with legacy SSE ones within the loop
+	const auto vex = [&](string_view instruction) {
+		return avx ? fmt::format("v{}", instruction.str()) : instruction.str();
+	};
+
+	const auto vector_name = [&](std::size_t index) { return vector_register_name(index, avx); };
+
+	//! \brief Emit destination = other <instruction> source, where destination may only be source if it is other.
+	const auto packed = [&](string_view instruction,
+							const std::string& source,
+							const std::string& other,
+							const std::string& destination) {
+		if (avx)
+		{
+			emit(vex(instruction), {source, other, destination});
+			return;
+		}
+
+		if (other != destination)
+		{
+			emit(is_double ? "movapd" : "movdqa", {other, destination});
+		}
+
+		emit(instruction, {source, destination});
+	};
+
+	// Same as intrinsic_min_max, on every lane
+	const auto packed_min_max = [&](string_view instruction,
+									const std::string& left,
+									const std::string& right,
+									const std::string& destination,
+									bool               wide) {
+		const std::string scratch[] = {
+			vector_register_name(0, wide), vector_register_name(1, wide), vector_register_name(2, wide)};
+
+		packed(instruction, right, left, scratch[0]);
+		packed("cmpunordpd", right, right, scratch[1]);
+		packed("andpd", scratch[1], left, scratch[2]);
+		packed("andnpd", scratch[0], scratch[1], scratch[1]);
+		packed("orpd", scratch[2], scratch[1], destination);
+	};
+
+	const auto fold = [&](ir::ReductionOperator op,
+						  const std::string& accumulator,
+						  const std::string& value,
+						  bool               wide) {
+		switch (op)
+		{
+		case ir::ReductionOperator::ADD: packed(is_double ? "addpd" : "paddq", value, accumulator, accumulator); break;
+		case ir::ReductionOperator::MIN: packed_min_max("minpd", accumulator, value, accumulator, wide); break;
+		case ir::ReductionOperator::MAX: packed_min_max("maxpd", accumulator, value, accumulator, wide); break;
+		}
+	};
+
+	std::array<bool, 16> used{};
+
+	const auto allocate = [&]() {
+		for (std::size_t index = first_register; index < used.size(); ++index)
+		{
+			if (!used[index])
+			{
+				used[index] = true;
+				return index;
+			}
+		}
+
+		m_compiler.bug("ran out of registers for a vectorized loop");
+	};
+
+	// Copy the scalar in the low lane of a register to every lane
+	const auto broadcast = [&](std::size_t index) {
+		const std::string narrow = vector_register_name(index, false);
+
+		if (avx)
+		{
+			emit(is_double ? "vbroadcastsd" : "vpbroadcastq", {narrow, vector_name(index)});
+		}
+		else
+		{
+			emit(is_double ? "unpcklpd" : "punpcklqdq", {narrow, narrow});
+		}
+	};
+
+	materialize_flags();
+
+	std::vector<Operand> inputs(kernel.input_count);
+
+	for (std::size_t i = kernel.input_count; i-- > 0;)
+	{
+		inputs[i] = pop_operand();
+	}
+
+	Operand bound = pop_operand();
+	Operand index = pop_operand();
+
+	// The kernel writes to memory and uses every SSE register
+	spill_all_operands();
+
+	// Inputs take the first registers, which never hold operands
+	std::vector<std::size_t> invariant_registers(kernel.value_count, no_register);
+
+	for (std::size_t i = 0; i < kernel.input_count; ++i)
+	{
+		Operand&          input       = inputs[i];
+		const std::size_t reg         = allocate();
+		const std::string destination = vector_register_name(reg, false);
+
+		if (input.is(Operand::Kind::MEMORY))
+		{
+			emit(vex(is_double ? "movsd" : "movq"), {input.str(), destination});
+		}
+		else if (is_double && input.is(Operand::Kind::REGISTER) && is_register_xmm(input.reg))
+		{
+			emit(vex("movapd"), {register_name(input.reg), destination});
+		}
+		else
+		{
+			emit(vex("movq"), {register_name(to_readable_register(input, false)), destination});
+		}
+
+		broadcast(reg);
+		release_operand(input);
+		invariant_registers[i] = reg;
+	}
+
+	const std::string index_register = register_name(to_register(index, false));
+	const std::string bound_register = register_name(to_readable_register(bound, false));
+
+	for (const ir::Instruction& instruction : kernel.instructions)
+	{
+		if (instruction.is(Opcode::CONSTANT))
+		{
+			const std::size_t reg = allocate();
+			load_operand(Operand::immediate(instruction.constant, Type::UNSIGNED_INT), Register::RAX);
+			emit(vex("movq"), {"%rax", vector_register_name(reg, false)});
+			broadcast(reg);
+			invariant_registers[instruction.result] = reg;
+		}
+	}
+
+	// Each copy of the kernel has its own accumulators, which start from the identity of their operator
+	std::vector<std::vector<std::size_t>> accumulators(kernel.reductions.size());
+
+	for (std::size_t r = 0; r < kernel.reductions.size(); ++r)
+	{
+		const ir::VectorReduction& reduction = kernel.reductions[r];
+
+		for (std::size_t copy = 0; copy < kernel.unroll; ++copy)
+		{
+			const std::size_t reg  = allocate();
+			const std::string name = vector_name(reg);
+			accumulators[r].push_back(reg);
+
+			if (reduction.op == ir::ReductionOperator::ADD)
+			{
+				packed(is_double ? "xorpd" : "pxor", name, name, name);
+			}
+			else if (copy == 0)
+			{
+				const Variable    variable{reduction.variable, {kernel.type}, reduction.variable_symbol};
+				const std::string location = variable_memory(variable, kernel.type).str();
+				emit(vex("movsd"), {location, vector_register_name(reg, false)});
+				broadcast(reg);
+			}
+			else
+			{
+				emit(vex("movapd"), {vector_name(accumulators[r][0]), name});
+			}
+		}
+	}
+
+	const std::string loop_label = fmt::format("__vector_loop{}", tag);
+	const std::string done_label = fmt::format("__vector_done{}", tag);
+
+	// Run a group of iterations while it does not go past the bound. The difference cannot overflow once the index is
+	// known not to be above the bound.
+	emit_label(loop_label);
+	emit("cmpq", {bound_register, index_register});
+	emit("jg", {done_label});
+	emit("movq", {bound_register, "%rax"});
+	emit("subq", {index_register, "%rax"});
+	emit("cmpq", {fmt::format("${}", step - 1), "%rax"});
+	emit("jb", {done_label});
+
+	const std::vector<std::size_t> last_uses = kernel.last_uses();
+	const std::string              move      = vex(is_double ? "movupd" : "movdqu");
+
+	for (std::size_t copy = 0; copy < kernel.unroll; ++copy)
+	{
+		std::vector<std::size_t> registers = invariant_registers;
+
+		const auto value_name = [&](ir::ValueId value) { return vector_name(registers[value]); };
+
+		const auto is_dying = [&](ir::ValueId value, std::size_t position) {
+			return invariant_registers[value] == no_register && last_uses[value] == position;
+		};
+
+		// Release the temporaries whose last use is at position, which may be done several times for the same value
+		const auto release_dead = [&](ir::ValueId value, std::size_t position) {
+			if (is_dying(value, position))
+			{
+				used[registers[value]] = false;
+			}
+		};
+
+		for (std::size_t i = 0; i < kernel.instructions.size(); ++i)
+		{
+			const ir::Instruction& instruction = kernel.instructions[i];
+
+			if (instruction.is(Opcode::CONSTANT))
+			{
+				continue;
+			}
+
+			std::string destination;
+
+			if (instruction.has_result())
+			{
+				registers[instruction.result] = allocate();
+				destination                   = value_name(instruction.result);
+			}
+
+			// Legacy SSE instructions overwrite their first operand, which saves a copy if it dies here
+			const auto overwrite = [&](ir::ValueId operand, ir::ValueId other) {
+				if (!avx && operand != other && is_dying(operand, i))
+				{
+					used[registers[instruction.result]] = false;
+					registers[instruction.result]       = registers[operand];
+					destination                         = value_name(instruction.result);
+				}
+			};
+
+			switch (instruction.opcode)
+			{
+			case Opcode::LOAD_ELEMENT:
+			case Opcode::STORE_ELEMENT:
+			{
+				const Variable     array{instruction.symbol, {kernel.type}, instruction.variable};
+				const std::int64_t offset = std::int64_t(instruction.constant) + std::int64_t(copy * kernel.lanes);
+				const std::string  element = fmt::format("(%rcx,{},8)", index_register);
+
+				emit("leaq", {variable_memory(array, kernel.type, offset * 8).str(), "%rcx"});
+
+				if (instruction.is(Opcode::LOAD_ELEMENT))
+				{
+					emit(move, {element, destination});
+				}
+				else
+				{
+					emit(move, {value_name(instruction.operands[0]), element});
+				}
+
+				break;
+			}
+
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::MUL:
+			case Opcode::DIV:
+			{
+				const char* const double_instructions[]  = {"addpd", "subpd", "mulpd", "divpd"};
+				const char* const integer_instructions[] = {"paddq", "psubq"};
+				const std::size_t which = underlying_cast(instruction.opcode) - underlying_cast(Opcode::ADD);
+				const bool        commutative = instruction.is(Opcode::ADD) || instruction.is(Opcode::MUL);
+
+				ir::ValueId left = instruction.operands[0], right = instruction.operands[1];
+
+				if (commutative && !is_dying(left, i) && is_dying(right, i))
+				{
+					std::swap(left, right);
+				}
+
+				overwrite(left, right);
+				packed(
+					is_double ? double_instructions[which] : integer_instructions[which],
+					value_name(right),
+					value_name(left),
+					destination);
+				break;
+			}
+
+			case Opcode::CALL:
+			{
+				if (instruction.symbol == "sqrt")
+				{
+					emit(vex("sqrtpd"), {value_name(instruction.operands[0]), destination});
+				}
+				else if (instruction.symbol == "fabs")
+				{
+					// Clear the sign bits with a mask of all ones shifted right by one
+					const std::string mask = vector_name(0);
+					overwrite(instruction.operands[0], ir::no_value);
+					packed("pcmpeqd", mask, mask, mask);
+					packed("psrlq", "$1", mask, mask);
+					packed("andpd", mask, value_name(instruction.operands[0]), destination);
+				}
+				else if (instruction.symbol == "fmin" || instruction.symbol == "fmax")
+				{
+					packed_min_max(
+						instruction.symbol == "fmin" ? "minpd" : "maxpd",
+						value_name(instruction.operands[0]),
+						value_name(instruction.operands[1]),
+						destination,
+						avx);
+				}
+				else
+				{
+					m_compiler.bug(fmt::format("cannot vectorize a call to {}", instruction.symbol));
+				}
+
+				break;
+			}
+
+			default:
+			{
+				m_compiler.bug(
+					fmt::format("cannot vectorize '{}'", ir::opcode_name(instruction.opcode).str()));
+			}
+			}
+
+			if (instruction.has_result())
+			{
+				release_dead(instruction.result, i);
+			}
+
+			for (const ir::ValueId operand : instruction.operands)
+			{
+				// Unless the result took over its register
+				if (!instruction.has_result() || registers[operand] != registers[instruction.result])
+				{
+					release_dead(operand, i);
+				}
+			}
+		}
+
+		for (std::size_t r = 0; r < kernel.reductions.size(); ++r)
+		{
+			const ir::VectorReduction& reduction = kernel.reductions[r];
+			fold(reduction.op, vector_name(accumulators[r][copy]), value_name(reduction.value), avx);
+		}
+
+		for (const ir::VectorReduction& reduction : kernel.reductions)
+		{
+			release_dead(reduction.value, kernel.instructions.size());
+		}
+	}
+
+	emit("addq", {fmt::format("${}", step), index_register});
+	emit("jmp", {loop_label});
+	emit_label(done_label);
+
+	// Inputs and constants are not needed anymore, which leaves a register to combine the lanes of accumulators
+	for (const std::size_t reg : invariant_registers)
+	{
+		if (reg != no_register)
+		{
+			used[reg] = false;
+		}
+	}
+
+	for (std::size_t r = 0; r < kernel.reductions.size(); ++r)
+	{
+		const ir::VectorReduction& reduction   = kernel.reductions[r];
+		const std::string          accumulator = vector_name(accumulators[r][0]);
+		const std::string          low         = vector_register_name(accumulators[r][0], false);
+		const std::size_t          high_index  = allocate();
+		const std::string          high        = vector_register_name(high_index, false);
+		const Variable             variable{reduction.variable, {kernel.type}, reduction.variable_symbol};
+		const std::string          location    = variable_memory(variable, kernel.type).str();
+
+		for (std::size_t copy = 1; copy < kernel.unroll; ++copy)
+		{
+			fold(reduction.op, accumulator, vector_name(accumulators[r][copy]), avx);
+		}
+
+		if (avx)
+		{
+			emit(is_double ? "vextractf128" : "vextracti128", {"$1", accumulator, high});
+			fold(reduction.op, low, high, false);
+		}
+
+		if (is_double)
+		{
+			packed("unpckhpd", low, low, high);
+		}
+		else
+		{
+			emit(vex("pshufd"), {"$0xee", low, high});
+		}
+
+		fold(reduction.op, low, high, false);
+		used[high_index] = false;
+
+		if (reduction.op != ir::ReductionOperator::ADD)
+		{
+			emit(vex("movsd"), {low, location});
+		}
+		else if (is_double)
+		{
+			packed("addsd", location, low, low);
+			emit(vex("movsd"), {low, location});
+		}
+		else
+		{
+			emit(vex("movq"), {low, "%rax"});
+			emit("addq", {"%rax", location});
+		}
+	}
+
+	if (avx)
+	{
+		// Avoid the penalty of running legacy SSE instructions while the upper halves of the AVX registers are dirty
+		emit("vzeroupper");
+	}
+
+	release_operand(bound);
+	push_operand(index);
+}
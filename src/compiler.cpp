@@ -16,27 +16,39 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "compiler.hpp"
+#include "codegen/x86/lowering.hpp"
 #include "exceptions.hpp"
+#include "ir/dead_code.hpp"
+#include "ir/inline.hpp"
+#include "ir/vectorize.hpp"
+#include "ir/verifier.hpp"
+#include "runtime.hpp"
 #include "token.hpp"
 #include "util/enums.hpp"
 #include "util/string_view.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fmt/color.h>
 #include <fmt/core.h>
-#include <fstream>
+#include <iostream>
 #include <vector>
 
-Compiler::Compiler(const Config& config, string_view file_name, std::istream& input, std::ostream& output) :
+Compiler::Compiler(
+	const Config& config, std::unique_ptr<SourceFile> source, std::ostream& output, std::ostream& diagnostics) :
 	m_config{config},
 	m_output_stream{output},
-	m_lexer{new yyFlexLexer(input, output)},
+	m_diagnostic_stream{diagnostics},
+	m_lexer{std::make_unique<Tokeniser>(*source)},
 	m_codegen{std::make_unique<CodeGen>(*this)}
 {
-	m_file_name_stack.push(file_name);
+	m_sources.push_back(std::move(source));
 
-	if (!input)
+	if (!m_config.include_cache_directory.empty() || m_config.include_cache_store != nullptr)
 	{
-		error("could not open source for writing");
+		m_include_cache = std::make_unique<IncludeCache>(
+			*this, m_config.include_cache_directory, m_config.include_cache_store);
 	}
 
 	if (!output)
@@ -49,8 +61,6 @@ void Compiler::operator()()
 {
 	try
 	{
-		m_codegen->begin_program();
-
 		read_token(); // Read first token
 		parse_program();
 
@@ -59,7 +69,82 @@ void Compiler::operator()()
 			error(fmt::format("extraneous characters at end of file. did you use '.' instead of ';'?"));
 		}
 
-		m_codegen->finalize_program();
+		if (m_config.inline_procedures)
+		{
+			std::vector<std::string> remarks;
+			ir::inline_procedures(m_program, m_symbols, m_for_loops, m_address_taken_variables, remarks);
+
+			if (m_config.inline_report)
+			{
+				for (const std::string& remark : remarks)
+				{
+					m_diagnostic_stream << "inline: " << remark << '\n';
+				}
+			}
+		}
+
+		for (const auto& it : m_for_loops)
+		{
+			ir::optimize_for_loop(m_program.functions[it.first], it.second, m_address_taken_variables);
+		}
+
+		if (m_config.bounds_check == BoundsCheck::AUTO)
+		{
+			for (std::size_t i = 0; i < m_program.functions.size(); ++i)
+			{
+				std::vector<ir::ForLoop> loops;
+
+				for (const auto& it : m_for_loops)
+				{
+					if (it.first == i)
+					{
+						loops.push_back(it.second);
+					}
+				}
+
+				ir::eliminate_bounds_checks(m_program.functions[i], loops);
+			}
+		}
+
+		if (m_config.vectorize)
+		{
+			ir::VectorizeOptions options;
+			options.lanes            = m_config.micro_architecture >= MicroArchitecture::X86_64_V3 ? 4 : 2;
+			options.registers        = CodeGen::vector_kernel_registers;
+			options.vectorize_double = m_config.floating_point_unit != FloatingPointUnit::X87;
+			options.reassociate      = m_config.reassociate;
+
+			for (const auto& it : m_for_loops)
+			{
+				std::string remark;
+				ir::vectorize_for_loop(m_program.functions[it.first], it.second, options, remark);
+
+				if (m_config.vectorize_report)
+				{
+					m_diagnostic_stream << fmt::format(
+						"vectorize: line {}: FOR {}: {}\n", it.second.line, it.second.variable, remark);
+				}
+			}
+		}
+
+		ir::eliminate_dead_code(m_program);
+
+		// Fields are laid out from the accesses left once the program was optimized
+		lay_out_records();
+
+		const std::vector<std::string> ir_errors = ir::verify(m_program);
+
+		if (!ir_errors.empty())
+		{
+			bug(fmt::format("invalid intermediate representation: {}", ir_errors.front()));
+		}
+
+		if (m_config.emit_ir)
+		{
+			ir::print(m_diagnostic_stream, m_program);
+		}
+
+		lower_program(m_program, *m_codegen);
 	}
 	catch (const CompilerError& e)
 	{
@@ -73,9 +158,42 @@ void Compiler::operator()()
 	}
 }
 
+Compiler::Expression Compiler::Expression::runtime(Type type)
+{
+	Expression expression;
+	expression.type = type;
+	return expression;
+}
+
+Compiler::Expression Compiler::Expression::constant(Type type, std::uint64_t value)
+{
+	Expression expression;
+	expression.type        = type;
+	expression.is_constant = true;
+	expression.value       = value;
+	return expression;
+}
+
+Compiler::Expression Compiler::Expression::constant_f64(double value)
+{
+	static_assert(sizeof(double) == sizeof(std::uint64_t), "double must be 64-bit on the compiler platform");
+
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	return constant(Type::DOUBLE, bits);
+}
+
+double Compiler::Expression::as_f64() const
+{
+	double result;
+	std::memcpy(&result, &value, sizeof(result));
+	return result;
+}
+
 Type Compiler::parse_factor_identifier()
 {
-	const std::string name = token_text();
+	const string_view name = token_text();
 
 	read_token(); // Consume identifier
 
@@ -91,12 +209,17 @@ Type Compiler::parse_factor_identifier()
 
 void Compiler::parse_statement_identifier()
 {
-	const std::string name = token_text();
+	const string_view name = token_text();
 	read_token(); // Consume identifier
 
 	if (m_current_token == TOKEN::LPARENT)
 	{
-		[[maybe_unused]] const Type type = parse_function_call_after_identifier(name);
+		const Type type = parse_function_call_after_identifier(name);
+
+		if (type != Type::VOID)
+		{
+			m_ir->discard_value();
+		}
 	}
 	else
 	{
@@ -104,39 +227,33 @@ void Compiler::parse_statement_identifier()
 	}
 }
 
-Type Compiler::parse_character_literal()
+Compiler::Expression Compiler::parse_character_literal()
 {
 	// 2nd character in e.g. `'h'`
-	m_codegen->load_i64(token_text()[1]);
+	const Expression expression = Expression::constant(Type::CHAR, token_text()[1]);
 	read_token();
 
-	return Type::CHAR;
+	return expression;
 }
 
-Type Compiler::parse_integer_literal()
+Compiler::Expression Compiler::parse_integer_literal()
 {
 	static_assert(
 		sizeof(unsigned long long) >= sizeof(std::int64_t),
 		"unsigned long long must be 64-bit on the compiler platform");
 
-	m_codegen->load_i64(std::stoull(token_text()));
+	const Expression expression = Expression::constant(Type::UNSIGNED_INT, std::stoull(token_text()));
 	read_token();
 
-	return Type::UNSIGNED_INT;
+	return expression;
 }
 
-Type Compiler::parse_float_literal()
+Compiler::Expression Compiler::parse_float_literal()
 {
-	static_assert(sizeof(double) == sizeof(std::int64_t), "double must be 64-bit on the compiler platform");
-
-	double        source = std::stod(token_text());
-	std::uint64_t target;
-	std::memcpy(&target, &source, sizeof(target));
-
-	m_codegen->load_i64(target);
+	const Expression expression = Expression::constant_f64(std::stod(token_text()));
 	read_token();
 
-	return Type::DOUBLE;
+	return expression;
 }
 
 Type Compiler::parse_variable_reference()
@@ -144,55 +261,66 @@ Type Compiler::parse_variable_reference()
 	read_token();
 
 	expect_token(TOKEN::ID, "expected identifier after referencing operator '@'");
-	const std::string name = token_text();
+	const string_view name = token_text();
 	read_token();
 
-	const auto it = m_variables.find(name);
-	if (it == m_variables.end())
+	const auto* it = m_variables.find(m_symbols.intern(name));
+	if (it == nullptr)
 	{
-		error(fmt::format("use of undeclared identifier '{}'", name));
+		error(fmt::format("use of undeclared identifier '{}'", name.str()));
 	}
 
 	const VariableType& variable_type = it->second;
 
+	if (find_array_type(variable_type.type) != nullptr)
+	{
+		error(fmt::format("cannot take the address of array '{}'", name.str()));
+	}
+
 	UserType user_type(UserType::Category::POINTER);
 	user_type.layout_data.pointer.target = variable_type.type;
-	const Type pointer_type              = create_type(user_type);
+	const Type pointer_type              = m_user_types.intern(user_type);
 
-	m_codegen->load_pointer_to_variable({it->first, variable_type});
+	m_ir->load_pointer_to_variable({name, variable_type, it->first}, pointer_type);
+	m_address_taken_variables.insert(name);
 
 	return pointer_type;
 }
 
-Type Compiler::parse_dereferencable()
+Compiler::Expression Compiler::parse_dereferencable()
 {
 	switch (m_current_token)
 	{
 	case LPARENT:
 	{
 		read_token();
-		Type type = parse_expression();
+		const Expression expression = parse_expression();
 		read_token(RPARENT, "expected ')'");
 
-		return type;
+		return expression;
 	}
 
 	case NOT:
 	{
 		read_token();
-		Type type = parse_factor();
-		check_type(type, Type::BOOLEAN);
+		const Expression expression = parse_factor();
+		check_type(expression.type, Type::BOOLEAN);
+
+		if (expression.is_constant)
+		{
+			return Expression::constant(Type::BOOLEAN, ~expression.value);
+		}
 
-		m_codegen->alu_not_bool();
+		m_ir->alu_not_bool();
 
-		return Type::BOOLEAN;
+		return Expression::runtime(Type::BOOLEAN);
 	}
 
-	case AT: return parse_variable_reference();
+	case AT: return Expression::runtime(parse_variable_reference());
 	case CHAR_LITERAL: return parse_character_literal();
 	case INTEGER_LITERAL: return parse_integer_literal();
 	case FLOAT_LITERAL: return parse_float_literal();
-	case ID: return parse_factor_identifier();
+	case ID: return Expression::runtime(parse_factor_identifier());
 	case KEYWORD_CONVERT: return parse_type_cast();
 	default:
 	{
@@ -201,33 +329,48 @@ Type Compiler::parse_dereferencable()
 	}
 }
 
-Type Compiler::parse_factor()
+Compiler::Expression Compiler::parse_factor()
 {
-	Type current_type = parse_dereferencable();
+	const Expression expression = parse_dereferencable();
+
+	if (m_current_token != TOKEN::EXPONENT)
+	{
+		return expression;
+	}
+
+	// Constants are never pointers, so this only reports the error below
+	Type current_type = emit_expression(expression);
 
 	while (try_read_token(TOKEN::EXPONENT))
 	{
-		const auto it = m_user_types.find(current_type);
+		const UserType::PointerType* pointer = find_pointer_type(current_type);
 
-		if (it == m_user_types.end() || it->second.category != UserType::Category::POINTER)
+		if (pointer == nullptr)
 		{
-			error(fmt::format("cannot dereference non-pointer type '{}'", type_name(current_type).str()));
+			error(fmt::format("cannot dereference non-pointer type '{}'", type_name(current_type)));
 		}
 
-		const UserType& type = it->second;
+		// Records are only ever read a field at a time
+		if (find_record_type(pointer->target) != nullptr)
+		{
+			const ir::FieldAccess field = parse_field_access(pointer->target, current_type);
+			m_ir->load_value_from_pointer(current_type, field);
+			continue;
+		}
 
-		m_codegen->load_value_from_pointer(type.layout_data.pointer.target);
-		current_type = type.layout_data.pointer.target;
+		m_ir->load_value_from_pointer(pointer->target);
+		current_type = pointer->target;
 	}
 
-	return current_type;
+	return Expression::runtime(current_type);
 }
 
-Type Compiler::parse_type_cast()
+Compiler::Expression Compiler::parse_type_cast()
 {
 	read_token(); // CONVERT
 
-	const Type source_type = parse_expression();
+	const Expression source      = parse_expression();
+	const Type       source_type = source.type;
 
 	read_token(KEYWORD_TO, "expected 'TO' after expression in CONVERT expression");
 
@@ -238,22 +381,30 @@ Type Compiler::parse_type_cast()
 	{
 		error(fmt::format(
 			"incompatible types for explicit conversion {} -> {}",
-			type_name(source_type).str(),
-			type_name(destination_type).str()));
+			type_name(source_type),
+			type_name(destination_type)));
+	}
+
+	Expression result;
+
+	if (fold_conversion(source, destination_type, result))
+	{
+		return result;
 	}
 
-	m_codegen->convert(source_type, destination_type);
+	emit_expression(source);
+	m_ir->convert(destination_type);
 
 	// right now just yolo it and don't convert
-	return destination_type;
+	return Expression::runtime(destination_type);
 }
 
 Type Compiler::parse_function_call_after_identifier(string_view name, bool expects_return)
 {
 	read_token(); // Consume '('
 
-	const auto it = m_functions.find(name);
-	if (it == m_functions.end())
+	const auto* it = m_functions.find(m_symbols.intern(name));
+	if (it == nullptr)
 	{
 		error(fmt::format("use of undeclared function '{}'", name.str()));
 	}
@@ -270,13 +421,6 @@ Type Compiler::parse_function_call_after_identifier(string_view name, bool expec
 		bug("variadic foreign function calls are not supported from the language for now");
 	}
 
-	FunctionCall call;
-	call.function_name = name;
-	call.return_type   = function.return_type;
-	call.variadic      = function.variadic;
-
-	m_codegen->function_call_prepare(call);
-
 	// TODO: try catch to add context for the nth parameter and also for the function call
 	std::size_t i = 0;
 	if (m_current_token != TOKEN::RPARENT)
@@ -291,11 +435,9 @@ Type Compiler::parse_function_call_after_identifier(string_view name, bool expec
 
 			const FunctionParameter& declared_parameter = function.parameters[i];
 
-			const Type expression_type = parse_expression();
+			const Type expression_type = emit_expression(parse_expression());
 			check_type(expression_type, declared_parameter.type);
 
-			m_codegen->function_call_param(call, expression_type);
-
 			++i;
 		} while (try_read_token(TOKEN::COMMA));
 	}
@@ -306,7 +448,7 @@ Type Compiler::parse_function_call_after_identifier(string_view name, bool expec
 			"not enough parameters for function '{}', expected {}", name.str(), function.parameters.size()));
 	}
 
-	m_codegen->function_call_finalize(call);
+	m_ir->function_call(name, function.return_type, i, function.variadic, function.foreign);
 
 	read_token(TOKEN::RPARENT, "expected ')' after parameter list in function call");
 
@@ -315,107 +457,155 @@ Type Compiler::parse_function_call_after_identifier(string_view name, bool expec
 
 Type Compiler::parse_variable_usage_after_identifier(string_view name)
 {
-	const auto it = m_variables.find(name);
-	if (it == m_variables.end())
+	const auto* it = m_variables.find(m_symbols.intern(name));
+	if (it == nullptr)
 	{
 		error(fmt::format("use of undeclared identifier '{}'", name.str()));
 	}
 
 	const VariableType& type = it->second;
 
-	m_codegen->load_variable({name, type});
+	if (const UserType::ArrayType* array = find_array_type(type.type))
+	{
+		parse_array_index(*array);
+
+		if (find_record_type(array->element) != nullptr)
+		{
+			Type                  field_type;
+			const ir::FieldAccess field = parse_field_access(array->element, field_type);
+			m_ir->load_element({name, type, it->first}, field_type, field);
+
+			return field_type;
+		}
+
+		m_ir->load_element({name, type, it->first}, array->element);
+
+		return array->element;
+	}
+
+	if (find_record_type(type.type) != nullptr)
+	{
+		Type                  field_type;
+		const ir::FieldAccess field = parse_field_access(type.type, field_type);
+		m_ir->load_field({name, type, it->first}, field, field_type);
+
+		return field_type;
+	}
+
+	m_ir->load_variable({name, type, it->first});
 
 	return type.type;
 }
 
-Type Compiler::parse_term()
+void Compiler::parse_array_index(const UserType::ArrayType& array)
+{
+	read_token(TOKEN::RBRACKET, "expected '[' and an index after array name");
+
+	Expression index = parse_expression();
+	check_type(index.type, Type::UNSIGNED_INT);
+
+	read_token(TOKEN::LBRACKET, "expected ']' after array index");
+
+	if (index.is_constant)
+	{
+		if (index.value < array.low || index.value > array.high)
+		{
+			error(fmt::format("array index {} is out of bounds [{}..{}]", index.value, array.low, array.high));
+		}
+
+		emit_expression(Expression::constant(Type::UNSIGNED_INT, index.value - array.low));
+		return;
+	}
+
+	// Elements are accessed by their offset from the start of the array
+	if (array.low != 0)
+	{
+		index = apply_binary_operation(TOKEN::ADDOP_SUB, index, Expression::constant(Type::UNSIGNED_INT, array.low));
+	}
+
+	emit_expression(index);
+
+	// An index below the low bound wraps around to a huge offset, so a single unsigned comparison checks both bounds
+	if (m_config.bounds_check != BoundsCheck::OFF)
+	{
+		m_ir->check_bounds(array.length());
+	}
+}
+
+ir::FieldAccess Compiler::parse_field_access(Type record_type, Type& field_type)
+{
+	const UserType::RecordType* record = find_record_type(record_type);
+
+	read_token(TOKEN::DOT, "expected '.' and a field name after record");
+	expect_token(TOKEN::ID, "expected field name after '.'");
+
+	const std::size_t index = record->find_field(token_text());
+
+	if (index == record->fields.size())
+	{
+		error(fmt::format("record has no field named '{}'", token_text().str()));
+	}
+
+	read_token();
+
+	ir::FieldAccess field;
+	field.record = record_type;
+	field.index  = index;
+
+	field_type = record->fields[index].type;
+	return field;
+}
+
+Compiler::Expression Compiler::parse_term()
 {
-	const Type first_type = parse_factor();
+	Expression first = parse_factor();
 	while (is_token_mulop(m_current_token))
 	{
 		const TOKEN op_token = m_current_token;
 		read_token();
 
-		const Type nth_type = parse_factor();
-		check_type(first_type, nth_type);
+		const Expression nth = parse_factor();
+		check_type(first.type, nth.type);
 
 		switch (op_token)
 		{
-		case TOKEN::MULOP_AND:
-		{
-			check_type(first_type, Type::BOOLEAN);
-			m_codegen->alu_and_bool();
-			break;
-		}
-
+		case TOKEN::MULOP_AND: check_type(first.type, Type::BOOLEAN); break;
 		case TOKEN::MULOP_MUL:
-		{
-			check_type(first_type, Type::ARITHMETIC);
-			m_codegen->alu_multiply(first_type);
-			break;
-		}
-
 		case TOKEN::MULOP_DIV:
-		{
-			check_type(first_type, Type::ARITHMETIC);
-			m_codegen->alu_divide(first_type);
-			break;
-		}
-
-		case TOKEN::MULOP_MOD:
-		{
-			check_type(first_type, Type::ARITHMETIC);
-			m_codegen->alu_modulus(first_type);
-			break;
-		}
-
+		case TOKEN::MULOP_MOD: check_type(first.type, Type::ARITHMETIC); break;
 		default: bug("unimplemented multiplicative operator");
 		}
+
+		first = apply_binary_operation(op_token, first, nth);
 	}
 
-	return first_type;
+	return first;
 }
 
-Type Compiler::parse_simple_expression()
+Compiler::Expression Compiler::parse_simple_expression()
 {
-	const Type first_type = parse_term();
+	Expression first = parse_term();
 
 	while (is_token_addop(m_current_token))
 	{
 		const TOKEN op_token = m_current_token;
 		read_token();
 
-		const Type nth_type = parse_term();
-		check_type(first_type, nth_type);
+		const Expression nth = parse_term();
+		check_type(first.type, nth.type);
 
 		switch (op_token)
 		{
-		case TOKEN::ADDOP_OR:
-		{
-			check_type(first_type, Type::BOOLEAN);
-			m_codegen->alu_or_bool();
-			break;
-		}
-
+		case TOKEN::ADDOP_OR: check_type(first.type, Type::BOOLEAN); break;
 		case TOKEN::ADDOP_ADD:
-		{
-			check_type(first_type, Type::ARITHMETIC);
-			m_codegen->alu_add(first_type);
-			break;
-		}
-
-		case TOKEN::ADDOP_SUB:
-		{
-			check_type(first_type, Type::ARITHMETIC);
-			m_codegen->alu_sub(first_type);
-			break;
-		}
-
+		case TOKEN::ADDOP_SUB: check_type(first.type, Type::ARITHMETIC); break;
 		default: bug("unimplemented additive operator");
 		}
+
+		first = apply_binary_operation(op_token, first, nth);
 	}
 
-	return first_type;
+	return first;
 }
 
 void Compiler::parse_declaration_block()
@@ -428,6 +618,8 @@ void Compiler::parse_declaration_block()
 		case TOKEN::KEYWORD_TYPE: parse_type_definition(); break;
 		case TOKEN::KEYWORD_FFI: parse_foreign_function_declaration(); break;
 		case TOKEN::KEYWORD_INCLUDE: parse_include(); break;
+		case TOKEN::KEYWORD_PROCEDURE:
+		case TOKEN::KEYWORD_FUNCTION: parse_procedure_declaration(); break;
 		default: return;
 		}
 	}
@@ -439,7 +631,7 @@ void Compiler::parse_variable_declaration_block()
 
 	for (;;)
 	{
-		std::vector<std::string> current_declarations;
+		std::vector<string_view> current_declarations;
 
 		do
 		{
@@ -449,17 +641,12 @@ void Compiler::parse_variable_declaration_block()
 
 		read_token(COLON, "expected ':' after variable name list in declaration block");
 
-		const Type type = parse_type();
+		VariableType variable_type{parse_type()};
+		variable_type.cache_aligned = try_read_token(TOKEN::KEYWORD_ALIGNED);
 
 		for (auto& name : current_declarations)
 		{
-			const auto emplace_result = m_variables.emplace(name, VariableType{type});
-			const bool success        = emplace_result.second;
-
-			if (!success)
-			{
-				error(fmt::format("duplicate declaration of variable '{}'", name));
-			}
+			declare_variable(name, variable_type);
 		}
 
 		read_token(TOKEN::SEMICOLON, "expected ';' after variable declaration");
@@ -496,11 +683,20 @@ void Compiler::parse_foreign_function_declaration()
 	{
 		do
 		{
-			if (is_token_type(m_current_token))
+			const Type type = parse_type();
+
+			if (find_array_type(type) != nullptr)
+			{
+				error("arrays cannot be passed to foreign functions");
+			}
+
+			if (find_record_type(type) != nullptr)
 			{
-				const auto type = parse_type();
-				function.parameters.push_back({type});
+				error("records can only be passed to foreign functions through pointers");
 			}
+
+			mark_foreign_type(type);
+			function.parameters.push_back({type});
 		} while (try_read_token(COMMA));
 	}
 
@@ -510,19 +706,154 @@ void Compiler::parse_foreign_function_declaration()
 
 	function.return_type = parse_type(true);
 
+	if (find_array_type(function.return_type) != nullptr || find_record_type(function.return_type) != nullptr)
+	{
+		error("foreign functions can only return records and arrays through pointers");
+	}
+
+	mark_foreign_type(function.return_type);
+
 	read_token(SEMICOLON, "expected ';' after FFI declaration");
 
-	const auto emplace_result = m_functions.emplace(name, std::move(function));
-	const bool success        = emplace_result.second;
+	if (!m_functions.emplace(m_symbols.intern(name), std::move(function)))
+	{
+		error(fmt::format("duplicate declaration of function '{}'", name));
+	}
+}
 
-	if (!success)
+void Compiler::parse_procedure_declaration()
+{
+	// The cache only holds declarations, not the code of procedures
+	mark_include_uncacheable();
+
+	const bool        is_function = m_current_token == TOKEN::KEYWORD_FUNCTION;
+	const string_view kind        = is_function ? "function" : "procedure";
+
+	read_token(); // consume PROCEDURE or FUNCTION
+
+	expect_token(ID, fmt::format("expected {} name", kind.str()));
+	const std::string name = token_text();
+	read_token();
+
+	if (name == "main")
+	{
+		error("'main' is reserved for the main block of the program");
+	}
+
+	if (m_functions.contains(m_symbols.intern(name)))
 	{
 		error(fmt::format("duplicate declaration of function '{}'", name));
 	}
+
+	m_program.functions.emplace_back();
+	m_program.functions.back().name = name;
+	m_in_procedure                  = true;
+
+	// Restored once the procedure was parsed, which drops its parameters and locals
+	const SymbolMap<VariableType> globals = m_variables;
+
+	Function    function;
+	std::size_t regular_count = 0, float_count = 0;
+
+	read_token(LPARENT, fmt::format("expected '(' after {} name", kind.str()));
+
+	if (m_current_token != RPARENT)
+	{
+		do
+		{
+			std::vector<string_view> names;
+
+			do
+			{
+				expect_token(ID, "expected parameter name");
+				names.push_back(token_text());
+				read_token();
+			} while (try_read_token(COMMA));
+
+			read_token(COLON, "expected ':' after parameter name list");
+
+			const Type type = parse_type();
+			check_procedure_value_type(type);
+
+			for (const string_view parameter : names)
+			{
+				declare_variable(parameter, {type}, true);
+				function.parameters.push_back({type, parameter});
+				++(type == Type::DOUBLE ? float_count : regular_count);
+			}
+		} while (try_read_token(SEMICOLON));
+	}
+
+	read_token(RPARENT, "expected ')' after parameter list");
+
+	// Parameters are only passed in registers
+	if (regular_count > 6 || float_count > 8)
+	{
+		error(fmt::format(
+			"{} '{}' has too many parameters: at most 6 non-DOUBLE and 8 DOUBLE ones are supported",
+			kind.str(),
+			name));
+	}
+
+	function.return_type = Type::VOID;
+
+	if (is_function)
+	{
+		read_token(COLON, "expected ':' after ')' to specify return type of function");
+
+		function.return_type = parse_type();
+		check_procedure_value_type(function.return_type);
+
+		// The result is assigned like a variable named after the function
+		declare_variable(name, {function.return_type});
+	}
+
+	m_program.functions.back().return_type = function.return_type;
+
+	read_token(SEMICOLON, fmt::format("expected ';' after {} header", kind.str()));
+
+	if (m_current_token == TOKEN::KEYWORD_INLINE || m_current_token == TOKEN::KEYWORD_NOINLINE)
+	{
+		m_program.functions.back().inlining
+			= m_current_token == TOKEN::KEYWORD_INLINE ? ir::Inlining::ALWAYS : ir::Inlining::NEVER;
+
+		read_token();
+		read_token(SEMICOLON, "expected ';' after INLINE or NOINLINE directive");
+	}
+
+	// Declared before the body, so that it may call itself
+	m_functions.emplace(m_symbols.intern(name), function);
+
+	if (m_current_token == TOKEN::KEYWORD_VAR)
+	{
+		parse_variable_declaration_block();
+	}
+
+	m_ir = std::make_unique<ir::Builder>(m_program.functions.back());
+
+	parse_block_statement();
+
+	if (is_function)
+	{
+		m_ir->load_variable({name, {function.return_type}, m_symbols.intern(name)});
+		m_ir->return_value();
+	}
+	else
+	{
+		m_ir->return_from_function();
+	}
+
+	read_token(SEMICOLON, fmt::format("expected ';' after the body of {} '{}'", kind.str(), name));
+
+	m_variables    = globals;
+	m_in_procedure = false;
 }
 
 void Compiler::parse_include()
 {
+	// The includer would need this include to be declared again when loaded from the cache
+	mark_include_uncacheable();
+
 	read_token(); // consume INCLUDE
 
 	expect_token(TOKEN::STRINGCONST, "expected string literal after INCLUDE directive");
@@ -541,22 +872,26 @@ void Compiler::parse_include()
 		return;
 	}
 
-	std::ifstream included_source{path};
+	// Relative to the working directory of the client when compiling for a compile server
+	const bool in_working_directory = !m_config.working_directory.empty() && (path.empty() || path.front() != '/');
 
-	if (!included_source)
+	std::unique_ptr<SourceFile> included_source
+		= SourceFile::open(in_working_directory ? m_config.working_directory + '/' + path : path);
+
+	if (included_source == nullptr)
 	{
 		for (const std::string& directory : m_config.include_lookup_paths)
 		{
-			included_source.open(directory + '/' + path);
+			included_source = SourceFile::open(directory + '/' + path);
 
-			if (included_source)
+			if (included_source != nullptr)
 			{
 				break;
 			}
 		}
 	}
 
-	if (!included_source)
+	if (included_source == nullptr)
 	{
 		try
 		{
@@ -575,15 +910,29 @@ void Compiler::parse_include()
 		}
 	}
 
+	if (m_include_cache != nullptr && m_include_cache->load(*included_source))
+	{
+		return;
+	}
+
 	// Create new lexer state and save old state
-	auto new_lexer_state   = std::unique_ptr<yyFlexLexer>{new yyFlexLexer(included_source, m_output_stream)};
+	auto new_lexer_state   = std::make_unique<Tokeniser>(*included_source);
 	auto old_lexer_state   = std::move(m_lexer);
 	m_lexer                = std::move(new_lexer_state);
 	auto old_current_token = m_current_token;
-	m_file_name_stack.push(path);
+	m_sources.push_back(std::move(included_source));
+
+	if (m_include_cache != nullptr)
+	{
+		m_include_recordings.push_back({m_include_cache->snapshot()});
+	}
 
 	const auto restore_state = [&] {
-		m_file_name_stack.pop();
+		if (m_include_cache != nullptr)
+		{
+			m_include_recordings.pop_back();
+		}
+
 		m_lexer         = std::move(old_lexer_state);
 		m_current_token = old_current_token;
 	};
@@ -607,10 +956,23 @@ void Compiler::parse_include()
 		throw;
 	}
 
+	if (m_include_cache != nullptr && m_include_recordings.back().cacheable)
+	{
+		m_include_cache->save(m_lexer->source(), m_include_recordings.back().start);
+	}
+
 	// Restore old state
 	restore_state();
 }
 
+void Compiler::mark_include_uncacheable()
+{
+	if (!m_include_recordings.empty())
+	{
+		m_include_recordings.back().cacheable = false;
+	}
+}
+
 Type Compiler::parse_type(bool allow_void)
 {
 	if (allow_void && try_read_token(VOID))
@@ -636,13 +998,20 @@ Type Compiler::parse_type(bool allow_void)
 
 	if (m_current_token == ID)
 	{
-		const auto it = m_typedefs.find(token_text());
+		const auto* it = m_typedefs.find(m_symbols.intern(token_text()));
 
-		if (it == m_typedefs.end())
+		if (it == nullptr)
 		{
 			error("expected type but identifier does not refer to any type definition");
 		}
 
+		// Types declared before the include may be different when it is loaded from the cache
+		if (!m_include_recordings.empty()
+			&& std::size_t(it - &*m_typedefs.begin()) < m_include_recordings.back().start.typedefs)
+		{
+			mark_include_uncacheable();
+		}
+
 		read_token();
 
 		return it->second;
@@ -653,11 +1022,117 @@ Type Compiler::parse_type(bool allow_void)
 		UserType type(UserType::Category::POINTER);
 		type.layout_data.pointer.target = parse_type(false);
 
-		return create_type(type);
+		if (find_array_type(type.layout_data.pointer.target) != nullptr)
+		{
+			error("pointers to arrays are not supported");
+		}
+
+		return m_user_types.intern(type);
 	}
 
-	error("expected type");
-}
+	if (try_read_token(KEYWORD_ARRAY))
+	{
+		read_token(RBRACKET, "expected '[' after 'ARRAY'");
+
+		expect_token(INTEGER_LITERAL, "expected integer literal as low bound of array");
+		const std::uint64_t low = parse_integer_literal().value;
+
+		read_token(DOTDOT, "expected '..' between the bounds of array");
+
+		expect_token(INTEGER_LITERAL, "expected integer literal as high bound of array");
+		const std::uint64_t high = parse_integer_literal().value;
+
+		read_token(LBRACKET, "expected ']' after the bounds of array");
+		read_token(KEYWORD_OF, "expected 'OF' after the bounds of array");
+
+		if (high < low)
+		{
+			error(fmt::format("high bound {} of array is lower than its low bound {}", high, low));
+		}
+
+		// Keeps the size of the array and the offsets of its elements far from overflowing
+		constexpr std::uint64_t max_array_length = std::uint64_t(1) << 32;
+
+		if (high - low >= max_array_length)
+		{
+			error(fmt::format("array of {} elements is too large", high - low + 1));
+		}
+
+		UserType type(UserType::Category::ARRAY);
+		type.layout_data.array.low     = low;
+		type.layout_data.array.high    = high;
+		type.layout_data.array.element = parse_type(false);
+
+		if (find_array_type(type.layout_data.array.element) != nullptr)
+		{
+			error("arrays of arrays are not supported");
+		}
+
+		return m_user_types.intern(type);
+	}
+
+	if (m_current_token == KEYWORD_RECORD)
+	{
+		// Unlike other user types, records with the same fields are still different types
+		return parse_record_type(m_user_types.create_record());
+	}
+
+	error("expected type");
+}
+
+Type Compiler::parse_record_type(Type record_type)
+{
+	read_token(); // RECORD
+
+	// The record is known while parsing its fields, so that they may point to it but not contain it
+	UserType::RecordType& record = m_user_types.find(record_type)->layout_data.record;
+
+	// Field declarations are separated by ';', which is optional after the last one
+	while (m_current_token != KEYWORD_END)
+	{
+		std::vector<std::string> names;
+
+		do
+		{
+			expect_token(ID, "expected field name in record");
+			names.push_back(token_text());
+			read_token();
+		} while (try_read_token(COMMA));
+
+		read_token(COLON, "expected ':' after field names in record");
+
+		const Type field_type = parse_type();
+
+		if (find_array_type(field_type) != nullptr || find_record_type(field_type) != nullptr)
+		{
+			error("fields of array or record type are not supported");
+		}
+
+		for (const std::string& name : names)
+		{
+			if (record.find_field(name) != record.fields.size())
+			{
+				error(fmt::format("duplicate field '{}' in record", name));
+			}
+
+			record.fields.push_back({name, field_type});
+		}
+
+		if (!try_read_token(SEMICOLON))
+		{
+			break;
+		}
+	}
+
+	read_token(KEYWORD_END, "expected 'END' after the fields of record");
+
+	if (record.fields.empty())
+	{
+		error("record has no fields");
+	}
+
+	return record_type;
+}
 
 void Compiler::parse_type_definition()
 {
@@ -669,53 +1144,274 @@ void Compiler::parse_type_definition()
 
 	read_token(TOKEN::EQUAL, "expected '=' after aliased name in TYPE declaration");
 
-	const Type aliased = parse_type();
-
-	read_token(TOKEN::SEMICOLON, "expected ';' after TYPE declaration");
-
-	const auto emplace_result = m_typedefs.emplace(alias, aliased);
-	const bool success        = emplace_result.second;
-
-	if (!success)
+	if (m_typedefs.contains(m_symbols.intern(alias)))
 	{
 		error(fmt::format("duplicate declaration of type '{}'", alias));
 	}
+
+	// Records are named before their fields are parsed, so that they can point to themselves, e.g. in linked lists
+	if (m_current_token == KEYWORD_RECORD)
+	{
+		const Type record_type = m_user_types.create_record(alias);
+		m_typedefs.emplace(m_symbols.intern(alias), record_type);
+		parse_record_type(record_type);
+	}
+	else
+	{
+		m_typedefs.emplace(m_symbols.intern(alias), parse_type());
+	}
+
+	read_token(TOKEN::SEMICOLON, "expected ';' after TYPE declaration");
 }
 
-Type Compiler::parse_expression()
+Compiler::Expression Compiler::parse_expression()
 {
-	const Type first_type = parse_simple_expression();
+	const Expression first = parse_simple_expression();
 
 	if (is_token_relop(m_current_token))
 	{
 		const TOKEN op_token = m_current_token;
 		read_token();
 
-		const Type nth_type = parse_simple_expression();
-		check_type(first_type, nth_type);
+		const Expression nth = parse_simple_expression();
+		check_type(first.type, nth.type);
+
+		return apply_binary_operation(op_token, first, nth);
+	}
+
+	return first;
+}
+
+Type Compiler::emit_expression(const Expression& expression)
+{
+	if (expression.is_constant)
+	{
+		if (expression.type == Type::DOUBLE)
+		{
+			m_ir->load_f64(expression.as_f64());
+		}
+		else
+		{
+			m_ir->load_constant(expression.type, expression.value);
+		}
+	}
+
+	return expression.type;
+}
+
+Compiler::Expression Compiler::apply_binary_operation(TOKEN op_token, const Expression& left, const Expression& right)
+{
+	Expression result;
+
+	if (fold_binary_operation(op_token, left, right, result))
+	{
+		return result;
+	}
+
+	if (left.is_constant && !right.is_constant)
+	{
+		// The code of the right operand was already generated: the constant has to go below it
+		emit_expression(left);
+		m_ir->swap_operands();
+	}
+	else
+	{
+		emit_expression(left);
+		emit_expression(right);
+	}
+
+	const Type type = left.type;
+
+	switch (op_token)
+	{
+	case TOKEN::MULOP_AND: m_ir->alu_binary(ir::Opcode::AND, type); break;
+	case TOKEN::MULOP_MUL: m_ir->alu_binary(ir::Opcode::MUL, type); break;
+	case TOKEN::MULOP_DIV: m_ir->alu_binary(ir::Opcode::DIV, type); break;
+	case TOKEN::MULOP_MOD: m_ir->alu_binary(ir::Opcode::MOD, type); break;
+	case TOKEN::ADDOP_OR: m_ir->alu_binary(ir::Opcode::OR, type); break;
+	case TOKEN::ADDOP_ADD: m_ir->alu_binary(ir::Opcode::ADD, type); break;
+	case TOKEN::ADDOP_SUB: m_ir->alu_binary(ir::Opcode::SUB, type); break;
+	case TOKEN::RELOP_EQU: m_ir->alu_compare(ir::Comparison::EQUAL); break;
+	case TOKEN::RELOP_DIFF: m_ir->alu_compare(ir::Comparison::NOT_EQUAL); break;
+	case TOKEN::RELOP_SUPE: m_ir->alu_compare(ir::Comparison::GREATER_EQUAL); break;
+	case TOKEN::RELOP_INFE: m_ir->alu_compare(ir::Comparison::LOWER_EQUAL); break;
+	case TOKEN::RELOP_INF: m_ir->alu_compare(ir::Comparison::LOWER); break;
+	case TOKEN::RELOP_SUP: m_ir->alu_compare(ir::Comparison::GREATER); break;
+	default: bug("unknown binary operator");
+	}
+
+	return Expression::runtime(is_token_relop(op_token) ? Type::BOOLEAN : type);
+}
+
+bool Compiler::fold_binary_operation(
+	TOKEN op_token, const Expression& left, const Expression& right, Expression& result) const
+{
+	if (!left.is_constant || !right.is_constant)
+	{
+		return false;
+	}
+
+	if (is_token_relop(op_token))
+	{
+		// Comparisons are evaluated from the flags set by cmp or ucomisd, with unsigned conditions.
+		// Unordered DOUBLE operands (i.e. NaN) set both ZF and CF.
+		bool zero, carry;
+
+		if (left.type == Type::UNSIGNED_INT)
+		{
+			zero  = left.value == right.value;
+			carry = left.value < right.value;
+		}
+		else if (left.type == Type::DOUBLE)
+		{
+			const double a = left.as_f64(), b = right.as_f64();
+			const bool   unordered = std::isnan(a) || std::isnan(b);
+
+			zero  = unordered || a == b;
+			carry = unordered || a < b;
+		}
+		else
+		{
+			return false;
+		}
+
+		bool holds;
+
+		switch (op_token)
+		{
+		case TOKEN::RELOP_EQU: holds = zero; break;
+		case TOKEN::RELOP_DIFF: holds = !zero; break;
+		case TOKEN::RELOP_SUPE: holds = !carry; break;
+		case TOKEN::RELOP_INFE: holds = carry || zero; break;
+		case TOKEN::RELOP_INF: holds = carry; break;
+		case TOKEN::RELOP_SUP: holds = !carry && !zero; break;
+		default: return false;
+		}
+
+		result = Expression::constant(Type::BOOLEAN, holds ? ~std::uint64_t(0) : 0);
+		return true;
+	}
+
+	switch (left.type)
+	{
+	case Type::BOOLEAN:
+	{
+		switch (op_token)
+		{
+		case TOKEN::MULOP_AND: result = Expression::constant(Type::BOOLEAN, left.value & right.value); return true;
+		case TOKEN::ADDOP_OR: result = Expression::constant(Type::BOOLEAN, left.value | right.value); return true;
+		default: return false;
+		}
+	}
+
+	case Type::UNSIGNED_INT:
+	{
+		const std::uint64_t a = left.value, b = right.value;
+		std::uint64_t       value;
+
+		switch (op_token)
+		{
+		case TOKEN::ADDOP_ADD: value = a + b; break;
+		case TOKEN::ADDOP_SUB: value = a - b; break;
+		case TOKEN::MULOP_MUL: value = a * b; break;
+		case TOKEN::MULOP_DIV:
+		case TOKEN::MULOP_MOD:
+		{
+			if (b == 0)
+			{
+				return false;
+			}
+
+			value = op_token == TOKEN::MULOP_DIV ? a / b : a % b;
+			break;
+		}
+
+		default: return false;
+		}
+
+		result = Expression::constant(Type::UNSIGNED_INT, value);
+		return true;
+	}
+
+	case Type::DOUBLE:
+	{
+		const double a = left.as_f64(), b = right.as_f64();
+		double       value;
+
+		// x87 arithmetic rounds to extended precision first, so only the SSE2 results can be reproduced exactly
+		const bool exact_arithmetic = m_config.floating_point_unit == FloatingPointUnit::SSE2;
 
 		switch (op_token)
 		{
-		case TOKEN::RELOP_EQU: m_codegen->alu_equal(first_type); break;
-		case TOKEN::RELOP_DIFF: m_codegen->alu_not_equal(first_type); break;
-		case TOKEN::RELOP_SUPE: m_codegen->alu_greater_equal(first_type); break;
-		case TOKEN::RELOP_INFE: m_codegen->alu_lower_equal(first_type); break;
-		case TOKEN::RELOP_INF: m_codegen->alu_lower(first_type); break;
-		case TOKEN::RELOP_SUP: m_codegen->alu_greater(first_type); break;
-		default: bug("unknown comparison operator");
+		case TOKEN::ADDOP_ADD: value = a + b; break;
+		case TOKEN::ADDOP_SUB: value = a - b; break;
+		case TOKEN::MULOP_MUL: value = a * b; break;
+		case TOKEN::MULOP_DIV: value = a / b; break;
+		case TOKEN::MULOP_MOD: value = std::fmod(a, b); break;
+		default: return false;
 		}
 
-		return Type::BOOLEAN;
+		// The sign and payload of a generated NaN depend on the hardware
+		if ((!exact_arithmetic && op_token != TOKEN::MULOP_MOD) || std::isnan(value))
+		{
+			return false;
+		}
+
+		result = Expression::constant_f64(value);
+		return true;
+	}
+
+	default:
+	{
+		return false;
+	}
+	}
+}
+
+bool Compiler::fold_conversion(const Expression& source, Type destination, Expression& result) const
+{
+	if (!source.is_constant)
+	{
+		return false;
+	}
+
+	// This mirrors the cases supported by CodeGen::convert
+	const bool source_integral = check_enum_range(source.type, Type::FIRST_INTEGRAL, Type::LAST_INTEGRAL);
+	const bool destination_integral
+		= check_enum_range(destination, Type::FIRST_INTEGRAL, Type::LAST_INTEGRAL) || destination == Type::CHAR;
+
+	if (source.type == destination || ((source_integral || destination == Type::CHAR) && destination_integral))
+	{
+		result = Expression::constant(destination, source.value);
+		return true;
+	}
+
+	if (source_integral && destination == Type::DOUBLE)
+	{
+		// cvtsi2sd converts from a signed integer
+		result = Expression::constant_f64(double(std::int64_t(source.value)));
+		return true;
 	}
 
-	return first_type;
+	if (source.type == Type::DOUBLE && destination_integral)
+	{
+		// cvttsd2si truncates, and returns the "integer indefinite" value for NaN and out of range values
+		const double value    = source.as_f64();
+		const bool   in_range = value >= -9223372036854775808.0 && value < 9223372036854775808.0;
+
+		result = Expression::constant(
+			destination, in_range ? std::uint64_t(std::int64_t(value)) : std::uint64_t(0x8000000000000000));
+		return true;
+	}
+
+	return false;
 }
 
 Variable Compiler::parse_assignment_statement()
 {
 	expect_token(ID, "expected an identifier");
 
-	const std::string name = token_text();
+	const string_view name = token_text();
 	read_token(); // We needed the token_text up until now - consume the identifier
 
 	return parse_assignment_statement_after_identifier(name);
@@ -723,134 +1419,238 @@ Variable Compiler::parse_assignment_statement()
 
 Variable Compiler::parse_assignment_statement_after_identifier(string_view name)
 {
-	const auto it = m_variables.find(name);
+	const Destination destination = parse_destination_after_identifier(name);
 
-	if (it == m_variables.end())
+	read_token(ASSIGN, "expected ':=' in variable assignment");
+
+	const Type type = emit_expression(parse_expression());
+	check_type(type, destination.type);
+
+	store_to_destination(destination, type);
+
+	// Only assignments to whole variables may initialize the variable of a FOR loop
+	const bool is_variable = destination.array == nullptr && !destination.field.is_set()
+		&& destination.dereferences.empty();
+
+	return is_variable ? destination.variable : Variable{};
+}
+
+Compiler::Destination Compiler::parse_destination_after_identifier(string_view name)
+{
+	const auto* it = m_variables.find(m_symbols.intern(name));
+
+	if (it == nullptr)
 	{
 		error(fmt::format("assignment of undeclared variable '{}'", name.str()));
 	}
 
-	const VariableType& variable_type = it->second;
+	Destination destination;
+	destination.variable = {name, it->second, it->first};
+	destination.array    = find_array_type(destination.variable.type.type);
+
+	Type current_type = destination.variable.type.type;
+
+	if (destination.array != nullptr)
+	{
+		parse_array_index(*destination.array);
+		current_type = destination.array->element;
+	}
 
-	if (m_current_token == TOKEN::EXPONENT)
+	if (find_record_type(current_type) != nullptr)
 	{
-		Type current_type = variable_type.type;
+		destination.field = parse_field_access(current_type, current_type);
+	}
 
-		std::vector<Type> dereference_stack;
+	destination.selected_type = current_type;
+
+	while (try_read_token(TOKEN::EXPONENT))
+	{
+		const UserType::PointerType* pointer = find_pointer_type(current_type);
 
-		while (try_read_token(TOKEN::EXPONENT))
+		if (pointer == nullptr)
 		{
-			// TODO: deduplicate code with parse_factor()
-			const auto it = m_user_types.find(current_type);
+			error(fmt::format("cannot dereference non-pointer type '{}'", type_name(current_type)));
+		}
 
-			if (it == m_user_types.end() || it->second.category != UserType::Category::POINTER)
-			{
-				error(fmt::format("cannot dereference non-pointer type '{}'", type_name(current_type).str()));
-			}
+		current_type = pointer->target;
 
-			const UserType& type = it->second;
+		ir::FieldAccess dereferenced_field;
 
-			dereference_stack.push_back(type.layout_data.pointer.target);
-			current_type = type.layout_data.pointer.target;
+		if (find_record_type(current_type) != nullptr)
+		{
+			dereferenced_field = parse_field_access(current_type, current_type);
 		}
 
-		// TODO: deduplicate code with below
-		read_token(ASSIGN, "expected ':=' in variable assignment");
+		destination.dereferences.emplace_back(current_type, dereferenced_field);
+	}
 
-		Type type = parse_expression();
+	if (find_record_type(current_type) != nullptr)
+	{
+		error("records can only be assigned a field at a time");
+	}
 
-		m_codegen->load_variable({name, variable_type});
+	destination.type = current_type;
+	return destination;
+}
 
-		dereference_stack.resize(dereference_stack.size() - 1); // ignore the last one
-		for (const Type type : dereference_stack)
+void Compiler::store_to_destination(const Destination& destination, Type value_type)
+{
+	const Variable& variable = destination.variable;
+
+	if (destination.dereferences.empty())
+	{
+		if (destination.array != nullptr)
 		{
-			m_codegen->load_value_from_pointer(type);
+			m_ir->store_element(variable, value_type, destination.field);
+		}
+		else if (destination.field.is_set())
+		{
+			m_ir->store_field(variable, destination.field, value_type);
+		}
+		else
+		{
+			m_ir->store_variable(variable);
 		}
 
-		m_codegen->store_value_to_pointer(type);
-
-		check_type(type, current_type);
-
-		return {};
+		return;
 	}
 
-	read_token(ASSIGN, "expected ':=' in variable assignment");
-
-	Type type = parse_expression();
+	// The pointer is loaded last, on top of the value to store
+	if (destination.array != nullptr)
+	{
+		// The index was pushed before the value
+		m_ir->swap_operands();
+		m_ir->load_element(variable, destination.selected_type, destination.field);
+	}
+	else if (destination.field.is_set())
+	{
+		m_ir->load_field(variable, destination.field, destination.selected_type);
+	}
+	else
+	{
+		m_ir->load_variable(variable);
+	}
 
-	m_codegen->store_variable({name, variable_type});
+	const auto& dereferences = destination.dereferences;
 
-	check_type(type, variable_type.type);
+	for (std::size_t i = 0; i + 1 < dereferences.size(); ++i)
+	{
+		m_ir->load_value_from_pointer(dereferences[i].first, dereferences[i].second);
+	}
 
-	return {name, variable_type};
+	m_ir->store_value_to_pointer(value_type, dereferences.back().second);
 }
 
 void Compiler::parse_if_statement()
 {
-	IfStatement if_statement;
-	m_codegen->statement_if_prepare(if_statement);
-
 	read_token();
-	check_type(parse_expression(), Type::BOOLEAN);
+	check_type(emit_expression(parse_expression()), Type::BOOLEAN);
 
 	read_token(KEYWORD_THEN, "expected 'THEN' after conditional expression of 'IF' statement");
 
-	m_codegen->statement_if_post_check(if_statement);
+	const ir::BlockId then_block = m_ir->create_block();
+	const ir::BlockId else_block = m_ir->create_block();
+	m_ir->branch(then_block, else_block);
 
+	m_ir->set_insertion_block(then_block);
 	parse_statement();
 
 	if (try_read_token(KEYWORD_ELSE))
 	{
-		m_codegen->statement_if_with_else(if_statement);
+		const ir::BlockId next_block = m_ir->create_block();
+		m_ir->jump(next_block);
+
+		m_ir->set_insertion_block(else_block);
 		parse_statement();
+		m_ir->jump(next_block);
+
+		m_ir->set_insertion_block(next_block);
 	}
 	else
 	{
-		m_codegen->statement_if_without_else(if_statement);
+		// Without an ELSE, the false branch is directly the statement after the IF
+		m_ir->jump(else_block);
+		m_ir->set_insertion_block(else_block);
 	}
-
-	m_codegen->statement_if_finalize(if_statement);
 }
 
 void Compiler::parse_while_statement()
 {
-	WhileStatement while_statement;
-	m_codegen->statement_while_prepare(while_statement);
+	const ir::BlockId condition_block = m_ir->create_block();
+	m_ir->jump(condition_block);
+	m_ir->set_insertion_block(condition_block);
 
 	read_token();
-	const Type type = parse_expression();
+	const Type type = emit_expression(parse_expression());
 	check_type(type, Type::BOOLEAN);
 
 	read_token(KEYWORD_DO, "expected 'DO' after conditional expression of 'WHILE' statement");
 
-	m_codegen->statement_while_post_check(while_statement);
+	const ir::BlockId body_block = m_ir->create_block();
+	const ir::BlockId next_block = m_ir->create_block();
+	m_ir->branch(body_block, next_block);
 
+	m_ir->set_insertion_block(body_block);
 	parse_statement();
+	m_ir->jump(condition_block);
 
-	m_codegen->statement_while_finalize(while_statement);
+	m_ir->set_insertion_block(next_block);
 }
 
 void Compiler::parse_for_statement()
 {
+	const std::size_t line = m_lexer->span().line;
+
 	read_token();
 	const auto assignment = parse_assignment_statement();
 	check_type(assignment.type.type, Type::UNSIGNED_INT);
 
-	ForStatement for_statement;
-	m_codegen->statement_for_prepare(for_statement, assignment);
-	m_codegen->statement_for_post_assignment(for_statement);
+	ir::ForLoop loop;
+	loop.line      = line;
+	loop.variable  = assignment.name;
+	loop.preheader = m_ir->insertion_block();
+	loop.header    = m_ir->create_block();
+
+	m_ir->jump(loop.header);
+	m_ir->set_insertion_block(loop.header);
 
 	read_token(KEYWORD_TO, "expected 'TO' after assignement in 'FOR' statement");
 
-	check_type(parse_expression(), Type::UNSIGNED_INT);
+	check_type(emit_expression(parse_expression()), Type::UNSIGNED_INT);
 
 	read_token(KEYWORD_DO, "expected 'DO' after max expression in 'FOR' statement");
 
-	m_codegen->statement_for_post_check(for_statement);
+	// The loop runs while bound >= variable, as signed integers. The bound is evaluated on every iteration, unless
+	// the loop optimizations prove it does not change.
+	m_ir->load_variable(assignment);
+	m_ir->alu_compare(ir::Comparison::SIGNED_GREATER_EQUAL);
+
+	const ir::BlockId body_block = m_ir->create_block();
+	loop.exit                    = m_ir->create_block();
+	m_ir->branch(body_block, loop.exit);
 
+	m_ir->set_insertion_block(body_block);
 	parse_statement();
 
-	m_codegen->statement_for_finalize(for_statement);
+	m_ir->load_variable(assignment);
+	m_ir->load_i64(1);
+	m_ir->alu_binary(ir::Opcode::ADD, Type::UNSIGNED_INT);
+	m_ir->store_variable(assignment);
+	m_ir->jump(loop.header);
+
+	loop.latch  = m_ir->insertion_block();
+	loop.blocks = {loop.header, body_block};
+
+	// Blocks created while parsing the body
+	for (ir::BlockId block = loop.exit + 1; block < m_program.functions.back().blocks.size(); ++block)
+	{
+		loop.blocks.push_back(block);
+	}
+
+	const ir::BlockId exit_block = loop.exit;
+	m_for_loops.emplace_back(m_program.functions.size() - 1, std::move(loop));
+
+	m_ir->set_insertion_block(exit_block);
 }
 
 void Compiler::parse_block_statement()
@@ -876,15 +1676,67 @@ void Compiler::parse_block_statement()
 void Compiler::parse_display_statement()
 {
 	read_token();
-	const Type type = parse_expression();
+	const Type type = emit_expression(parse_expression());
 
 	// check if user defined, if not its not allowed
 	if (check_enum_range(type, Type::FIRST_USER_DEFINED, Type::LAST_USER_DEFINED))
 	{
-		error(fmt::format("DISPLAY is not supported for type {}", type_name(type).str()));
+		error(fmt::format("DISPLAY is not supported for type {}", type_name(type)));
+	}
+
+	m_ir->debug_display();
+}
+
+void Compiler::parse_new_statement()
+{
+	read_token(); // NEW
+	read_token(LPARENT, "expected '(' after NEW");
+
+	expect_token(ID, "expected pointer variable in NEW");
+	const std::string name = token_text();
+	read_token();
+
+	const Destination            destination = parse_destination_after_identifier(name);
+	const UserType::PointerType* pointer     = find_pointer_type(destination.type);
+
+	if (pointer == nullptr)
+	{
+		error(fmt::format("NEW expects a pointer, not '{}'", type_name(destination.type)));
+	}
+
+	read_token(RPARENT, "expected ')' after pointer in NEW");
+
+	// The size of records is only known once they were laid out
+	m_ir->allocate(destination.type, find_record_type(pointer->target) != nullptr ? 0 : value_size(pointer->target));
+	store_to_destination(destination, destination.type);
+}
+
+void Compiler::parse_dispose_statement()
+{
+	read_token(); // DISPOSE
+	read_token(LPARENT, "expected '(' after DISPOSE");
+
+	const Type                   type    = emit_expression(parse_expression());
+	const UserType::PointerType* pointer = find_pointer_type(type);
+
+	if (pointer == nullptr)
+	{
+		error(fmt::format("DISPOSE expects a pointer, not '{}'", type_name(type)));
 	}
 
-	m_codegen->debug_display(type);
+	read_token(RPARENT, "expected ')' after pointer in DISPOSE");
+
+	m_ir->dispose(find_record_type(pointer->target) != nullptr ? 0 : value_size(pointer->target));
+}
+
+void Compiler::parse_arena_statement()
+{
+	read_token(); // ARENA
+
+	// Nothing can leave the statement early, so the arena always ends
+	m_ir->function_call(runtime::arena_begin_function, Type::VOID, 0, false, true);
+	parse_statement();
+	m_ir->function_call(runtime::arena_end_function, Type::VOID, 0, false, true);
 }
 
 void Compiler::parse_statement()
@@ -896,6 +1748,9 @@ void Compiler::parse_statement()
 	case TOKEN::KEYWORD_FOR: parse_for_statement(); break;
 	case TOKEN::KEYWORD_BEGIN: parse_block_statement(); break;
 	case TOKEN::KEYWORD_DISPLAY: parse_display_statement(); break;
+	case TOKEN::KEYWORD_NEW: parse_new_statement(); break;
+	case TOKEN::KEYWORD_DISPOSE: parse_dispose_statement(); break;
+	case TOKEN::KEYWORD_ARENA: parse_arena_statement(); break;
 	case TOKEN::ID: parse_statement_identifier(); break;
 	default: error("expected statement");
 	}
@@ -903,81 +1758,288 @@ void Compiler::parse_statement()
 
 void Compiler::parse_main_block_statement()
 {
-	m_codegen->begin_main_procedure();
+	m_program.functions.emplace_back();
+
+	ir::Function& main_function = m_program.functions.back();
+	main_function.name          = "main";
+	m_ir                        = std::make_unique<ir::Builder>(main_function);
 
 	parse_block_statement();
+
+	// The tokenizer reads e.g. "END.." as the range operator, which is still the final '.' followed by garbage
+	if (m_current_token == DOTDOT)
+	{
+		error("extraneous characters at end of file. did you use '.' instead of ';'?");
+	}
+
 	read_token(DOT, "expected '.' at end of program");
 
-	m_codegen->finalize_main_procedure();
+	m_ir->return_from_function();
 }
 
 void Compiler::parse_program()
 {
-	m_codegen->begin_executable_section();
 	parse_declaration_block();
 	parse_main_block_statement();
-	m_codegen->finalize_executable_section();
+	declare_global_variables();
+}
+
+const UserType::ArrayType* Compiler::find_array_type(Type type) const
+{
+	const UserType* user_type = m_user_types.find(type);
+
+	if (user_type == nullptr || user_type->category != UserType::Category::ARRAY)
+	{
+		return nullptr;
+	}
+
+	return &user_type->layout_data.array;
+}
+
+const UserType::RecordType* Compiler::find_record_type(Type type) const
+{
+	const UserType* user_type = m_user_types.find(type);
+
+	if (user_type == nullptr || user_type->category != UserType::Category::RECORD)
+	{
+		return nullptr;
+	}
 
-	m_codegen->begin_global_data_section();
-	emit_global_variables();
-	m_codegen->finalize_global_data_section();
+	return &user_type->layout_data.record;
 }
 
-Type Compiler::create_type(UserType user_type)
+const UserType::PointerType* Compiler::find_pointer_type(Type type) const
 {
-	// TODO: have another map for the opposite lookup
-	for (const auto it : m_user_types)
+	const UserType* user_type = m_user_types.find(type);
+
+	if (user_type == nullptr || user_type->category != UserType::Category::POINTER)
 	{
-		const Type      other_type      = it.first;
-		const UserType& other_user_type = it.second;
+		return nullptr;
+	}
 
-		if (user_type == other_user_type)
-		{
-			return other_type;
-		}
+	return &user_type->layout_data.pointer;
+}
+
+void Compiler::mark_foreign_type(Type type)
+{
+	if (const UserType::PointerType* pointer = find_pointer_type(type))
+	{
+		mark_foreign_type(pointer->target);
+		return;
 	}
 
-	const auto emplace_result = m_user_types.emplace(allocate_type_id(), user_type);
-	const auto it             = emplace_result.first;
-	const bool success        = emplace_result.second;
+	UserType* user_type = m_user_types.find(type);
 
-	if (!success)
+	if (user_type == nullptr || user_type->category != UserType::Category::RECORD)
+	{
+		return;
+	}
+
+	UserType::RecordType& record = user_type->layout_data.record;
+
+	if (record.foreign)
+	{
+		return;
+	}
+
+	record.foreign = true;
+
+	for (const UserType::RecordType::Field& field : record.fields)
+	{
+		mark_foreign_type(field.type);
+	}
+}
+
+//! \brief Choose the offset of every field of \p record, then its size and alignment.
+//!
+//! \details
+//!		Foreign records follow the C ABI: fields are in declaration order, each aligned to its size.
+//!		Fields of the other records are ordered by size and heat, with the hot 8-byte fields first, then the hot
+//!		bytes, the cold bytes and finally the cold 8-byte fields. Hot fields are thus packed together at the start of
+//!		the record and padding is only ever needed once, between the bytes and the cold 8-byte fields.
+//!
+//! \param heat The weighted number of accesses to each field.
+static void lay_out_record(UserType::RecordType& record, const std::vector<std::uint64_t>& heat)
+{
+	std::vector<std::size_t> order(record.fields.size());
+
+	for (std::size_t i = 0; i < order.size(); ++i)
 	{
-		bug("type id was already allocated");
+		order[i] = i;
 	}
 
-	return it->first;
+	if (!record.foreign)
+	{
+		const std::uint64_t hottest = *std::max_element(heat.begin(), heat.end());
+
+		// Fields accessed at least an eighth as often as the hottest one are hot
+		const auto rank = [&](std::size_t i) {
+			const bool is_hot  = heat[i] != 0 && heat[i] * 8 >= hottest;
+			const bool is_wide = value_size(record.fields[i].type) == 8;
+			return is_hot ? (is_wide ? 0 : 1) : (is_wide ? 3 : 2);
+		};
+
+		std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+			return rank(a) != rank(b) ? rank(a) < rank(b) : heat[a] > heat[b];
+		});
+	}
+
+	std::size_t offset = 0;
+	record.alignment   = 1;
+
+	for (const std::size_t i : order)
+	{
+		// Fields are scalars, which are aligned to their size
+		const std::size_t size = value_size(record.fields[i].type);
+
+		record.fields[i].offset = (offset + size - 1) / size * size;
+		offset                  = record.fields[i].offset + size;
+
+		record.alignment = std::max(record.alignment, size);
+	}
+
+	record.size = (offset + record.alignment - 1) / record.alignment * record.alignment;
 }
 
-Type Compiler::allocate_type_id()
+void Compiler::lay_out_records()
 {
-	m_first_free_type = Type(underlying_cast(m_first_free_type) + 1);
-	return m_first_free_type;
+	// Each access counts 8 times more per loop around it, as a guess of how often it runs
+	constexpr std::size_t max_weighted_depth = 6;
+
+	std::unordered_map<Type, std::vector<std::uint64_t>, EnumClassHash> heats;
+
+	for (const ir::Function& function : m_program.functions)
+	{
+		const std::vector<std::size_t> depths = ir::loop_depths(function);
+
+		for (ir::BlockId block = 0; block < function.blocks.size(); ++block)
+		{
+			const std::size_t   depth  = std::min(depths[block], max_weighted_depth);
+			const std::uint64_t weight = std::uint64_t(1) << (3 * depth);
+
+			for (const ir::Instruction& instruction : function.blocks[block].instructions)
+			{
+				if (instruction.field.is_set())
+				{
+					std::vector<std::uint64_t>& heat = heats[instruction.field.record];
+					heat.resize(find_record_type(instruction.field.record)->fields.size());
+					heat[instruction.field.index] += weight;
+				}
+			}
+		}
+	}
+
+	for (UserTypeTable::Entry& entry : m_user_types)
+	{
+		if (entry.user_type.category == UserType::Category::RECORD)
+		{
+			std::vector<std::uint64_t>& heat = heats[entry.type];
+			heat.resize(entry.user_type.layout_data.record.fields.size());
+
+			lay_out_record(entry.user_type.layout_data.record, heat);
+		}
+	}
+
+	for (ir::Function& function : m_program.functions)
+	{
+		for (ir::BasicBlock& block : function.blocks)
+		{
+			for (ir::Instruction& instruction : block.instructions)
+			{
+				ir::FieldAccess& field = instruction.field;
+
+				if (field.is_set())
+				{
+					const UserType::RecordType* record = find_record_type(field.record);
+					field.offset                       = record->fields[field.index].offset;
+					field.record_size                  = record->size;
+				}
+
+				if (instruction.is(ir::Opcode::NEW) || instruction.is(ir::Opcode::DISPOSE))
+				{
+					// The pointer is the result of NEW and the operand of DISPOSE
+					const Type pointer_type
+						= instruction.has_result() ? instruction.type : function.value_types[instruction.operands[0]];
+
+					if (const UserType::RecordType* record = find_record_type(find_pointer_type(pointer_type)->target))
+					{
+						instruction.constant = record->size;
+					}
+				}
+			}
+		}
+	}
 }
 
-void Compiler::emit_global_variables()
+std::string Compiler::type_name(Type type) const { return m_user_types.name(type); }
+
+void Compiler::declare_global_variables()
 {
 	for (const auto& it : m_variables)
 	{
-		const auto&         name = it.first;
-		const VariableType& type = it.second;
+		m_program.globals.push_back({m_symbols.name(it.first), it.second, it.first});
+	}
+
+	// Sorted so that the output does not depend on the iteration order of the hash map
+	std::sort(m_program.globals.begin(), m_program.globals.end(), [](const Variable& a, const Variable& b) {
+		return a.name < b.name;
+	});
+}
+
+void Compiler::declare_variable(string_view name, VariableType type, bool parameter)
+{
+	if (!m_in_procedure)
+	{
+		if (!m_variables.emplace(m_symbols.intern(name), type))
+		{
+			error(fmt::format("duplicate declaration of variable '{}'", name.str()));
+		}
+
+		return;
+	}
+
+	ir::Function& procedure = m_program.functions.back();
 
-		m_codegen->define_global_variable({name, type});
+	if (procedure.find_local(name) != nullptr)
+	{
+		error(fmt::format("duplicate declaration of variable '{}'", name.str()));
 	}
+
+	if (type.cache_aligned)
+	{
+		error(fmt::format(
+			"local variable '{}' cannot be ALIGNED, which only applies to global variables", name.str()));
+	}
+
+	const Symbol symbol = m_symbols.intern(name);
+
+	(parameter ? procedure.parameters : procedure.locals).push_back({name, type, symbol});
+	m_variables[symbol] = type;
 }
 
-string_view Compiler::current_file() const { return m_file_name_stack.top(); }
+void Compiler::check_procedure_value_type(Type type) const
+{
+	if (find_array_type(type) != nullptr || find_record_type(type) != nullptr)
+	{
+		error("arrays and records can only be passed to and returned from procedures through pointers");
+	}
+}
+
+string_view Compiler::current_file() const { return m_lexer->source().name(); }
 
 void Compiler::show_source_context() const
 {
-	fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::white), "{}:{}: ", current_file().str(), m_lexer->lineno());
-};
+	const TokenSpan& span = m_lexer->span();
+
+	m_diagnostic_stream << fmt::format(
+		fmt::emphasis::bold | fg(fmt::color::white), "{}:{}:{}: ", current_file().str(), span.line, span.column);
+}
 
 void Compiler::error(string_view error_message) const
 {
 	show_source_context();
-	fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "error: ");
-	fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::white), "{}\n", error_message.str());
+	m_diagnostic_stream << fmt::format(fmt::emphasis::bold | fg(fmt::color::red), "error: ")
+						<< fmt::format(fmt::emphasis::bold | fg(fmt::color::white), "{}\n", error_message.str());
 
 	note(fmt::format("while reading token '{}'", token_text().str()));
 
@@ -987,14 +2049,14 @@ void Compiler::error(string_view error_message) const
 void Compiler::note(string_view note_message) const
 {
 	show_source_context();
-	fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::green_yellow), "note:  ");
-	fmt::print(stderr, "{}\n", note_message.str());
+	m_diagnostic_stream << fmt::format(fmt::emphasis::bold | fg(fmt::color::green_yellow), "note:  ")
+						<< note_message.str() << '\n';
 }
 
 void Compiler::bug(string_view error_message) const
 {
 	show_source_context();
-	fmt::print(stderr, fg(fmt::color::red), "error: COMPILER BUG!\n");
+	m_diagnostic_stream << fmt::format(fg(fmt::color::red), "error: COMPILER BUG!\n");
 
 	error(error_message);
 }
@@ -1025,11 +2087,11 @@ void Compiler::check_type(Type a, Type b) const
 
 	if (!match)
 	{
-		error(fmt::format("incompatible types: {}, {}", type_name(a).str(), type_name(b).str()));
+		error(fmt::format("incompatible types: {}, {}", type_name(a), type_name(b)));
 	}
 }
 
-string_view Compiler::token_text() const { return m_lexer->YYText(); }
+string_view Compiler::token_text() const { return m_lexer->text(); }
 
 void Compiler::expect_token(TOKEN expected, string_view error_message) const
 {
@@ -2,26 +2,32 @@
 
 #include "codegen/x86/codegen.hpp"
 #include "function.hpp"
+#include "include_cache.hpp"
+#include "ir/builder.hpp"
+#include "ir/ir.hpp"
+#include "ir/loops.hpp"
+#include "source.hpp"
+#include "symbol.hpp"
 #include "token.hpp"
+#include "tokeniser.hpp"
 #include "types.hpp"
 #include "usertype.hpp"
 #include "util/enums.hpp"
 #include "util/string_view.hpp"
 #include "variable.hpp"
 
-#include <iosfwd>
+#include <cstdint>
+#include <iostream>
 #include <memory>
-#include <stack>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-#include <FlexLexer.h>
-
 class Compiler
 {
 	friend class CodeGen;
+	friend class IncludeCache;
 
 	public:
 	enum class Target
@@ -30,75 +36,297 @@ class Compiler
 		LINUX
 	};
 
+	//! \brief Instruction set used for DOUBLE arithmetic.
+	enum class FloatingPointUnit
+	{
+		//! Scalar SSE2 instructions (addsd, ucomisd...), which every x86-64 CPU supports.
+		SSE2,
+
+		//! Legacy x87 FPU stack instructions. Opt-in fallback, mostly useful for comparison purposes.
+		X87
+	};
+
+	//! \brief Minimum x86-64 microarchitecture level of the CPUs running the generated program, which determines the
+	//! instruction set extensions the code generator may use.
+	enum class MicroArchitecture
+	{
+		//! Baseline x86-64, up to SSE2.
+		X86_64,
+
+		//! Adds SSE4.1 (roundsd), among others.
+		X86_64_V2,
+
+		//! Adds FMA and AVX2, among others.
+		X86_64_V3
+	};
+
+	//! \brief Whether array indices are checked against the bounds of the array at runtime.
+	enum class BoundsCheck
+	{
+		//! Never check indices. Out of bounds accesses read or write whatever lies next to the array.
+		OFF,
+
+		//! Check every index that is not a constant, trapping if it is out of bounds.
+		ON,
+
+		//! Like ON, but drop the checks of the indices that are proven to stay in bounds, e.g. in FOR loops.
+		AUTO
+	};
+
 	struct Config
 	{
 		std::vector<std::string> include_lookup_paths;
 		Target                   target;
+		FloatingPointUnit        floating_point_unit = FloatingPointUnit::SSE2;
+		MicroArchitecture        micro_architecture  = MicroArchitecture::X86_64;
+		BoundsCheck              bounds_check        = BoundsCheck::AUTO;
+
+		//! Whether the generated instructions go through the peephole optimizer before being written out.
+		bool peephole_optimization = true;
+
+		//! Whether to print the count of instructions removed by each peephole rule to stderr.
+		bool peephole_report = false;
+
+		//! Whether to check the stack depth computed at compile time before each call, trapping on a mismatch.
+		bool check_stack_depth = false;
+
+		//! Whether to print the intermediate representation of the program to stderr before lowering it.
+		bool emit_ir = false;
+
+		//! Whether calls to small procedures may be replaced by a copy of their body.
+		bool inline_procedures = true;
+
+		//! Whether to print to stderr why each call to a procedure was inlined or not.
+		bool inline_report = false;
+
+		//! Whether FOR loops over arrays may run several iterations at once with packed SSE2 or AVX2 instructions.
+		bool vectorize = true;
+
+		//! Whether to print to stderr why each FOR loop was vectorized or not.
+		bool vectorize_report = false;
+
+		//! Whether DOUBLE sums may be computed in another order, e.g. by vectorized loops, changing their rounding.
+		bool reassociate = false;
+
+		//! Directory where the declarations of INCLUDE'd files are cached between compilations, see IncludeCache.
+		//! Includes are always parsed if it is empty.
+		std::string include_cache_directory;
+
+		//! Entries of the include cache kept in memory by a compile server, shared with its other compilations.
+		IncludeCacheStore* include_cache_store = nullptr;
+
+		//! Directory that relative INCLUDE paths are looked up in, instead of the working directory of the process,
+		//! which a compile server shares between clients working in different directories.
+		std::string working_directory;
 	};
 
+	//! \brief Compile \p source, writing the assembly to \p output and errors and reports to \p diagnostics.
+	//! \details Compilers share no mutable state, so that several of them may run on different threads.
 	Compiler(
-		const Config& config,
-		string_view   file_name = "<stdin>.pas",
-		std::istream&           = std::cin,
-		std::ostream&           = std::cout);
+		const Config&               config,
+		std::unique_ptr<SourceFile> source,
+		std::ostream&               output      = std::cout,
+		std::ostream&               diagnostics = std::cerr);
 
 	void operator()();
 
 	private:
 	const Config& m_config;
 
-	std::stack<std::string> m_file_name_stack;
-
 	std::ostream& m_output_stream;
+	std::ostream& m_diagnostic_stream;
+
+	//! Files read so far, which are kept open because token_text() points into them.
+	std::vector<std::unique_ptr<SourceFile>> m_sources;
+
+	//! Tokeniser of the file being parsed, which is the last one of m_sources unless an INCLUDE was finished.
+	std::unique_ptr<Tokeniser> m_lexer;
+	TOKEN                      m_current_token;
 
-	std::unique_ptr<yyFlexLexer> m_lexer;
-	TOKEN                        m_current_token;
+	//! Names of the variables, types and functions, which the tables below are keyed by.
+	SymbolTable m_symbols;
 
-	std::unordered_map<std::string, VariableType>     m_variables;
-	std::unordered_map<std::string, Type>             m_typedefs;
-	std::unordered_map<Type, UserType, EnumClassHash> m_user_types;
-	std::unordered_map<std::string, Function>         m_functions;
+	//! Variables in scope: the globals, hidden by the parameters and locals of the procedure being parsed if any.
+	SymbolMap<VariableType>                           m_variables;
+	SymbolMap<Type>                                   m_typedefs;
+	UserTypeTable                                     m_user_types;
+	SymbolMap<Function>                               m_functions;
 	std::unordered_set<std::string>                   m_includes;
 
+	//! Cache of the declarations of includes, or nullptr if it is disabled.
+	std::unique_ptr<IncludeCache> m_include_cache;
+
+	//! \brief Include being parsed, whose declarations are saved to the include cache unless they depend on anything
+	//! declared outside of it.
+	struct IncludeRecording
+	{
+		IncludeCache::Snapshot start;
+		bool                   cacheable = true;
+	};
+
+	//! Includes being parsed, innermost last.
+	std::vector<IncludeRecording> m_include_recordings;
+
+	//! Program being built by the parser, which is lowered to assembly once parsing succeeded.
+	ir::Program                  m_program;
+	std::unique_ptr<ir::Builder> m_ir;
+
+	//! Whether the body of a procedure is being parsed, which is the last function of the program.
+	bool m_in_procedure = false;
+
+	//! FOR loops with the index of their function, inner loops first. They are optimized once the whole program was
+	//! parsed, when it is known which variables have their address taken.
+	std::vector<std::pair<std::size_t, ir::ForLoop>> m_for_loops;
+	std::unordered_set<std::string>                  m_address_taken_variables;
+
 	std::unique_ptr<CodeGen> m_codegen;
 
-	Type m_first_free_type = Type::FIRST_USER_DEFINED;
-
-	[[nodiscard]] Type parse_factor_identifier();
-	void               parse_statement_identifier();
-	[[nodiscard]] Type parse_character_literal();
-	[[nodiscard]] Type parse_integer_literal();
-	[[nodiscard]] Type parse_float_literal();
-	[[nodiscard]] Type parse_variable_reference();
-	[[nodiscard]] Type parse_dereferencable();
-	[[nodiscard]] Type parse_factor();
-	[[nodiscard]] Type parse_type_cast();
-	[[nodiscard]] Type parse_function_call_after_identifier(string_view name, bool expects_return = false);
-	[[nodiscard]] Type parse_variable_usage_after_identifier(string_view name);
-	[[nodiscard]] Type parse_term();
-	[[nodiscard]] Type parse_simple_expression();
-	void               parse_declaration_block();
-	void               parse_variable_declaration_block();
-	void               parse_foreign_function_declaration();
-	void               parse_include();
-	[[nodiscard]] Type parse_type(bool allow_void = false);
-	void               parse_type_definition();
-	[[nodiscard]] Type parse_expression();
-	Variable           parse_assignment_statement();
-	Variable           parse_assignment_statement_after_identifier(string_view name);
-	void               parse_if_statement();
-	void               parse_while_statement();
-	void               parse_for_statement();
-	void               parse_block_statement();
-	void               parse_display_statement();
-	void               parse_statement();
-	void               parse_main_block_statement();
-	void               parse_program();
-
-	Type create_type(UserType user_type);
-	Type allocate_type_id();
-
-	void emit_global_variables();
+	//! \brief Result of parsing an expression.
+	//! Expressions that only depend on literals are evaluated at compile time: no code is generated for them until
+	//! emit_expression() is called.
+	struct Expression
+	{
+		Type type        = Type::VOID;
+		bool is_constant = false;
+
+		//! Value of a constant expression, as the bit pattern of its runtime representation (e.g. all ones for a true
+		//! BOOLEAN).
+		std::uint64_t value = 0;
+
+		[[nodiscard]] static Expression runtime(Type type);
+		[[nodiscard]] static Expression constant(Type type, std::uint64_t value);
+		[[nodiscard]] static Expression constant_f64(double value);
+
+		[[nodiscard]] double as_f64() const;
+	};
+
+	//! \brief Where an assignment writes: a variable, an element of an array or a field of either, then maybe what
+	//! it points to after a chain of dereferences.
+	struct Destination
+	{
+		Variable variable;
+
+		//! Layout of the variable if the destination is one of its elements, nullptr otherwise.
+		const UserType::ArrayType* array = nullptr;
+
+		//! Field of the variable or of its element, if any.
+		ir::FieldAccess field;
+
+		//! Type of the variable, element or field, before dereferencing.
+		Type selected_type = Type::VOID;
+
+		//! Type reached by each dereference, with the field then accessed if any.
+		std::vector<std::pair<Type, ir::FieldAccess>> dereferences;
+
+		//! Type of the written value.
+		Type type = Type::VOID;
+	};
+
+	[[nodiscard]] Type       parse_factor_identifier();
+	void                     parse_statement_identifier();
+	[[nodiscard]] Expression parse_character_literal();
+	[[nodiscard]] Expression parse_integer_literal();
+	[[nodiscard]] Expression parse_float_literal();
+	[[nodiscard]] Type       parse_variable_reference();
+	[[nodiscard]] Expression parse_dereferencable();
+	[[nodiscard]] Expression parse_factor();
+	[[nodiscard]] Expression parse_type_cast();
+	[[nodiscard]] Type       parse_function_call_after_identifier(string_view name, bool expects_return = false);
+	[[nodiscard]] Type       parse_variable_usage_after_identifier(string_view name);
+	void                     parse_array_index(const UserType::ArrayType& array);
+	[[nodiscard]] Expression parse_term();
+	[[nodiscard]] Expression parse_simple_expression();
+	void                     parse_declaration_block();
+	void                     parse_variable_declaration_block();
+	void                     parse_foreign_function_declaration();
+	void                     parse_procedure_declaration();
+	void                     parse_include();
+	[[nodiscard]] Type       parse_type(bool allow_void = false);
+	Type                     parse_record_type(Type record_type);
+	void                     parse_type_definition();
+	[[nodiscard]] Expression parse_expression();
+	Variable                 parse_assignment_statement();
+	Variable                 parse_assignment_statement_after_identifier(string_view name);
+	void                     parse_if_statement();
+	void                     parse_while_statement();
+	void                     parse_for_statement();
+	void                     parse_block_statement();
+	void                     parse_display_statement();
+	void                     parse_new_statement();
+	void                     parse_dispose_statement();
+	void                     parse_arena_statement();
+	void                     parse_statement();
+	void                     parse_main_block_statement();
+	void                     parse_program();
+
+	//! \brief Parse the '.' and the name of a field of the record of type \p record_type.
+	//! \param field_type Set to the type of the field.
+	[[nodiscard]] ir::FieldAccess parse_field_access(Type record_type, Type& field_type);
+
+	//! \brief Parse the destination of an assignment after the name of its variable, up to the ':='. Indices are
+	//! evaluated right away.
+	[[nodiscard]] Destination parse_destination_after_identifier(string_view name);
+
+	//! \brief Generate the code writing the value on top of the operand stack, of type \p value_type, to
+	//! \p destination.
+	void store_to_destination(const Destination& destination, Type value_type);
+
+	//! \brief Generate the code loading \p expression if it is a constant, which was deferred until now.
+	Type emit_expression(const Expression& expression);
+
+	//! \brief Evaluate the binary operator \p op_token at compile time if possible, otherwise generate its code.
+	[[nodiscard]] Expression apply_binary_operation(TOKEN op_token, const Expression& left, const Expression& right);
+
+	//! \brief Evaluate the binary operator \p op_token at compile time, following the semantics of the generated code.
+	//! \returns false if an operand is not constant or if the operation cannot be folded safely, e.g. for a division
+	//! by zero, which must still trap at runtime.
+	[[nodiscard]] bool fold_binary_operation(
+		TOKEN op_token, const Expression& left, const Expression& right, Expression& result) const;
+
+	//! \brief Evaluate CONVERT \p source TO \p destination at compile time, following the semantics of the generated
+	//! code.
+	//! \returns false if \p source is not constant or if the conversion is not supported.
+	[[nodiscard]] bool fold_conversion(const Expression& source, Type destination, Expression& result) const;
+
+	//! \brief Name of \p type for diagnostics, including user-defined types.
+	[[nodiscard]] std::string type_name(Type type) const;
+
+	//! \brief Find the layout of \p type if it is an array type.
+	//! \returns nullptr otherwise.
+	[[nodiscard]] const UserType::ArrayType* find_array_type(Type type) const;
+
+	//! \brief Find the layout of \p type if it is a record type.
+	//! \returns nullptr otherwise.
+	[[nodiscard]] const UserType::RecordType* find_record_type(Type type) const;
+
+	//! \brief Find the target of \p type if it is a pointer type.
+	//! \returns nullptr otherwise.
+	[[nodiscard]] const UserType::PointerType* find_pointer_type(Type type) const;
+
+	//! \brief Give the C layout to the records that foreign functions may access through \p type, a type of their
+	//! parameters or return value.
+	void mark_foreign_type(Type type);
+
+	//! \brief Choose the layout of every record, then resolve the offsets of the fields accessed by the program and
+	//! the sizes of the records allocated by NEW.
+	//!
+	//! \details
+	//!		Records that do not cross FFI are laid out by the compiler, whose freedom to reorder fields is used to avoid
+	//!		padding and to group the hot fields, i.e. the ones accessed the most, weighted by loop depth, so that they
+	//!		share as few cache lines as possible.
+	void lay_out_records();
+
+	void declare_global_variables();
+
+	//! \brief Declare the variable \p name: a global, or a parameter or local of the procedure being parsed, which
+	//! hides the global of the same name until the end of the procedure.
+	void declare_variable(string_view name, VariableType type, bool parameter = false);
+
+	//! \brief Keep the include being parsed, if any, from being saved to the include cache.
+	void mark_include_uncacheable();
+
+	//! \brief Check that values of type \p type can be passed to and returned from procedures, i.e. in a register.
+	void check_procedure_value_type(Type type) const;
 
 	string_view current_file() const;
 
@@ -129,6 +357,7 @@ class Compiler
 	//!		- check_type(Type::ARITHMETIC, Type::UNSIGNED_INT) will show a *compiler bug error*
 	void check_type(Type a, Type b) const;
 
+	//! \brief Text of the current token, which stays valid until the compiler is destroyed.
 	[[nodiscard]] string_view token_text() const;
 
 	//! \brief If the current token is not \p expected, show \p error_message as an error.
@@ -141,6 +370,5 @@ class Compiler
 	bool try_read_token(TOKEN expected);
 
 	//! \brief Read the next token and update \var current.
-	//! \warning This will invalidate any prior token_text() references.
 	TOKEN read_token();
 };
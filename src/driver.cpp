@@ -0,0 +1,453 @@
+#include "driver.hpp"
+
+#include "source.hpp"
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <spawn.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace
+{
+std::string base_name(std::string path) { return path.substr(0, path.find_last_of('.')); }
+
+//! \brief \p path, relative to \p directory if it is a relative path.
+std::string resolve(const std::string& directory, const std::string& path)
+{
+	return path.empty() || path.front() == '/' ? path : directory + '/' + path;
+}
+
+//! \brief Run the program \p arguments[0] with \p arguments, writing what it prints to \p output.
+//! \details The program is run without a shell, since the arguments may come from any client of a compile server.
+//! \returns The status of the program as given by waitpid(), or -1 if it could not be run.
+int run_program(const std::vector<std::string>& arguments, std::ostream& output)
+{
+	std::vector<char*> argv;
+
+	for (const std::string& argument : arguments)
+	{
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	}
+
+	argv.push_back(nullptr);
+
+	// Programs run for other threads of a compile server must not keep the pipe open, which they would if they were
+	// spawned before the pipe was made close-on-exec
+	int pipe_fds[2];
+
+	if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+	{
+		return -1;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDERR_FILENO);
+
+	pid_t     pid;
+	const int spawn_error = posix_spawn(&pid, argv.front(), &actions, nullptr, argv.data(), environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipe_fds[1]);
+
+	if (spawn_error != 0)
+	{
+		close(pipe_fds[0]);
+		return -1;
+	}
+
+	char    buffer[4096];
+	ssize_t size;
+
+	while ((size = read(pipe_fds[0], buffer, sizeof(buffer))) != 0)
+	{
+		if (size > 0)
+		{
+			output.write(buffer, size);
+		}
+		else if (errno != EINTR)
+		{
+			break;
+		}
+	}
+
+	close(pipe_fds[0]);
+
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			return -1;
+		}
+	}
+
+	return status;
+}
+
+//! \brief Compilation of one input-file, whose diagnostics are kept until every file was compiled.
+struct CompileJob
+{
+	//! Empty to read stdin.
+	std::string source_path;
+
+	//! Empty to write to stdout, after the assembly of the jobs before it.
+	std::string assembly_path;
+
+	std::ostringstream assembly, diagnostics;
+	bool               succeeded = false;
+};
+
+void compile(const Compiler::Config& config, CompileJob& job, std::istream& input)
+{
+	// possibly never used
+	std::ofstream output_file;
+
+	std::unique_ptr<SourceFile> source;
+	std::ostream*               output_stream = &job.assembly;
+
+	if (job.source_path.empty())
+	{
+		source = SourceFile::read(input, "<stdin>");
+	}
+	else
+	{
+		source = SourceFile::open(job.source_path);
+
+		if (source == nullptr)
+		{
+			job.diagnostics << fmt::format("<cli>: could not open source file '{}' for reading\n", job.source_path);
+			return;
+		}
+	}
+
+	if (!job.assembly_path.empty())
+	{
+		output_stream = &output_file;
+		output_file.open(job.assembly_path);
+
+		if (!output_file)
+		{
+			job.diagnostics << fmt::format(
+				"<cli>: could not open destination file '{}' for writing\n", job.assembly_path);
+			return;
+		}
+	}
+
+	try
+	{
+		Compiler{config, std::move(source), *output_stream, job.diagnostics}();
+	}
+	catch (const std::runtime_error& e)
+	{
+		// Error was handled and displayed already
+		job.diagnostics << "<cli>: aborting due to past errors\n";
+		return;
+	}
+
+	job.succeeded = true;
+}
+
+//! \brief Run every job, on up to \p thread_count threads including the calling one.
+void compile_all(
+	const Compiler::Config& config, std::vector<CompileJob>& jobs, std::size_t thread_count, std::istream& input)
+{
+	std::atomic<std::size_t> next_job{0};
+
+	const auto work = [&] {
+		for (std::size_t i = next_job++; i < jobs.size(); i = next_job++)
+		{
+			compile(config, jobs[i], input);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (std::size_t i = 1; i < std::min(thread_count, jobs.size()); ++i)
+	{
+		threads.emplace_back(work);
+	}
+
+	work();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+} // namespace
+
+bool CliFlags::parse(int argc, char** argv, std::ostream& output, std::ostream& errors)
+{
+	CLI::App cli{
+		"cericompiler\n"
+		"Example:\n"
+		"\tcericompiler ./hello.pas -o ./hello -I /path/to/installation/std/\n"
+		"\t./hello\n"
+		"Compile server:\n"
+		"\tcericompiler --server /tmp/ceri.sock &\n"
+		"\tcericompiler --connect /tmp/ceri.sock ./hello.pas -o ./hello -I /path/to/installation/std/\n"};
+
+	try
+	{
+		parse(cli, argc, argv);
+	}
+	catch (const CLI::ParseError& e)
+	{
+		cli.exit(e, output, errors);
+		return false;
+	}
+
+	return true;
+}
+
+void CliFlags::parse(CLI::App& cli, int argc, char** argv)
+{
+	const std::map<std::string, Compiler::Target> target_map{{"x86_64-apple-darwin", Compiler::Target::APPLE_DARWIN},
+															 {"x86_64-linux", Compiler::Target::LINUX}};
+
+	const std::map<std::string, Compiler::FloatingPointUnit> fpu_map{
+		{"sse2", Compiler::FloatingPointUnit::SSE2}, {"x87", Compiler::FloatingPointUnit::X87}};
+
+	const std::map<std::string, Compiler::MicroArchitecture> march_map{
+		{"x86-64", Compiler::MicroArchitecture::X86_64},
+		{"x86-64-v2", Compiler::MicroArchitecture::X86_64_V2},
+		{"x86-64-v3", Compiler::MicroArchitecture::X86_64_V3}};
+
+	const std::map<std::string, Compiler::BoundsCheck> bounds_check_map{
+		{"off", Compiler::BoundsCheck::OFF}, {"on", Compiler::BoundsCheck::ON}, {"auto", Compiler::BoundsCheck::AUTO}};
+
+	// Default even if on unknown platform
+	config.target = Compiler::Target::LINUX;
+#ifdef __APPLE__
+	config.target = Compiler::Target::APPLE_DARWIN;
+#endif
+
+	cli.add_option(
+		"input-files",
+		source_paths,
+		".pas sources to compile, each into its own assembly file; stdin if not specified");
+
+	const auto paths_group = cli.add_option_group("output paths");
+
+	const auto option_assembly_stdout
+		= paths_group->add_flag("--assembly-stdout", assembly_stdout, "write assembly to stdout rather than a file");
+
+	const auto option_assembly_path = paths_group->add_option(
+		"-s,--assembly-output", assembly_path, "target assembly path, based on input-file if left empty");
+
+	[[maybe_unused]] const auto option_program_path = paths_group->add_option(
+		"-o,--program-output", program_path, "target program file path, a.out if left empty or unspecified");
+
+	const auto actions_group = cli.add_option_group("actions");
+
+	const auto option_should_link = actions_group->add_flag(
+		"-l,--link", should_link, "whether an executable should be generated. enabled by --program-output");
+
+	[[maybe_unused]] const auto option_runtime_library = actions_group->add_option(
+		"--runtime-library",
+		runtime_library_path,
+		"runtime library linked with the program, which implements NEW, DISPOSE, ARENA and DISPLAY");
+
+	[[maybe_unused]] const auto option_jobs = actions_group->add_option(
+		"-j,--jobs", jobs, "count of input-files compiled in parallel, or 0 for the count of cores");
+
+	[[maybe_unused]] const auto option_server = actions_group->add_option(
+		"--server",
+		server_socket,
+		"serve the compilations of clients started with --connect on this Unix socket, until killed");
+
+	const auto settings_group = cli.add_option_group("compilation settings");
+
+	[[maybe_unused]] const auto option_target
+		= settings_group->add_option("--target", config.target, "target architecture and ABI")
+			  ->transform(CLI::CheckedTransformer(target_map, CLI::ignore_case));
+
+	[[maybe_unused]] const auto option_fpu
+		= settings_group
+			  ->add_option("--fpu", config.floating_point_unit, "instruction set for DOUBLE arithmetic (sse2 or x87)")
+			  ->transform(CLI::CheckedTransformer(fpu_map, CLI::ignore_case));
+
+	[[maybe_unused]] const auto option_march
+		= settings_group
+			  ->add_option(
+				  "--march", config.micro_architecture, "minimum CPU level (x86-64, x86-64-v2 or x86-64-v3)")
+			  ->transform(CLI::CheckedTransformer(march_map, CLI::ignore_case));
+
+	[[maybe_unused]] const auto option_bounds_check
+		= settings_group
+			  ->add_option(
+				  "--bounds-check",
+				  config.bounds_check,
+				  "check array indices at runtime (off, on, or auto to skip the provably safe ones)")
+			  ->transform(CLI::CheckedTransformer(bounds_check_map, CLI::ignore_case));
+
+	[[maybe_unused]] const auto option_no_peephole
+		= settings_group->add_flag("--no-peephole", no_peephole, "disable the peephole optimizer");
+
+	[[maybe_unused]] const auto option_peephole_report = settings_group->add_flag(
+		"--peephole-report", config.peephole_report, "print how many instructions each peephole rule removed");
+
+	[[maybe_unused]] const auto option_check_stack_depth = settings_group->add_flag(
+		"--check-stack-depth", config.check_stack_depth, "trap at runtime if the stack depth is wrong at a call");
+
+	[[maybe_unused]] const auto option_emit_ir = settings_group->add_flag(
+		"--emit-ir", config.emit_ir, "print the intermediate representation of the program to stderr");
+
+	[[maybe_unused]] const auto option_no_inline
+		= settings_group->add_flag("--no-inline", no_inline, "do not replace calls to procedures by their body");
+
+	[[maybe_unused]] const auto option_inline_report = settings_group->add_flag(
+		"--inline-report", config.inline_report, "print why each call to a procedure was inlined or not");
+
+	[[maybe_unused]] const auto option_no_vectorize = settings_group->add_flag(
+		"--no-vectorize", no_vectorize, "do not run FOR loops over arrays with packed instructions");
+
+	[[maybe_unused]] const auto option_vectorize_report = settings_group->add_flag(
+		"--vectorize-report", config.vectorize_report, "print why each FOR loop was vectorized or not");
+
+	[[maybe_unused]] const auto option_reassociate = settings_group->add_flag(
+		"--reassociate",
+		config.reassociate,
+		"allow DOUBLE sums to be computed in another order, e.g. to vectorize them, which changes their rounding");
+
+	[[maybe_unused]] const auto option_lookup_paths = settings_group->add_option(
+		"-I,--include-paths",
+		config.include_lookup_paths,
+		"list of directories that can be used as base include directories");
+
+	[[maybe_unused]] const auto option_include_cache = settings_group->add_option(
+		"--include-cache",
+		config.include_cache_directory,
+		"directory where the declarations of INCLUDE'd files are cached, so that later compilations skip parsing them");
+
+	option_assembly_stdout->excludes(option_assembly_path)->excludes(option_should_link);
+
+	cli.parse(argc, argv);
+
+	config.peephole_optimization = !no_peephole;
+	config.vectorize             = !no_vectorize;
+	config.inline_procedures     = !no_inline;
+
+	if (!program_path.empty())
+	{
+		should_link = true;
+	}
+
+	// Several input-files are each written next to their source, see run()
+	if (!assembly_stdout && assembly_path.empty() && source_paths.size() <= 1)
+	{
+		assembly_path = base_name(source_paths.empty() ? "" : source_paths.front()) + ".s";
+	}
+
+	if (should_link && program_path.empty())
+	{
+		program_path = "a.out";
+	}
+}
+
+void CliFlags::resolve_paths(const std::string& directory)
+{
+	for (std::string& path : source_paths)
+	{
+		path = resolve(directory, path);
+	}
+
+	assembly_path        = resolve(directory, assembly_path);
+	program_path         = resolve(directory, program_path);
+	runtime_library_path = resolve(directory, runtime_library_path);
+
+	for (std::string& path : config.include_lookup_paths)
+	{
+		path = resolve(directory, path);
+	}
+
+	config.include_cache_directory = resolve(directory, config.include_cache_directory);
+	config.working_directory       = directory;
+}
+
+int run(const CliFlags& flags, std::istream& input, std::ostream& output, std::ostream& errors)
+{
+	if (flags.source_paths.size() > 1 && (!flags.assembly_path.empty() || flags.should_link))
+	{
+		errors << "<cli>: --assembly-output and --link require a single input-file\n";
+		return 1;
+	}
+
+	// Each file is compiled by its own Compiler. The diagnostics and the assembly written to stdout of every file are
+	// printed in the order of the command line once they are all compiled, so that neither depends on scheduling
+	std::vector<CompileJob> jobs(std::max<std::size_t>(flags.source_paths.size(), 1));
+
+	if (flags.source_paths.empty())
+	{
+		jobs.front().assembly_path = flags.assembly_path;
+	}
+
+	for (std::size_t i = 0; i < flags.source_paths.size(); ++i)
+	{
+		jobs[i].source_path   = flags.source_paths[i];
+		jobs[i].assembly_path = jobs.size() == 1 || flags.assembly_stdout ? flags.assembly_path
+																		  : base_name(flags.source_paths[i]) + ".s";
+	}
+
+	const std::size_t thread_count = flags.jobs != 0 ? flags.jobs : std::max(std::thread::hardware_concurrency(), 1u);
+	compile_all(flags.config, jobs, thread_count, input);
+
+	bool succeeded = true;
+
+	for (const CompileJob& job : jobs)
+	{
+		output << job.assembly.str() << std::flush;
+		errors << job.diagnostics.str() << std::flush;
+		succeeded = succeeded && job.succeeded;
+	}
+
+	if (!succeeded)
+	{
+		return 1;
+	}
+
+	if (flags.should_link)
+	{
+		// TODO: tweakable gcc path
+		std::vector<std::string> arguments{"/usr/bin/gcc", flags.assembly_path, "-o", flags.program_path};
+
+		if (!flags.runtime_library_path.empty())
+		{
+			arguments.push_back(flags.runtime_library_path);
+		}
+
+		arguments.push_back("-lm");
+
+		const int exit_status = run_program(arguments, errors);
+
+		if (exit_status < 0)
+		{
+			errors << "<cli>: could not run the linker\n";
+			return 1;
+		}
+
+		if (exit_status != 0)
+		{
+			const int exit_code = WIFEXITED(exit_status) ? WEXITSTATUS(exit_status) : 1;
+			errors << fmt::format("<cli>: linker unexpectedly exited with code {}\n", exit_code);
+			return exit_code;
+		}
+	}
+
+	return 0;
+}
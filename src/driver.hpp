@@ -0,0 +1,47 @@
+#pragma once
+
+#include "compiler.hpp"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Static library built from runtime/, found where the build put it unless overridden
+#ifndef CERI_RUNTIME_LIBRARY
+#	define CERI_RUNTIME_LIBRARY ""
+#endif
+
+namespace CLI
+{
+class App;
+}
+
+//! \brief What the command line asks the compiler to do.
+struct CliFlags
+{
+	std::vector<std::string> source_paths;
+	std::string              assembly_path, program_path, runtime_library_path = CERI_RUNTIME_LIBRARY;
+	bool     assembly_stdout = false, should_link = false, no_peephole = false, no_vectorize = false, no_inline = false;
+	unsigned jobs            = 0;
+
+	//! Unix socket to serve compilations on, rather than compiling anything, see run_server().
+	std::string server_socket;
+
+	Compiler::Config config;
+
+	//! \brief Parse the command line \p argv, writing the help or the errors to \p output and \p errors.
+	//! \returns Whether there is anything to do.
+	bool parse(int argc, char** argv, std::ostream& output, std::ostream& errors);
+
+	//! \brief Make the relative paths of the command line relative to \p directory, rather than to the working
+	//! directory of the process.
+	void resolve_paths(const std::string& directory);
+
+	private:
+	void parse(CLI::App& cli, int argc, char** argv);
+};
+
+//! \brief Compile and link what \p flags ask for, reading stdin from \p input and writing stdout and stderr to
+//! \p output and \p errors.
+//! \returns The exit status of the compiler.
+int run(const CliFlags& flags, std::istream& input, std::ostream& output, std::ostream& errors);
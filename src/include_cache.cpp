@@ -0,0 +1,744 @@
+#include "include_cache.hpp"
+
+#include "compiler.hpp"
+#include "util/enums.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+#include <functional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// An entry is laid out as follows, with integers in the byte order of the host and strings prefixed by their size:
+//	header:     "CERIINC\0", u32 version, hash of the sources of the layout, u64 hash of the include, u64 size of the
+//	            include
+//	records:    u64 count, then the name of each record
+//	types:      u64 count, then each type: u8 kind, followed by
+//	            - BUILTIN: u64 type
+//	            - POINTER: u64 index of its target, which is an earlier type
+//	            - ARRAY:   u64 low bound, u64 high bound, u64 index of its element, which is an earlier type
+//	            - RECORD:  u64 index of the record
+//	fields:     for each record, u64 count, then the name and the u64 index of the type of each field
+//	typedefs:   u64 count, then the alias and the u64 index of the type of each typedef
+//	variables:  u64 count, then the name, the u64 index of the type and the u8 ALIGNED flag of each variable
+//	functions:  u64 count, then the name, the u8 variadic flag, the u64 index of the return type, u64 count of
+//	            parameters and the u64 index of the type of each parameter of each foreign function
+
+// Hash of the sources the layout of entries depends on, in hexadecimal, set by CMakeLists.txt
+#ifndef CERI_INCLUDE_CACHE_LAYOUT
+#	define CERI_INCLUDE_CACHE_LAYOUT ""
+#endif
+
+namespace
+{
+constexpr string_view layout = CERI_INCLUDE_CACHE_LAYOUT;
+
+constexpr char magic[8] = {'C', 'E', 'R', 'I', 'I', 'N', 'C', '\0'};
+
+enum class TypeKind : std::uint8_t
+{
+	BUILTIN,
+	POINTER,
+	ARRAY,
+	RECORD
+};
+
+//! \brief Type stored in an entry, which refers to the types it is made of by their index in the entry.
+struct CachedType
+{
+	TypeKind kind;
+
+	//! Builtin type, index of the target or the element, or index of the record.
+	std::uint64_t value = 0;
+
+	std::uint64_t low = 0, high = 0;
+};
+
+struct CachedDeclaration
+{
+	string_view   name = "";
+	std::uint64_t type = 0;
+
+	//! ALIGNED for variables, variadic for functions.
+	bool flag = false;
+
+	//! Parameters of functions.
+	std::vector<std::uint64_t> parameters;
+};
+
+CachedDeclaration declaration(string_view name, std::uint64_t type, bool flag = false)
+{
+	CachedDeclaration result;
+	result.name = name;
+	result.type = type;
+	result.flag = flag;
+
+	return result;
+}
+
+class Writer
+{
+	public:
+	void u8(std::uint8_t value) { append(&value, sizeof(value)); }
+	void u32(std::uint32_t value) { append(&value, sizeof(value)); }
+	void u64(std::uint64_t value) { append(&value, sizeof(value)); }
+
+	void string(string_view value)
+	{
+		u64(value.size());
+		append(value.data(), value.size());
+	}
+
+	const std::string& data() const { return m_data; }
+
+	private:
+	void append(const void* data, std::size_t size) { m_data.append(static_cast<const char*>(data), size); }
+
+	std::string m_data;
+};
+
+//! \brief Reads an entry in place. Reading past its end fails the reader, which then only returns zeros.
+class Reader
+{
+	public:
+	explicit Reader(string_view data) : m_data{data} {}
+
+	std::uint8_t  u8() { return read<std::uint8_t>(); }
+	std::uint32_t u32() { return read<std::uint32_t>(); }
+	std::uint64_t u64() { return read<std::uint64_t>(); }
+
+	string_view bytes(std::uint64_t size)
+	{
+		if (!ensure(size))
+		{
+			return "";
+		}
+
+		const string_view value = m_data.substr(m_offset, std::size_t(size));
+		m_offset += std::size_t(size);
+
+		return value;
+	}
+
+	string_view string() { return bytes(u64()); }
+
+	//! \brief Read a count of items of at least \p item_size bytes, which cannot be more than there is room left for.
+	std::uint64_t count(std::size_t item_size)
+	{
+		const std::uint64_t value = u64();
+
+		if (value > (m_data.size() - m_offset) / item_size)
+		{
+			fail();
+			return 0;
+		}
+
+		return value;
+	}
+
+	//! \brief Read an index, which must be below \p bound.
+	std::uint64_t index(std::uint64_t bound)
+	{
+		const std::uint64_t value = u64();
+
+		if (value >= bound)
+		{
+			fail();
+			return 0;
+		}
+
+		return value;
+	}
+
+	bool failed() const { return m_failed; }
+	bool at_end() const { return m_offset == m_data.size(); }
+
+	private:
+	//! \brief Fail the reader, returning false.
+	bool fail()
+	{
+		m_failed = true;
+		return false;
+	}
+
+	bool ensure(std::uint64_t size) { return (!m_failed && size <= m_data.size() - m_offset) || fail(); }
+
+	template<typename T>
+	T read()
+	{
+		T value = 0;
+
+		if (ensure(sizeof(value)))
+		{
+			std::memcpy(&value, m_data.data() + m_offset, sizeof(value));
+			m_offset += sizeof(value);
+		}
+
+		return value;
+	}
+
+	string_view m_data;
+	std::size_t m_offset = 0;
+	bool        m_failed = false;
+};
+
+//! \brief Numbers the types that the declarations of an include refer to, along with the types they are made of.
+class TypeEncoder
+{
+	public:
+	TypeEncoder(
+		const UserTypeTable&                                          user_types,
+		const std::unordered_map<Type, std::uint64_t, EnumClassHash>& records) :
+		m_user_types{user_types},
+		m_records{records}
+	{
+	}
+
+	//! \brief Index of \p type, which is added after the types it is made of if it was not yet.
+	std::uint64_t index(Type type)
+	{
+		const auto it = m_indices.find(type);
+
+		if (it != m_indices.end())
+		{
+			return it->second;
+		}
+
+		CachedType      cached{TypeKind::BUILTIN, std::uint64_t(underlying_cast(type))};
+		const UserType* user_type = m_user_types.find(type);
+
+		if (user_type != nullptr)
+		{
+			switch (user_type->category)
+			{
+			case UserType::Category::POINTER:
+			{
+				cached = {TypeKind::POINTER, index(user_type->layout_data.pointer.target)};
+				break;
+			}
+
+			case UserType::Category::ARRAY:
+			{
+				const UserType::ArrayType& array = user_type->layout_data.array;
+				cached = {TypeKind::ARRAY, index(array.element), array.low, array.high};
+				break;
+			}
+
+			case UserType::Category::RECORD:
+			{
+				const auto record = m_records.find(type);
+
+				if (record == m_records.end())
+				{
+					throw std::runtime_error("cached include refers to a record it does not declare");
+				}
+
+				cached = {TypeKind::RECORD, record->second};
+				break;
+			}
+			}
+		}
+
+		m_types.push_back(cached);
+		m_indices.emplace(type, m_types.size() - 1);
+
+		return m_types.size() - 1;
+	}
+
+	const std::vector<CachedType>& types() const { return m_types; }
+
+	private:
+	const UserTypeTable&                                          m_user_types;
+	const std::unordered_map<Type, std::uint64_t, EnumClassHash>& m_records;
+
+	std::vector<CachedType>                                m_types;
+	std::unordered_map<Type, std::uint64_t, EnumClassHash> m_indices;
+};
+} // namespace
+
+std::shared_ptr<const std::string> IncludeCacheStore::find(const std::string& path, std::uint64_t hash)
+{
+	Slot current;
+	current.hash = hash;
+
+	const bool stamped = stamp(path, current);
+
+	std::lock_guard<std::mutex> lock{m_mutex};
+
+	const auto it = m_slots.find(path);
+
+	if (it == m_slots.end())
+	{
+		return nullptr;
+	}
+
+	const Slot& slot = it->second;
+
+	if (!stamped || slot.hash != current.hash || slot.modification_time != current.modification_time
+		|| slot.size != current.size)
+	{
+		m_slots.erase(it);
+		return nullptr;
+	}
+
+	return slot.entry;
+}
+
+void IncludeCacheStore::insert(const std::string& path, std::uint64_t hash, std::string entry)
+{
+	Slot slot;
+	slot.hash  = hash;
+	slot.entry = std::make_shared<const std::string>(std::move(entry));
+
+	if (!stamp(path, slot))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock{m_mutex};
+	m_slots[path] = std::move(slot);
+}
+
+bool IncludeCacheStore::stamp(const std::string& path, Slot& slot)
+{
+	struct stat status;
+
+	if (stat(path.c_str(), &status) != 0)
+	{
+		return false;
+	}
+
+#ifdef __APPLE__
+	const timespec& modification_time = status.st_mtimespec;
+#else
+	const timespec& modification_time = status.st_mtim;
+#endif
+
+	slot.modification_time = std::int64_t(modification_time.tv_sec) * 1000000000 + modification_time.tv_nsec;
+	slot.size              = std::uint64_t(status.st_size);
+
+	return true;
+}
+
+IncludeCache::IncludeCache(Compiler& compiler, std::string directory, IncludeCacheStore* store) :
+	m_compiler{compiler}, m_directory{std::move(directory)}, m_store{store}
+{
+}
+
+IncludeCache::Snapshot IncludeCache::snapshot() const
+{
+	return {
+		m_compiler.m_typedefs.size(),
+		m_compiler.m_variables.size(),
+		m_compiler.m_functions.size(),
+		m_compiler.m_user_types.size()};
+}
+
+bool IncludeCache::load(const SourceFile& source)
+{
+	const string_view   text = source.text();
+	const std::uint64_t hash = std::hash<string_view>{}(text);
+
+	if (m_store != nullptr)
+	{
+		const std::shared_ptr<const std::string> entry = m_store->find(source.name(), hash);
+
+		if (entry != nullptr && declare(*entry, hash, text.size()))
+		{
+			return true;
+		}
+	}
+
+	if (m_directory.empty())
+	{
+		return false;
+	}
+
+	const std::unique_ptr<SourceFile> entry = SourceFile::open(entry_path(hash));
+
+	if (entry == nullptr || !declare(entry->text(), hash, text.size()))
+	{
+		return false;
+	}
+
+	if (m_store != nullptr)
+	{
+		m_store->insert(source.name(), hash, entry->text().str());
+	}
+
+	return true;
+}
+
+bool IncludeCache::declare(string_view entry, std::uint64_t hash, std::size_t size)
+{
+	Reader reader{entry};
+
+	const string_view header = reader.bytes(sizeof(magic));
+
+	if (reader.failed() || std::memcmp(header.data(), magic, sizeof(magic)) != 0 || reader.u32() != version
+		|| reader.string() != layout || reader.u64() != hash || reader.u64() != size)
+	{
+		return false;
+	}
+
+	// The whole entry is read before declaring anything, so that a bad entry leaves the compiler as it was
+	std::vector<string_view> record_names;
+
+	for (std::uint64_t i = reader.count(8); i > 0; --i)
+	{
+		record_names.push_back(reader.string());
+	}
+
+	std::vector<CachedType> types(reader.count(9));
+
+	for (std::size_t i = 0; i < types.size(); ++i)
+	{
+		CachedType& type = types[i];
+		type.kind        = TypeKind(reader.u8());
+
+		switch (type.kind)
+		{
+		case TypeKind::BUILTIN:
+		{
+			type.value = reader.index(underlying_cast(Type::LAST_CONCRETE) + 1);
+			break;
+		}
+
+		case TypeKind::POINTER: type.value = reader.index(i); break;
+
+		case TypeKind::ARRAY:
+		{
+			type.low   = reader.u64();
+			type.high  = reader.u64();
+			type.value = reader.index(i);
+			break;
+		}
+
+		case TypeKind::RECORD: type.value = reader.index(record_names.size()); break;
+
+		default: return false;
+		}
+	}
+
+	std::vector<std::vector<CachedDeclaration>> fields(record_names.size());
+
+	for (std::vector<CachedDeclaration>& record_fields : fields)
+	{
+		record_fields.resize(reader.count(16));
+
+		for (CachedDeclaration& field : record_fields)
+		{
+			field.name = reader.string();
+			field.type = reader.index(types.size());
+		}
+	}
+
+	std::vector<CachedDeclaration> typedefs(reader.count(16));
+
+	for (CachedDeclaration& typedef_declaration : typedefs)
+	{
+		typedef_declaration.name = reader.string();
+		typedef_declaration.type = reader.index(types.size());
+	}
+
+	std::vector<CachedDeclaration> variables(reader.count(17));
+
+	for (CachedDeclaration& variable : variables)
+	{
+		variable.name = reader.string();
+		variable.type = reader.index(types.size());
+		variable.flag = reader.u8() != 0;
+	}
+
+	std::vector<CachedDeclaration> functions(reader.count(25));
+
+	for (CachedDeclaration& function : functions)
+	{
+		function.name = reader.string();
+		function.flag = reader.u8() != 0;
+		function.type = reader.index(types.size());
+		function.parameters.resize(reader.count(8));
+
+		for (std::uint64_t& parameter : function.parameters)
+		{
+			parameter = reader.index(types.size());
+		}
+	}
+
+	if (reader.failed() || !reader.at_end())
+	{
+		return false;
+	}
+
+	std::vector<Type> records;
+
+	for (const string_view name : record_names)
+	{
+		records.push_back(m_compiler.m_user_types.create_record(name));
+	}
+
+	std::vector<Type> resolved;
+
+	for (const CachedType& type : types)
+	{
+		switch (type.kind)
+		{
+		case TypeKind::BUILTIN: resolved.push_back(Type(type.value)); break;
+
+		case TypeKind::POINTER:
+		{
+			UserType pointer(UserType::Category::POINTER);
+			pointer.layout_data.pointer.target = resolved[type.value];
+			resolved.push_back(m_compiler.m_user_types.intern(pointer));
+			break;
+		}
+
+		case TypeKind::ARRAY:
+		{
+			UserType array(UserType::Category::ARRAY);
+			array.layout_data.array.element = resolved[type.value];
+			array.layout_data.array.low     = type.low;
+			array.layout_data.array.high    = type.high;
+			resolved.push_back(m_compiler.m_user_types.intern(array));
+			break;
+		}
+
+		case TypeKind::RECORD: resolved.push_back(records[type.value]); break;
+		}
+	}
+
+	for (std::size_t i = 0; i < records.size(); ++i)
+	{
+		UserType::RecordType& record = m_compiler.m_user_types.find(records[i])->layout_data.record;
+
+		for (const CachedDeclaration& field : fields[i])
+		{
+			record.fields.push_back({field.name, resolved[field.type]});
+		}
+	}
+
+	for (const CachedDeclaration& typedef_declaration : typedefs)
+	{
+		const Symbol alias = m_compiler.m_symbols.intern(typedef_declaration.name);
+
+		if (!m_compiler.m_typedefs.emplace(alias, resolved[typedef_declaration.type]))
+		{
+			m_compiler.error(fmt::format("duplicate declaration of type '{}'", typedef_declaration.name.str()));
+		}
+	}
+
+	for (const CachedDeclaration& variable : variables)
+	{
+		m_compiler.declare_variable(variable.name, {resolved[variable.type], variable.flag});
+	}
+
+	for (const CachedDeclaration& cached_function : functions)
+	{
+		Function function;
+		function.foreign     = true;
+		function.variadic    = cached_function.flag;
+		function.return_type = resolved[cached_function.type];
+		m_compiler.mark_foreign_type(function.return_type);
+
+		for (const std::uint64_t parameter : cached_function.parameters)
+		{
+			function.parameters.push_back({resolved[parameter]});
+			m_compiler.mark_foreign_type(resolved[parameter]);
+		}
+
+		if (!m_compiler.m_functions.emplace(m_compiler.m_symbols.intern(cached_function.name), std::move(function)))
+		{
+			m_compiler.error(fmt::format("duplicate declaration of function '{}'", cached_function.name.str()));
+		}
+	}
+
+	return true;
+}
+
+void IncludeCache::save(const SourceFile& source, const Snapshot& start) const
+{
+	const UserTypeTable& user_types = m_compiler.m_user_types;
+
+	// Records declared by the include, which its types refer to by index
+	std::unordered_map<Type, std::uint64_t, EnumClassHash> record_indices;
+	std::vector<const UserTypeTable::Entry*>               records;
+
+	for (auto it = user_types.begin() + std::ptrdiff_t(start.user_types); it != user_types.end(); ++it)
+	{
+		if (it->user_type.category == UserType::Category::RECORD)
+		{
+			record_indices.emplace(it->type, records.size());
+			records.push_back(&*it);
+		}
+	}
+
+	// Types are numbered before anything is written, since they come first
+	TypeEncoder types{user_types, record_indices};
+
+	std::vector<std::vector<CachedDeclaration>> fields;
+
+	for (const UserTypeTable::Entry* record : records)
+	{
+		fields.emplace_back();
+
+		for (const UserType::RecordType::Field& field : record->user_type.layout_data.record.fields)
+		{
+			fields.back().push_back(declaration(field.name, types.index(field.type)));
+		}
+	}
+
+	std::vector<CachedDeclaration> typedefs, variables, functions;
+
+	for (auto it = m_compiler.m_typedefs.begin() + std::ptrdiff_t(start.typedefs); it != m_compiler.m_typedefs.end();
+		 ++it)
+	{
+		typedefs.push_back(declaration(m_compiler.m_symbols.name(it->first), types.index(it->second)));
+	}
+
+	for (auto it = m_compiler.m_variables.begin() + std::ptrdiff_t(start.variables);
+		 it != m_compiler.m_variables.end();
+		 ++it)
+	{
+		const VariableType& type = it->second;
+		variables.push_back(
+			declaration(m_compiler.m_symbols.name(it->first), types.index(type.type), type.cache_aligned));
+	}
+
+	for (auto it = m_compiler.m_functions.begin() + std::ptrdiff_t(start.functions);
+		 it != m_compiler.m_functions.end();
+		 ++it)
+	{
+		const Function& function = it->second;
+
+		functions.push_back(
+			declaration(m_compiler.m_symbols.name(it->first), types.index(function.return_type), function.variadic));
+
+		for (const FunctionParameter& parameter : function.parameters)
+		{
+			functions.back().parameters.push_back(types.index(parameter.type));
+		}
+	}
+
+	const string_view   text = source.text();
+	const std::uint64_t hash = std::hash<string_view>{}(text);
+
+	Writer writer;
+
+	for (const char c : magic)
+	{
+		writer.u8(std::uint8_t(c));
+	}
+
+	writer.u32(version);
+	writer.string(layout);
+	writer.u64(hash);
+	writer.u64(text.size());
+
+	writer.u64(records.size());
+
+	for (const UserTypeTable::Entry* record : records)
+	{
+		writer.string(record->name);
+	}
+
+	writer.u64(types.types().size());
+
+	for (const CachedType& type : types.types())
+	{
+		writer.u8(std::uint8_t(type.kind));
+
+		if (type.kind == TypeKind::ARRAY)
+		{
+			writer.u64(type.low);
+			writer.u64(type.high);
+		}
+
+		writer.u64(type.value);
+	}
+
+	for (const std::vector<CachedDeclaration>& record_fields : fields)
+	{
+		writer.u64(record_fields.size());
+
+		for (const CachedDeclaration& field : record_fields)
+		{
+			writer.string(field.name);
+			writer.u64(field.type);
+		}
+	}
+
+	writer.u64(typedefs.size());
+
+	for (const CachedDeclaration& typedef_declaration : typedefs)
+	{
+		writer.string(typedef_declaration.name);
+		writer.u64(typedef_declaration.type);
+	}
+
+	writer.u64(variables.size());
+
+	for (const CachedDeclaration& variable : variables)
+	{
+		writer.string(variable.name);
+		writer.u64(variable.type);
+		writer.u8(variable.flag);
+	}
+
+	writer.u64(functions.size());
+
+	for (const CachedDeclaration& function : functions)
+	{
+		writer.string(function.name);
+		writer.u8(function.flag);
+		writer.u64(function.type);
+		writer.u64(function.parameters.size());
+
+		for (const std::uint64_t parameter : function.parameters)
+		{
+			writer.u64(parameter);
+		}
+	}
+
+	if (m_store != nullptr)
+	{
+		m_store->insert(source.name(), hash, writer.data());
+	}
+
+	if (m_directory.empty())
+	{
+		return;
+	}
+
+	// Written next to the entry then renamed over it, so that concurrent compilations never read a partial entry. The
+	// temporary file is named after the process and thread, which may be compiling other files including it too.
+	mkdir(m_directory.c_str(), 0777);
+
+	const std::string path = entry_path(hash);
+	const std::string temporary_path
+		= fmt::format("{}.{}.{:x}.tmp", path, getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+	std::FILE* file = std::fopen(temporary_path.c_str(), "wb");
+
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	const bool written = std::fwrite(writer.data().data(), 1, writer.data().size(), file) == writer.data().size();
+
+	if (std::fclose(file) != 0 || !written || std::rename(temporary_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary_path.c_str());
+	}
+}
+
+std::string IncludeCache::entry_path(std::uint64_t hash) const
+{
+	return layout.size() == 0 ? fmt::format("{}/{:016x}-v{}.ceri-include", m_directory, hash, version)
+							  : fmt::format("{}/{:016x}-v{}-{}.ceri-include", m_directory, hash, version, layout.str());
+}
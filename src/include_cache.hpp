@@ -0,0 +1,104 @@
+#pragma once
+
+#include "source.hpp"
+#include "util/string_view.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Compiler;
+
+//! \brief Entries of the include cache kept in memory by a compile server, which are shared by the compilations it
+//! runs concurrently.
+//!
+//! \details
+//!		Entries are keyed by the path of their include. An entry is dropped once the modification time or the size of
+//!		its file changes, or once the text of the include does not hash to the same value anymore.
+class IncludeCacheStore
+{
+	public:
+	//! \brief Entry of the include at \p path, whose text hashes to \p hash, or nullptr if the include changed since.
+	std::shared_ptr<const std::string> find(const std::string& path, std::uint64_t hash);
+
+	//! \brief Hold \p entry for the include at \p path, whose text hashes to \p hash.
+	void insert(const std::string& path, std::uint64_t hash, std::string entry);
+
+	private:
+	struct Slot
+	{
+		std::uint64_t hash = 0;
+
+		//! Modification time in nanoseconds and size of the file when the entry was added.
+		std::int64_t  modification_time = 0;
+		std::uint64_t size              = 0;
+
+		//! Shared with the compilations declaring it, so that replacing it does not pull it from under them.
+		std::shared_ptr<const std::string> entry;
+	};
+
+	//! \brief Set the modification time and size of \p slot to the ones of the file at \p path.
+	//! \returns Whether the file could be inspected.
+	static bool stamp(const std::string& path, Slot& slot);
+
+	std::mutex                            m_mutex;
+	std::unordered_map<std::string, Slot> m_slots;
+};
+
+//! \brief Cache of the declarations added by INCLUDE'd files, so that later compilations load them rather than lex
+//! and parse the file again.
+//!
+//! \details
+//!		Entries are files of a directory, named after the hash of the text of the include, the version of their format
+//!		and the hash of the sources their layout depends on, e.g. the one of the Type enum: editing an include or
+//!		changing how declarations are numbered or written misses the cache rather than loading stale declarations,
+//!		while rebuilding the same compiler keeps it. Entries repeat them in their header, along with the size of the
+//!		include. An entry that does not match them, or that is truncated, is ignored and written again once the
+//!		include was parsed.
+//!
+//!		A compile server also keeps entries in an IncludeCacheStore, so that its compilations do not even read them.
+//!
+//!		Only includes whose declarations do not depend on the file including them are cached, see
+//!		Compiler::parse_include(): they may only declare FFI functions, TYPEs and VARs, whose types are builtin or
+//!		declared by the include itself.
+class IncludeCache
+{
+	public:
+	//! \brief Bumped whenever the format of entries changes, for the builds that do not hash the sources of their
+	//! layout.
+	static constexpr std::uint32_t version = 2;
+
+	//! \brief Count of each kind of declaration of the compiler, to tell the ones added by an include apart.
+	struct Snapshot
+	{
+		std::size_t typedefs = 0, variables = 0, functions = 0, user_types = 0;
+	};
+
+	//! \param directory Where entries are read and written, or empty to only keep them in \p store.
+	//! \param store Entries kept in memory, or nullptr to only keep them in \p directory.
+	IncludeCache(Compiler& compiler, std::string directory, IncludeCacheStore* store);
+
+	[[nodiscard]] Snapshot snapshot() const;
+
+	//! \brief Declare what the entry of \p source holds, if there is a valid one.
+	//! \returns Whether there was, otherwise \p source must be parsed.
+	bool load(const SourceFile& source);
+
+	//! \brief Write the entry of \p source, which holds the declarations the compiler got since \p start.
+	//! \details Failing to write it is not an error, since the include is parsed again next time.
+	void save(const SourceFile& source, const Snapshot& start) const;
+
+	private:
+	//! \brief Declare what \p entry holds, if it is valid for an include whose text hashes to \p hash and is
+	//! \p size bytes long.
+	bool declare(string_view entry, std::uint64_t hash, std::size_t size);
+
+	[[nodiscard]] std::string entry_path(std::uint64_t hash) const;
+
+	Compiler&          m_compiler;
+	std::string        m_directory;
+	IncludeCacheStore* m_store;
+};
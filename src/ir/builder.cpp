@@ -0,0 +1,291 @@
+#include "builder.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace ir
+{
+Builder::Builder(Function& function) : m_function{function}
+{
+	if (m_function.blocks.empty())
+	{
+		m_function.blocks.emplace_back();
+	}
+}
+
+BlockId Builder::create_block()
+{
+	m_function.blocks.emplace_back();
+	return m_function.blocks.size() - 1;
+}
+
+void Builder::set_insertion_block(BlockId block)
+{
+	// Values never flow through the stack from one block to another
+	if (!m_stack.empty())
+	{
+		throw std::runtime_error("values left on the IR builder stack at the end of a block");
+	}
+
+	m_block = block;
+}
+
+void Builder::load_variable(const Variable& variable)
+{
+	Instruction instruction{Opcode::LOAD_GLOBAL};
+	instruction.symbol   = variable.name;
+	instruction.variable = variable.symbol;
+	push_value(append(std::move(instruction), variable.type.type));
+}
+
+void Builder::load_i64(std::uint64_t value) { load_constant(Type::UNSIGNED_INT, value); }
+
+void Builder::load_f64(double value)
+{
+	static_assert(sizeof(double) == sizeof(std::uint64_t), "double must be 64-bit on the compiler platform");
+
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	load_constant(Type::DOUBLE, bits);
+}
+
+void Builder::load_constant(Type type, std::uint64_t bits)
+{
+	Instruction instruction{Opcode::CONSTANT};
+	instruction.constant = bits;
+	push_value(append(std::move(instruction), type));
+}
+
+void Builder::load_pointer_to_variable(const Variable& variable, Type pointer_type)
+{
+	Instruction instruction{Opcode::GLOBAL_ADDRESS};
+	instruction.symbol   = variable.name;
+	instruction.variable = variable.symbol;
+	push_value(append(std::move(instruction), pointer_type));
+}
+
+void Builder::load_value_from_pointer(Type dereferenced_type, const FieldAccess& field)
+{
+	Instruction instruction{Opcode::LOAD};
+	instruction.operands = {pop_value()};
+	instruction.field    = field;
+	push_value(append(std::move(instruction), dereferenced_type));
+}
+
+void Builder::load_field(const Variable& record, const FieldAccess& field, Type field_type)
+{
+	Instruction instruction{Opcode::LOAD_GLOBAL};
+	instruction.symbol   = record.name;
+	instruction.variable = record.symbol;
+	instruction.field    = field;
+	push_value(append(std::move(instruction), field_type));
+}
+
+void Builder::swap_operands()
+{
+	const ValueId top   = pop_value();
+	const ValueId below = pop_value();
+	push_value(top);
+	push_value(below);
+}
+
+void Builder::discard_value() { pop_value(); }
+
+void Builder::store_variable(const Variable& variable)
+{
+	Instruction instruction{Opcode::STORE_GLOBAL};
+	instruction.type     = variable.type.type;
+	instruction.symbol   = variable.name;
+	instruction.variable = variable.symbol;
+	instruction.operands = {pop_value()};
+	append(std::move(instruction));
+}
+
+void Builder::store_field(const Variable& record, const FieldAccess& field, Type value_type)
+{
+	Instruction instruction{Opcode::STORE_GLOBAL};
+	instruction.type     = value_type;
+	instruction.symbol   = record.name;
+	instruction.variable = record.symbol;
+	instruction.field    = field;
+	instruction.operands = {pop_value()};
+	append(std::move(instruction));
+}
+
+void Builder::store_value_to_pointer(Type value_type, const FieldAccess& field)
+{
+	const ValueId pointer = pop_value();
+	const ValueId value   = pop_value();
+
+	Instruction instruction{Opcode::STORE};
+	instruction.type     = value_type;
+	instruction.operands = {value, pointer};
+	instruction.field    = field;
+	append(std::move(instruction));
+}
+
+void Builder::load_element(const Variable& array, Type element_type, const FieldAccess& field)
+{
+	Instruction instruction{Opcode::LOAD_ELEMENT};
+	instruction.symbol   = array.name;
+	instruction.variable = array.symbol;
+	instruction.operands = {pop_value()};
+	instruction.field    = field;
+	push_value(append(std::move(instruction), element_type));
+}
+
+void Builder::store_element(const Variable& array, Type value_type, const FieldAccess& field)
+{
+	const ValueId value = pop_value();
+	const ValueId index = pop_value();
+
+	Instruction instruction{Opcode::STORE_ELEMENT};
+	instruction.type     = value_type;
+	instruction.symbol   = array.name;
+	instruction.variable = array.symbol;
+	instruction.operands = {index, value};
+	instruction.field    = field;
+	append(std::move(instruction));
+}
+
+void Builder::check_bounds(std::uint64_t length)
+{
+	Instruction instruction{Opcode::CHECK_BOUNDS};
+	instruction.constant = length;
+	instruction.operands = {pop_value()};
+	push_value(append(std::move(instruction), Type::UNSIGNED_INT));
+}
+
+void Builder::alu_not_bool()
+{
+	Instruction instruction{Opcode::NOT};
+	instruction.operands = {pop_value()};
+	push_value(append(std::move(instruction), Type::BOOLEAN));
+}
+
+void Builder::alu_binary(Opcode opcode, Type type)
+{
+	const ValueId right = pop_value();
+	const ValueId left  = pop_value();
+
+	Instruction instruction{opcode};
+	instruction.operands = {left, right};
+	push_value(append(std::move(instruction), type));
+}
+
+void Builder::alu_compare(Comparison comparison)
+{
+	const ValueId right = pop_value();
+	const ValueId left  = pop_value();
+
+	Instruction instruction{Opcode::COMPARE};
+	instruction.comparison = comparison;
+	instruction.operands   = {left, right};
+	push_value(append(std::move(instruction), Type::BOOLEAN));
+}
+
+void Builder::convert(Type destination)
+{
+	Instruction instruction{Opcode::CONVERT};
+	instruction.operands = {pop_value()};
+	push_value(append(std::move(instruction), destination));
+}
+
+void Builder::function_call(
+	string_view name, Type return_type, std::size_t parameter_count, bool variadic, bool foreign)
+{
+	if (m_stack.size() < parameter_count)
+	{
+		throw std::runtime_error("IR builder stack underflow");
+	}
+
+	Instruction instruction{Opcode::CALL};
+	instruction.symbol   = name;
+	instruction.variadic = variadic;
+	instruction.foreign  = foreign;
+	instruction.operands.assign(m_stack.end() - parameter_count, m_stack.end());
+	m_stack.resize(m_stack.size() - parameter_count);
+
+	const ValueId result = append(std::move(instruction), return_type);
+
+	if (return_type != Type::VOID)
+	{
+		push_value(result);
+	}
+}
+
+void Builder::allocate(Type pointer_type, std::uint64_t size)
+{
+	Instruction instruction{Opcode::NEW};
+	instruction.constant = size;
+	push_value(append(std::move(instruction), pointer_type));
+}
+
+void Builder::dispose(std::uint64_t size)
+{
+	Instruction instruction{Opcode::DISPOSE};
+	instruction.operands = {pop_value()};
+	instruction.constant = size;
+	append(std::move(instruction));
+}
+
+void Builder::debug_display()
+{
+	Instruction instruction{Opcode::DISPLAY};
+	instruction.operands = {pop_value()};
+	append(std::move(instruction));
+}
+
+void Builder::jump(BlockId target)
+{
+	Instruction instruction{Opcode::JUMP};
+	instruction.blocks = {target};
+	append(std::move(instruction));
+}
+
+void Builder::branch(BlockId if_true, BlockId if_false)
+{
+	Instruction instruction{Opcode::BRANCH};
+	instruction.operands = {pop_value()};
+	instruction.blocks   = {if_true, if_false};
+	append(std::move(instruction));
+}
+
+void Builder::return_from_function() { append(Instruction(Opcode::RETURN)); }
+
+void Builder::return_value()
+{
+	Instruction instruction{Opcode::RETURN};
+	instruction.operands = {pop_value()};
+	append(std::move(instruction));
+}
+
+ValueId Builder::append(Instruction instruction, Type result_type)
+{
+	if (result_type != Type::VOID)
+	{
+		instruction.type   = result_type;
+		instruction.result = m_function.create_value(result_type);
+	}
+
+	const ValueId result = instruction.result;
+	m_function.blocks[m_block].instructions.push_back(std::move(instruction));
+	return result;
+}
+
+ValueId Builder::pop_value()
+{
+	if (m_stack.empty())
+	{
+		throw std::runtime_error("IR builder stack underflow");
+	}
+
+	const ValueId value = m_stack.back();
+	m_stack.pop_back();
+	return value;
+}
+
+void Builder::push_value(ValueId value) { m_stack.push_back(value); }
+} // namespace ir
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ir/ir.hpp"
+#include "types.hpp"
+#include "util/string_view.hpp"
+#include "variable.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ir
+{
+//! \brief Appends instructions to a function as the parser goes.
+//!
+//! \details
+//!		The interface is the one of a stack machine, like the code generator it replaces for the parser: loads push a
+//!		value, operations pop their operands and push their result. The stack only exists while building, operands
+//!		are explicit in the resulting instructions.
+class Builder
+{
+	public:
+	explicit Builder(Function& function);
+
+	//! \brief Create an empty block, which does not change where instructions are inserted.
+	[[nodiscard]] BlockId create_block();
+
+	//! \brief Append the next instructions to \p block.
+	void set_insertion_block(BlockId block);
+
+	[[nodiscard]] BlockId insertion_block() const { return m_block; }
+
+	void load_variable(const Variable& variable);
+	void load_i64(std::uint64_t value);
+	void load_f64(double value);
+	void load_constant(Type type, std::uint64_t bits);
+	void load_pointer_to_variable(const Variable& variable, Type pointer_type);
+
+	//! \brief Pop a pointer and push the value it points to, or the field \p field of the record it points to.
+	void load_value_from_pointer(Type dereferenced_type, const FieldAccess& field = {});
+
+	//! \brief Push the field \p field of the record variable \p record.
+	void load_field(const Variable& record, const FieldAccess& field, Type field_type);
+
+	//! \brief Swap the two values on top of the stack.
+	void swap_operands();
+
+	//! \brief Pop the value on top of the stack without using it, e.g. the result of a function called as a statement.
+	void discard_value();
+
+	void store_variable(const Variable& variable);
+
+	//! \brief Pop a value and write it to the field \p field of the record variable \p record.
+	void store_field(const Variable& record, const FieldAccess& field, Type value_type);
+
+	//! \brief Pop a pointer, then the value to write where it points, or to the field \p field of the record it
+	//! points to.
+	void store_value_to_pointer(Type value_type, const FieldAccess& field = {});
+
+	//! \brief Pop a zero-based index and push the element of \p array it refers to, or the field \p field of that
+	//! element for an array of records.
+	void load_element(const Variable& array, Type element_type, const FieldAccess& field = {});
+
+	//! \brief Pop a value, then the zero-based index of the element of \p array to write it to, or whose field \p
+	//! field to write it to for an array of records.
+	void store_element(const Variable& array, Type value_type, const FieldAccess& field = {});
+
+	//! \brief Pop a zero-based index and push it back, trapping at runtime unless it is lower than \p length.
+	void check_bounds(std::uint64_t length);
+
+	void alu_not_bool();
+
+	//! \brief Pop two operands and push the result of the arithmetic or logic \p opcode, e.g. ADD.
+	void alu_binary(Opcode opcode, Type type);
+	void alu_compare(Comparison comparison);
+
+	void convert(Type destination);
+
+	//! \brief Pop \p parameter_count parameters, pushing the result of the call unless \p return_type is VOID.
+	void function_call(
+		string_view name, Type return_type, std::size_t parameter_count, bool variadic, bool foreign);
+
+	//! \brief Push a pointer of type \p pointer_type to a new block of \p size bytes.
+	void allocate(Type pointer_type, std::uint64_t size);
+
+	//! \brief Pop a pointer to a block of \p size bytes, and give the block back.
+	void dispose(std::uint64_t size);
+
+	void debug_display();
+
+	void jump(BlockId target);
+
+	//! \brief Pop a BOOLEAN and branch to \p if_true or \p if_false accordingly.
+	void branch(BlockId if_true, BlockId if_false);
+
+	void return_from_function();
+
+	//! \brief Pop the result of the function, and return it.
+	void return_value();
+
+	private:
+	//! \brief Append \p instruction to the current block, with a new result value if \p result_type is not VOID.
+	ValueId append(Instruction instruction, Type result_type = Type::VOID);
+
+	ValueId pop_value();
+	void    push_value(ValueId value);
+
+	Function& m_function;
+	BlockId   m_block = 0;
+
+	std::vector<ValueId> m_stack;
+};
+} // namespace ir
@@ -0,0 +1,347 @@
+#include "dead_code.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ir
+{
+using VariableSet = std::unordered_set<std::string>;
+
+//! \brief Variables of the program, as far as dead code elimination is concerned.
+struct ProgramVariables
+{
+	VariableSet globals;
+
+	//! Variables which are loaded, have an element loaded or have their address taken anywhere in the program.
+	//! Every variable accessed by a vectorized loop counts as read, since its stores are never removed.
+	VariableSet read;
+
+	//! Variables which may be accessed through pointers.
+	VariableSet address_taken;
+};
+
+//! \brief Find the variables accessed by a vectorized loop, which may all be read since reductions read their variable
+//! and stores only write part of their array.
+static VariableSet kernel_variables(const VectorKernel& kernel)
+{
+	VariableSet variables;
+
+	for (const Instruction& instruction : kernel.instructions)
+	{
+		if (!instruction.symbol.empty())
+		{
+			variables.insert(instruction.symbol);
+		}
+	}
+
+	for (const VectorReduction& reduction : kernel.reductions)
+	{
+		variables.insert(reduction.variable);
+	}
+
+	return variables;
+}
+
+static ProgramVariables program_variables(const Program& program)
+{
+	ProgramVariables variables;
+
+	for (const Variable& variable : program.globals)
+	{
+		variables.globals.insert(variable.name);
+	}
+
+	for (const Function& function : program.functions)
+	{
+		for (const BasicBlock& block : function.blocks)
+		{
+			for (const Instruction& instruction : block.instructions)
+			{
+				if (instruction.is(Opcode::LOAD_GLOBAL) || instruction.is(Opcode::LOAD_ELEMENT))
+				{
+					variables.read.insert(instruction.symbol);
+				}
+				else if (instruction.is(Opcode::GLOBAL_ADDRESS))
+				{
+					variables.read.insert(instruction.symbol);
+					variables.address_taken.insert(instruction.symbol);
+				}
+				else if (instruction.is(Opcode::VECTOR_LOOP))
+				{
+					const VariableSet accessed = kernel_variables(*instruction.kernel);
+					variables.read.insert(accessed.begin(), accessed.end());
+				}
+			}
+		}
+	}
+
+	return variables;
+}
+
+//! \brief Make live the globals which \p function does not hide with its own parameters and locals.
+static void insert_globals(const Function& function, const ProgramVariables& variables, VariableSet& live)
+{
+	for (const std::string& global : variables.globals)
+	{
+		if (function.find_local(global) == nullptr)
+		{
+			live.insert(global);
+		}
+	}
+}
+
+static bool is_variable_store(const Instruction& instruction)
+{
+	return instruction.is(Opcode::STORE_GLOBAL) || instruction.is(Opcode::STORE_ELEMENT);
+}
+
+//! \brief Update the variables live before \p instruction from \p live, the variables live after it.
+static void transfer_liveness(
+	const Function& function, const Instruction& instruction, const ProgramVariables& variables, VariableSet& live)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::STORE_GLOBAL:
+	{
+		if (!instruction.field.is_set())
+		{
+			live.erase(instruction.symbol);
+		}
+
+		break;
+	}
+
+	// Writing an element or a field leaves the other ones untouched, so it does not kill the variable
+	case Opcode::LOAD_GLOBAL:
+	case Opcode::LOAD_ELEMENT: live.insert(instruction.symbol); break;
+
+	case Opcode::VECTOR_LOOP:
+	{
+		const VariableSet accessed = kernel_variables(*instruction.kernel);
+		live.insert(accessed.begin(), accessed.end());
+		break;
+	}
+
+	// Stores through pointers may only write part of the variables they could alias, so they never kill them
+	case Opcode::LOAD: live.insert(variables.address_taken.begin(), variables.address_taken.end()); break;
+
+	// Procedures of the program may also read any global
+	case Opcode::CALL:
+	{
+		live.insert(variables.address_taken.begin(), variables.address_taken.end());
+
+		if (!instruction.foreign)
+		{
+			insert_globals(function, variables, live);
+		}
+
+		break;
+	}
+
+	// Parameters and locals die with their function
+	case Opcode::RETURN:
+	{
+		if (function.name != "main")
+		{
+			insert_globals(function, variables, live);
+		}
+
+		break;
+	}
+
+	default: break;
+	}
+}
+
+//! \brief Remove the instructions of \p instructions whose flag in \p dead is set, moving each kept one only once.
+//! \returns Whether an instruction was removed.
+static bool remove_flagged(std::vector<Instruction>& instructions, const std::vector<bool>& dead)
+{
+	// remove_if tests every instruction before moving it, so its address still gives its index in the block
+	const Instruction* const first = instructions.data();
+
+	const auto end = std::remove_if(instructions.begin(), instructions.end(), [&](const Instruction& instruction) {
+		return dead[std::size_t(&instruction - first)];
+	});
+
+	const bool removed = end != instructions.end();
+	instructions.erase(end, instructions.end());
+
+	return removed;
+}
+
+//! \brief Remove the stores to variables that are not live after them.
+//! \returns Whether an instruction was removed.
+static bool remove_dead_stores(Function& function, const ProgramVariables& variables)
+{
+	std::vector<VariableSet> live_in(function.blocks.size());
+	std::vector<VariableSet> live_out(function.blocks.size());
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (BlockId block = function.blocks.size(); block-- > 0;)
+		{
+			VariableSet live;
+
+			for (const BlockId successor : function.successors(block))
+			{
+				live.insert(live_in[successor].begin(), live_in[successor].end());
+			}
+
+			live_out[block] = live;
+
+			const std::vector<Instruction>& instructions = function.blocks[block].instructions;
+
+			for (auto it = instructions.rbegin(); it != instructions.rend(); ++it)
+			{
+				transfer_liveness(function, *it, variables, live);
+			}
+
+			if (live != live_in[block])
+			{
+				live_in[block] = std::move(live);
+				changed        = true;
+			}
+		}
+	}
+
+	bool removed = false;
+
+	for (BlockId block = 0; block < function.blocks.size(); ++block)
+	{
+		std::vector<Instruction>& instructions = function.blocks[block].instructions;
+		VariableSet&              live         = live_out[block];
+		std::vector<bool>         dead(instructions.size());
+
+		for (std::size_t i = instructions.size(); i-- > 0;)
+		{
+			if (is_variable_store(instructions[i]) && live.count(instructions[i].symbol) == 0)
+			{
+				dead[i] = true;
+				continue;
+			}
+
+			transfer_liveness(function, instructions[i], variables, live);
+		}
+
+		removed |= remove_flagged(instructions, dead);
+	}
+
+	return removed;
+}
+
+//! \brief Remove the stores to variables which are never read.
+//! \returns Whether an instruction was removed.
+static bool remove_unread_stores(Function& function, const ProgramVariables& variables)
+{
+	bool removed = false;
+
+	for (BasicBlock& block : function.blocks)
+	{
+		const auto end = std::remove_if(block.instructions.begin(), block.instructions.end(), [&](const Instruction& i) {
+			return is_variable_store(i) && variables.read.count(i.symbol) == 0;
+		});
+
+		removed |= end != block.instructions.end();
+		block.instructions.erase(end, block.instructions.end());
+	}
+
+	return removed;
+}
+
+//! \brief Remove the instructions that have no side effects and whose value is not used by an instruction that is
+//! kept. Unlike counting uses, this also removes phis that only use each other, e.g. for a variable of a loop.
+//! \returns Whether an instruction was removed.
+static bool remove_unused_values(Function& function)
+{
+	using Location = std::pair<BlockId, std::size_t>;
+
+	std::unordered_map<ValueId, Location> definitions;
+	std::vector<std::vector<bool>>        used(function.blocks.size());
+	std::vector<Location>                 worklist;
+
+	for (BlockId block = 0; block < function.blocks.size(); ++block)
+	{
+		const std::vector<Instruction>& instructions = function.blocks[block].instructions;
+		used[block].resize(instructions.size());
+
+		for (std::size_t i = 0; i < instructions.size(); ++i)
+		{
+			if (instructions[i].has_result())
+			{
+				definitions.emplace(instructions[i].result, Location{block, i});
+			}
+
+			if (has_side_effects(instructions[i].opcode))
+			{
+				used[block][i] = true;
+				worklist.push_back({block, i});
+			}
+		}
+	}
+
+	while (!worklist.empty())
+	{
+		const Location location = worklist.back();
+		worklist.pop_back();
+
+		for (const ValueId operand : function.blocks[location.first].instructions[location.second].operands)
+		{
+			const auto it = definitions.find(operand);
+
+			if (it != definitions.end() && !used[it->second.first][it->second.second])
+			{
+				used[it->second.first][it->second.second] = true;
+				worklist.push_back(it->second);
+			}
+		}
+	}
+
+	bool removed = false;
+
+	for (BlockId block = 0; block < function.blocks.size(); ++block)
+	{
+		used[block].flip();
+		removed |= remove_flagged(function.blocks[block].instructions, used[block]);
+	}
+
+	return removed;
+}
+
+void eliminate_dead_code(Program& program)
+{
+	ProgramVariables variables;
+
+	// Removing a store may leave the computation of its value unused, which may in turn contain the last load of a
+	// variable, whose stores then become dead too
+	for (bool changed = true; changed;)
+	{
+		changed   = false;
+		variables = program_variables(program);
+
+		for (Function& function : program.functions)
+		{
+			changed |= remove_unread_stores(function, variables);
+			changed |= remove_dead_stores(function, variables);
+			changed |= remove_unused_values(function);
+		}
+	}
+
+	const auto is_unread = [&](const Variable& variable) { return variables.read.count(variable.name) == 0; };
+
+	program.globals.erase(
+		std::remove_if(program.globals.begin(), program.globals.end(), is_unread), program.globals.end());
+
+	for (Function& function : program.functions)
+	{
+		function.locals.erase(
+			std::remove_if(function.locals.begin(), function.locals.end(), is_unread), function.locals.end());
+	}
+}
+} // namespace ir
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ir/ir.hpp"
+
+namespace ir
+{
+//! \brief Remove the computations of \p program whose result is never observed.
+//!
+//! \details
+//!		- A store to a variable is removed if the variable is written again or the program ends before it is read.
+//!		  Stores to array elements are only removed in the latter case.
+//!		- An instruction without side effects is removed if its value is not used.
+//!		- A variable is removed if it is never read and its address is never taken, along with its stores.
+//!		Variables whose address is taken may be read through any pointer and by any function call, including foreign
+//!		ones, and globals by any procedure of the program. The program ends when main returns, while procedures return
+//!		to a caller which may read any global, but none of their parameters and locals.
+void eliminate_dead_code(Program& program);
+} // namespace ir
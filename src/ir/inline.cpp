@@ -0,0 +1,793 @@
+#include "inline.hpp"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+
+namespace ir
+{
+namespace
+{
+//! Procedures are not inlined into a function past this size, except for shims and procedures declared INLINE.
+constexpr std::size_t max_caller_size = 2000;
+
+//! Size up to which a procedure is inlined on top of the cost of the call, outside of and in loops.
+constexpr std::size_t small_procedure_size = 8, loop_procedure_size = 32;
+
+//! Size up to which a procedure called once is inlined, since its body is then removed.
+constexpr std::size_t single_call_size = 256;
+
+bool accesses_variable(const Instruction& instruction)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::LOAD_GLOBAL:
+	case Opcode::GLOBAL_ADDRESS:
+	case Opcode::STORE_GLOBAL:
+	case Opcode::LOAD_ELEMENT:
+	case Opcode::STORE_ELEMENT: return true;
+	default: return false;
+	}
+}
+
+//! \brief Estimate the instructions generated for a call besides the body of the callee: moving the arguments and the
+//! result, aligning the stack, the call and return themselves, and saving registers in the callee.
+std::size_t call_cost(const Instruction& call) { return 6 + call.operands.size() + (call.has_result() ? 1 : 0); }
+
+//! \brief Estimate the instructions generated for \p instruction of \p function once inlined.
+std::size_t instruction_cost(const Function& function, const Instruction& instruction)
+{
+	switch (instruction.opcode)
+	{
+	// Constants end up as immediates, and most jumps fall through to the next block
+	case Opcode::CONSTANT:
+	case Opcode::PHI:
+	case Opcode::JUMP:
+	case Opcode::RETURN: return 0;
+
+	// Arguments are used in place of the parameters
+	case Opcode::LOAD_GLOBAL:
+	{
+		const Variable* variable = function.find_local(instruction.symbol);
+		const bool      is_parameter
+			= variable != nullptr && variable >= function.parameters.data()
+			  && variable < function.parameters.data() + function.parameters.size();
+
+		return is_parameter ? 0 : 1;
+	}
+
+	case Opcode::CALL: return call_cost(instruction);
+	case Opcode::NEW:
+	case Opcode::DISPOSE:
+	case Opcode::DISPLAY: return 4;
+	case Opcode::VECTOR_LOOP: return 32;
+	default: return 1;
+	}
+}
+
+std::size_t function_size(const Function& function)
+{
+	std::size_t size = 0;
+
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			size += instruction_cost(function, instruction);
+		}
+	}
+
+	return size;
+}
+
+bool calls_itself(const Function& function)
+{
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			if (instruction.is(Opcode::CALL) && !instruction.foreign && instruction.symbol == function.name)
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+//! \brief Whether \p function only forwards its parameters to a foreign function, possibly converted or along with
+//! constants, and returns its result, e.g. `ln := log(x)`.
+//! \param target Set to the name of the foreign function.
+bool is_forwarding_shim(const Function& function, std::string& target)
+{
+	if (function.blocks.size() != 1)
+	{
+		return false;
+	}
+
+	const Instruction* call = nullptr;
+
+	for (const Instruction& instruction : function.blocks.front().instructions)
+	{
+		switch (instruction.opcode)
+		{
+		case Opcode::CONSTANT:
+		case Opcode::CONVERT:
+		case Opcode::RETURN: break;
+
+		// Only the parameters and the result are accessed
+		case Opcode::LOAD_GLOBAL:
+		case Opcode::STORE_GLOBAL:
+		{
+			if (function.find_local(instruction.symbol) == nullptr || instruction.field.is_set())
+			{
+				return false;
+			}
+
+			break;
+		}
+
+		case Opcode::CALL:
+		{
+			if (call != nullptr || !instruction.foreign)
+			{
+				return false;
+			}
+
+			call = &instruction;
+			break;
+		}
+
+		default: return false;
+		}
+	}
+
+	if (call == nullptr)
+	{
+		return false;
+	}
+
+	target = call->symbol;
+	return true;
+}
+
+//! \brief Find the variables of \p function that are only accessed as a whole by LOAD_GLOBAL and STORE_GLOBAL, and the
+//! ones that are also never written to.
+void find_scalar_variables(
+	const Function& function, std::unordered_set<std::string>& scalars, std::unordered_set<std::string>& read_only)
+{
+	std::unordered_set<std::string> written, memory;
+
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			if (!accesses_variable(instruction))
+			{
+				continue;
+			}
+
+			if (!instruction.is(Opcode::LOAD_GLOBAL))
+			{
+				written.insert(instruction.symbol);
+			}
+
+			if ((!instruction.is(Opcode::LOAD_GLOBAL) && !instruction.is(Opcode::STORE_GLOBAL))
+				|| instruction.field.is_set())
+			{
+				memory.insert(instruction.symbol);
+			}
+		}
+	}
+
+	for (const std::vector<Variable>* variables : {&function.parameters, &function.locals})
+	{
+		for (const Variable& variable : *variables)
+		{
+			if (memory.count(variable.name) == 0)
+			{
+				scalars.insert(variable.name);
+
+				if (written.count(variable.name) == 0)
+				{
+					read_only.insert(variable.name);
+				}
+			}
+		}
+	}
+}
+
+//! \brief Use the value stored to one of \p variables for the loads that follow in the same block, in blocks \p first
+//! to the last one of \p function. Nothing else may write to the variables.
+void forward_stores(Function& function, BlockId first, const std::unordered_set<std::string>& variables)
+{
+	// Loads are replaced in one pass over the function, then removed from each block at once
+	std::unordered_map<ValueId, ValueId> replacements;
+
+	const auto forwarded = [&](const Instruction& instruction) {
+		return instruction.is(Opcode::LOAD_GLOBAL) && replacements.count(instruction.result) != 0;
+	};
+
+	for (BlockId block = first; block < function.blocks.size(); ++block)
+	{
+		std::unordered_map<std::string, ValueId> stored;
+		std::vector<Instruction>&                instructions = function.blocks[block].instructions;
+
+		for (const Instruction& instruction : instructions)
+		{
+			if (variables.count(instruction.symbol) == 0)
+			{
+				continue;
+			}
+
+			if (instruction.is(Opcode::STORE_GLOBAL))
+			{
+				// The stored value may itself be a load that was forwarded
+				const auto replacement     = replacements.find(instruction.operands.front());
+				stored[instruction.symbol] = replacement != replacements.end() ? replacement->second
+																			   : instruction.operands.front();
+			}
+			else if (instruction.is(Opcode::LOAD_GLOBAL) && stored.count(instruction.symbol) != 0)
+			{
+				replacements.emplace(instruction.result, stored[instruction.symbol]);
+			}
+		}
+
+		instructions.erase(std::remove_if(instructions.begin(), instructions.end(), forwarded), instructions.end());
+	}
+
+	function.replace_uses(replacements);
+}
+
+class Inliner
+{
+	public:
+	Inliner(
+		Program&                                      program,
+		SymbolTable&                                  symbols,
+		std::vector<std::pair<std::size_t, ForLoop>>& loops,
+		std::unordered_set<std::string>&              address_taken_variables,
+		std::vector<std::string>&                     remarks);
+
+	void operator()();
+
+	private:
+	//! \brief Decide whether the call \p call in \p block of the function \p caller should be replaced by the body of
+	//! \p callee.
+	//! \param reason Set to the reason of the decision.
+	bool should_inline(
+		std::size_t        caller,
+		BlockId            block,
+		const Instruction& call,
+		const Function&    callee,
+		std::string&       reason) const;
+
+	//! \brief Replace the instruction \p index of \p block, a call to \p callee, by a copy of its body.
+	//! \returns The new block holding the instructions that followed the call.
+	BlockId inline_call(std::size_t caller, BlockId block, std::size_t index, std::size_t callee);
+
+	//! \brief Make the loops of \p caller follow \p block being split at a call, its end moving to \p continuation and
+	//! the blocks from \p body_begin to \p body_end holding the inlined body.
+	void split_loops(std::size_t caller, BlockId block, BlockId continuation, BlockId body_begin, BlockId body_end);
+
+	//! \brief Copy the loops of \p callee to \p caller, where its body starts at \p body_begin.
+	void copy_loops(
+		std::size_t                                      callee,
+		std::size_t                                      caller,
+		BlockId                                          body_begin,
+		const std::unordered_map<std::string, Variable>& names);
+
+	//! \brief Remove the procedures that main does not call, directly or not.
+	void remove_uncalled_functions();
+
+	Program&                                      m_program;
+	SymbolTable&                                  m_symbols;
+	std::vector<std::pair<std::size_t, ForLoop>>& m_loops;
+	std::unordered_set<std::string>&              m_address_taken_variables;
+	std::vector<std::string>&                     m_remarks;
+
+	std::unordered_map<std::string, std::size_t> m_function_indices;
+
+	//! Calls of each procedure in the program before inlining, recursive ones excluded.
+	std::unordered_map<std::string, std::size_t> m_call_counts;
+
+	//! Inlined bodies so far, numbering the copies of their variables.
+	std::size_t m_inlined_count = 0;
+};
+
+Inliner::Inliner(
+	Program&                                      program,
+	SymbolTable&                                  symbols,
+	std::vector<std::pair<std::size_t, ForLoop>>& loops,
+	std::unordered_set<std::string>&              address_taken_variables,
+	std::vector<std::string>&                     remarks) :
+	m_program{program},
+	m_symbols{symbols},
+	m_loops{loops},
+	m_address_taken_variables{address_taken_variables},
+	m_remarks{remarks}
+{
+	for (std::size_t i = 0; i < program.functions.size(); ++i)
+	{
+		const Function& function          = program.functions[i];
+		m_function_indices[function.name] = i;
+
+		for (const BasicBlock& block : function.blocks)
+		{
+			for (const Instruction& instruction : block.instructions)
+			{
+				if (instruction.is(Opcode::CALL) && !instruction.foreign && instruction.symbol != function.name)
+				{
+					++m_call_counts[instruction.symbol];
+				}
+			}
+		}
+	}
+}
+
+void Inliner::operator()()
+{
+	for (std::size_t caller = 0; caller < m_program.functions.size(); ++caller)
+	{
+		// Blocks of the function as written, and the ones that their end was moved to by inlining
+		std::vector<BlockId> pending(m_program.functions[caller].blocks.size());
+		std::iota(pending.begin(), pending.end(), BlockId(0));
+
+		for (std::size_t i = 0; i < pending.size(); ++i)
+		{
+			const BlockId block = pending[i];
+
+			for (std::size_t index = 0; index < m_program.functions[caller].blocks[block].instructions.size(); ++index)
+			{
+				const Function&    function = m_program.functions[caller];
+				const Instruction& call     = function.blocks[block].instructions[index];
+
+				if (!call.is(Opcode::CALL) || call.foreign)
+				{
+					continue;
+				}
+
+				const std::size_t callee = m_function_indices.at(call.symbol);
+				std::string       reason;
+				const bool        inlined = should_inline(caller, block, call, m_program.functions[callee], reason);
+
+				m_remarks.push_back(fmt::format(
+					"{} calls {}: {}{}", function.name, call.symbol, inlined ? "inlined, " : "not inlined, ", reason));
+
+				if (inlined)
+				{
+					pending.push_back(inline_call(caller, block, index, callee));
+					break;
+				}
+			}
+		}
+	}
+
+	remove_uncalled_functions();
+}
+
+bool Inliner::should_inline(
+	std::size_t caller, BlockId block, const Instruction& call, const Function& callee, std::string& reason) const
+{
+	const Function& function = m_program.functions[caller];
+
+	if (callee.name == function.name || calls_itself(callee))
+	{
+		reason = "recursive";
+		return false;
+	}
+
+	if (callee.inlining == Inlining::NEVER)
+	{
+		reason = "declared NOINLINE";
+		return false;
+	}
+
+	// The header of a FOR loop only evaluates the bound, compares and branches
+	for (const auto& it : m_loops)
+	{
+		if (it.first == caller && it.second.header == block)
+		{
+			reason = "called by the bound of a FOR loop";
+			return false;
+		}
+	}
+
+	std::string target;
+
+	if (is_forwarding_shim(callee, target))
+	{
+		reason = fmt::format("forwards to {}", target);
+		return true;
+	}
+
+	if (callee.inlining == Inlining::ALWAYS)
+	{
+		reason = "declared INLINE";
+		return true;
+	}
+
+	const std::size_t size = function_size(callee);
+
+	if (function_size(function) + size > max_caller_size)
+	{
+		reason = fmt::format("{} would grow past {} instructions", function.name, max_caller_size);
+		return false;
+	}
+
+	const bool        in_loop = loop_depths(function)[block] > 0;
+	const std::size_t limit   = call_cost(call) + (in_loop ? loop_procedure_size : small_procedure_size);
+	const char*       where   = in_loop ? " in a loop" : "";
+
+	if (size <= limit)
+	{
+		reason = fmt::format("size {} within the limit of {}{}", size, limit, where);
+		return true;
+	}
+
+	if (m_call_counts.at(callee.name) == 1 && size <= single_call_size)
+	{
+		reason = fmt::format("size {}, only call", size);
+		return true;
+	}
+
+	reason = fmt::format("size {} over the limit of {}{}", size, limit, where);
+	return false;
+}
+
+BlockId Inliner::inline_call(std::size_t caller, BlockId block, std::size_t index, std::size_t callee)
+{
+	Function&       function     = m_program.functions[caller];
+	const Function& body         = m_program.functions[callee];
+	const BlockId   continuation = function.blocks.size();
+	const BlockId   body_begin   = continuation + 1;
+
+	function.blocks.emplace_back();
+
+	std::vector<Instruction>& instructions = function.blocks[block].instructions;
+	const Instruction         call         = instructions[index];
+
+	function.blocks[continuation].instructions.assign(
+		std::make_move_iterator(instructions.begin() + std::ptrdiff_t(index + 1)),
+		std::make_move_iterator(instructions.end()));
+	instructions.erase(instructions.begin() + std::ptrdiff_t(index), instructions.end());
+
+	// The successors of the block are now entered from its end
+	for (const BlockId successor : function.successors(continuation))
+	{
+		for (Instruction& instruction : function.blocks[successor].instructions)
+		{
+			if (instruction.is(Opcode::PHI))
+			{
+				std::replace(instruction.blocks.begin(), instruction.blocks.end(), block, continuation);
+			}
+		}
+	}
+
+	split_loops(caller, block, continuation, body_begin, body_begin + body.blocks.size());
+
+	std::unordered_set<std::string> scalars, read_only;
+	find_scalar_variables(body, scalars, read_only);
+
+	// Parameters that are only read are replaced by the arguments, other variables are copied to the caller
+	std::unordered_map<std::string, Variable> names;
+	std::unordered_set<std::string>           forwarded_variables;
+	std::vector<ValueId>                      values(body.value_types.size(), no_value);
+	++m_inlined_count;
+
+	for (std::size_t i = 0; i < body.parameters.size(); ++i)
+	{
+		const Variable& parameter = body.parameters[i];
+
+		if (read_only.count(parameter.name) == 0)
+		{
+			continue;
+		}
+
+		for (const BasicBlock& body_block : body.blocks)
+		{
+			for (const Instruction& instruction : body_block.instructions)
+			{
+				if (instruction.is(Opcode::LOAD_GLOBAL) && instruction.symbol == parameter.name)
+				{
+					values[instruction.result] = call.operands[i];
+				}
+			}
+		}
+	}
+
+	for (const std::vector<Variable>* variables : {&body.parameters, &body.locals})
+	{
+		for (const Variable& variable : *variables)
+		{
+			const bool is_parameter = variables == &body.parameters;
+
+			if (is_parameter && read_only.count(variable.name) != 0)
+			{
+				continue;
+			}
+
+			// Identifiers cannot contain dots, so the copies never hide a variable of the caller
+			const std::string name = fmt::format("{}.{}.{}", body.name, variable.name, m_inlined_count);
+			names[variable.name]   = {name, variable.type, m_symbols.intern(name)};
+			function.locals.push_back(names[variable.name]);
+
+			if (m_address_taken_variables.count(variable.name) != 0)
+			{
+				m_address_taken_variables.insert(name);
+			}
+			else if (scalars.count(variable.name) != 0)
+			{
+				forwarded_variables.insert(name);
+			}
+		}
+	}
+
+	for (ValueId value = 0; value < values.size(); ++value)
+	{
+		if (values[value] == no_value)
+		{
+			values[value] = function.create_value(body.value_types[value]);
+		}
+	}
+
+	for (std::size_t i = 0; i < body.parameters.size(); ++i)
+	{
+		const auto it = names.find(body.parameters[i].name);
+
+		if (it != names.end())
+		{
+			Instruction store{Opcode::STORE_GLOBAL};
+			store.type     = body.parameters[i].type.type;
+			store.symbol   = it->second.name;
+			store.variable = it->second.symbol;
+			store.operands = {call.operands[i]};
+			function.blocks[block].instructions.push_back(std::move(store));
+		}
+	}
+
+	Instruction jump{Opcode::JUMP};
+	jump.blocks = {body_begin};
+	function.blocks[block].instructions.push_back(std::move(jump));
+
+	// Returning jumps to the end of the caller block, with the result of the procedure if it has one
+	std::vector<ValueId> results;
+	std::vector<BlockId> returning_blocks;
+
+	for (BlockId body_block = 0; body_block < body.blocks.size(); ++body_block)
+	{
+		BasicBlock copy;
+
+		for (const Instruction& instruction : body.blocks[body_block].instructions)
+		{
+			if (instruction.is(Opcode::LOAD_GLOBAL) && read_only.count(instruction.symbol) != 0
+				&& names.count(instruction.symbol) == 0)
+			{
+				continue;
+			}
+
+			if (instruction.is(Opcode::RETURN))
+			{
+				if (!instruction.operands.empty())
+				{
+					results.push_back(values[instruction.operands.front()]);
+				}
+
+				returning_blocks.push_back(body_begin + body_block);
+
+				Instruction return_jump{Opcode::JUMP};
+				return_jump.blocks = {continuation};
+				copy.instructions.push_back(std::move(return_jump));
+				continue;
+			}
+
+			Instruction instruction_copy = instruction;
+
+			if (instruction.has_result())
+			{
+				instruction_copy.result = values[instruction.result];
+			}
+
+			for (ValueId& operand : instruction_copy.operands)
+			{
+				operand = values[operand];
+			}
+
+			for (BlockId& target : instruction_copy.blocks)
+			{
+				target += body_begin;
+			}
+
+			const auto name = names.find(instruction.symbol);
+
+			if (accesses_variable(instruction) && name != names.end())
+			{
+				instruction_copy.symbol   = name->second.name;
+				instruction_copy.variable = name->second.symbol;
+			}
+
+			copy.instructions.push_back(std::move(instruction_copy));
+		}
+
+		function.blocks.push_back(std::move(copy));
+	}
+
+	if (call.has_result())
+	{
+		if (results.size() == 1)
+		{
+			function.replace_uses(call.result, results.front());
+		}
+		else
+		{
+			Instruction phi{Opcode::PHI};
+			phi.type     = call.type;
+			phi.result   = call.result;
+			phi.operands = results;
+			phi.blocks   = returning_blocks;
+
+			std::vector<Instruction>& continuation_instructions = function.blocks[continuation].instructions;
+			continuation_instructions.insert(continuation_instructions.begin(), std::move(phi));
+		}
+	}
+
+	copy_loops(callee, caller, body_begin, names);
+
+	// E.g. the result, which is stored right before being loaded to be returned
+	forward_stores(function, body_begin, forwarded_variables);
+
+	return continuation;
+}
+
+void Inliner::split_loops(std::size_t caller, BlockId block, BlockId continuation, BlockId body_begin, BlockId body_end)
+{
+	for (auto& it : m_loops)
+	{
+		ForLoop& loop = it.second;
+
+		if (it.first != caller)
+		{
+			continue;
+		}
+
+		if (std::find(loop.blocks.begin(), loop.blocks.end(), block) != loop.blocks.end())
+		{
+			loop.blocks.push_back(continuation);
+
+			for (BlockId body_block = body_begin; body_block < body_end; ++body_block)
+			{
+				loop.blocks.push_back(body_block);
+			}
+		}
+
+		if (loop.latch == block)
+		{
+			loop.latch = continuation;
+		}
+
+		if (loop.preheader == block)
+		{
+			loop.preheader = continuation;
+		}
+	}
+}
+
+void Inliner::copy_loops(
+	std::size_t                                      callee,
+	std::size_t                                      caller,
+	BlockId                                          body_begin,
+	const std::unordered_map<std::string, Variable>& names)
+{
+	std::vector<std::pair<std::size_t, ForLoop>> copies;
+
+	for (const auto& it : m_loops)
+	{
+		if (it.first != callee)
+		{
+			continue;
+		}
+
+		ForLoop loop = it.second;
+
+		const auto name = names.find(loop.variable);
+
+		if (name != names.end())
+		{
+			loop.variable = name->second.name;
+		}
+
+		loop.preheader += body_begin;
+		loop.header += body_begin;
+		loop.latch += body_begin;
+		loop.exit += body_begin;
+
+		for (BlockId& block : loop.blocks)
+		{
+			block += body_begin;
+		}
+
+		copies.emplace_back(caller, std::move(loop));
+	}
+
+	// Inner loops are optimized first, and the loops of the body are nested in any loop of the caller around the call
+	const auto first_caller_loop = std::find_if(m_loops.begin(), m_loops.end(), [&](const auto& it) {
+		return it.first == caller;
+	});
+
+	m_loops.insert(first_caller_loop, copies.begin(), copies.end());
+}
+
+void Inliner::remove_uncalled_functions()
+{
+	std::unordered_set<std::string> called{"main"};
+	std::vector<std::string>        worklist{"main"};
+
+	while (!worklist.empty())
+	{
+		const auto it = m_function_indices.find(worklist.back());
+		worklist.pop_back();
+
+		if (it == m_function_indices.end())
+		{
+			continue;
+		}
+
+		for (const BasicBlock& block : m_program.functions[it->second].blocks)
+		{
+			for (const Instruction& instruction : block.instructions)
+			{
+				if (instruction.is(Opcode::CALL) && !instruction.foreign && called.insert(instruction.symbol).second)
+				{
+					worklist.push_back(instruction.symbol);
+				}
+			}
+		}
+	}
+
+	const auto end = std::remove_if(m_loops.begin(), m_loops.end(), [&](const auto& it) {
+		return called.count(m_program.functions[it.first].name) == 0;
+	});
+
+	m_loops.erase(end, m_loops.end());
+
+	std::vector<std::size_t> new_indices(m_program.functions.size(), 0);
+	std::vector<Function>    functions;
+
+	for (std::size_t i = 0; i < m_program.functions.size(); ++i)
+	{
+		Function& function = m_program.functions[i];
+
+		if (called.count(function.name) == 0)
+		{
+			const auto count = m_call_counts.find(function.name);
+			m_remarks.push_back(fmt::format(
+				"removed {}, which is {} called", function.name, count == m_call_counts.end() ? "never" : "no longer"));
+			continue;
+		}
+
+		new_indices[i] = functions.size();
+		functions.push_back(std::move(function));
+	}
+
+	for (auto& it : m_loops)
+	{
+		it.first = new_indices[it.first];
+	}
+
+	m_program.functions = std::move(functions);
+}
+} // namespace
+
+void inline_procedures(
+	Program&                                      program,
+	SymbolTable&                                  symbols,
+	std::vector<std::pair<std::size_t, ForLoop>>& loops,
+	std::unordered_set<std::string>&              address_taken_variables,
+	std::vector<std::string>&                     remarks)
+{
+	Inliner{program, symbols, loops, address_taken_variables, remarks}();
+}
+} // namespace ir
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ir/ir.hpp"
+#include "ir/loops.hpp"
+#include "symbol.hpp"
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ir
+{
+//! \brief Replace the calls to the procedures of \p program by a copy of their body where it is worth it, then remove
+//! the procedures that are no longer called. Must be called before the loops are optimized.
+//!
+//! \details
+//!		Procedures are visited in order, so that a procedure was already inlined into before being inlined itself. The
+//!		calls of an inlined body are not considered again, which keeps recursive procedures from being unrolled.
+//!		A call is inlined if:
+//!		- The procedure is a shim forwarding its parameters to a foreign function, e.g. `ln := log(x)`, whose body is
+//!		  not larger than the call.
+//!		- The procedure was declared INLINE.
+//!		- The estimated size of the procedure is below the cost of the call plus a small allowance, which is larger
+//!		  in loops, or it is the only call of the procedure.
+//!		Procedures declared NOINLINE, recursive procedures and calls in the bound of a FOR loop are never inlined, and
+//!		procedures stop growing past a fixed size.
+//!		The parameters and locals of an inlined procedure become locals of the caller, except for the parameters that
+//!		are only read, which are replaced by the arguments.
+//!
+//! \param symbols Interns the names of the copies of the variables of inlined procedures.
+//! \param loops FOR loops of the program with the index of their function, updated to follow the blocks that calls
+//! are split into. The loops of an inlined procedure are copied along with its body.
+//! \param address_taken_variables Variables whose address is taken anywhere in the program, extended with the copies
+//! of the ones of inlined procedures.
+//! \param remarks Appended with the decision taken for each call, and with the procedures that were removed.
+void inline_procedures(
+	Program&                                      program,
+	SymbolTable&                                  symbols,
+	std::vector<std::pair<std::size_t, ForLoop>>& loops,
+	std::unordered_set<std::string>&              address_taken_variables,
+	std::vector<std::string>&                     remarks);
+} // namespace ir
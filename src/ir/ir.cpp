@@ -0,0 +1,480 @@
+#include "ir.hpp"
+
+#include "util/enums.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fmt/core.h>
+#include <ostream>
+#include <stdexcept>
+
+namespace ir
+{
+static constexpr std::array<string_view, 28> opcode_names{{
+	"const", "load_global",  "global_address", "load",         "store_global",
+	"store", "load_element", "store_element",  "check_bounds", "not",
+	"and",   "or",           "add",            "sub",          "mul",
+	"div",   "mod",          "cmp",            "convert",      "call",
+	"new",   "dispose",      "display",        "vector_loop",  "phi",
+	"jump",  "branch",       "return",
+}};
+
+static_assert(
+	opcode_names.size() == std::size_t(Opcode::RETURN) + 1, "Please update opcode names when modifying the enum");
+
+static constexpr std::array<string_view, 10> comparison_names{{
+	"eq",
+	"ne",
+	"lt",
+	"le",
+	"gt",
+	"ge",
+	"slt",
+	"sle",
+	"sgt",
+	"sge",
+}};
+
+static_assert(
+	comparison_names.size() == std::size_t(Comparison::SIGNED_GREATER_EQUAL) + 1,
+	"Please update comparison names when modifying the enum");
+
+static constexpr std::array<string_view, 3> reduction_operator_names{{"add", "min", "max"}};
+
+static_assert(
+	reduction_operator_names.size() == std::size_t(ReductionOperator::MAX) + 1,
+	"Please update reduction operator names when modifying the enum");
+
+string_view opcode_name(Opcode opcode) { return opcode_names[underlying_cast(opcode)]; }
+
+string_view reduction_operator_name(ReductionOperator op) { return reduction_operator_names[underlying_cast(op)]; }
+
+string_view comparison_name(Comparison comparison) { return comparison_names[underlying_cast(comparison)]; }
+
+Comparison swap_comparison(Comparison comparison)
+{
+	switch (comparison)
+	{
+	case Comparison::LOWER: return Comparison::GREATER;
+	case Comparison::LOWER_EQUAL: return Comparison::GREATER_EQUAL;
+	case Comparison::GREATER: return Comparison::LOWER;
+	case Comparison::GREATER_EQUAL: return Comparison::LOWER_EQUAL;
+	case Comparison::SIGNED_LOWER: return Comparison::SIGNED_GREATER;
+	case Comparison::SIGNED_LOWER_EQUAL: return Comparison::SIGNED_GREATER_EQUAL;
+	case Comparison::SIGNED_GREATER: return Comparison::SIGNED_LOWER;
+	case Comparison::SIGNED_GREATER_EQUAL: return Comparison::SIGNED_LOWER_EQUAL;
+	default: return comparison;
+	}
+}
+
+bool is_terminator(Opcode opcode)
+{
+	return opcode == Opcode::JUMP || opcode == Opcode::BRANCH || opcode == Opcode::RETURN;
+}
+
+bool has_side_effects(Opcode opcode)
+{
+	switch (opcode)
+	{
+	case Opcode::STORE_GLOBAL:
+	case Opcode::STORE:
+	case Opcode::STORE_ELEMENT:
+	case Opcode::CALL:
+	case Opcode::DISPOSE:
+	case Opcode::DISPLAY:
+	case Opcode::VECTOR_LOOP:
+	case Opcode::JUMP:
+	case Opcode::BRANCH:
+	case Opcode::RETURN: return true;
+
+	// Integer division by zero and out of bounds indices trap
+	case Opcode::DIV:
+	case Opcode::MOD:
+	case Opcode::CHECK_BOUNDS: return true;
+
+	default: return false;
+	}
+}
+
+std::vector<std::size_t> VectorKernel::last_uses() const
+{
+	std::vector<std::size_t> result(value_count, 0);
+
+	for (std::size_t i = 0; i < instructions.size(); ++i)
+	{
+		if (instructions[i].has_result())
+		{
+			result[instructions[i].result] = i;
+		}
+
+		for (const ValueId operand : instructions[i].operands)
+		{
+			result[operand] = i;
+		}
+	}
+
+	for (const VectorReduction& reduction : reductions)
+	{
+		result[reduction.value] = instructions.size();
+	}
+
+	return result;
+}
+
+std::size_t VectorKernel::register_count() const
+{
+	const std::vector<std::size_t> last = last_uses();
+
+	std::vector<bool> is_temporary(value_count, false);
+	std::size_t       invariant = input_count + reductions.size() * unroll;
+	std::size_t       live = 0, peak = 0;
+
+	for (std::size_t i = 0; i < instructions.size(); ++i)
+	{
+		const Instruction& instruction = instructions[i];
+
+		if (instruction.is(Opcode::CONSTANT))
+		{
+			++invariant;
+			continue;
+		}
+
+		if (instruction.has_result())
+		{
+			is_temporary[instruction.result] = true;
+			peak                             = std::max(peak, ++live);
+		}
+
+		// Each temporary dies once, at its last use or right away if unused
+		for (ValueId value = 0; value < value_count; ++value)
+		{
+			const bool is_used = value == instruction.result
+				|| std::find(instruction.operands.begin(), instruction.operands.end(), value)
+					   != instruction.operands.end();
+
+			if (is_used && is_temporary[value] && last[value] == i)
+			{
+				--live;
+			}
+		}
+	}
+
+	return invariant + peak;
+}
+
+ValueId Function::create_value(Type type)
+{
+	value_types.push_back(type);
+	return value_types.size() - 1;
+}
+
+void Function::replace_uses(ValueId value, ValueId replacement)
+{
+	for (BasicBlock& block : blocks)
+	{
+		for (Instruction& instruction : block.instructions)
+		{
+			std::replace(instruction.operands.begin(), instruction.operands.end(), value, replacement);
+		}
+	}
+}
+
+void Function::replace_uses(const std::unordered_map<ValueId, ValueId>& replacements)
+{
+	if (replacements.empty())
+	{
+		return;
+	}
+
+	for (BasicBlock& block : blocks)
+	{
+		for (Instruction& instruction : block.instructions)
+		{
+			for (ValueId& operand : instruction.operands)
+			{
+				const auto it = replacements.find(operand);
+
+				if (it != replacements.end())
+				{
+					operand = it->second;
+				}
+			}
+		}
+	}
+}
+
+std::vector<BlockId> Function::successors(BlockId block) const
+{
+	const BasicBlock& basic_block = blocks[block];
+
+	if (!basic_block.is_terminated())
+	{
+		return {};
+	}
+
+	return basic_block.terminator().blocks;
+}
+
+std::vector<std::vector<BlockId>> Function::predecessors() const
+{
+	std::vector<std::vector<BlockId>> result(blocks.size());
+
+	for (BlockId block = 0; block < blocks.size(); ++block)
+	{
+		for (const BlockId successor : successors(block))
+		{
+			// Both targets of a BRANCH may be the same block, which is only a single predecessor
+			auto& list = result[successor];
+
+			if (std::find(list.begin(), list.end(), block) == list.end())
+			{
+				list.push_back(block);
+			}
+		}
+	}
+
+	return result;
+}
+
+std::vector<BlockId> Function::reverse_postorder() const
+{
+	std::vector<BlockId> postorder;
+
+	if (blocks.empty())
+	{
+		return postorder;
+	}
+
+	std::vector<bool> visited(blocks.size(), false);
+
+	// Iterative depth-first search. Successors are visited last to first, so that the true side of a BRANCH comes
+	// first once the order is reversed.
+	struct Frame
+	{
+		BlockId              block;
+		std::vector<BlockId> successors;
+	};
+
+	std::vector<Frame> stack;
+	stack.push_back({0, successors(0)});
+	visited[0] = true;
+
+	while (!stack.empty())
+	{
+		Frame& frame = stack.back();
+
+		if (frame.successors.empty())
+		{
+			postorder.push_back(frame.block);
+			stack.pop_back();
+			continue;
+		}
+
+		const BlockId next = frame.successors.back();
+		frame.successors.pop_back();
+
+		if (!visited[next])
+		{
+			visited[next] = true;
+			stack.push_back({next, successors(next)});
+		}
+	}
+
+	std::reverse(postorder.begin(), postorder.end());
+	return postorder;
+}
+
+const Variable* Function::find_local(const std::string& name) const
+{
+	for (const std::vector<Variable>* variables : {&parameters, &locals})
+	{
+		for (const Variable& variable : *variables)
+		{
+			if (variable.name == name)
+			{
+				return &variable;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+static std::string type_string(Type type)
+{
+	switch (type)
+	{
+	case Type::VOID: return "void";
+	case Type::UNSIGNED_INT: return "u64";
+	case Type::DOUBLE: return "f64";
+	case Type::BOOLEAN: return "bool";
+	case Type::CHAR: return "char";
+	default: return fmt::format("type{}", underlying_cast(type));
+	}
+}
+
+//! \param prefix '%' for the values of functions, '$' for the values of vector kernels.
+static std::string value_string(ValueId value, char prefix = '%') { return fmt::format("{}{}", prefix, value); }
+
+//! \param kernel Whether \p instruction belongs to a VectorKernel, which is printed indented below its VECTOR_LOOP.
+static void print_instruction(std::ostream& stream, const Instruction& instruction, bool kernel = false)
+{
+	const char prefix = kernel ? '$' : '%';
+
+	stream << (kernel ? "\t\t" : "\t");
+
+	if (instruction.has_result())
+	{
+		stream << value_string(instruction.result, prefix) << " = ";
+	}
+
+	stream << opcode_name(instruction.opcode);
+
+	if (instruction.is(Opcode::COMPARE))
+	{
+		stream << ' ' << comparison_name(instruction.comparison);
+	}
+
+	if (instruction.type != Type::VOID)
+	{
+		stream << ' ' << type_string(instruction.type);
+	}
+
+	std::vector<std::string> arguments;
+
+	if (instruction.is(Opcode::CONSTANT))
+	{
+		arguments.push_back(fmt::format("0x{:x}", instruction.constant));
+	}
+
+	if (!instruction.symbol.empty())
+	{
+		arguments.push_back("@" + instruction.symbol);
+	}
+
+	if (kernel && (instruction.is(Opcode::LOAD_ELEMENT) || instruction.is(Opcode::STORE_ELEMENT)))
+	{
+		arguments.push_back(fmt::format("i{:+}", std::int64_t(instruction.constant)));
+	}
+
+	if (instruction.is(Opcode::PHI))
+	{
+		for (std::size_t i = 0; i < instruction.operands.size(); ++i)
+		{
+			arguments.push_back(
+				fmt::format("[{}, bb{}]", value_string(instruction.operands[i]), instruction.blocks[i]));
+		}
+	}
+	else
+	{
+		for (const ValueId operand : instruction.operands)
+		{
+			arguments.push_back(value_string(operand, prefix));
+		}
+
+		if (instruction.is(Opcode::CHECK_BOUNDS) || instruction.is(Opcode::NEW) || instruction.is(Opcode::DISPOSE))
+		{
+			arguments.push_back(fmt::format("0x{:x}", instruction.constant));
+		}
+
+		// The offset of a field is only known once the layout of its record was chosen
+		if (instruction.field.is_set())
+		{
+			const FieldAccess& field = instruction.field;
+			arguments.push_back(
+				field.record_size == 0 ? fmt::format("field {}", field.index)
+									   : fmt::format("field {} at +{}", field.index, field.offset));
+		}
+
+		if (instruction.is(Opcode::VECTOR_LOOP))
+		{
+			const VectorKernel& vector_kernel = *instruction.kernel;
+			arguments.push_back(fmt::format("{} x{}", type_string(vector_kernel.type), vector_kernel.lanes));
+			arguments.push_back(fmt::format("unroll {}", vector_kernel.unroll));
+		}
+
+		for (const BlockId block : instruction.blocks)
+		{
+			arguments.push_back(fmt::format("bb{}", block));
+		}
+	}
+
+	for (std::size_t i = 0; i < arguments.size(); ++i)
+	{
+		stream << (i == 0 ? " " : ", ") << arguments[i];
+	}
+
+	stream << '\n';
+
+	if (instruction.is(Opcode::VECTOR_LOOP))
+	{
+		for (const Instruction& kernel_instruction : instruction.kernel->instructions)
+		{
+			print_instruction(stream, kernel_instruction, true);
+		}
+
+		for (const VectorReduction& reduction : instruction.kernel->reductions)
+		{
+			stream << fmt::format(
+				"\t\treduce {} @{}, {}\n",
+				reduction_operator_name(reduction.op).str(),
+				reduction.variable,
+				value_string(reduction.value, '$'));
+		}
+	}
+}
+
+void print(std::ostream& stream, const Program& program)
+{
+	for (const Variable& global : program.globals)
+	{
+		stream << fmt::format("global @{}: {}\n", global.name, type_string(global.type.type));
+	}
+
+	for (const Function& function : program.functions)
+	{
+		stream << "\nfunction " << function.name;
+
+		// The main procedure has neither parameters nor a result
+		if (function.name != "main")
+		{
+			stream << '(';
+
+			for (std::size_t i = 0; i < function.parameters.size(); ++i)
+			{
+				const Variable& parameter = function.parameters[i];
+				stream << (i == 0 ? "" : ", ") << '@' << parameter.name << ": " << type_string(parameter.type.type);
+			}
+
+			stream << ')';
+
+			if (function.return_type != Type::VOID)
+			{
+				stream << ": " << type_string(function.return_type);
+			}
+
+			if (function.inlining != Inlining::AUTO)
+			{
+				stream << (function.inlining == Inlining::ALWAYS ? " inline" : " noinline");
+			}
+		}
+
+		stream << '\n';
+
+		for (const Variable& local : function.locals)
+		{
+			stream << fmt::format("\tlocal @{}: {}\n", local.name, type_string(local.type.type));
+		}
+
+		for (BlockId block = 0; block < function.blocks.size(); ++block)
+		{
+			stream << fmt::format("bb{}:\n", block);
+
+			for (const Instruction& instruction : function.blocks[block].instructions)
+			{
+				print_instruction(stream, instruction);
+			}
+		}
+	}
+}
+} // namespace ir
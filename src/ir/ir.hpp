@@ -0,0 +1,329 @@
+#pragma once
+
+#include "types.hpp"
+#include "util/string_view.hpp"
+#include "variable.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//! \brief Typed SSA intermediate representation, built by the parser and lowered by the backends.
+//!
+//! \details
+//!		A program is made of functions, which are made of basic blocks. Each block is a list of instructions ending
+//!		with exactly one terminator (JUMP, BRANCH or RETURN). Instructions define at most one value, which is
+//!		identified by its index in the function and never reassigned.
+//!		Variables are not values: they live in memory, and are accessed through LOAD_GLOBAL and STORE_GLOBAL. The
+//!		parameters and locals of a function hide the globals of the same name.
+namespace ir
+{
+using ValueId = std::size_t;
+using BlockId = std::size_t;
+
+constexpr ValueId no_value = std::numeric_limits<ValueId>::max();
+
+enum class Opcode
+{
+	//! Constant of any type, given as the bit pattern of its runtime representation.
+	CONSTANT,
+
+	//! Value of a variable.
+	LOAD_GLOBAL,
+
+	//! Pointer to a variable.
+	GLOBAL_ADDRESS,
+
+	//! Value pointed to by the pointer operand.
+	LOAD,
+
+	//! Write the operand to a variable.
+	STORE_GLOBAL,
+
+	//! Write the first operand to where the second operand points.
+	STORE,
+
+	//! Element of an array variable at the zero-based index operand.
+	//! Elements are as large as their type, or as their record for the accesses to the field of a record.
+	LOAD_ELEMENT,
+
+	//! Write the second operand to the element of an array variable at the zero-based index given by the first.
+	STORE_ELEMENT,
+
+	//! Trap unless the operand is lower than the constant, the length of an array, as an unsigned integer. Produces the
+	//! operand, so that accessing the element depends on the check.
+	CHECK_BOUNDS,
+
+	NOT,
+	AND,
+	OR,
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	MOD,
+
+	//! Compare the two operands, producing a BOOLEAN.
+	COMPARE,
+
+	//! Convert the operand to the type of the instruction, following the rules of CONVERT ... TO.
+	CONVERT,
+
+	//! Call a function with the operands as parameters.
+	CALL,
+
+	//! Pointer, of the type of the instruction, to a new block of memory as large as the constant and filled with
+	//! zeros. Allocated by the runtime library, from the innermost ARENA if any.
+	NEW,
+
+	//! Give back the block of memory, as large as the constant, that the operand points to, unless it belongs to an
+	//! ARENA.
+	DISPOSE,
+
+	//! Print the operand to stdout.
+	DISPLAY,
+
+	//! Run the kernel of the instruction on groups of consecutive iterations of a FOR loop, as long as whole groups
+	//! remain. The operands are the first iteration and the bound of the loop, followed by the inputs of the kernel.
+	//! Produces the first iteration left for the scalar loop.
+	VECTOR_LOOP,
+
+	//! Value of the operand whose index matches the predecessor the block was entered from, in the blocks.
+	PHI,
+
+	// Terminators
+	JUMP,
+	BRANCH,
+
+	//! Leave the function, producing the operand as its result if it has one.
+	RETURN
+};
+
+enum class Comparison
+{
+	EQUAL,
+	NOT_EQUAL,
+
+	// Unsigned for INTEGER operands
+	LOWER,
+	LOWER_EQUAL,
+	GREATER,
+	GREATER_EQUAL,
+
+	// Only valid for INTEGER operands
+	SIGNED_LOWER,
+	SIGNED_LOWER_EQUAL,
+	SIGNED_GREATER,
+	SIGNED_GREATER_EQUAL
+};
+
+[[nodiscard]] string_view opcode_name(Opcode opcode);
+[[nodiscard]] string_view comparison_name(Comparison comparison);
+
+//! \brief Whether \p comparison holds when its operands are swapped, e.g. LOWER for GREATER.
+[[nodiscard]] Comparison swap_comparison(Comparison comparison);
+
+[[nodiscard]] bool is_terminator(Opcode opcode);
+
+//! \brief Whether the instruction may have an effect other than defining its value, which forbids removing it.
+[[nodiscard]] bool has_side_effects(Opcode opcode);
+
+struct VectorKernel;
+
+//! \brief Field of a record accessed by LOAD_GLOBAL, STORE_GLOBAL, LOAD, STORE, LOAD_ELEMENT or STORE_ELEMENT, rather
+//! than the whole value.
+//!
+//! \details
+//!		Fields are identified by their position in the declaration of the record, since the layout of records is only
+//!		chosen once the whole program is known, from how often each field is accessed. Their offset is then resolved
+//!		before lowering.
+struct FieldAccess
+{
+	//! Type of the record, VOID if the instruction does not access a field.
+	Type        record = Type::VOID;
+	std::size_t index  = 0;
+
+	//! Offset of the field from the start of the record, and size of the record, in bytes.
+	std::size_t offset = 0, record_size = 0;
+
+	[[nodiscard]] bool is_set() const { return record != Type::VOID; }
+};
+
+struct Instruction
+{
+	explicit Instruction(Opcode opcode) : opcode{opcode} {}
+
+	Opcode opcode;
+
+	//! Type of the defined value, or of the written value for STORE_GLOBAL, STORE and STORE_ELEMENT, VOID otherwise.
+	Type type = Type::VOID;
+
+	ValueId result = no_value;
+
+	std::vector<ValueId> operands;
+
+	//! Successors for terminators: the target of JUMP, the true then false targets of BRANCH.
+	//! Predecessors for PHI, parallel to the operands.
+	std::vector<BlockId> blocks;
+
+	//! Bits for CONSTANT, array length for CHECK_BOUNDS, size of the block of memory for NEW and DISPOSE, offset from
+	//! the index of the iteration for the element accesses of a VectorKernel.
+	std::uint64_t constant = 0;
+
+	//! Variable name for LOAD_GLOBAL, GLOBAL_ADDRESS, STORE_GLOBAL, LOAD_ELEMENT and STORE_ELEMENT, function name for
+	//! CALL.
+	std::string symbol;
+
+	//! Interned variable name for the same instructions, which the assembly label of the variable is looked up by.
+	Symbol variable = {};
+
+	//! For COMPARE.
+	Comparison comparison = Comparison::EQUAL;
+
+	//! For CALL.
+	bool variadic = false, foreign = false;
+
+	//! For VECTOR_LOOP.
+	std::shared_ptr<const VectorKernel> kernel;
+
+	//! For loads and stores of a field of a record.
+	FieldAccess field;
+
+	[[nodiscard]] bool is(Opcode other) const { return opcode == other; }
+	[[nodiscard]] bool has_result() const { return result != no_value; }
+};
+
+//! \brief Operation folding the values of a reduction into its variable.
+enum class ReductionOperator
+{
+	ADD,
+
+	//! Like the C functions fmin and fmax, which only return NaN if both operands are NaN. Only over DOUBLE, which is
+	//! the only type these functions take.
+	MIN,
+	MAX
+};
+
+//! \brief Variable updated by every iteration of a vectorized loop, as `variable := variable <op> value`.
+struct VectorReduction
+{
+	std::string       variable;
+	Symbol            variable_symbol;
+	ReductionOperator op;
+
+	//! Value of the kernel folded into the variable.
+	ValueId value;
+};
+
+//! \brief Body of a FOR loop, as run by VECTOR_LOOP on several consecutive iterations at once.
+//!
+//! \details
+//!		Values of the kernel are numbered on their own. The first ones are the inputs, i.e. the operands of
+//!		VECTOR_LOOP after the bound, which are the same for every iteration. The other values hold one element per
+//!		iteration. Instructions are limited to:
+//!		- CONSTANT.
+//!		- LOAD_ELEMENT, and STORE_ELEMENT whose only operand is the stored value. The index of the element is the
+//!		  one of the iteration plus the constant of the instruction, as a signed integer.
+//!		- ADD, SUB, MUL and DIV.
+//!		- CALL to the C functions sqrt, fabs, fmin and fmax.
+struct VectorKernel
+{
+	//! Type of every value, DOUBLE or INTEGER.
+	Type type = Type::VOID;
+
+	//! Iterations run by each instruction.
+	std::size_t lanes = 1;
+
+	//! Copies of the kernel run by each iteration of the vector loop, each with its own accumulators for the
+	//! reductions so that they do not wait for each other.
+	std::size_t unroll = 1;
+
+	std::size_t input_count = 0, value_count = 0;
+
+	std::vector<Instruction>     instructions;
+	std::vector<VectorReduction> reductions;
+
+	//! \brief Find the index of the last instruction using each value, which is the size of the kernel for the values
+	//! of reductions, and the defining instruction for unused values.
+	[[nodiscard]] std::vector<std::size_t> last_uses() const;
+
+	//! \brief Count the vector registers needed to run the kernel without spilling.
+	//!
+	//! \details
+	//!		Inputs, constants and accumulators are held for the whole loop. Other values are held from their definition
+	//!		to their last use. The result of an instruction is allocated before its operands are released.
+	[[nodiscard]] std::size_t register_count() const;
+};
+
+struct BasicBlock
+{
+	std::vector<Instruction> instructions;
+
+	[[nodiscard]] const Instruction& terminator() const { return instructions.back(); }
+	[[nodiscard]] bool is_terminated() const { return !instructions.empty() && is_terminator(terminator().opcode); }
+};
+
+//! \brief Whether the calls to a function may be replaced by its body, as declared by INLINE or NOINLINE.
+enum class Inlining
+{
+	//! Decided by the cost of the function against the cost of the call.
+	AUTO,
+	ALWAYS,
+	NEVER
+};
+
+struct Function
+{
+	std::string name;
+
+	//! Variables of the function. The main procedure has no parameters, and only has the locals of the procedures
+	//! inlined into it. Parameters are passed in the order of their declaration.
+	std::vector<Variable> parameters, locals;
+
+	//! Type of the operand of RETURN, VOID for procedures.
+	Type return_type = Type::VOID;
+
+	Inlining inlining = Inlining::AUTO;
+
+	//! The first block is the entry point.
+	std::vector<BasicBlock> blocks;
+
+	//! Type of every value, indexed by ValueId.
+	std::vector<Type> value_types;
+
+	//! \brief Allocate a new value of type \p type, which still has to be defined by an instruction.
+	[[nodiscard]] ValueId create_value(Type type);
+
+	//! \brief Make every instruction using \p value use \p replacement instead.
+	void replace_uses(ValueId value, ValueId replacement);
+
+	//! \brief Make every instruction using a key of \p replacements use its value instead, in a single pass.
+	void replace_uses(const std::unordered_map<ValueId, ValueId>& replacements);
+
+	[[nodiscard]] std::vector<BlockId> successors(BlockId block) const;
+	[[nodiscard]] std::vector<std::vector<BlockId>> predecessors() const;
+
+	//! \brief Blocks reachable from the entry, in reverse postorder. For the structured control flow of the language,
+	//! this is also the order of the source.
+	[[nodiscard]] std::vector<BlockId> reverse_postorder() const;
+
+	//! \brief Find the parameter or local named \p name, nullptr for globals.
+	[[nodiscard]] const Variable* find_local(const std::string& name) const;
+};
+
+struct Program
+{
+	std::vector<Variable> globals;
+	std::vector<Function> functions;
+};
+
+[[nodiscard]] string_view reduction_operator_name(ReductionOperator op);
+
+//! \brief Write a textual representation of \p program, e.g. "%2 = add u64 %0, %1".
+void print(std::ostream& stream, const Program& program);
+} // namespace ir
@@ -0,0 +1,510 @@
+#include "loops.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+namespace ir
+{
+//! \brief Side effects of the instructions of a loop, which determine what can be moved out of it.
+struct LoopEffects
+{
+	//! Variables written to by name.
+	std::unordered_set<std::string> stored_variables;
+
+	//! Whether the loop writes through a pointer or calls a function, which may write to any variable whose address
+	//! was taken.
+	bool has_indirect_writes = false;
+
+	//! Whether the loop calls a procedure of the program, which may also read and write any global.
+	bool calls_procedures = false;
+};
+
+static LoopEffects loop_effects(const Function& function, const ForLoop& loop)
+{
+	LoopEffects effects;
+
+	for (const BlockId block : loop.blocks)
+	{
+		for (const Instruction& instruction : function.blocks[block].instructions)
+		{
+			if (instruction.is(Opcode::STORE_GLOBAL) || instruction.is(Opcode::STORE_ELEMENT))
+			{
+				effects.stored_variables.insert(instruction.symbol);
+			}
+			else if (instruction.is(Opcode::STORE) || instruction.is(Opcode::CALL))
+			{
+				effects.has_indirect_writes = true;
+				effects.calls_procedures |= instruction.is(Opcode::CALL) && !instruction.foreign;
+			}
+		}
+	}
+
+	return effects;
+}
+
+static bool is_loop_invariant(
+	const Function&                        function,
+	const Instruction&                     instruction,
+	const LoopEffects&                     effects,
+	const std::unordered_set<std::string>& address_taken_variables)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::CONSTANT:
+	case Opcode::GLOBAL_ADDRESS:
+	case Opcode::NOT:
+	case Opcode::AND:
+	case Opcode::OR:
+	case Opcode::ADD:
+	case Opcode::SUB:
+	case Opcode::MUL:
+	case Opcode::DIV:
+	case Opcode::MOD:
+	case Opcode::COMPARE:
+	case Opcode::CONVERT: return true;
+
+	case Opcode::LOAD_GLOBAL:
+	{
+		const bool stored         = effects.stored_variables.count(instruction.symbol) != 0;
+		const bool address_taken  = address_taken_variables.count(instruction.symbol) != 0;
+		const bool global         = function.find_local(instruction.symbol) == nullptr;
+		const bool may_be_written = stored || (address_taken && effects.has_indirect_writes)
+			|| (global && effects.calls_procedures);
+		return !may_be_written;
+	}
+
+	// Reads through pointers, calls and control flow stay in the loop
+	default: return false;
+	}
+}
+
+//! \brief Move the evaluation of the bound from the header to the preheader, if it does not depend on the loop.
+static void hoist_bound(
+	Function& function, const ForLoop& loop, const std::unordered_set<std::string>& address_taken_variables)
+{
+	std::vector<Instruction>& header = function.blocks[loop.header].instructions;
+
+	// The bound is everything before the load of the variable, the comparison and the branch
+	if (header.size() < 3)
+	{
+		return;
+	}
+
+	const auto bound_end = header.end() - 3;
+
+	const LoopEffects effects = loop_effects(function, loop);
+
+	// Instructions that are not moved could still be used by the ones that are, so the bound is moved as a whole.
+	// Division by zero traps in the preheader instead of the header, which is fine as the header always runs once.
+	const bool invariant = std::all_of(header.begin(), bound_end, [&](const Instruction& instruction) {
+		return is_loop_invariant(function, instruction, effects, address_taken_variables);
+	});
+
+	if (!invariant || header.begin() == bound_end)
+	{
+		return;
+	}
+
+	std::vector<Instruction>& preheader = function.blocks[loop.preheader].instructions;
+
+	preheader.insert(
+		preheader.end() - 1, std::make_move_iterator(header.begin()), std::make_move_iterator(bound_end));
+	header.erase(header.begin(), bound_end);
+}
+
+//! \brief Find the only STORE_GLOBAL to \p variable among \p blocks.
+//! \returns false if there is none or several.
+static bool find_single_store(
+	Function&                   function,
+	const std::vector<BlockId>& blocks,
+	const std::string&          variable,
+	BlockId&                    store_block,
+	std::size_t&                store_index)
+{
+	std::size_t count = 0;
+
+	for (const BlockId block : blocks)
+	{
+		const std::vector<Instruction>& instructions = function.blocks[block].instructions;
+
+		for (std::size_t i = 0; i < instructions.size(); ++i)
+		{
+			if (instructions[i].is(Opcode::STORE_GLOBAL) && instructions[i].symbol == variable)
+			{
+				store_block = block;
+				store_index = i;
+				++count;
+			}
+		}
+	}
+
+	return count == 1;
+}
+
+//! \brief Keep the variable of the loop in an SSA value rather than in memory, for the whole loop.
+static void promote_variable(Function& function, const ForLoop& loop)
+{
+	BlockId     latch_block = 0;
+	std::size_t latch_index = 0;
+
+	// The increment must be the only assignment of the loop
+	if (!find_single_store(function, loop.blocks, loop.variable, latch_block, latch_index) || latch_block != loop.latch)
+	{
+		return;
+	}
+
+	// The initial value is the last one stored by the preheader, i.e. by the assignment of the FOR statement
+	std::vector<Instruction>& preheader = function.blocks[loop.preheader].instructions;
+
+	const auto initial_store = std::find_if(preheader.rbegin(), preheader.rend(), [&](const Instruction& instruction) {
+		return instruction.is(Opcode::STORE_GLOBAL) && instruction.symbol == loop.variable;
+	});
+
+	if (initial_store == preheader.rend())
+	{
+		return;
+	}
+
+	std::vector<Instruction>& latch = function.blocks[loop.latch].instructions;
+
+	Instruction phi{Opcode::PHI};
+	phi.type     = Type::UNSIGNED_INT;
+	phi.result   = function.create_value(Type::UNSIGNED_INT);
+	phi.operands = {initial_store->operands[0], latch[latch_index].operands[0]};
+	phi.blocks   = {loop.preheader, loop.latch};
+
+	// Written back by a copy of the store of the latch, which is removed
+	const Symbol variable = latch[latch_index].variable;
+
+	// Every path leaving the loop goes through the exit, which is the only place the variable is written back. Before
+	// that, nothing can observe the memory of the variable, since its address is never taken.
+	preheader.erase(std::next(initial_store).base());
+	latch.erase(latch.begin() + std::ptrdiff_t(latch_index));
+
+	// Loads are replaced in one pass over the function, then removed from each block at once
+	std::unordered_map<ValueId, ValueId> replacements;
+
+	const auto is_variable_load = [&](const Instruction& instruction) {
+		return instruction.is(Opcode::LOAD_GLOBAL) && instruction.symbol == loop.variable;
+	};
+
+	for (const BlockId block : loop.blocks)
+	{
+		std::vector<Instruction>& instructions = function.blocks[block].instructions;
+
+		for (const Instruction& instruction : instructions)
+		{
+			if (is_variable_load(instruction))
+			{
+				replacements.emplace(instruction.result, phi.result);
+			}
+		}
+
+		instructions.erase(
+			std::remove_if(instructions.begin(), instructions.end(), is_variable_load), instructions.end());
+	}
+
+	function.replace_uses(replacements);
+
+	Instruction write_back{Opcode::STORE_GLOBAL};
+	write_back.type     = Type::UNSIGNED_INT;
+	write_back.symbol   = loop.variable;
+	write_back.variable = variable;
+	write_back.operands = {phi.result};
+
+	std::vector<Instruction>& exit = function.blocks[loop.exit].instructions;
+	exit.insert(exit.begin(), std::move(write_back));
+
+	std::vector<Instruction>& header = function.blocks[loop.header].instructions;
+	header.insert(header.begin(), std::move(phi));
+}
+
+void optimize_for_loop(
+	Function& function, const ForLoop& loop, const std::unordered_set<std::string>& address_taken_variables)
+{
+	hoist_bound(function, loop, address_taken_variables);
+
+	// Procedures called by the loop could read a global variable of the loop while it is not written back
+	const bool global = function.find_local(loop.variable) == nullptr;
+
+	if (address_taken_variables.count(loop.variable) == 0 && !(global && loop_effects(function, loop).calls_procedures))
+	{
+		promote_variable(function, loop);
+	}
+}
+
+static const Instruction* find_definition(const Function& function, ValueId value)
+{
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			if (instruction.result == value)
+			{
+				return &instruction;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+std::vector<std::size_t> loop_depths(const Function& function)
+{
+	const std::vector<BlockId> order = function.reverse_postorder();
+
+	std::vector<std::size_t> depths(function.blocks.size(), 0);
+	std::vector<std::size_t> order_index(function.blocks.size(), no_value);
+
+	for (std::size_t i = 0; i < order.size(); ++i)
+	{
+		order_index[order[i]] = i;
+	}
+
+	const auto predecessors = function.predecessors();
+
+	for (const BlockId latch : order)
+	{
+		for (const BlockId header : function.successors(latch))
+		{
+			// The control flow of the language is structured, so every edge going backwards closes a natural loop
+			if (order_index[header] > order_index[latch])
+			{
+				continue;
+			}
+
+			std::vector<bool>    in_loop(function.blocks.size(), false);
+			std::vector<BlockId> worklist{latch};
+			in_loop[header] = true;
+
+			while (!worklist.empty())
+			{
+				const BlockId block = worklist.back();
+				worklist.pop_back();
+
+				if (in_loop[block] || order_index[block] == no_value)
+				{
+					continue;
+				}
+
+				in_loop[block] = true;
+				worklist.insert(worklist.end(), predecessors[block].begin(), predecessors[block].end());
+			}
+
+			for (BlockId block = 0; block < in_loop.size(); ++block)
+			{
+				depths[block] += in_loop[block] ? 1 : 0;
+			}
+		}
+	}
+
+	return depths;
+}
+
+bool find_promoted_loop(const Function& function, const ForLoop& loop, PromotedLoop& result)
+{
+	// The header of a promoted loop starts with the phi and ends with the comparison to the bound and the branch
+	const std::vector<Instruction>& header = function.blocks[loop.header].instructions;
+
+	if (header.size() < 3 || !header.front().is(Opcode::PHI))
+	{
+		return false;
+	}
+
+	const Instruction& phi     = header.front();
+	const Instruction& compare = header[header.size() - 2];
+
+	const bool is_loop_phi = phi.blocks == std::vector<BlockId>{loop.preheader, loop.latch}
+		&& compare.is(Opcode::COMPARE) && compare.comparison == Comparison::SIGNED_GREATER_EQUAL
+		&& compare.operands[1] == phi.result;
+
+	if (!is_loop_phi)
+	{
+		return false;
+	}
+
+	// The variable only grows by steps of 1, so it never skips past the bound
+	const Instruction* increment = find_definition(function, phi.operands[1]);
+
+	if (increment == nullptr || !increment->is(Opcode::ADD) || increment->operands[0] != phi.result)
+	{
+		return false;
+	}
+
+	const Instruction* step = find_definition(function, increment->operands[1]);
+
+	if (step == nullptr || !step->is(Opcode::CONSTANT) || step->constant != 1)
+	{
+		return false;
+	}
+
+	result = PromotedLoop{&loop, phi.result, increment->result, phi.operands[0], compare.operands[0]};
+	return true;
+}
+
+//! \brief Inclusive range of the values an INTEGER value may take, as signed integers.
+struct ValueRange
+{
+	std::int64_t min, max;
+};
+
+class RangeAnalysis
+{
+	public:
+	RangeAnalysis(const Function& function, const std::vector<ForLoop>& loops);
+
+	//! \brief Compute the range of \p value where it is used by \p block.
+	//! \returns false if it is unknown.
+	bool range(ValueId value, BlockId block, ValueRange& result);
+
+	private:
+	const Function& m_function;
+
+	std::unordered_map<ValueId, const Instruction*> m_definitions;
+
+	//! Promoted loops by the phi holding their variable.
+	std::unordered_map<ValueId, PromotedLoop> m_loops;
+
+	//! Phis whose range is being computed, which cannot depend on themselves.
+	std::unordered_set<ValueId> m_visiting;
+};
+
+RangeAnalysis::RangeAnalysis(const Function& function, const std::vector<ForLoop>& loops) : m_function{function}
+{
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			if (instruction.has_result())
+			{
+				m_definitions.emplace(instruction.result, &instruction);
+			}
+		}
+	}
+
+	for (const ForLoop& loop : loops)
+	{
+		PromotedLoop promoted;
+
+		if (find_promoted_loop(function, loop, promoted))
+		{
+			m_loops.emplace(promoted.variable, promoted);
+		}
+	}
+}
+
+bool RangeAnalysis::range(ValueId value, BlockId block, ValueRange& result)
+{
+	// Large enough for any array, small enough that adding two ranges cannot overflow
+	constexpr std::int64_t limit = std::int64_t(1) << 48;
+
+	const auto is_small = [&](const ValueRange& range) {
+		return range.min >= -limit && range.max <= limit && range.min <= range.max;
+	};
+
+	const auto it = m_definitions.find(value);
+
+	if (it == m_definitions.end() || m_function.value_types[value] != Type::UNSIGNED_INT)
+	{
+		return false;
+	}
+
+	const Instruction& instruction = *it->second;
+
+	switch (instruction.opcode)
+	{
+	case Opcode::CONSTANT:
+	{
+		result = {std::int64_t(instruction.constant), std::int64_t(instruction.constant)};
+		return is_small(result);
+	}
+
+	case Opcode::ADD:
+	case Opcode::SUB:
+	{
+		ValueRange left, right;
+
+		if (!range(instruction.operands[0], block, left) || !range(instruction.operands[1], block, right))
+		{
+			return false;
+		}
+
+		result = instruction.is(Opcode::ADD) ? ValueRange{left.min + right.min, left.max + right.max}
+											 : ValueRange{left.min - right.max, left.max - right.min};
+		return is_small(result);
+	}
+
+	case Opcode::PHI:
+	{
+		const auto loop_it = m_loops.find(value);
+
+		if (loop_it == m_loops.end() || m_visiting.count(value) != 0)
+		{
+			return false;
+		}
+
+		// Outside of the body, e.g. in the exit block, the variable is past the bound
+		const PromotedLoop& loop       = loop_it->second;
+		const auto&         blocks     = loop.loop->blocks;
+		const bool          is_in_body = block != loop.loop->header
+			&& std::find(blocks.begin(), blocks.end(), block) != blocks.end();
+
+		if (!is_in_body)
+		{
+			return false;
+		}
+
+		ValueRange initial, bound;
+
+		m_visiting.insert(value);
+		const bool known = range(loop.initial, block, initial) && range(loop.bound, block, bound);
+		m_visiting.erase(value);
+
+		// If the lowest initial value is above the highest bound, the body never runs and any range holds
+		result = {initial.min, std::max(initial.min, bound.max)};
+		return known;
+	}
+
+	default: return false;
+	}
+}
+
+void eliminate_bounds_checks(Function& function, const std::vector<ForLoop>& loops)
+{
+	std::vector<std::pair<BlockId, ValueId>> removed_checks;
+
+	{
+		RangeAnalysis analysis{function, loops};
+
+		for (BlockId block = 0; block < function.blocks.size(); ++block)
+		{
+			for (const Instruction& instruction : function.blocks[block].instructions)
+			{
+				ValueRange range;
+
+				if (instruction.is(Opcode::CHECK_BOUNDS) && analysis.range(instruction.operands[0], block, range)
+					&& range.min >= 0 && std::uint64_t(range.max) < instruction.constant)
+				{
+					removed_checks.emplace_back(block, instruction.result);
+				}
+			}
+		}
+	}
+
+	for (const auto& check : removed_checks)
+	{
+		std::vector<Instruction>& instructions = function.blocks[check.first].instructions;
+
+		const auto it = std::find_if(instructions.begin(), instructions.end(), [&](const Instruction& instruction) {
+			return instruction.result == check.second;
+		});
+
+		const ValueId index = it->operands[0];
+		instructions.erase(it);
+		function.replace_uses(check.second, index);
+	}
+}
+} // namespace ir
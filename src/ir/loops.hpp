@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ir/ir.hpp"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace ir
+{
+//! \brief Blocks of a FOR loop, as built by the parser.
+//!
+//! \details
+//!		The preheader stores the initial value of the variable, then jumps to the header. The header evaluates the
+//!		bound, loads the variable, compares them and branches to the body or to the exit. The latch is the last block
+//!		of the body: it increments the variable and jumps back to the header.
+struct ForLoop
+{
+	std::string variable;
+
+	BlockId preheader, header, latch, exit;
+
+	//! Every block of the loop, including the header and the latch.
+	std::vector<BlockId> blocks;
+
+	//! Line of the FOR statement, for reports.
+	std::size_t line = 0;
+};
+
+//! \brief Values of a FOR loop whose variable is kept in an SSA value by optimize_for_loop.
+struct PromotedLoop
+{
+	const ForLoop* loop;
+
+	//! Phi holding the variable in the header, and its value incremented by 1 in the latch.
+	ValueId variable, next;
+
+	//! Initial value and bound of the variable.
+	ValueId initial, bound;
+};
+
+//! \brief Count the loops each block of \p function is part of, found from the back edges of the reverse postorder.
+[[nodiscard]] std::vector<std::size_t> loop_depths(const Function& function);
+
+//! \brief Check whether the variable of \p loop was kept in an SSA value, finding its values if so.
+bool find_promoted_loop(const Function& function, const ForLoop& loop, PromotedLoop& result);
+
+//! \brief Optimize \p loop, which must be called on inner loops before outer loops.
+//!
+//! \details
+//!		- The bound is evaluated once in the preheader if it does not depend on anything the loop may modify.
+//!		- If its address is never taken, the variable is kept in an SSA value (a phi in the header) for the whole
+//!		  loop, and only written back to memory when leaving the loop. The body must not assign the variable, nor call
+//!		  a procedure of the program if the variable is a global.
+//!
+//! \param address_taken_variables Variables whose address is taken anywhere in the program, which may thus be read
+//! or written through pointers.
+void optimize_for_loop(
+	Function& function, const ForLoop& loop, const std::unordered_set<std::string>& address_taken_variables);
+
+//! \brief Remove the bounds checks of \p function whose index provably stays in bounds, which must be called once
+//! every loop of \p loops was optimized.
+//!
+//! \details
+//!		Indices are known to stay in a range if they are constants, the variable of an enclosing FOR loop kept in an
+//!		SSA value, or sums and differences of those. The variable of a loop ranges from the lowest initial value to the
+//!		highest bound in the body of the loop.
+void eliminate_bounds_checks(Function& function, const std::vector<ForLoop>& loops);
+} // namespace ir
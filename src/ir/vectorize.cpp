@@ -0,0 +1,644 @@
+#include "vectorize.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fmt/core.h>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ir
+{
+namespace
+{
+//! \brief Thrown when a loop cannot be vectorized.
+struct Rejection
+{
+	std::string reason;
+};
+
+//! \brief Value computed outside of the loop and used by the kernel, either as is or loaded from a variable in the
+//! preheader.
+struct KernelInput
+{
+	ValueId  value;
+	Variable hoisted_variable;
+};
+
+//! \brief Reduction whose value is computed, but not stored yet.
+struct PendingReduction
+{
+	std::string       variable;
+	ReductionOperator op;
+	ValueId           value;
+};
+
+//! \brief Translates the body of a promoted FOR loop to a VectorKernel.
+//!
+//! \details
+//!		Kernel values are numbered as they are created, inputs included, and renumbered by finalize_kernel so that
+//!		inputs come first.
+class LoopVectorizer
+{
+	public:
+	LoopVectorizer(
+		Function& function, const ForLoop& loop, const PromotedLoop& promoted, const VectorizeOptions& options);
+
+	//! \brief Build the kernel of the loop, throwing a Rejection if it cannot be vectorized.
+	void build_kernel();
+
+	//! \brief Insert the VECTOR_LOOP in the preheader and start the scalar loop from its result.
+	void insert_vector_loop();
+
+	[[nodiscard]] const VectorKernel& kernel() const { return m_kernel; }
+
+	private:
+	void scan_body();
+	void translate(const Instruction& instruction);
+	void translate_reduction(const Instruction& instruction, ReductionOperator op);
+	void translate_store(const Instruction& instruction);
+	bool translate_index(const Instruction& instruction);
+	void finalize_kernel();
+
+	//! \brief Get the kernel value for \p value, used as an operand of a vector instruction.
+	ValueId vector_operand(ValueId value);
+
+	//! \brief Get the offset of the element at \p index from the index of the iteration.
+	std::int64_t element_offset(ValueId index, const std::string& array);
+
+	//! \brief Append \p instruction to the kernel, with a new result if \p has_result is set.
+	ValueId append(Instruction instruction, bool has_result);
+
+	[[noreturn]] void reject(std::string reason) const { throw Rejection{std::move(reason)}; }
+
+	Function&               m_function;
+	const ForLoop&          m_loop;
+	const PromotedLoop&     m_promoted;
+	const VectorizeOptions& m_options;
+
+	std::unordered_map<ValueId, const Instruction*> m_definitions;
+	std::unordered_map<ValueId, std::size_t>        m_use_counts;
+
+	//! Values defined by the body.
+	std::unordered_set<ValueId> m_body_values;
+
+	//! Variables assigned by the body, which may only be reductions.
+	std::unordered_set<std::string> m_stored_variables, m_reduced_variables;
+
+	//! Offsets from the index of the iteration at which each array is accessed.
+	std::unordered_map<std::string, std::unordered_set<std::int64_t>> m_element_offsets;
+	std::unordered_set<std::string>                                   m_stored_arrays;
+
+	//! Indices of the body, as offsets from the index of the iteration.
+	std::unordered_map<ValueId, std::int64_t> m_indices;
+
+	//! Loads of the variables of reductions, by value.
+	std::unordered_map<ValueId, std::string> m_reduction_loads;
+
+	//! Loads of variables the body does not assign, which are moved to the preheader if used.
+	std::unordered_map<ValueId, Variable> m_invariant_loads;
+
+	std::unordered_map<ValueId, PendingReduction> m_pending_reductions;
+
+	//! Kernel values of the values of the function.
+	std::unordered_map<ValueId, ValueId> m_values;
+
+	//! Kernel values of the inputs, in order.
+	std::vector<ValueId>     m_input_values;
+	std::vector<KernelInput> m_inputs;
+
+	VectorKernel m_kernel;
+};
+
+LoopVectorizer::LoopVectorizer(
+	Function& function, const ForLoop& loop, const PromotedLoop& promoted, const VectorizeOptions& options) :
+	m_function{function},
+	m_loop{loop},
+	m_promoted{promoted},
+	m_options{options}
+{
+	for (const BasicBlock& block : function.blocks)
+	{
+		for (const Instruction& instruction : block.instructions)
+		{
+			if (instruction.has_result())
+			{
+				m_definitions.emplace(instruction.result, &instruction);
+			}
+
+			for (const ValueId operand : instruction.operands)
+			{
+				++m_use_counts[operand];
+			}
+		}
+	}
+}
+
+void LoopVectorizer::build_kernel()
+{
+	// The body must be a single block, ending with the increment of the variable, and the header must only hold the
+	// phi, the comparison to the bound and the branch
+	if (m_loop.blocks.size() != 2 || m_loop.blocks[1] != m_loop.latch)
+	{
+		reject("the body contains control flow");
+	}
+
+	if (m_function.blocks[m_loop.header].instructions.size() != 3)
+	{
+		reject("the bound is evaluated on every iteration");
+	}
+
+	scan_body();
+
+	const std::vector<Instruction>& body = m_function.blocks[m_loop.latch].instructions;
+
+	for (auto it = body.begin(); it != body.end() - 1; ++it)
+	{
+		translate(*it);
+	}
+
+	if (!m_pending_reductions.empty())
+	{
+		reject(fmt::format("the reduction of @{} is never stored", m_pending_reductions.begin()->second.variable));
+	}
+
+	for (const std::string& array : m_stored_arrays)
+	{
+		if (m_element_offsets[array].size() > 1)
+		{
+			reject(fmt::format("iterations depend on each other through @{}", array));
+		}
+	}
+
+	if (m_inputs.size() > 4)
+	{
+		reject("too many values are computed outside of the loop");
+	}
+
+	finalize_kernel();
+
+	for (const std::size_t unroll : {4, 2, 1})
+	{
+		m_kernel.unroll = unroll;
+
+		if (m_kernel.register_count() <= m_options.registers)
+		{
+			return;
+		}
+	}
+
+	reject(fmt::format("the body needs more than {} vector registers", m_options.registers));
+}
+
+void LoopVectorizer::scan_body()
+{
+	for (const Instruction& instruction : m_function.blocks[m_loop.latch].instructions)
+	{
+		if (instruction.has_result())
+		{
+			m_body_values.insert(instruction.result);
+		}
+
+		if (instruction.is(Opcode::STORE_GLOBAL))
+		{
+			m_stored_variables.insert(instruction.symbol);
+		}
+		else if (instruction.is(Opcode::STORE_ELEMENT))
+		{
+			m_stored_arrays.insert(instruction.symbol);
+		}
+
+		if (instruction.field.is_set())
+		{
+			reject("the body accesses the fields of records");
+		}
+
+		const bool is_element = instruction.is(Opcode::LOAD_ELEMENT) || instruction.is(Opcode::STORE_ELEMENT);
+
+		if (is_element && m_kernel.type == Type::VOID)
+		{
+			m_kernel.type = instruction.type;
+		}
+	}
+
+	if (m_kernel.type == Type::VOID)
+	{
+		reject("the body does not access arrays");
+	}
+
+	if (m_kernel.type != Type::DOUBLE && m_kernel.type != Type::UNSIGNED_INT)
+	{
+		reject(fmt::format("the body accesses arrays of {}", type_name(m_kernel.type).str()));
+	}
+
+	if (m_kernel.type == Type::DOUBLE && !m_options.vectorize_double)
+	{
+		reject("DOUBLE arithmetic runs on the x87 FPU");
+	}
+
+	m_kernel.lanes = m_options.lanes;
+	m_indices.emplace(m_promoted.variable, 0);
+}
+
+void LoopVectorizer::translate(const Instruction& instruction)
+{
+	switch (instruction.opcode)
+	{
+	// Constants are only added to the kernel when used by a vector instruction
+	case Opcode::CONSTANT: break;
+
+	case Opcode::LOAD_GLOBAL:
+	{
+		if (m_stored_variables.count(instruction.symbol) != 0)
+		{
+			m_reduction_loads.emplace(instruction.result, instruction.symbol);
+		}
+		else
+		{
+			const Variable variable{
+				instruction.symbol, {m_function.value_types[instruction.result]}, instruction.variable};
+			m_invariant_loads.emplace(instruction.result, variable);
+		}
+
+		break;
+	}
+
+	case Opcode::STORE_GLOBAL: translate_store(instruction); break;
+
+	case Opcode::LOAD_ELEMENT:
+	case Opcode::STORE_ELEMENT:
+	{
+		if (instruction.type != m_kernel.type)
+		{
+			reject("the body accesses arrays of different types");
+		}
+
+		Instruction element{instruction.opcode};
+		element.type     = instruction.type;
+		element.symbol   = instruction.symbol;
+		element.variable = instruction.variable;
+		element.constant = std::uint64_t(element_offset(instruction.operands[0], instruction.symbol));
+
+		if (instruction.is(Opcode::STORE_ELEMENT))
+		{
+			element.operands = {vector_operand(instruction.operands[1])};
+			append(std::move(element), false);
+		}
+		else
+		{
+			m_values.emplace(instruction.result, append(std::move(element), true));
+		}
+
+		break;
+	}
+
+	case Opcode::ADD:
+	case Opcode::SUB:
+	case Opcode::MUL:
+	case Opcode::DIV:
+	case Opcode::MOD:
+	{
+		if (instruction.result == m_promoted.next || translate_index(instruction))
+		{
+			break;
+		}
+
+		const bool has_reduction_operand = m_reduction_loads.count(instruction.operands[0]) != 0
+			|| m_reduction_loads.count(instruction.operands[1]) != 0;
+
+		if (instruction.is(Opcode::ADD) && has_reduction_operand)
+		{
+			translate_reduction(instruction, ReductionOperator::ADD);
+			break;
+		}
+
+		// SSE2 and AVX2 have packed additions and subtractions of 64-bit integers, but no multiplications or divisions
+		const bool is_packed = instruction.type == Type::DOUBLE
+			? !instruction.is(Opcode::MOD)
+			: instruction.is(Opcode::ADD) || instruction.is(Opcode::SUB);
+
+		if (!is_packed)
+		{
+			reject(fmt::format(
+				"no packed instruction computes '{}' on {}",
+				opcode_name(instruction.opcode).str(),
+				type_name(instruction.type).str()));
+		}
+
+		Instruction arithmetic{instruction.opcode};
+		arithmetic.type     = instruction.type;
+		arithmetic.operands = {vector_operand(instruction.operands[0]), vector_operand(instruction.operands[1])};
+		m_values.emplace(instruction.result, append(std::move(arithmetic), true));
+		break;
+	}
+
+	case Opcode::CALL:
+	{
+		const bool is_unary  = instruction.symbol == "sqrt" || instruction.symbol == "fabs";
+		const bool is_binary = instruction.symbol == "fmin" || instruction.symbol == "fmax";
+
+		if (!instruction.foreign || instruction.type != Type::DOUBLE
+			|| instruction.operands.size() != (is_binary ? 2 : 1) || !(is_unary || is_binary))
+		{
+			reject(fmt::format("the body calls {}", instruction.symbol));
+		}
+
+		const bool has_reduction_operand = std::any_of(
+			instruction.operands.begin(), instruction.operands.end(), [&](ValueId operand) {
+				return m_reduction_loads.count(operand) != 0;
+			});
+
+		if (is_binary && has_reduction_operand)
+		{
+			translate_reduction(
+				instruction, instruction.symbol == "fmin" ? ReductionOperator::MIN : ReductionOperator::MAX);
+			break;
+		}
+
+		Instruction call{Opcode::CALL};
+		call.type    = Type::DOUBLE;
+		call.symbol  = instruction.symbol;
+		call.foreign = true;
+
+		for (const ValueId operand : instruction.operands)
+		{
+			call.operands.push_back(vector_operand(operand));
+		}
+
+		m_values.emplace(instruction.result, append(std::move(call), true));
+		break;
+	}
+
+	case Opcode::CHECK_BOUNDS: reject("an index is not proven to stay within the bounds of its array");
+	case Opcode::DISPLAY: reject("the body displays values");
+	case Opcode::CONVERT: reject("the body converts values between types");
+
+	case Opcode::GLOBAL_ADDRESS:
+	case Opcode::LOAD:
+	case Opcode::STORE: reject("the body accesses memory through pointers");
+
+	default: reject(fmt::format("the body contains '{}'", opcode_name(instruction.opcode).str()));
+	}
+}
+
+void LoopVectorizer::translate_reduction(const Instruction& instruction, ReductionOperator op)
+{
+	const bool    is_left_reduced = m_reduction_loads.count(instruction.operands[0]) != 0;
+	const ValueId load            = instruction.operands[is_left_reduced ? 0 : 1];
+	const ValueId term            = instruction.operands[is_left_reduced ? 1 : 0];
+
+	if (instruction.type != m_kernel.type)
+	{
+		reject(fmt::format("@{} is not of the type of the arrays", m_reduction_loads.at(load)));
+	}
+
+	if (m_use_counts[load] != 1 || m_use_counts[instruction.result] != 1)
+	{
+		reject(fmt::format("@{} is read by every iteration", m_reduction_loads.at(load)));
+	}
+
+	if (op == ReductionOperator::ADD && instruction.type == Type::DOUBLE && !m_options.reassociate)
+	{
+		reject(fmt::format(
+			"vectorizing the sum @{} would change its rounding (allowed by --reassociate)",
+			m_reduction_loads.at(load)));
+	}
+
+	m_pending_reductions.emplace(
+		instruction.result, PendingReduction{m_reduction_loads.at(load), op, vector_operand(term)});
+}
+
+void LoopVectorizer::translate_store(const Instruction& instruction)
+{
+	const auto it = m_pending_reductions.find(instruction.operands[0]);
+
+	if (it == m_pending_reductions.end() || it->second.variable != instruction.symbol
+		|| !m_reduced_variables.insert(instruction.symbol).second)
+	{
+		reject(fmt::format("the assignment of @{} is not a reduction", instruction.symbol));
+	}
+
+	m_kernel.reductions.push_back({it->second.variable, instruction.variable, it->second.op, it->second.value});
+	m_pending_reductions.erase(it);
+}
+
+bool LoopVectorizer::translate_index(const Instruction& instruction)
+{
+	const auto is_index = [&](ValueId value) { return m_indices.count(value) != 0; };
+
+	if (instruction.type != Type::UNSIGNED_INT
+		|| !(is_index(instruction.operands[0]) || is_index(instruction.operands[1])))
+	{
+		return false;
+	}
+
+	// Indices may only be the variable plus or minus constants
+	const bool    is_left_index = is_index(instruction.operands[0]);
+	const ValueId index         = instruction.operands[is_left_index ? 0 : 1];
+	const auto    constant      = m_definitions.find(instruction.operands[is_left_index ? 1 : 0]);
+
+	const bool is_affine = constant != m_definitions.end() && constant->second->is(Opcode::CONSTANT)
+		&& (instruction.is(Opcode::ADD) || (instruction.is(Opcode::SUB) && is_left_index));
+
+	if (!is_affine)
+	{
+		reject(fmt::format("the body uses '{}' as a value rather than as an index", m_loop.variable));
+	}
+
+	const std::int64_t delta = std::int64_t(constant->second->constant);
+	m_indices.emplace(instruction.result, m_indices[index] + (instruction.is(Opcode::ADD) ? delta : -delta));
+	return true;
+}
+
+ValueId LoopVectorizer::vector_operand(ValueId value)
+{
+	const auto it = m_values.find(value);
+
+	if (it != m_values.end())
+	{
+		return it->second;
+	}
+
+	if (m_indices.count(value) != 0)
+	{
+		reject(fmt::format("the body uses '{}' as a value rather than as an index", m_loop.variable));
+	}
+
+	if (m_reduction_loads.count(value) != 0)
+	{
+		reject(fmt::format("@{} is read by every iteration", m_reduction_loads.at(value)));
+	}
+
+	if (m_pending_reductions.count(value) != 0)
+	{
+		reject(fmt::format("@{} is read by every iteration", m_pending_reductions.at(value).variable));
+	}
+
+	if (m_function.value_types[value] != m_kernel.type)
+	{
+		reject(fmt::format(
+			"the body mixes {} and {} values",
+			type_name(m_kernel.type).str(),
+			type_name(m_function.value_types[value]).str()));
+	}
+
+	ValueId kernel_value;
+
+	if (m_body_values.count(value) == 0)
+	{
+		kernel_value = m_kernel.value_count++;
+		m_inputs.push_back({value, {}});
+		m_input_values.push_back(kernel_value);
+	}
+	else if (m_invariant_loads.count(value) != 0)
+	{
+		kernel_value = m_kernel.value_count++;
+		m_inputs.push_back({no_value, m_invariant_loads.at(value)});
+		m_input_values.push_back(kernel_value);
+	}
+	else
+	{
+		const Instruction& definition = *m_definitions.at(value);
+
+		if (!definition.is(Opcode::CONSTANT))
+		{
+			reject(fmt::format("the body contains '{}'", opcode_name(definition.opcode).str()));
+		}
+
+		Instruction constant{Opcode::CONSTANT};
+		constant.type     = definition.type;
+		constant.constant = definition.constant;
+		kernel_value      = append(std::move(constant), true);
+	}
+
+	m_values.emplace(value, kernel_value);
+	return kernel_value;
+}
+
+std::int64_t LoopVectorizer::element_offset(ValueId index, const std::string& array)
+{
+	const auto it = m_indices.find(index);
+
+	if (it == m_indices.end())
+	{
+		reject(fmt::format("@{} is not indexed by '{}' plus a constant", array, m_loop.variable));
+	}
+
+	m_element_offsets[array].insert(it->second);
+	return it->second;
+}
+
+ValueId LoopVectorizer::append(Instruction instruction, bool has_result)
+{
+	if (has_result)
+	{
+		instruction.result = m_kernel.value_count++;
+	}
+
+	m_kernel.instructions.push_back(std::move(instruction));
+	return m_kernel.instructions.back().result;
+}
+
+void LoopVectorizer::finalize_kernel()
+{
+	std::vector<ValueId> renumbered(m_kernel.value_count, no_value);
+	ValueId              next = 0;
+
+	for (const ValueId input : m_input_values)
+	{
+		renumbered[input] = next++;
+	}
+
+	for (Instruction& instruction : m_kernel.instructions)
+	{
+		for (ValueId& operand : instruction.operands)
+		{
+			operand = renumbered[operand];
+		}
+
+		if (instruction.has_result())
+		{
+			renumbered[instruction.result] = next;
+			instruction.result             = next++;
+		}
+	}
+
+	for (VectorReduction& reduction : m_kernel.reductions)
+	{
+		reduction.value = renumbered[reduction.value];
+	}
+
+	m_kernel.input_count = m_inputs.size();
+}
+
+void LoopVectorizer::insert_vector_loop()
+{
+	std::vector<Instruction>& preheader = m_function.blocks[m_loop.preheader].instructions;
+	std::vector<Instruction>  inserted;
+
+	Instruction vector_loop{Opcode::VECTOR_LOOP};
+	vector_loop.type     = Type::UNSIGNED_INT;
+	vector_loop.operands = {m_promoted.initial, m_promoted.bound};
+
+	for (const KernelInput& input : m_inputs)
+	{
+		if (input.value != no_value)
+		{
+			vector_loop.operands.push_back(input.value);
+			continue;
+		}
+
+		Instruction load{Opcode::LOAD_GLOBAL};
+		load.type     = m_kernel.type;
+		load.symbol   = input.hoisted_variable.name;
+		load.variable = input.hoisted_variable.symbol;
+		load.result   = m_function.create_value(m_kernel.type);
+		vector_loop.operands.push_back(load.result);
+		inserted.push_back(std::move(load));
+	}
+
+	vector_loop.result = m_function.create_value(Type::UNSIGNED_INT);
+	vector_loop.kernel = std::make_shared<const VectorKernel>(m_kernel);
+
+	// The scalar loop starts where the vector loop stopped
+	m_function.blocks[m_loop.header].instructions.front().operands[0] = vector_loop.result;
+
+	inserted.push_back(std::move(vector_loop));
+	preheader.insert(preheader.end() - 1, inserted.begin(), inserted.end());
+}
+} // namespace
+
+bool vectorize_for_loop(Function& function, const ForLoop& loop, const VectorizeOptions& options, std::string& remark)
+{
+	PromotedLoop promoted;
+
+	if (!find_promoted_loop(function, loop, promoted))
+	{
+		remark = fmt::format("'{}' is not kept in a register", loop.variable);
+		return false;
+	}
+
+	LoopVectorizer vectorizer{function, loop, promoted, options};
+
+	try
+	{
+		vectorizer.build_kernel();
+	}
+	catch (const Rejection& rejection)
+	{
+		remark = rejection.reason;
+		return false;
+	}
+
+	vectorizer.insert_vector_loop();
+
+	const VectorKernel& kernel = vectorizer.kernel();
+	remark                     = kernel.unroll == 1
+							 ? fmt::format("vectorized ({} lanes)", kernel.lanes)
+							 : fmt::format("vectorized ({} lanes, unrolled {} times)", kernel.lanes, kernel.unroll);
+	return true;
+}
+} // namespace ir
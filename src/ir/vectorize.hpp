@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ir/ir.hpp"
+#include "ir/loops.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace ir
+{
+struct VectorizeOptions
+{
+	//! Elements of 8 bytes held by a vector register.
+	std::size_t lanes = 2;
+
+	//! Vector registers available to the kernel, so that its values never have to be spilled.
+	std::size_t registers = 0;
+
+	//! Whether DOUBLE arithmetic may be vectorized, which is not the case when it runs on the x87 FPU.
+	bool vectorize_double = true;
+
+	//! Whether DOUBLE sums may be computed in a different order, which changes their rounding.
+	bool reassociate = false;
+};
+
+//! \brief Run \p loop on groups of consecutive iterations with packed instructions, if it can be done without
+//! changing the result of the program. Must be called once the loops were optimized and bounds checks eliminated.
+//!
+//! \details
+//!		The vector loop is inserted at the end of the preheader, as a VECTOR_LOOP instruction, and the scalar loop
+//!		then runs the iterations left.
+//!		The loop must be promoted, with a bound that is evaluated once and a body without control flow. Every element
+//!		it accesses must be at the index of the iteration plus a constant, and each array it writes to must only be
+//!		accessed at a single index, so that iterations do not depend on each other. Other variables may only be
+//!		written to by reductions, e.g. `s := s + a[i]` or `m := fmax(m, a[i])`.
+//!
+//! \param remark Set to the reason why the loop was not vectorized, or to a summary of how it was.
+//! \returns Whether the loop was vectorized.
+bool vectorize_for_loop(Function& function, const ForLoop& loop, const VectorizeOptions& options, std::string& remark);
+} // namespace ir
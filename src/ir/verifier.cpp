@@ -0,0 +1,610 @@
+#include "verifier.hpp"
+
+#include "util/enums.hpp"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <unordered_map>
+#include <utility>
+
+namespace ir
+{
+class FunctionVerifier
+{
+	public:
+	FunctionVerifier(
+		const Function& function, std::unordered_map<std::string, Type> globals, std::vector<std::string>& errors) :
+		m_function{function},
+		m_variables{std::move(globals)},
+		m_errors{errors}
+	{
+		for (const std::vector<Variable>* variables : {&function.parameters, &function.locals})
+		{
+			for (const Variable& variable : *variables)
+			{
+				m_variables[variable.name] = variable.type.type;
+			}
+		}
+	}
+
+	void operator()();
+
+	private:
+	//! Location of the definition of a value.
+	struct Definition
+	{
+		BlockId     block;
+		std::size_t index;
+	};
+
+	void verify_block_structure(BlockId block);
+	void verify_instruction(BlockId block, std::size_t index);
+	void verify_types(const Instruction& instruction);
+	void verify_phi(BlockId block, const Instruction& instruction);
+
+	//! \brief Check that \p value is available at the position \p index of \p block.
+	void verify_dominance(ValueId value, BlockId block, std::size_t index);
+
+	void compute_dominators();
+	bool dominates(BlockId dominator, BlockId block) const;
+
+	Type operand_type(const Instruction& instruction, std::size_t operand) const;
+
+	void report(BlockId block, string_view message);
+
+	const Function& m_function;
+
+	//! Globals, hidden by the parameters and locals of the function.
+	std::unordered_map<std::string, Type> m_variables;
+
+	std::vector<std::string>& m_errors;
+
+	std::vector<std::vector<BlockId>>       m_predecessors;
+	std::unordered_map<ValueId, Definition> m_definitions;
+
+	//! Immediate dominator of each block reachable from the entry, itself for the entry.
+	std::vector<BlockId> m_immediate_dominators;
+	std::vector<bool>    m_reachable;
+};
+
+static constexpr BlockId no_block = no_value;
+
+void FunctionVerifier::operator()()
+{
+	if (m_function.blocks.empty())
+	{
+		m_errors.push_back(fmt::format("function {}: no entry block", m_function.name));
+		return;
+	}
+
+	const std::size_t error_count = m_errors.size();
+
+	for (BlockId block = 0; block < m_function.blocks.size(); ++block)
+	{
+		verify_block_structure(block);
+	}
+
+	// The control flow graph has to be sound to compute dominators
+	if (m_errors.size() != error_count)
+	{
+		return;
+	}
+
+	m_predecessors = m_function.predecessors();
+	compute_dominators();
+
+	for (BlockId block = 0; block < m_function.blocks.size(); ++block)
+	{
+		for (std::size_t index = 0; index < m_function.blocks[block].instructions.size(); ++index)
+		{
+			verify_instruction(block, index);
+		}
+	}
+}
+
+void FunctionVerifier::verify_block_structure(BlockId block)
+{
+	const BasicBlock& basic_block = m_function.blocks[block];
+
+	if (!basic_block.is_terminated())
+	{
+		report(block, "block is not terminated");
+	}
+
+	bool phis_allowed = true;
+
+	for (std::size_t index = 0; index < basic_block.instructions.size(); ++index)
+	{
+		const Instruction& instruction = basic_block.instructions[index];
+
+		if (is_terminator(instruction.opcode) && index + 1 != basic_block.instructions.size())
+		{
+			report(
+				block,
+				fmt::format("terminator '{}' in the middle of the block", opcode_name(instruction.opcode).str()));
+		}
+
+		if (instruction.is(Opcode::PHI) && !phis_allowed)
+		{
+			report(block, "phi after a regular instruction");
+		}
+
+		phis_allowed = phis_allowed && instruction.is(Opcode::PHI);
+
+		if (instruction.has_result())
+		{
+			if (instruction.result >= m_function.value_types.size())
+			{
+				report(block, fmt::format("%{} is out of range", instruction.result));
+			}
+			else if (!m_definitions.emplace(instruction.result, Definition{block, index}).second)
+			{
+				report(block, fmt::format("%{} is defined more than once", instruction.result));
+			}
+			else if (m_function.value_types[instruction.result] != instruction.type)
+			{
+				report(block, fmt::format("%{} is defined with another type than declared", instruction.result));
+			}
+		}
+
+		for (const BlockId target : instruction.blocks)
+		{
+			if (target >= m_function.blocks.size())
+			{
+				report(block, fmt::format("reference to the missing block bb{}", target));
+			}
+		}
+
+		const std::size_t expected_targets
+			= instruction.is(Opcode::JUMP) ? 1 : instruction.is(Opcode::BRANCH) ? 2 : instruction.blocks.size();
+
+		if (instruction.blocks.size() != expected_targets
+			|| (instruction.blocks.size() != 0 && !instruction.is(Opcode::PHI) && !is_terminator(instruction.opcode)))
+		{
+			report(block, fmt::format("wrong block count for '{}'", opcode_name(instruction.opcode).str()));
+		}
+	}
+}
+
+void FunctionVerifier::verify_instruction(BlockId block, std::size_t index)
+{
+	const Instruction& instruction = m_function.blocks[block].instructions[index];
+
+	for (const ValueId operand : instruction.operands)
+	{
+		if (m_definitions.find(operand) == m_definitions.end())
+		{
+			report(block, fmt::format("use of the undefined value %{}", operand));
+			return;
+		}
+	}
+
+	if (instruction.is(Opcode::PHI))
+	{
+		verify_phi(block, instruction);
+	}
+	else if (m_reachable[block])
+	{
+		for (const ValueId operand : instruction.operands)
+		{
+			verify_dominance(operand, block, index);
+		}
+	}
+
+	const std::size_t error_count = m_errors.size();
+	verify_types(instruction);
+
+	if (m_errors.size() != error_count)
+	{
+		m_errors.back() = fmt::format("{} in '{}'", m_errors.back(), opcode_name(instruction.opcode).str());
+	}
+}
+
+void FunctionVerifier::verify_types(const Instruction& instruction)
+{
+	const auto expect = [&](bool condition, string_view message) {
+		if (!condition)
+		{
+			m_errors.push_back(fmt::format("function {}: {}", m_function.name, message.str()));
+		}
+
+		return condition;
+	};
+
+	const auto expect_operands = [&](std::size_t count) {
+		return expect(instruction.operands.size() == count, fmt::format("expected {} operands", count));
+	};
+
+	const bool has_value = instruction.type != Type::VOID && instruction.has_result();
+
+	if (instruction.field.is_set())
+	{
+		const bool is_access = instruction.is(Opcode::LOAD_GLOBAL) || instruction.is(Opcode::STORE_GLOBAL)
+			|| instruction.is(Opcode::LOAD) || instruction.is(Opcode::STORE) || instruction.is(Opcode::LOAD_ELEMENT)
+			|| instruction.is(Opcode::STORE_ELEMENT);
+
+		expect(is_access, "field of a record on an instruction that does not access memory");
+	}
+
+	switch (instruction.opcode)
+	{
+	case Opcode::CONSTANT:
+	{
+		expect_operands(0) && expect(has_value, "constant without a value");
+		break;
+	}
+
+	case Opcode::LOAD_GLOBAL:
+	case Opcode::STORE_GLOBAL:
+	{
+		const bool load = instruction.is(Opcode::LOAD_GLOBAL);
+
+		if (!expect_operands(load ? 0 : 1) || !expect(load == has_value, "mismatched result"))
+		{
+			break;
+		}
+
+		const auto it = m_variables.find(instruction.symbol);
+
+		if (expect(it != m_variables.end(), fmt::format("unknown variable @{}", instruction.symbol)))
+		{
+			// The type of a record variable is the one of the record, not of the accessed field
+			expect(instruction.field.is_set() || it->second == instruction.type, "mismatched variable type");
+		}
+
+		if (!load)
+		{
+			expect(operand_type(instruction, 0) == instruction.type, "mismatched stored type");
+		}
+
+		break;
+	}
+
+	case Opcode::GLOBAL_ADDRESS:
+	{
+		expect_operands(0) && expect(has_value, "missing result")
+			&& expect(
+				m_variables.count(instruction.symbol) != 0, fmt::format("unknown variable @{}", instruction.symbol));
+		break;
+	}
+
+	case Opcode::LOAD:
+	{
+		expect_operands(1) && expect(has_value, "missing result");
+		break;
+	}
+
+	case Opcode::STORE:
+	{
+		expect_operands(2) && expect(operand_type(instruction, 0) == instruction.type, "mismatched stored type");
+		break;
+	}
+
+	case Opcode::LOAD_ELEMENT:
+	case Opcode::STORE_ELEMENT:
+	{
+		const bool load = instruction.is(Opcode::LOAD_ELEMENT);
+
+		if (!expect_operands(load ? 1 : 2) || !expect(load == has_value, "mismatched result"))
+		{
+			break;
+		}
+
+		expect(m_variables.count(instruction.symbol) != 0, fmt::format("unknown variable @{}", instruction.symbol))
+			&& expect(operand_type(instruction, 0) == Type::UNSIGNED_INT, "non-integer index");
+
+		if (!load)
+		{
+			expect(operand_type(instruction, 1) == instruction.type, "mismatched stored type");
+		}
+
+		break;
+	}
+
+	case Opcode::CHECK_BOUNDS:
+	{
+		expect_operands(1) && expect(instruction.type == Type::UNSIGNED_INT, "non-integer result")
+			&& expect(operand_type(instruction, 0) == Type::UNSIGNED_INT, "non-integer index");
+		break;
+	}
+
+	case Opcode::NOT:
+	{
+		expect_operands(1) && expect(instruction.type == Type::BOOLEAN, "non-boolean result")
+			&& expect(operand_type(instruction, 0) == Type::BOOLEAN, "non-boolean operand");
+		break;
+	}
+
+	case Opcode::AND:
+	case Opcode::OR:
+	case Opcode::ADD:
+	case Opcode::SUB:
+	case Opcode::MUL:
+	case Opcode::DIV:
+	case Opcode::MOD:
+	{
+		if (!expect_operands(2) || !expect(has_value, "missing result"))
+		{
+			break;
+		}
+
+		const bool logic = instruction.is(Opcode::AND) || instruction.is(Opcode::OR);
+		const bool valid_type
+			= logic ? instruction.type == Type::BOOLEAN
+					: check_enum_range(instruction.type, Type::FIRST_ARITHMETIC, Type::LAST_ARITHMETIC);
+
+		expect(valid_type, "invalid type")
+			&& expect(operand_type(instruction, 0) == instruction.type, "mismatched type")
+			&& expect(operand_type(instruction, 1) == instruction.type, "mismatched type");
+		break;
+	}
+
+	case Opcode::COMPARE:
+	{
+		if (!expect_operands(2) || !expect(instruction.type == Type::BOOLEAN, "non-boolean result"))
+		{
+			break;
+		}
+
+		const Type type = operand_type(instruction, 0);
+		const bool signed_comparison
+			= check_enum_range(instruction.comparison, Comparison::SIGNED_LOWER, Comparison::SIGNED_GREATER_EQUAL);
+
+		expect(operand_type(instruction, 1) == type, "mismatched operand types")
+			&& expect(!signed_comparison || type == Type::UNSIGNED_INT, "signed comparison of non-integers");
+		break;
+	}
+
+	case Opcode::CONVERT:
+	case Opcode::DISPLAY:
+	{
+		expect_operands(1) && expect(instruction.is(Opcode::CONVERT) == has_value, "mismatched result");
+		break;
+	}
+
+	case Opcode::CALL:
+	{
+		expect(!instruction.symbol.empty(), "missing function name")
+			&& expect((instruction.type != Type::VOID) == instruction.has_result(), "mismatched result");
+		break;
+	}
+
+	case Opcode::NEW:
+	{
+		// The size of records is only resolved once they were laid out, which must happen before verifying
+		expect_operands(0) && expect(has_value, "missing result") && expect(instruction.constant != 0, "empty block");
+		break;
+	}
+
+	case Opcode::DISPOSE:
+	{
+		expect_operands(1) && expect(!instruction.has_result(), "unexpected result")
+			&& expect(instruction.constant != 0, "empty block");
+		break;
+	}
+
+	case Opcode::VECTOR_LOOP:
+	{
+		if (!expect(instruction.kernel != nullptr, "missing kernel")
+			|| !expect(instruction.type == Type::UNSIGNED_INT && has_value, "non-integer result")
+			|| !expect_operands(2 + instruction.kernel->input_count))
+		{
+			break;
+		}
+
+		expect(operand_type(instruction, 0) == Type::UNSIGNED_INT, "non-integer first iteration")
+			&& expect(operand_type(instruction, 1) == Type::UNSIGNED_INT, "non-integer bound");
+
+		for (std::size_t i = 2; i < instruction.operands.size(); ++i)
+		{
+			expect(operand_type(instruction, i) == instruction.kernel->type, "mismatched input type");
+		}
+
+		for (const Instruction& kernel_instruction : instruction.kernel->instructions)
+		{
+			const bool element = kernel_instruction.is(Opcode::LOAD_ELEMENT)
+				|| kernel_instruction.is(Opcode::STORE_ELEMENT);
+
+			if (element)
+			{
+				expect(
+					m_variables.count(kernel_instruction.symbol) != 0,
+					fmt::format("unknown variable @{}", kernel_instruction.symbol));
+			}
+		}
+
+		break;
+	}
+
+	case Opcode::PHI:
+	{
+		if (!expect(has_value, "missing result"))
+		{
+			break;
+		}
+
+		for (std::size_t i = 0; i < instruction.operands.size(); ++i)
+		{
+			expect(operand_type(instruction, i) == instruction.type, "mismatched incoming type");
+		}
+
+		break;
+	}
+
+	case Opcode::JUMP:
+	{
+		expect_operands(0) && expect(!instruction.has_result(), "unexpected result");
+		break;
+	}
+
+	case Opcode::RETURN:
+	{
+		const bool has_operand = m_function.return_type != Type::VOID;
+
+		expect_operands(has_operand ? 1 : 0) && expect(!instruction.has_result(), "unexpected result")
+			&& expect(!has_operand || operand_type(instruction, 0) == m_function.return_type, "mismatched result type");
+		break;
+	}
+
+	case Opcode::BRANCH:
+	{
+		expect_operands(1) && expect(operand_type(instruction, 0) == Type::BOOLEAN, "non-boolean condition");
+		break;
+	}
+	}
+}
+
+void FunctionVerifier::verify_phi(BlockId block, const Instruction& instruction)
+{
+	const std::vector<BlockId>& predecessors = m_predecessors[block];
+
+	if (instruction.operands.size() != instruction.blocks.size() || instruction.blocks.size() != predecessors.size())
+	{
+		report(block, "phi does not have exactly one value per predecessor");
+		return;
+	}
+
+	for (std::size_t i = 0; i < instruction.blocks.size(); ++i)
+	{
+		const BlockId incoming = instruction.blocks[i];
+
+		if (std::find(predecessors.begin(), predecessors.end(), incoming) == predecessors.end()
+			|| std::count(instruction.blocks.begin(), instruction.blocks.end(), incoming) != 1)
+		{
+			report(block, fmt::format("bb{} is not a predecessor, or is listed several times", incoming));
+			continue;
+		}
+
+		// The incoming value has to be available at the end of the predecessor
+		if (m_reachable[incoming])
+		{
+			verify_dominance(instruction.operands[i], incoming, m_function.blocks[incoming].instructions.size());
+		}
+	}
+}
+
+void FunctionVerifier::verify_dominance(ValueId value, BlockId block, std::size_t index)
+{
+	const Definition& definition = m_definitions.at(value);
+
+	const bool available = definition.block == block ? definition.index < index : dominates(definition.block, block);
+
+	if (!available)
+	{
+		report(block, fmt::format("%{} does not dominate its use", value));
+	}
+}
+
+void FunctionVerifier::compute_dominators()
+{
+	// "A Simple, Fast Dominance Algorithm" (Cooper, Harvey and Kennedy)
+	const std::vector<BlockId> order = m_function.reverse_postorder();
+
+	std::vector<std::size_t> order_index(m_function.blocks.size(), 0);
+	m_reachable.assign(m_function.blocks.size(), false);
+
+	for (std::size_t i = 0; i < order.size(); ++i)
+	{
+		order_index[order[i]] = i;
+		m_reachable[order[i]] = true;
+	}
+
+	m_immediate_dominators.assign(m_function.blocks.size(), no_block);
+	m_immediate_dominators[0] = 0;
+
+	const auto intersect = [&](BlockId a, BlockId b) {
+		while (a != b)
+		{
+			while (order_index[a] > order_index[b])
+			{
+				a = m_immediate_dominators[a];
+			}
+
+			while (order_index[b] > order_index[a])
+			{
+				b = m_immediate_dominators[b];
+			}
+		}
+
+		return a;
+	};
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (std::size_t i = 1; i < order.size(); ++i)
+		{
+			const BlockId block     = order[i];
+			BlockId       dominator = no_block;
+
+			for (const BlockId predecessor : m_predecessors[block])
+			{
+				if (m_immediate_dominators[predecessor] == no_block)
+				{
+					continue;
+				}
+
+				dominator = dominator == no_block ? predecessor : intersect(predecessor, dominator);
+			}
+
+			if (m_immediate_dominators[block] != dominator)
+			{
+				m_immediate_dominators[block] = dominator;
+				changed                       = true;
+			}
+		}
+	}
+}
+
+bool FunctionVerifier::dominates(BlockId dominator, BlockId block) const
+{
+	if (!m_reachable[dominator])
+	{
+		return false;
+	}
+
+	while (true)
+	{
+		if (block == dominator)
+		{
+			return true;
+		}
+
+		if (block == 0)
+		{
+			return false;
+		}
+
+		block = m_immediate_dominators[block];
+	}
+}
+
+Type FunctionVerifier::operand_type(const Instruction& instruction, std::size_t operand) const
+{
+	return m_function.value_types[instruction.operands[operand]];
+}
+
+void FunctionVerifier::report(BlockId block, string_view message)
+{
+	m_errors.push_back(fmt::format("function {}, bb{}: {}", m_function.name, block, message.str()));
+}
+
+std::vector<std::string> verify(const Program& program)
+{
+	std::vector<std::string>              errors;
+	std::unordered_map<std::string, Type> globals;
+
+	for (const Variable& global : program.globals)
+	{
+		globals.emplace(global.name, global.type.type);
+	}
+
+	for (const Function& function : program.functions)
+	{
+		FunctionVerifier{function, globals, errors}();
+	}
+
+	return errors;
+}
+} // namespace ir
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ir/ir.hpp"
+
+#include <string>
+#include <vector>
+
+namespace ir
+{
+//! \brief Check the structural and typing rules of \p program, e.g. that every block is terminated and that values
+//! are defined before being used.
+//! \returns A description of every problem found, which is empty for a valid program.
+[[nodiscard]] std::vector<std::string> verify(const Program& program);
+} // namespace ir
@@ -0,0 +1,26 @@
+#pragma once
+
+//! \brief Functions of the runtime library shipped in runtime/, which is linked with every program.
+namespace runtime
+{
+//! `void* __ceri_new(uint64_t size)`: block of memory filled with zeros.
+constexpr const char* new_function = "__ceri_new";
+
+//! `void __ceri_dispose(void* pointer, uint64_t size)`: give back a block returned by __ceri_new.
+constexpr const char* dispose_function = "__ceri_dispose";
+
+//! `void __ceri_arena_begin(void)`: allocate the next blocks from a new arena, until it ends.
+constexpr const char* arena_begin_function = "__ceri_arena_begin";
+
+//! `void __ceri_arena_end(void)`: free every block allocated from the innermost arena at once.
+constexpr const char* arena_end_function = "__ceri_arena_end";
+
+//! `void __ceri_display_u64(uint64_t value)`: print an INTEGER or a BOOLEAN, given as 1 or 0, and a newline.
+constexpr const char* display_u64_function = "__ceri_display_u64";
+
+//! `void __ceri_display_char(uint64_t value)`: print the character in the low byte of value, without a newline.
+constexpr const char* display_char_function = "__ceri_display_char";
+
+//! `void __ceri_display_f64(double value)`: print a DOUBLE with 6 decimals, and a newline.
+constexpr const char* display_f64_function = "__ceri_display_f64";
+} // namespace runtime
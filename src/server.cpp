@@ -0,0 +1,484 @@
+#include "server.hpp"
+
+#include "driver.hpp"
+#include "include_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fmt/core.h>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Clients and the server exchange messages made of a u8 kind, a u64 size and as many bytes, in the byte order of the
+// host. A client sends ARGUMENTS: its working directory and each of its arguments, each followed by a null character.
+// The server may then send INPUT_REQUEST if the compilation reads stdin, which the client answers with INPUT. The
+// server sends OUTPUT and ERRORS, which hold what was written to stdout and stderr, as the compilation writes them,
+// then EXIT, which holds the u32 exit status.
+
+namespace
+{
+enum class MessageKind : std::uint8_t
+{
+	ARGUMENTS,
+	INPUT_REQUEST,
+	INPUT,
+	OUTPUT,
+	ERRORS,
+	EXIT
+};
+
+//! Larger messages are refused rather than allocated for.
+constexpr std::uint64_t max_message_size = std::uint64_t(64) << 20;
+
+//! Clients that send or read nothing for this long are dropped, so that idle ones do not keep the workers busy.
+constexpr timeval client_timeout = {60, 0};
+
+//! \brief Connections accepted by the server, waiting for a worker to serve them.
+class ConnectionQueue
+{
+	public:
+	explicit ConnectionQueue(std::size_t capacity) : m_capacity{capacity} {}
+
+	//! \brief Add \p connection, waiting until there is room for it.
+	void push(int connection)
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
+		m_not_full.wait(lock, [&] { return m_connections.size() < m_capacity; });
+		m_connections.push_back(connection);
+		m_not_empty.notify_one();
+	}
+
+	//! \brief Take the oldest connection, waiting until there is one.
+	int pop()
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
+		m_not_empty.wait(lock, [&] { return !m_connections.empty(); });
+
+		const int connection = m_connections.front();
+		m_connections.pop_front();
+		m_not_full.notify_one();
+
+		return connection;
+	}
+
+	private:
+	std::size_t             m_capacity;
+	std::deque<int>         m_connections;
+	std::mutex              m_mutex;
+	std::condition_variable m_not_full, m_not_empty;
+};
+
+bool write_all(int fd, const char* data, std::size_t size)
+{
+	while (size != 0)
+	{
+		const ssize_t written = write(fd, data, size);
+
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (written <= 0)
+		{
+			return false;
+		}
+
+		data += written;
+		size -= std::size_t(written);
+	}
+
+	return true;
+}
+
+bool read_all(int fd, char* data, std::size_t size)
+{
+	while (size != 0)
+	{
+		const ssize_t read_size = read(fd, data, size);
+
+		if (read_size < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (read_size <= 0)
+		{
+			return false;
+		}
+
+		data += read_size;
+		size -= std::size_t(read_size);
+	}
+
+	return true;
+}
+
+bool send_message(int fd, MessageKind kind, const std::string& payload)
+{
+	const char          kind_byte = char(kind);
+	const std::uint64_t size      = payload.size();
+
+	return write_all(fd, &kind_byte, 1) && write_all(fd, reinterpret_cast<const char*>(&size), sizeof(size))
+		&& write_all(fd, payload.data(), payload.size());
+}
+
+bool receive_message(int fd, MessageKind& kind, std::string& payload)
+{
+	char          kind_byte;
+	std::uint64_t size;
+
+	if (!read_all(fd, &kind_byte, 1) || !read_all(fd, reinterpret_cast<char*>(&size), sizeof(size))
+		|| size > max_message_size)
+	{
+		return false;
+	}
+
+	kind = MessageKind(kind_byte);
+	payload.resize(std::size_t(size));
+
+	return read_all(fd, &payload[0], payload.size());
+}
+
+//! \brief Sends what is written to it to a client, as messages of one kind, whenever its buffer fills or it is
+//! flushed.
+class MessageStreambuf : public std::streambuf
+{
+	public:
+	MessageStreambuf(int connection, MessageKind kind) : m_connection{connection}, m_kind{kind} { reset(); }
+
+	//! \brief Whether the client received everything sent so far.
+	bool delivered() const { return m_delivered; }
+
+	protected:
+	int_type overflow(int_type character) override
+	{
+		send();
+
+		if (!traits_type::eq_int_type(character, traits_type::eof()))
+		{
+			*pptr() = traits_type::to_char_type(character);
+			pbump(1);
+		}
+
+		return traits_type::not_eof(character);
+	}
+
+	int sync() override
+	{
+		send();
+		return 0;
+	}
+
+	private:
+	void reset() { setp(m_buffer, m_buffer + sizeof(m_buffer)); }
+
+	void send()
+	{
+		const std::size_t size = std::size_t(pptr() - pbase());
+
+		// What is written once the client went away is dropped, since nothing is left to do with it
+		if (size != 0 && m_delivered)
+		{
+			m_delivered = send_message(m_connection, m_kind, std::string(pbase(), size));
+		}
+
+		reset();
+	}
+
+	int         m_connection;
+	MessageKind m_kind;
+	bool        m_delivered = true;
+	char        m_buffer[4096];
+};
+
+//! \brief Address of the Unix socket at \p path.
+//! \returns Whether \p path fits in an address.
+bool socket_address(const std::string& path, sockaddr_un& address)
+{
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	return true;
+}
+
+//! \brief Compile what the client on \p connection sent as \p arguments.
+//! \returns The exit status of the compiler.
+int compile_request(
+	int connection, const std::string& arguments, IncludeCacheStore& store, std::ostream& output, std::ostream& errors)
+{
+	std::vector<std::string> argument_strings;
+
+	for (std::size_t begin = 0, end; (end = arguments.find('\0', begin)) != std::string::npos; begin = end + 1)
+	{
+		argument_strings.push_back(arguments.substr(begin, end - begin));
+	}
+
+	if (argument_strings.empty())
+	{
+		errors << "<cli>: malformed request to the compile server\n";
+		return 1;
+	}
+
+	// The working directory of the client takes the place of the name of the program
+	const std::string directory = argument_strings.front();
+	argument_strings.front()    = "cericompiler";
+
+	std::vector<char*> argv;
+
+	for (std::string& argument : argument_strings)
+	{
+		argv.push_back(&argument[0]);
+	}
+
+	CliFlags flags;
+
+	if (!flags.parse(int(argv.size()), argv.data(), output, errors))
+	{
+		return 1;
+	}
+
+	if (!flags.server_socket.empty())
+	{
+		errors << "<cli>: --server cannot be forwarded to a compile server\n";
+		return 1;
+	}
+
+	flags.resolve_paths(directory);
+	flags.config.include_cache_store = &store;
+
+	// stdin is only asked for when it is compiled, since the client may be given one that is never closed
+	std::istringstream input;
+
+	if (flags.source_paths.empty())
+	{
+		MessageKind kind;
+		std::string text;
+
+		if (!send_message(connection, MessageKind::INPUT_REQUEST, "") || !receive_message(connection, kind, text)
+			|| kind != MessageKind::INPUT)
+		{
+			errors << "<cli>: could not read stdin from the client\n";
+			return 1;
+		}
+
+		input.str(text);
+	}
+
+	return run(flags, input, output, errors);
+}
+
+void serve(int connection, IncludeCacheStore& store)
+{
+	MessageKind kind;
+	std::string arguments;
+
+	if (receive_message(connection, kind, arguments) && kind == MessageKind::ARGUMENTS)
+	{
+		MessageStreambuf output_buffer{connection, MessageKind::OUTPUT}, errors_buffer{connection, MessageKind::ERRORS};
+		std::ostream     output{&output_buffer}, errors{&errors_buffer};
+
+		const std::uint32_t status = std::uint32_t(compile_request(connection, arguments, store, output, errors));
+
+		output.flush();
+		errors.flush();
+
+		if (output_buffer.delivered() && errors_buffer.delivered())
+		{
+			send_message(
+				connection, MessageKind::EXIT, std::string(reinterpret_cast<const char*>(&status), sizeof(status)));
+		}
+	}
+
+	close(connection);
+}
+} // namespace
+
+int run_server(const std::string& socket_path)
+{
+	// Writing to a client that went away must fail rather than kill the server
+	std::signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address;
+
+	if (!socket_address(socket_path, address))
+	{
+		fmt::print(stderr, "<cli>: socket path '{}' is too long\n", socket_path);
+		return 1;
+	}
+
+	// The socket of a server that was killed is left behind, and would keep this one from binding to it
+	struct stat status;
+
+	if (stat(socket_path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+	{
+		unlink(socket_path.c_str());
+	}
+
+	// Sockets are close-on-exec from the start, so that the linkers run by other workers never inherit them
+	const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+		|| listen(listener, SOMAXCONN) != 0)
+	{
+		fmt::print(stderr, "<cli>: could not listen on socket '{}': {}\n", socket_path, std::strerror(errno));
+		return 1;
+	}
+
+	IncludeCacheStore store;
+
+	// Clients are served by a fixed count of workers, which bounds the count of compilations running at once and the
+	// memory holding their outputs. Other clients wait in the queue, then in the backlog of the socket.
+	const std::size_t worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+	ConnectionQueue          queue{worker_count};
+	std::vector<std::thread> workers;
+
+	for (std::size_t i = 0; i < worker_count; ++i)
+	{
+		workers.emplace_back([&] {
+			for (int connection; (connection = queue.pop()) >= 0;)
+			{
+				serve(connection, store);
+			}
+		});
+	}
+
+	for (;;)
+	{
+		const int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+		if (connection >= 0)
+		{
+			setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &client_timeout, sizeof(client_timeout));
+			setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &client_timeout, sizeof(client_timeout));
+			queue.push(connection);
+			continue;
+		}
+
+		if (errno == EINTR || errno == ECONNABORTED)
+		{
+			continue;
+		}
+
+		fmt::print(stderr, "<cli>: could not accept a client on socket '{}': {}\n", socket_path, std::strerror(errno));
+		break;
+	}
+
+	// Workers stop once they get a negative connection, after serving the ones queued before it
+	for (std::size_t i = 0; i < worker_count; ++i)
+	{
+		queue.push(-1);
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	close(listener);
+
+	return 1;
+}
+
+int run_client(const std::string& socket_path, int argc, char** argv)
+{
+	std::signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address;
+	const int   connection = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (!socket_address(socket_path, address) || connection < 0
+		|| connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		fmt::print(stderr, "<cli>: could not connect to the compile server on '{}'\n", socket_path);
+		return 1;
+	}
+
+	std::string arguments;
+
+	char* const directory = getcwd(nullptr, 0);
+
+	if (directory != nullptr)
+	{
+		arguments += directory;
+		std::free(directory);
+	}
+
+	arguments += '\0';
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments += argv[i];
+		arguments += '\0';
+	}
+
+	bool          sent   = send_message(connection, MessageKind::ARGUMENTS, arguments);
+	bool          exited = false;
+	std::uint32_t status = 1;
+
+	MessageKind kind;
+	std::string payload;
+
+	while (sent && !exited && receive_message(connection, kind, payload))
+	{
+		switch (kind)
+		{
+		case MessageKind::INPUT_REQUEST:
+		{
+			const std::string input{std::istreambuf_iterator<char>{std::cin}, std::istreambuf_iterator<char>{}};
+			sent = send_message(connection, MessageKind::INPUT, input);
+			break;
+		}
+
+		case MessageKind::OUTPUT: std::fwrite(payload.data(), 1, payload.size(), stdout); break;
+		case MessageKind::ERRORS: std::fwrite(payload.data(), 1, payload.size(), stderr); break;
+
+		case MessageKind::EXIT:
+		{
+			if (payload.size() == sizeof(status))
+			{
+				std::memcpy(&status, payload.data(), sizeof(status));
+			}
+
+			exited = true;
+			break;
+		}
+
+		default: break;
+		}
+	}
+
+	close(connection);
+
+	if (!exited)
+	{
+		fmt::print(stderr, "<cli>: lost the connection to the compile server on '{}'\n", socket_path);
+		return 1;
+	}
+
+	return int(status);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+//! \brief Serve compilations on the Unix socket at \p socket_path, until the process is killed.
+//!
+//! \details
+//!		Clients are served by as many worker threads as there are cores, each with its own command line and working
+//!		directory, by the same code as the compiler run from the command line. The declarations of the includes are
+//!		kept in memory across the compilations, see IncludeCacheStore. What the compilation writes to stdout and stderr
+//!		is sent to the client as it is written. Clients that send or read nothing for a minute are dropped, which
+//!		includes the ones whose stdin stays open that long.
+//!
+//! \returns The exit status of the compiler if the socket could not be set up, or stopped accepting clients.
+int run_server(const std::string& socket_path);
+
+//! \brief Have the server on the Unix socket at \p socket_path compile the command line \p argv as if it were run in
+//! the working directory of this process, forwarding its stdin, stdout and stderr.
+//! \returns The exit status the server compiled with.
+int run_client(const std::string& socket_path, int argc, char** argv);
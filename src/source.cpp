@@ -0,0 +1,89 @@
+#include "source.hpp"
+
+#include <fcntl.h>
+#include <istream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::unique_ptr<SourceFile> SourceFile::open(const std::string& path)
+{
+	const int descriptor = ::open(path.c_str(), O_RDONLY);
+
+	if (descriptor < 0)
+	{
+		return nullptr;
+	}
+
+	std::unique_ptr<SourceFile> source{new SourceFile{path}};
+
+	struct stat status;
+	const bool  is_regular_file = fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode);
+
+	// Empty files cannot be mapped, but reading them costs nothing
+	if (is_regular_file && status.st_size > 0)
+	{
+		void* const mapping = mmap(nullptr, std::size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+		if (mapping != MAP_FAILED)
+		{
+			// Tokens are read from the start to the end
+			madvise(mapping, std::size_t(status.st_size), MADV_SEQUENTIAL);
+
+			source->m_data   = static_cast<const char*>(mapping);
+			source->m_size   = std::size_t(status.st_size);
+			source->m_mapped = true;
+		}
+	}
+
+	if (!source->m_mapped)
+	{
+		char buffer[64 * 1024];
+
+		for (;;)
+		{
+			const ssize_t count = ::read(descriptor, buffer, sizeof(buffer));
+
+			if (count < 0)
+			{
+				::close(descriptor);
+				return nullptr;
+			}
+
+			if (count == 0)
+			{
+				break;
+			}
+
+			source->m_buffer.append(buffer, std::size_t(count));
+		}
+
+		source->m_data = source->m_buffer.data();
+		source->m_size = source->m_buffer.size();
+	}
+
+	// The mapping outlives the descriptor
+	::close(descriptor);
+
+	return source;
+}
+
+std::unique_ptr<SourceFile> SourceFile::read(std::istream& input, const std::string& name)
+{
+	std::unique_ptr<SourceFile> source{new SourceFile{name}};
+
+	source->m_buffer.assign(std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{});
+	source->m_data = source->m_buffer.data();
+	source->m_size = source->m_buffer.size();
+
+	return source;
+}
+
+SourceFile::~SourceFile()
+{
+	if (m_mapped)
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+}
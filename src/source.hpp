@@ -0,0 +1,44 @@
+#pragma once
+
+#include "util/string_view.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+//! \brief Text of a source file, which stays at the same address for as long as the SourceFile lives, so that tokens
+//! can refer to it rather than be copied.
+//!
+//! \details
+//!		Regular files are mapped in memory, so that they are not copied at all. Anything else, e.g. a pipe or stdin, is
+//!		read once into a buffer.
+class SourceFile
+{
+	public:
+	//! \brief Open the file at \p path, or return nullptr if it cannot be read.
+	static std::unique_ptr<SourceFile> open(const std::string& path);
+
+	//! \brief Read the whole of \p input, naming it \p name in diagnostics.
+	static std::unique_ptr<SourceFile> read(std::istream& input, const std::string& name);
+
+	SourceFile(const SourceFile&) = delete;
+	SourceFile& operator=(const SourceFile&) = delete;
+
+	~SourceFile();
+
+	const std::string& name() const { return m_name; }
+	string_view        text() const { return {m_data, m_size}; }
+
+	private:
+	explicit SourceFile(std::string name) : m_name{std::move(name)} {}
+
+	std::string m_name;
+
+	const char* m_data = "";
+	std::size_t m_size = 0;
+
+	//! Whether m_data is a mapping of the file, rather than pointing into m_buffer.
+	bool        m_mapped = false;
+	std::string m_buffer;
+};
@@ -0,0 +1,52 @@
+#include "symbol.hpp"
+
+Symbol SymbolTable::intern(string_view name)
+{
+	// Kept at most 3/4 full, so that probe sequences stay short
+	if ((m_entries.size() + 1) * 4 > m_slots.size() * 3)
+	{
+		grow();
+	}
+
+	const std::size_t   full_hash = std::hash<string_view>{}(name);
+	const std::uint32_t hash      = std::uint32_t(full_hash ^ (full_hash >> 32));
+	const std::size_t   mask      = m_slots.size() - 1;
+
+	std::size_t i = hash & mask;
+
+	for (; m_slots[i] != 0; i = (i + 1) & mask)
+	{
+		const std::uint32_t id    = m_slots[i] - 1;
+		const Entry&        entry = m_entries[id];
+
+		if (entry.hash == hash && string_view{entry.name} == name)
+		{
+			return {id, hash};
+		}
+	}
+
+	const std::uint32_t id = std::uint32_t(m_entries.size());
+	m_entries.push_back({name.str(), "_ceri_var_" + name.str(), hash});
+	m_slots[i] = id + 1;
+
+	return {id, hash};
+}
+
+void SymbolTable::grow()
+{
+	m_slots.assign(m_slots.empty() ? 64 : m_slots.size() * 2, 0);
+
+	const std::size_t mask = m_slots.size() - 1;
+
+	for (std::uint32_t id = 0; id < m_entries.size(); ++id)
+	{
+		std::size_t i = m_entries[id].hash & mask;
+
+		while (m_slots[i] != 0)
+		{
+			i = (i + 1) & mask;
+		}
+
+		m_slots[i] = id + 1;
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "util/string_view.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! \brief Identifier interned by a SymbolTable, which compares and hashes without looking at its characters.
+struct Symbol
+{
+	//! Index of the symbol in its table.
+	std::uint32_t id;
+
+	//! Hash of the name of the symbol, computed once when it was interned.
+	std::uint32_t hash;
+
+	friend bool operator==(Symbol a, Symbol b) { return a.id == b.id; }
+	friend bool operator!=(Symbol a, Symbol b) { return a.id != b.id; }
+};
+
+//! \brief Interns identifiers, so that each distinct name is stored, hashed and mangled only once.
+class SymbolTable
+{
+	public:
+	//! \brief Symbol named \p name, which is added to the table the first time that name is seen.
+	//! \details Only allocates when adding a symbol.
+	Symbol intern(string_view name);
+
+	//! \brief Name of \p symbol, which stays valid as long as the table.
+	string_view name(Symbol symbol) const { return m_entries[symbol.id].name; }
+
+	//! \brief Assembly label of the variable named by \p symbol.
+	const std::string& mangled_name(Symbol symbol) const { return m_entries[symbol.id].mangled_name; }
+
+	private:
+	struct Entry
+	{
+		std::string   name, mangled_name;
+		std::uint32_t hash;
+	};
+
+	//! Grow m_slots to twice its size, or to its initial size if it is empty.
+	void grow();
+
+	//! Entries in the order they were interned. A deque does not move them when it grows, which keeps names valid.
+	std::deque<Entry> m_entries;
+
+	//! Open addressing table of 1 + the index of an entry, or 0 for empty slots. Its size is a power of two.
+	std::vector<std::uint32_t> m_slots;
+};
+
+//! \brief Map from symbols to values of type \p T, stored in a flat open addressing table.
+//!
+//! \details
+//!		Entries are stored contiguously in the order they were added, which is the iteration order. Lookups probe a
+//!		table of indices with the precomputed hash of the symbol, and never compare names. Entries cannot be removed:
+//!		scopes are restored by assigning a copy of the map.
+template<typename T>
+class SymbolMap
+{
+	public:
+	using value_type = std::pair<Symbol, T>;
+
+	//! \brief Entry of \p symbol, or nullptr if there is none.
+	value_type* find(Symbol symbol)
+	{
+		const std::uint32_t slot = m_slots.empty() ? 0 : m_slots[find_slot(symbol)];
+		return slot == 0 ? nullptr : &m_entries[slot - 1];
+	}
+
+	const value_type* find(Symbol symbol) const { return const_cast<SymbolMap*>(this)->find(symbol); }
+
+	bool contains(Symbol symbol) const { return find(symbol) != nullptr; }
+
+	std::size_t size() const { return m_entries.size(); }
+
+	//! \brief Add \p value for \p symbol, unless there is an entry for it already.
+	//! \returns Whether \p value was added.
+	bool emplace(Symbol symbol, T value)
+	{
+		if (contains(symbol))
+		{
+			return false;
+		}
+
+		// Kept at most 3/4 full, so that probe sequences stay short
+		if ((m_entries.size() + 1) * 4 > m_slots.size() * 3)
+		{
+			grow();
+		}
+
+		m_entries.emplace_back(symbol, std::move(value));
+		m_slots[find_slot(symbol)] = std::uint32_t(m_entries.size());
+
+		return true;
+	}
+
+	//! \brief Value of \p symbol, which is default constructed if there was none.
+	T& operator[](Symbol symbol)
+	{
+		emplace(symbol, T{});
+		return find(symbol)->second;
+	}
+
+	typename std::vector<value_type>::const_iterator begin() const { return m_entries.begin(); }
+	typename std::vector<value_type>::const_iterator end() const { return m_entries.end(); }
+
+	private:
+	//! \brief Slot of \p symbol if it is in the map, otherwise the empty slot where it would be added.
+	std::size_t find_slot(Symbol symbol) const
+	{
+		const std::size_t mask = m_slots.size() - 1;
+
+		for (std::size_t i = symbol.hash & mask;; i = (i + 1) & mask)
+		{
+			if (m_slots[i] == 0 || m_entries[m_slots[i] - 1].first == symbol)
+			{
+				return i;
+			}
+		}
+	}
+
+	void grow()
+	{
+		m_slots.assign(m_slots.empty() ? 16 : m_slots.size() * 2, 0);
+
+		for (std::size_t i = 0; i < m_entries.size(); ++i)
+		{
+			m_slots[find_slot(m_entries[i].first)] = std::uint32_t(i + 1);
+		}
+	}
+
+	std::vector<value_type>    m_entries;
+	std::vector<std::uint32_t> m_slots;
+};
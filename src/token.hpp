@@ -23,7 +23,18 @@ enum TOKEN
 	KEYWORD_CONVERT,
 	KEYWORD_FFI,
 	KEYWORD_INCLUDE,
-	LAST_KEYWORD = KEYWORD_INCLUDE,
+	KEYWORD_ALIGNED,
+	KEYWORD_ARRAY,
+	KEYWORD_OF,
+	KEYWORD_RECORD,
+	KEYWORD_NEW,
+	KEYWORD_DISPOSE,
+	KEYWORD_ARENA,
+	KEYWORD_PROCEDURE,
+	KEYWORD_FUNCTION,
+	KEYWORD_INLINE,
+	KEYWORD_NOINLINE,
+	LAST_KEYWORD = KEYWORD_NOINLINE,
 
 	FIRST_TYPE,
 	TYPE_INTEGER = FIRST_TYPE,
@@ -69,6 +80,7 @@ enum TOKEN
 	COLON,
 	SEMICOLON,
 	DOT,
+	DOTDOT,
 	NOT,
 	ASSIGN,
 	EXPONENT,
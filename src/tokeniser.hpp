@@ -0,0 +1,70 @@
+#pragma once
+
+#include "source.hpp"
+#include "util/string_view.hpp"
+
+#include <cstddef>
+
+// FlexLexer.h defines yyFlexLexer every time it is included, and the scanner generated from tokeniser.l includes it
+// before this header.
+#ifndef yyFlexLexerOnce
+#	include <FlexLexer.h>
+#endif
+
+//! \brief Position of a token in the source it was read from.
+struct TokenSpan
+{
+	//! Offset of the first character from the start of the source.
+	std::size_t offset = 0;
+	std::size_t length = 0;
+
+	//! Line and column of the first character, both starting at 1.
+	std::size_t line = 1, column = 1;
+};
+
+//! \brief Scanner generated from tokeniser.l, reading a SourceFile.
+//!
+//! \details
+//!		Flex still copies the source into its own buffer to scan it, but tokens are handed out as spans of the source,
+//!		which are valid for as long as the SourceFile is: the text of a token is not copied, and is not overwritten by
+//!		reading the next one.
+class Tokeniser : public yyFlexLexer
+{
+	public:
+	explicit Tokeniser(const SourceFile& source) : m_source{source} {}
+
+	//! \brief Read the next token, which is defined by flex.
+	int yylex() override;
+
+	const SourceFile& source() const { return m_source; }
+
+	//! \brief Span of the last token read, or an empty span at the end of the source.
+	const TokenSpan& span() const { return m_span; }
+
+	//! \brief Text of the last token read, which points into the source.
+	string_view text() const { return m_source.text().substr(m_span.offset, m_span.length); }
+
+	protected:
+	//! \brief Called by flex to fill its buffer, with up to \p max_size characters copied from the source.
+	int LexerInput(char* buffer, int max_size) override;
+
+	private:
+	//! \brief Called by flex before the action of every rule, which matched the \p length next characters.
+	void begin_token(std::size_t length);
+
+	//! \brief Skip a comment up to and including its '*)', after its '(*' was read.
+	void skip_comment();
+
+	//! \brief Move the position past the \p length next characters.
+	void advance(std::size_t length);
+
+	const SourceFile& m_source;
+
+	//! Offset of the next character to give to flex.
+	std::size_t m_input_offset = 0;
+
+	TokenSpan m_span;
+
+	//! Position of the next character to be matched.
+	std::size_t m_offset = 0, m_line = 1, m_column = 1;
+};
@@ -12,7 +12,7 @@ string_view type_name(Type type)
 {
 	if (check_enum_range(type, Type::FIRST_USER_DEFINED, Type::LAST_USER_DEFINED))
 	{
-		// TODO: perform an actual lookup
+		// Named by the UserTypeTable they belong to
 		return "<user-defined>";
 	}
 
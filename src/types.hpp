@@ -41,4 +41,5 @@ enum class Type : std::int_fast32_t
 	LAST_USER_DEFINED = std::numeric_limits<std::int_fast32_t>::max(),
 };
 
+//! \brief Name of the builtin \p type. User-defined types are named by UserTypeTable::name().
 string_view type_name(Type type);
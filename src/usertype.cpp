@@ -1,10 +1,29 @@
 #include "usertype.hpp"
 
+#include "util/enums.hpp"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <functional>
+#include <stdexcept>
+
 UserType::UserType(UserType::Category category) : category{category}
 {
 	switch (category)
 	{
-	case Category::POINTER: new (&layout_data.pointer) PointerType();
+	case Category::POINTER: new (&layout_data.pointer) PointerType(); break;
+	case Category::ARRAY: new (&layout_data.array) ArrayType(); break;
+	case Category::RECORD: new (&layout_data.record) RecordType(); break;
+	}
+}
+
+UserType::UserType(const UserType& other) : category{other.category}
+{
+	switch (category)
+	{
+	case Category::POINTER: new (&layout_data.pointer) PointerType(other.layout_data.pointer); break;
+	case Category::ARRAY: new (&layout_data.array) ArrayType(other.layout_data.array); break;
+	case Category::RECORD: new (&layout_data.record) RecordType(other.layout_data.record); break;
 	}
 }
 
@@ -12,24 +31,132 @@ UserType::~UserType()
 {
 	switch (category)
 	{
-	case Category::POINTER: layout_data.pointer.~PointerType();
+	case Category::POINTER: layout_data.pointer.~PointerType(); break;
+	case Category::ARRAY: layout_data.array.~ArrayType(); break;
+	case Category::RECORD: layout_data.record.~RecordType(); break;
+	}
+}
+
+UserType& UserType::operator=(const UserType& other)
+{
+	if (this != &other)
+	{
+		this->~UserType();
+		new (this) UserType(other);
+	}
+
+	return *this;
+}
+
+std::size_t UserType::RecordType::find_field(string_view name) const
+{
+	const auto it = std::find_if(fields.begin(), fields.end(), [&](const Field& field) { return field.name == name; });
+	return std::size_t(it - fields.begin());
+}
+
+Type UserTypeTable::intern(const UserType& user_type)
+{
+	Structure structure{user_type.category, Type::VOID};
+
+	switch (user_type.category)
+	{
+	case UserType::Category::POINTER: structure.target = user_type.layout_data.pointer.target; break;
+
+	case UserType::Category::ARRAY:
+	{
+		structure.target = user_type.layout_data.array.element;
+		structure.low    = user_type.layout_data.array.low;
+		structure.high   = user_type.layout_data.array.high;
+		break;
+	}
+
+	case UserType::Category::RECORD: throw std::runtime_error("records are created by create_record()");
+	}
+
+	const auto it = m_structures.find(structure);
+
+	if (it != m_structures.end())
+	{
+		return it->second;
 	}
+
+	const Type type = add(user_type, {});
+	m_structures.emplace(structure, type);
+
+	return type;
+}
+
+Type UserTypeTable::create_record(string_view name) { return add(UserType(UserType::Category::RECORD), name); }
+
+Type UserTypeTable::add(const UserType& user_type, std::string name)
+{
+	// Types start right after FIRST_USER_DEFINED
+	const Type type = Type(underlying_cast(Type::FIRST_USER_DEFINED) + std::int_fast32_t(m_entries.size()) + 1);
+	m_entries.push_back({type, user_type, std::move(name)});
+
+	return type;
+}
+
+const UserType* UserTypeTable::find(Type type) const
+{
+	const Entry* entry = find_entry(type);
+	return entry != nullptr ? &entry->user_type : nullptr;
+}
+
+UserType* UserTypeTable::find(Type type)
+{
+	Entry* entry = const_cast<Entry*>(find_entry(type));
+	return entry != nullptr ? &entry->user_type : nullptr;
 }
 
-bool operator==(const UserType& a, const UserType& b)
+const UserTypeTable::Entry* UserTypeTable::find_entry(Type type) const
 {
-	if (a.category != b.category)
+	if (!check_enum_range(type, Type::FIRST_USER_DEFINED, Type::LAST_USER_DEFINED))
 	{
-		return false;
+		return nullptr;
 	}
 
-	switch (a.category)
+	const std::size_t index = std::size_t(underlying_cast(type) - underlying_cast(Type::FIRST_USER_DEFINED) - 1);
+	return index < m_entries.size() ? &m_entries[index] : nullptr;
+}
+
+std::string UserTypeTable::name(Type type) const
+{
+	const Entry* entry = find_entry(type);
+
+	if (entry == nullptr)
+	{
+		return type_name(type).str();
+	}
+
+	switch (entry->user_type.category)
 	{
-	case UserType::Category::POINTER:
+	case UserType::Category::POINTER: return "^" + name(entry->user_type.layout_data.pointer.target);
+
+	case UserType::Category::ARRAY:
+	{
+		const UserType::ArrayType& array = entry->user_type.layout_data.array;
+		return fmt::format("ARRAY [{}..{}] OF {}", array.low, array.high, name(array.element));
+	}
+
+	case UserType::Category::RECORD:
 	{
-		return a.layout_data.pointer.target == b.layout_data.pointer.target;
+		// Records are named by their TYPE declaration, so that naming a pointer to itself in a field does not recurse
+		return entry->name.empty() ? "<anonymous record>" : entry->name;
 	}
 	}
 
-	return true;
+	return "<unknown>";
+}
+
+std::size_t UserTypeTable::StructureHash::operator()(const Structure& structure) const noexcept
+{
+	std::size_t hash = std::hash<std::uint64_t>{}(std::uint64_t(underlying_cast(structure.target)));
+
+	for (const std::uint64_t value : {std::uint64_t(structure.category), structure.low, structure.high})
+	{
+		hash ^= std::hash<std::uint64_t>{}(value) + 0x9e3779b97f4a7c15u + (hash << 6) + (hash >> 2);
+	}
+
+	return hash;
 }
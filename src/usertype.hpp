@@ -1,16 +1,23 @@
 #pragma once
 
 #include "types.hpp"
+#include "util/string_view.hpp"
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 struct UserType
 {
 	enum class Category
 	{
 		POINTER,
-		/*ARRAY,
-		RECORD*/
+		ARRAY,
+		RECORD
 	};
 
 	struct PointerType
@@ -18,15 +25,129 @@ struct UserType
 		Type target;
 	};
 
+	//! \brief Fixed-size array, indexed from low to high inclusive. Its elements are stored contiguously.
+	struct ArrayType
+	{
+		Type          element;
+		std::uint64_t low, high;
+
+		[[nodiscard]] std::uint64_t length() const { return high - low + 1; }
+	};
+
+	//! \brief Fields stored together, each at a fixed offset from the start of the record.
+	//!
+	//! \details
+	//!		Records that cross FFI are laid out like C does, in declaration order. The compiler chooses the layout of
+	//!		the others once the whole program is known, see Compiler::lay_out_records(). Offsets and sizes are only
+	//!		valid from then on.
+	struct RecordType
+	{
+		struct Field
+		{
+			std::string name;
+			Type        type;
+
+			//! Bytes from the start of the record.
+			std::size_t offset = 0;
+		};
+
+		std::vector<Field> fields;
+
+		//! Whether foreign functions may access the record through a pointer, which requires the C layout.
+		bool foreign = false;
+
+		//! Bytes taken by the record including its padding, which is also the distance between the elements of an
+		//! array of records.
+		std::size_t size = 0, alignment = 1;
+
+		//! \returns The index of the field named \p name, or the count of fields if there is none.
+		[[nodiscard]] std::size_t find_field(string_view name) const;
+	};
+
 	UserType(Category category);
+	UserType(const UserType& other);
 	~UserType();
 
+	UserType& operator=(const UserType& other);
+
 	Category category;
 
-	union
+	union LayoutData
 	{
+		LayoutData() {}
+		~LayoutData() {}
+
 		PointerType pointer;
+		ArrayType   array;
+		RecordType  record;
 	} layout_data;
+};
+
+//! \brief User-defined types, numbered densely from Type::FIRST_USER_DEFINED.
+//!
+//! \details
+//!		Pointer and array types are hash-consed: creating a type equal to an existing one returns the existing one,
+//!		which is found by hashing its structure rather than by comparing it with every type. Records are never shared,
+//!		since every RECORD ... END declares a type of its own.
+class UserTypeTable
+{
+	public:
+	struct Entry
+	{
+		Type     type;
+		UserType user_type;
+
+		//! Name of the TYPE declaration of a record, or empty for records declared in place.
+		std::string name;
+	};
+
+	//! \brief Pointer or array type described by \p user_type, which is created the first time it is asked for.
+	Type intern(const UserType& user_type);
+
+	//! \brief Create a record type without fields, which are added by the parser, named \p name in diagnostics.
+	Type create_record(string_view name = "");
+
+	//! \returns The user type \p type refers to, or nullptr if it is a builtin type.
+	[[nodiscard]] const UserType* find(Type type) const;
+	[[nodiscard]] UserType*       find(Type type);
+
+	//! \brief Name of \p type, spelled like in the source, e.g. `^ARRAY [1..4] OF CHAR`.
+	[[nodiscard]] std::string name(Type type) const;
+
+	std::size_t size() const { return m_entries.size(); }
+
+	//! Entries in the order of their types. Pointers to them stay valid when types are added.
+	std::deque<Entry>::iterator       begin() { return m_entries.begin(); }
+	std::deque<Entry>::iterator       end() { return m_entries.end(); }
+	std::deque<Entry>::const_iterator begin() const { return m_entries.begin(); }
+	std::deque<Entry>::const_iterator end() const { return m_entries.end(); }
+
+	private:
+	//! \brief What makes a pointer or array type equal to another, i.e. every field of PointerType or ArrayType.
+	struct Structure
+	{
+		UserType::Category category;
+
+		//! Target of a pointer or element of an array.
+		Type target;
+
+		std::uint64_t low = 0, high = 0;
+
+		friend bool operator==(const Structure& a, const Structure& b)
+		{
+			return a.category == b.category && a.target == b.target && a.low == b.low && a.high == b.high;
+		}
+	};
+
+	struct StructureHash
+	{
+		std::size_t operator()(const Structure& structure) const noexcept;
+	};
+
+	Type add(const UserType& user_type, std::string name);
+
+	[[nodiscard]] const Entry* find_entry(Type type) const;
 
-	friend bool operator==(const UserType& a, const UserType& b);
+	std::deque<Entry>                                  m_entries;
+	std::unordered_map<Structure, Type, StructureHash> m_structures;
 };
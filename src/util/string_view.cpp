@@ -1,5 +1,6 @@
 #include "string_view.hpp"
 
+#include <cstdint>
 #include <ostream>
 #include <string>
 
@@ -23,6 +24,13 @@ string_view::operator std::string() const { return str(); }
 
 std::size_t std::hash<::string_view>::operator()(::string_view s) const noexcept
 {
-	// Defer to std::string's hash algorithm for now
-	return std::hash<std::string>{}(s.str());
+	// FNV-1a, which hashes the characters in place rather than copying them to a std::string
+	std::uint64_t hash = 14695981039346656037u;
+
+	for (std::size_t i = 0; i < s.size(); ++i)
+	{
+		hash = (hash ^ static_cast<unsigned char>(s[i])) * 1099511628211u;
+	}
+
+	return std::size_t(hash);
 }
@@ -33,6 +33,7 @@ class string_view
 	friend std::ostream& operator<<(std::ostream& os, string_view view);
 
 	constexpr std::size_t size() const { return m_size; }
+	constexpr const char* data() const { return m_data; }
 
 	string_view substr(std::size_t from, std::size_t count) const { return {m_data + from, count}; }
 
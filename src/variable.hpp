@@ -1,5 +1,6 @@
 #pragma once
 
+#include "symbol.hpp"
 #include "types.hpp"
 
 #include <string>
@@ -8,6 +9,10 @@ struct VariableType
 {
 	// This is a struct on its own in case we add metadata or anything of the sort
 	Type type;
+
+	//! Whether the variable was declared ALIGNED: it starts a cache line of its own, which it does not share with any
+	//! other variable.
+	bool cache_aligned = false;
 };
 
 struct Variable
@@ -15,5 +20,6 @@ struct Variable
 	std::string  name;
 	VariableType type;
 
-	std::string mangled_name() const;
+	//! Interned name, given when the variable is declared, which its assembly label is looked up by.
+	Symbol symbol = {};
 };
@@ -0,0 +1,26 @@
+(*
+    Pascal names for some of the functions of <math.h>
+    Each of them only forwards to the C function, and calls are inlined down to calling it directly.
+*)
+
+INCLUDE "stdc/math.pas";
+
+FUNCTION abs(x : INTEGER) : INTEGER;
+BEGIN
+    abs := llabs(x)
+END;
+
+FUNCTION ln(x : DOUBLE) : DOUBLE;
+BEGIN
+    ln := log(x)
+END;
+
+FUNCTION arctan(x : DOUBLE) : DOUBLE;
+BEGIN
+    arctan := atan(x)
+END;
+
+FUNCTION power(x, y : DOUBLE) : DOUBLE;
+BEGIN
+    power := pow(x, y)
+END;
@@ -7,7 +7,7 @@
    That might have consequences on the ABI. *)
 
 FFI llabs(INTEGER): INTEGER;
-(* FFI lldiv() *) (* This will require record support and record support in the FFI *)
+(* FFI lldiv() *) (* This returns a record by value, whereas records only cross the FFI through pointers *)
 
 (* Basic operations *)
 FFI fabs(DOUBLE): DOUBLE;
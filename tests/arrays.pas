@@ -0,0 +1,34 @@
+VAR i, s : INTEGER;
+    squares : ARRAY [1..10] OF INTEGER;
+    letters : ARRAY [0..3] OF CHAR;
+    halves : ARRAY [5..7] OF DOUBLE;
+    flags : ARRAY [0..2] OF BOOLEAN;
+
+BEGIN
+    FOR i := 1 TO 10 DO
+        squares[i] := i * i;
+
+    s := 0;
+    FOR i := 1 TO 10 DO
+        s := s + squares[i];
+    DISPLAY s;
+
+    i := 7;
+    DISPLAY squares[i - 1] + squares[3];
+
+    letters[0] := 'a';
+    letters[1] := 'b';
+    FOR i := 2 TO 3 DO
+        letters[i] := 'z';
+    FOR i := 0 TO 3 DO
+        DISPLAY letters[i];
+
+    FOR i := 5 TO 7 DO
+        halves[i] := CONVERT i TO DOUBLE / 2.0;
+    DISPLAY halves[5] + halves[7];
+
+    flags[1] := 1 == 1;
+    i := 1;
+    IF flags[i] THEN DISPLAY 'y' ELSE DISPLAY 'n';
+    IF flags[0] THEN DISPLAY 'y' ELSE DISPLAY 'n'
+END.
@@ -0,0 +1,12 @@
+VAR i, n : INTEGER;
+    a : ARRAY [1..10] OF INTEGER;
+
+BEGIN
+    (* i stays within [1..10]: no check *)
+    FOR i := 1 TO 10 DO
+        a[i] := i;
+
+    (* n is only known at runtime: the index is checked *)
+    n := a[3];
+    DISPLAY a[n]
+END.
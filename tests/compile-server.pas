@@ -0,0 +1,8 @@
+INCLUDE "stdc/math.pas";
+
+VAR total : INTEGER;
+
+BEGIN
+    total := llabs(0 - 42);
+    DISPLAY total
+END.
@@ -0,0 +1,13 @@
+VAR a : INTEGER; d : DOUBLE;
+BEGIN
+	a := 5;
+	DISPLAY 3 * 8 + 4 - a;
+	DISPLAY 100 - 7 * 2 * a;
+	d := 7.5 / 2.0 + 1.0;
+	DISPLAY d;
+	DISPLAY CONVERT 3.9 TO INTEGER;
+	DISPLAY CONVERT 100000000000000000000.0 TO INTEGER;
+	DISPLAY CONVERT 2 * 3 TO DOUBLE;
+	IF 2 < 3 THEN DISPLAY 7;
+	IF 2.0 > 3.0 THEN DISPLAY 8 ELSE DISPLAY 9
+END.
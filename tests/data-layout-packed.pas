@@ -0,0 +1,32 @@
+VAR c, d : CHAR;
+    t, f : BOOLEAN;
+    hits : INTEGER ALIGNED;
+    pc : ^CHAR;
+    pb : ^BOOLEAN;
+
+BEGIN
+    (* BOOLEAN and CHAR variables take a single byte: storing to one must not clobber its neighbours *)
+    hits := 42;
+    c := 'a';
+    d := 'b';
+    t := 1 == 1;
+    f := 1 == 0;
+
+    DISPLAY c;
+    DISPLAY d;
+
+    IF t THEN DISPLAY 1;
+    IF f THEN DISPLAY 2 ELSE DISPLAY 3;
+
+    pc := @d;
+    pc^ := 'z';
+    DISPLAY c;
+    DISPLAY pc^;
+
+    pb := @f;
+    pb^ := t;
+    IF f THEN DISPLAY 4;
+
+    DISPLAY hits;
+    DISPLAY t
+END.
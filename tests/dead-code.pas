@@ -0,0 +1,19 @@
+VAR a, b, scratch, unused : INTEGER;
+    p : ^INTEGER;
+
+BEGIN
+    scratch := 3;
+
+    (* Overwritten before being read *)
+    a := 1;
+    a := scratch * 2;
+
+    (* Never read: the variable, its store and the addition go away *)
+    unused := a + 1;
+
+    (* b is read through p, so its last store stays *)
+    p := @b;
+    b := 5;
+    b := a;
+    DISPLAY p^
+END.
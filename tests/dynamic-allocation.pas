@@ -0,0 +1,54 @@
+TYPE Node = RECORD
+    value : INTEGER;
+    next : ^Node
+END;
+TYPE NodePointer = ^Node;
+
+VAR head, node, spare : NodePointer;
+    counter : ^INTEGER;
+    i, sum : INTEGER;
+
+BEGIN
+    FOR i := 1 TO 5 DO
+    BEGIN
+        NEW(node);
+        node^.value := i;
+        node^.next := head;
+        head := node
+    END;
+
+    sum := 0;
+    node := head;
+    FOR i := 1 TO 5 DO
+    BEGIN
+        sum := sum * 10 + node^.value;
+        node := node^.next
+    END;
+    DISPLAY sum;
+
+    (* A disposed block is reused by the next allocation of the same size, and cleared *)
+    spare := head^.next;
+    DISPOSE(head);
+    NEW(head);
+    DISPLAY head^.value;
+
+    NEW(counter);
+    counter^ := 41;
+    counter^ := counter^ + 1;
+    DISPLAY counter^;
+    DISPOSE(counter);
+
+    (* Everything allocated in an arena is freed when it ends, and disposing it is a no-op *)
+    FOR i := 1 TO 1000 DO
+        ARENA
+        BEGIN
+            NEW(node);
+            node^.value := i;
+            NEW(node^.next);
+            node^.next^.value := node^.value * 2;
+            sum := node^.next^.value;
+            DISPOSE(node)
+        END;
+    DISPLAY sum;
+    DISPLAY spare^.value
+END.
@@ -0,0 +1,8 @@
+VAR n : INTEGER;
+
+BEGIN
+    n := 0;
+
+    WHILE n < 10 DO
+        n := n + 3
+END.
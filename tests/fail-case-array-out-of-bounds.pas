@@ -0,0 +1,5 @@
+VAR a : ARRAY [1..3] OF INTEGER;
+
+BEGIN
+    a[4] := 1
+END.
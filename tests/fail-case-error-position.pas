@@ -0,0 +1,5 @@
+VAR x : INTEGER;
+BEGIN
+	(* the error is reported ** after ** this comment *)
+  x := 1 +;
+END.
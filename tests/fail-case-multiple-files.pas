@@ -0,0 +1,4 @@
+VAR total : INTEGER;
+BEGIN
+	total := count
+END.
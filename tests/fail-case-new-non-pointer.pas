@@ -0,0 +1,5 @@
+VAR n : INTEGER;
+
+BEGIN
+    NEW(n)
+END.
@@ -0,0 +1,7 @@
+TYPE Vector = ARRAY [1..3] OF DOUBLE;
+
+PROCEDURE scale(v : Vector; factor : DOUBLE);
+BEGIN
+END;
+
+BEGIN END.
@@ -0,0 +1,6 @@
+TYPE Division = RECORD quotient, remainder : INTEGER END;
+
+FFI lldiv(INTEGER, INTEGER): Division;
+
+BEGIN
+END.
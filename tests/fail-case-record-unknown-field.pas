@@ -0,0 +1,7 @@
+TYPE Point = RECORD x, y : INTEGER END;
+
+VAR p : Point;
+
+BEGIN
+    p.z := 1
+END.
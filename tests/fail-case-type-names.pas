@@ -0,0 +1,5 @@
+TYPE Node = RECORD next : ^Node; value : INTEGER END;
+VAR p : ^Node; q : ^^INTEGER;
+BEGIN
+	p := q
+END.
@@ -0,0 +1,21 @@
+(* struct timespec from C, which keeps its declaration order so that libc can fill it in *)
+TYPE Timespec = RECORD
+    seconds, nanoseconds : INTEGER
+END;
+
+FFI timespec_get(^Timespec, INTEGER): INTEGER;
+
+VAR now : Timespec;
+    i, base : INTEGER;
+
+BEGIN
+    (* TIME_UTC *)
+    base := timespec_get(@now, 1);
+
+    (* Only the nanoseconds are hot, which would move them first if the layout was the compiler's *)
+    FOR i := 1 TO 10 DO
+        base := base + now.nanoseconds % 2;
+
+    DISPLAY now.seconds > 1600000000;
+    DISPLAY now.nanoseconds < 1000000000
+END.
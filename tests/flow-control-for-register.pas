@@ -0,0 +1,32 @@
+VAR i, j, k, n, s : INTEGER;
+    p : ^INTEGER;
+
+BEGIN
+    s := 0;
+    n := 4;
+
+    (* The bound cannot be hoisted: n changes in the body *)
+    FOR i := 1 TO n DO
+    BEGIN
+        n := n - 1;
+        s := s + i
+    END;
+
+    DISPLAY s;
+    DISPLAY i;
+
+    FOR i := 1 TO 3 DO
+        FOR j := i TO n * 2 DO
+            s := s + i * j;
+
+    DISPLAY s;
+    DISPLAY j;
+
+    (* k is written through a pointer, so it must stay in memory *)
+    p := @k;
+
+    FOR k := 1 TO 6 DO
+        p^ := p^ + 1;
+
+    DISPLAY k
+END.
@@ -0,0 +1,17 @@
+(* Comparisons feeding IF/WHILE branch on the flags directly, other uses materialize a boolean *)
+
+VAR a, b : INTEGER;
+VAR x : DOUBLE;
+
+BEGIN
+    a := 3;
+    b := 4;
+    DISPLAY a < b;
+    DISPLAY !(a < b);
+    IF !(a >= b) THEN DISPLAY 'k';
+    x := 0.0;
+    WHILE x < 2.5 DO x := x + 1.0;
+    DISPLAY x;
+    IF (a == 3) || (b == 3) THEN DISPLAY 'o';
+    DISPLAY (a <> b) && (b <> a)
+END.
@@ -0,0 +1,14 @@
+(* Included by include-cache.pas, whose compilations after the first load these declarations from the cache *)
+
+TYPE Node = RECORD
+    value : INTEGER;
+    next : ^Node
+END;
+
+TYPE Row = ARRAY [1..3] OF ^Node;
+
+VAR first, second, third : Node;
+    row : Row;
+    scale : DOUBLE ALIGNED;
+
+FFI putchar(INTEGER) : INTEGER;
@@ -0,0 +1,29 @@
+INCLUDE "include-cache-declarations.pas";
+INCLUDE "stdc/math.pas";
+
+VAR i, s : INTEGER;
+    p : ^Node;
+
+BEGIN
+    row[1] := @first;
+    row[2] := @second;
+    row[3] := @third;
+
+    FOR i := 1 TO 3 DO
+        row[i]^.value := i * 10;
+    first.next := row[2];
+    second.next := row[3];
+
+    s := 0;
+    p := row[1];
+    FOR i := 1 TO 2 DO
+    BEGIN
+        s := s + p^.value;
+        p := p^.next
+    END;
+    DISPLAY s + p^.value;
+
+    scale := hypot(3.0, 4.0);
+    DISPLAY scale;
+    putchar(10)
+END.
@@ -0,0 +1,39 @@
+VAR i, total : INTEGER;
+
+FUNCTION fact(n : INTEGER) : INTEGER;
+BEGIN
+    IF n < 2 THEN
+        fact := 1
+    ELSE
+        fact := n * fact(n - 1)
+END;
+
+FUNCTION bound(n : INTEGER) : INTEGER;
+BEGIN
+    bound := n + 1
+END;
+
+PROCEDURE log_value(n : INTEGER); NOINLINE;
+BEGIN
+    DISPLAY n
+END;
+
+PROCEDURE report(a, b, c : INTEGER);
+BEGIN
+    DISPLAY a;
+    DISPLAY b;
+    DISPLAY c;
+    DISPLAY a + b + c;
+    DISPLAY a * b * c
+END;
+
+BEGIN
+    total := 0;
+
+    FOR i := 1 TO bound(3) DO
+        total := total + fact(i);
+
+    log_value(total);
+    report(1, 2, 3);
+    report(4, 5, 6)
+END.
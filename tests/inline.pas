@@ -0,0 +1,48 @@
+INCLUDE "math.pas";
+
+VAR i, total : INTEGER;
+
+(* Returns from several branches *)
+FUNCTION clamp(value, low, high : INTEGER) : INTEGER;
+BEGIN
+    IF value < low THEN
+        clamp := low
+    ELSE IF value > high THEN
+        clamp := high
+    ELSE
+        clamp := value
+END;
+
+FUNCTION twice(x : INTEGER) : INTEGER; NOINLINE;
+BEGIN
+    twice := 2 * x
+END;
+
+(* Has a FOR loop of its own, and writes to its parameter *)
+PROCEDURE add(amount : INTEGER); INLINE;
+VAR k : INTEGER;
+BEGIN
+    amount := amount * 2;
+
+    FOR k := 1 TO amount DO
+        total := total + 1
+END;
+
+BEGIN
+    total := 0;
+    FOR i := 1 TO 10 DO
+        total := total + clamp(i, 3, 7);
+    DISPLAY total;
+
+    DISPLAY twice(21);
+
+    total := 0;
+    FOR i := 1 TO 3 DO
+        add(i);
+    DISPLAY total;
+
+    DISPLAY abs(3 - 8);
+    DISPLAY ln(1.0);
+    DISPLAY arctan(0.0);
+    DISPLAY power(2.0, 10.0)
+END.
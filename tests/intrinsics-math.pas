@@ -0,0 +1,22 @@
+INCLUDE "stdc/math.pas";
+
+VAR x, y, nan : DOUBLE;
+
+BEGIN
+	nan := 0.0 / 0.0;
+	x := 2.25;
+	y := 0.0 - 3.5;
+
+	DISPLAY sqrt(x);
+	DISPLAY fabs(y);
+	DISPLAY fmin(x, y);
+	DISPLAY fmax(x, nan);
+	DISPLAY fmin(nan, y);
+	DISPLAY fmod(0.0 - 10.0, 3.0);
+	DISPLAY 1000000000000000000000.0 % x;
+	DISPLAY floor(y);
+	DISPLAY ceil(y);
+	DISPLAY trunc(y);
+	DISPLAY round(y);
+	DISPLAY round(0.49999999999999994)
+END.
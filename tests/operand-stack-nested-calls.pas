@@ -0,0 +1,12 @@
+FFI fmod(DOUBLE, DOUBLE): DOUBLE;
+FFI llabs(INTEGER): INTEGER;
+VAR x, y : DOUBLE;
+
+(* Evaluating a parameter must not clobber the parameters that were evaluated before *)
+
+BEGIN
+    x := 7.5;
+    y := 2.0;
+    DISPLAY fmod(fmod(x, y) + 10.0, fmod(x + y, 4.0));
+    DISPLAY llabs(llabs(17) + llabs(5))
+END.
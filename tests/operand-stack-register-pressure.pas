@@ -0,0 +1,15 @@
+VAR a, b, c : INTEGER;
+VAR p : BOOLEAN;
+
+(* Deeply nested expressions need more registers than available, which forces spills to the machine stack *)
+
+BEGIN
+    a := 17;
+    b := 5;
+    c := ((a + 1) * (b + 2)) + ((a - 3) * ((b + 4) * ((a + 5) * ((b + 6) * ((a + 7) * (b + 8))))));
+    DISPLAY c;
+    DISPLAY a % b;
+    DISPLAY a / b;
+    p := (a > b) && (b > a);
+    DISPLAY p
+END.
@@ -0,0 +1,9 @@
+VAR a, b : INTEGER;
+
+(* The "and" already sets the flags the branch needs, so the "test" emitted for the IF condition is redundant *)
+
+BEGIN
+    a := 3;
+    b := 4;
+    IF (a < b) && (b > 1) THEN DISPLAY 'y'
+END.
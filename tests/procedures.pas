@@ -0,0 +1,94 @@
+TYPE Digits = ARRAY [0..9] OF INTEGER;
+
+VAR i, total, n : INTEGER;
+
+FUNCTION fib(n : INTEGER) : INTEGER;
+BEGIN
+    IF n < 2 THEN
+        fib := n
+    ELSE
+        fib := fib(n - 1) + fib(n - 2)
+END;
+
+(* Parameters and locals hide the globals of the same name *)
+FUNCTION square_sum(n : INTEGER) : INTEGER;
+VAR i, total : INTEGER;
+BEGIN
+    total := 0;
+    FOR i := 1 TO n DO
+        total := total + i * i;
+    square_sum := total
+END;
+
+FUNCTION mix(a : INTEGER; x, y : DOUBLE; c : CHAR; negate : BOOLEAN) : DOUBLE;
+BEGIN
+    IF negate THEN
+        mix := CONVERT a TO DOUBLE - x * y
+    ELSE
+        mix := CONVERT a TO DOUBLE + x * y;
+
+    DISPLAY c
+END;
+
+FUNCTION is_even(n : INTEGER) : BOOLEAN;
+BEGIN
+    is_even := n % 2 == 0
+END;
+
+(* Reads and writes the globals of the loop that calls it *)
+PROCEDURE count(step : INTEGER);
+BEGIN
+    total := total + i * step
+END;
+
+PROCEDURE show(n : INTEGER);
+BEGIN
+    DISPLAY n + 1
+END;
+
+FUNCTION digit_sum(n : INTEGER) : INTEGER;
+VAR digits : Digits; p : ^INTEGER; k, sum : INTEGER;
+BEGIN
+    k := 0;
+
+    WHILE n > 0 DO
+    BEGIN
+        digits[k] := n % 10;
+        n := n / 10;
+        k := k + 1
+    END;
+
+    sum := 0;
+    p := @sum;
+
+    WHILE k > 0 DO
+    BEGIN
+        k := k - 1;
+        p^ := p^ + digits[k]
+    END;
+
+    digit_sum := sum
+END;
+
+BEGIN
+    DISPLAY fib(20);
+    DISPLAY square_sum(10);
+
+    total := 0;
+    FOR i := 1 TO 4 DO
+        count(10);
+    DISPLAY total;
+    DISPLAY i;
+
+    DISPLAY mix(1, 1.5, 2.0, 'a', 1 == 0);
+    DISPLAY mix(1, 1.5, 2.0, 'b', 0 == 0);
+
+    n := 0;
+    FOR i := 1 TO 10 DO
+        IF is_even(i) THEN
+            n := n + 1;
+    DISPLAY n;
+
+    DISPLAY digit_sum(98765);
+    show(fib(10))
+END.
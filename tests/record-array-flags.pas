@@ -0,0 +1,18 @@
+TYPE R3 = RECORD a : CHAR; b : INTEGER; c : BOOLEAN END;
+
+(* Elements are 16 bytes apart, a stride that is multiplied by imul, which must not clobber the comparison *)
+VAR arr : ARRAY [1..7] OF R3; i : INTEGER;
+
+BEGIN
+    i := 2;
+    arr[i].c := i == 2;
+    IF arr[i].c THEN DISPLAY 'y' ELSE DISPLAY 'n';
+
+    arr[i].c := i == 3;
+    IF arr[i].c THEN DISPLAY 'y' ELSE DISPLAY 'n';
+
+    FOR i := 1 TO 7 DO
+        arr[i].c := i % 2 == 0;
+    FOR i := 1 TO 7 DO
+        IF arr[i].c THEN DISPLAY 'y' ELSE DISPLAY 'n'
+END.
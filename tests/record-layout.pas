@@ -0,0 +1,23 @@
+TYPE Node = RECORD
+    visited : BOOLEAN;
+    cost : INTEGER;
+    label : CHAR;
+    weight, unused : DOUBLE
+END;
+
+VAR nodes : ARRAY [0..99] OF Node;
+    i : INTEGER;
+    total : DOUBLE;
+
+BEGIN
+    nodes[0].visited := 1 == 1;
+    nodes[0].label := 'a';
+    nodes[0].cost := 1;
+
+    (* weight and visited are hot, while cost and label are cold and unused is never accessed *)
+    total := 0.0;
+    FOR i := 0 TO 99 DO
+        IF nodes[i].visited THEN
+            total := total + nodes[i].weight;
+    DISPLAY total
+END.
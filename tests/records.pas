@@ -0,0 +1,43 @@
+TYPE Particle = RECORD
+    x, y : INTEGER;
+    alive : BOOLEAN;
+    tag : CHAR;
+    mass : DOUBLE
+END;
+
+VAR p : Particle;
+    swarm : ARRAY [1..4] OF Particle;
+    pp : ^Particle;
+    i, s : INTEGER;
+
+BEGIN
+    p.x := 3;
+    p.y := 4;
+    p.alive := 1 == 1;
+    p.tag := 'p';
+    p.mass := 1.5;
+    DISPLAY p.x * p.y;
+    IF p.alive THEN DISPLAY p.tag;
+    DISPLAY p.mass;
+
+    FOR i := 1 TO 4 DO
+    BEGIN
+        swarm[i].x := i;
+        swarm[i].y := i * 10;
+        swarm[i].tag := 'a'
+    END;
+    swarm[3].tag := 'c';
+
+    s := 0;
+    FOR i := 1 TO 4 DO
+        s := s + swarm[i].x + swarm[i].y;
+    DISPLAY s;
+    DISPLAY swarm[2].tag;
+    DISPLAY swarm[3].tag;
+
+    pp := @p;
+    pp^.x := 42;
+    pp^.alive := 1 == 0;
+    DISPLAY p.x + pp^.y;
+    IF pp^.alive THEN DISPLAY 'y' ELSE DISPLAY 'n'
+END.
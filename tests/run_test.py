@@ -1,9 +1,11 @@
 #!/usr/bin/env python3
 
 # Usage:
-# run_test.py compile_and_pray <compiler_path> <source> <asmoutput> <exeoutput>
-# run_test.py compile_and_match_output <compiler_path> <source> <asmoutput> <exeoutput> <regex>
-# run_test.py compile_and_match_diagnostic <compiler_path> <source> <regex>
+# run_test.py compile_and_pray <compiler_path> <source> <asmoutput> <exeoutput> [compiler flags...]
+# run_test.py compile_and_match_output <compiler_path> <source> <asmoutput> <exeoutput> <regex> [compiler flags...]
+# run_test.py compile_and_match_diagnostic <compiler_path> <source> <regex> [compiler flags...]
+# run_test.py compile_through_server <compiler_path> <source> <exeoutput> <regex> [compiler flags...]
+# run_test.py compile_and_match_output_without_ir <compiler_path> <source> <asmoutput> <exeoutput> <regex> <ir_regex> [compiler flags...]
 # This should be called by a CTest within CMakeLists.txt
 from subprocess import Popen, PIPE, DEVNULL
 import sys
@@ -27,13 +29,15 @@ common_compiler_flags = [
 if action == "compile_and_pray":
     asm_path = sys.argv[4]
     exec_path = sys.argv[5]
+    extra_compiler_flags = sys.argv[6:]
 
     compiler_process = Popen([
         compiler_path,
         source_path,
         "--assembly-output", asm_path,
         "--program-output", exec_path,
-        *common_compiler_flags
+        *common_compiler_flags,
+        *extra_compiler_flags
     ])
 
     (stdout, stderr) = compiler_process.communicate()
@@ -45,13 +49,15 @@ elif action == "compile_and_match_output":
     asm_path = sys.argv[4]
     exec_path = sys.argv[5]
     output_pattern = sys.argv[6] + '$'
+    extra_compiler_flags = sys.argv[7:]
 
     compiler_process = Popen([
         compiler_path,
         source_path,
         "--assembly-output", asm_path,
         "--program-output", exec_path,
-        *common_compiler_flags
+        *common_compiler_flags,
+        *extra_compiler_flags
     ])
 
     (stdout, stderr) = compiler_process.communicate()
@@ -73,13 +79,15 @@ elif action == "compile_and_match_output":
 
 elif action == "compile_and_match_diagnostic":
     diagnostic_pattern = sys.argv[4]
+    extra_compiler_flags = sys.argv[5:]
 
     compiler_process = Popen(
         [
             compiler_path,
             source_path,
             "--assembly-stdout", # TODO: option to discard assembly
-            *common_compiler_flags
+            *common_compiler_flags,
+            *extra_compiler_flags
         ],
         stdout=DEVNULL,
         stderr=PIPE
@@ -95,6 +103,144 @@ elif action == "compile_and_match_diagnostic":
         )
         sys.exit(1)
 
+elif action == "compile_and_match_output_without_ir":
+    asm_path = sys.argv[4]
+    exec_path = sys.argv[5]
+    output_pattern = sys.argv[6] + '$'
+    absent_ir_pattern = sys.argv[7]
+    extra_compiler_flags = sys.argv[8:]
+
+    compiler_process = Popen([
+        compiler_path,
+        source_path,
+        "--assembly-output", asm_path,
+        "--program-output", exec_path,
+        "--emit-ir",
+        *common_compiler_flags,
+        *extra_compiler_flags
+    ], stderr=PIPE)
+
+    (stdout, stderr) = compiler_process.communicate()
+
+    if compiler_process.returncode != 0:
+        print(stderr.decode("utf-8"), file=sys.stderr)
+        sys.exit(compiler_process.returncode)
+
+    ir_match = re.search(absent_ir_pattern, stderr.decode("utf-8"))
+
+    if ir_match is not None:
+        print(
+            "Found pattern \"{}\" in the IR: \"{}\"".format(absent_ir_pattern, ir_match.group(0)),
+            file=sys.stderr
+        )
+        sys.exit(1)
+
+    output_process = Popen([exec_path], stdout=PIPE)
+
+    (stdout, stderr) = output_process.communicate()
+
+    if re.match(output_pattern, stdout.decode("utf-8")) is None:
+        print(
+            "Failed to match pattern \"{}\". ".format(output_pattern) +
+            "Program output:\n{}".format(stdout.decode("utf-8")),
+            file=sys.stderr
+        )
+        sys.exit(1)
+
+elif action == "compile_through_server":
+    import shutil
+    import tempfile
+    import time
+
+    exec_path = sys.argv[4]
+    output_pattern = sys.argv[5] + '$'
+    extra_compiler_flags = sys.argv[6:]
+
+    def fail(message):
+        print(message, file=sys.stderr)
+        sys.exit(1)
+
+    # Kept short, since the path of a Unix socket is limited to about a hundred characters
+    socket_directory = tempfile.mkdtemp(prefix="ceri-")
+    socket_path = os.path.join(socket_directory, "server.sock")
+    server_process = Popen([compiler_path, "--server", socket_path])
+
+    try:
+        for _ in range(100):
+            if os.path.exists(socket_path) or server_process.poll() is not None:
+                break
+            time.sleep(0.05)
+
+        if not os.path.exists(socket_path):
+            fail("The compile server did not create its socket")
+
+        client = [compiler_path, "--connect", socket_path]
+
+        # From a file, linked by the server
+        compiler_process = Popen([
+            *client,
+            source_path,
+            "--assembly-output", exec_path + ".s",
+            "--program-output", exec_path,
+            *common_compiler_flags,
+            *extra_compiler_flags
+        ], stderr=PIPE)
+
+        (stdout, stderr) = compiler_process.communicate()
+
+        if compiler_process.returncode != 0:
+            fail("Compiling through the server failed:\n{}".format(stderr.decode("utf-8")))
+
+        output_process = Popen([exec_path], stdout=PIPE)
+
+        (stdout, stderr) = output_process.communicate()
+
+        if re.match(output_pattern, stdout.decode("utf-8")) is None:
+            fail(
+                "Failed to match pattern \"{}\". ".format(output_pattern) +
+                "Program output:\n{}".format(stdout.decode("utf-8"))
+            )
+
+        # From stdin, which must give the same assembly as the compiler run on its own
+        with open(source_path, "rb") as source_file:
+            source = source_file.read()
+
+        assembly = []
+
+        for command in [client, []]:
+            compiler_process = Popen([
+                *(command or [compiler_path]),
+                "--assembly-stdout",
+                *common_compiler_flags,
+                *extra_compiler_flags
+            ], stdin=PIPE, stdout=PIPE, stderr=PIPE)
+
+            (stdout, stderr) = compiler_process.communicate(source)
+
+            if compiler_process.returncode != 0:
+                fail("Compiling stdin failed:\n{}".format(stderr.decode("utf-8")))
+
+            assembly.append(stdout)
+
+        if assembly[0] != assembly[1] or len(assembly[0]) == 0:
+            fail("The server did not write the same assembly as the compiler to stdout")
+
+        # Errors are reported with the exit status of the compilation
+        compiler_process = Popen(
+            [*client, "--assembly-stdout"],
+            stdin=PIPE, stdout=DEVNULL, stderr=PIPE
+        )
+
+        (stdout, stderr) = compiler_process.communicate(b"BEGIN undeclared := 0 END.")
+
+        if compiler_process.returncode != 1 or b"undeclared" not in stderr:
+            fail("The server did not report the error of an ill-formed program:\n{}".format(stderr.decode("utf-8")))
+
+    finally:
+        server_process.terminate()
+        server_process.wait()
+        shutil.rmtree(socket_directory)
+
 else:
     print("Invalid action {} entered".format(action), file=sys.stderr)
     sys.exit(1)
@@ -0,0 +1,20 @@
+INCLUDE "stdc/math.pas";
+
+VAR i, n : INTEGER; x : DOUBLE;
+
+(* Calls happen at various stack depths: spilled operands, results discarded by call statements in a loop... *)
+
+BEGIN
+	n := 0;
+	x := 1.0;
+
+	FOR i := 1 TO 3 DO
+	BEGIN
+		cos(x);
+		llabs(i);
+		n := n + llabs(i) * (n + llabs(i + (n + llabs(2))))
+	END;
+
+	DISPLAY n;
+	DISPLAY x + cos(0.0) * (x + cos(x - 1.0))
+END.
@@ -0,0 +1,46 @@
+VAR a, b, i, errors : INTEGER;
+BEGIN
+	errors := 0;
+	a := 1;
+	FOR i := 1 TO 1000 DO
+	BEGIN
+		a := a * 6364136223846793005 + 1442695040888963407;
+		b := 2;
+		IF a / 2 <> a / b THEN errors := errors + 1;
+		IF a % 2 <> a % b THEN errors := errors + 1;
+		IF a * 2 <> a * b THEN errors := errors + 1;
+		b := 7;
+		IF a / 7 <> a / b THEN errors := errors + 1;
+		IF a % 7 <> a % b THEN errors := errors + 1;
+		IF a * 7 <> a * b THEN errors := errors + 1;
+		b := 10;
+		IF a / 10 <> a / b THEN errors := errors + 1;
+		IF a % 10 <> a % b THEN errors := errors + 1;
+		IF a * 10 <> a * b THEN errors := errors + 1;
+		b := 16;
+		IF a / 16 <> a / b THEN errors := errors + 1;
+		IF a % 16 <> a % b THEN errors := errors + 1;
+		IF a * 16 <> a * b THEN errors := errors + 1;
+		b := 24;
+		IF a / 24 <> a / b THEN errors := errors + 1;
+		IF a % 24 <> a % b THEN errors := errors + 1;
+		IF a * 24 <> a * b THEN errors := errors + 1;
+		b := 641;
+		IF a / 641 <> a / b THEN errors := errors + 1;
+		IF a % 641 <> a % b THEN errors := errors + 1;
+		IF a * 641 <> a * b THEN errors := errors + 1;
+		b := 1000000007;
+		IF a / 1000000007 <> a / b THEN errors := errors + 1;
+		IF a % 1000000007 <> a % b THEN errors := errors + 1;
+		IF a * 1000000007 <> a * b THEN errors := errors + 1;
+		b := 9223372036854775809;
+		IF a / 9223372036854775809 <> a / b THEN errors := errors + 1;
+		IF a % 9223372036854775809 <> a % b THEN errors := errors + 1;
+		IF a * 9223372036854775809 <> a * b THEN errors := errors + 1
+	END;
+	DISPLAY errors;
+	a := 18446744073709551557;
+	DISPLAY a / 7;
+	DISPLAY a % 1000;
+	DISPLAY a * 40
+END.
@@ -0,0 +1,150 @@
+(* Enough globals to grow the symbol table several times, each needing a label of its own *)
+VAR a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16, a17, a18, a19, a20,
+    a21, a22, a23, a24, a25, a26, a27, a28, a29, a30, a31, a32, a33, a34, a35, a36, a37, a38, a39,
+    a40, a41, a42, a43, a44, a45, a46, a47, a48, a49, a50, a51, a52, a53, a54, a55, a56, a57, a58,
+    a59, a60, a61, a62, a63, a64, a65, a66, a67, a68, a69, a70, a71, a72, a73, a74, a75, a76, a77,
+    a78, a79, a80, a81, a82, a83, a84, a85, a86, a87, a88, a89, a90, a91, a92, a93, a94, a95, a96,
+    a97, a98, a99 : INTEGER;
+VAR x, total, sum : INTEGER;
+
+(* Its parameter and local hide the globals, and each of its inlined copies is a variable of its own *)
+FUNCTION inner(x : INTEGER) : INTEGER;
+VAR total : INTEGER;
+BEGIN
+    total := x * 2;
+    inner := total + a99
+END;
+
+(* Hides the globals that inner reads or hides too. Once inlined, its local whose address is taken stays in memory *)
+FUNCTION outer(x : INTEGER) : INTEGER; INLINE;
+VAR total, a0 : INTEGER; p : ^INTEGER;
+BEGIN
+    a0 := inner(x + 1);
+    p := @total;
+    p^ := inner(a0);
+    outer := total + x + a1
+END;
+
+BEGIN
+    a0 := 1;
+    a1 := a0 + 1;
+    a2 := a1 + 1;
+    a3 := a2 + 1;
+    a4 := a3 + 1;
+    a5 := a4 + 1;
+    a6 := a5 + 1;
+    a7 := a6 + 1;
+    a8 := a7 + 1;
+    a9 := a8 + 1;
+    a10 := a9 + 1;
+    a11 := a10 + 1;
+    a12 := a11 + 1;
+    a13 := a12 + 1;
+    a14 := a13 + 1;
+    a15 := a14 + 1;
+    a16 := a15 + 1;
+    a17 := a16 + 1;
+    a18 := a17 + 1;
+    a19 := a18 + 1;
+    a20 := a19 + 1;
+    a21 := a20 + 1;
+    a22 := a21 + 1;
+    a23 := a22 + 1;
+    a24 := a23 + 1;
+    a25 := a24 + 1;
+    a26 := a25 + 1;
+    a27 := a26 + 1;
+    a28 := a27 + 1;
+    a29 := a28 + 1;
+    a30 := a29 + 1;
+    a31 := a30 + 1;
+    a32 := a31 + 1;
+    a33 := a32 + 1;
+    a34 := a33 + 1;
+    a35 := a34 + 1;
+    a36 := a35 + 1;
+    a37 := a36 + 1;
+    a38 := a37 + 1;
+    a39 := a38 + 1;
+    a40 := a39 + 1;
+    a41 := a40 + 1;
+    a42 := a41 + 1;
+    a43 := a42 + 1;
+    a44 := a43 + 1;
+    a45 := a44 + 1;
+    a46 := a45 + 1;
+    a47 := a46 + 1;
+    a48 := a47 + 1;
+    a49 := a48 + 1;
+    a50 := a49 + 1;
+    a51 := a50 + 1;
+    a52 := a51 + 1;
+    a53 := a52 + 1;
+    a54 := a53 + 1;
+    a55 := a54 + 1;
+    a56 := a55 + 1;
+    a57 := a56 + 1;
+    a58 := a57 + 1;
+    a59 := a58 + 1;
+    a60 := a59 + 1;
+    a61 := a60 + 1;
+    a62 := a61 + 1;
+    a63 := a62 + 1;
+    a64 := a63 + 1;
+    a65 := a64 + 1;
+    a66 := a65 + 1;
+    a67 := a66 + 1;
+    a68 := a67 + 1;
+    a69 := a68 + 1;
+    a70 := a69 + 1;
+    a71 := a70 + 1;
+    a72 := a71 + 1;
+    a73 := a72 + 1;
+    a74 := a73 + 1;
+    a75 := a74 + 1;
+    a76 := a75 + 1;
+    a77 := a76 + 1;
+    a78 := a77 + 1;
+    a79 := a78 + 1;
+    a80 := a79 + 1;
+    a81 := a80 + 1;
+    a82 := a81 + 1;
+    a83 := a82 + 1;
+    a84 := a83 + 1;
+    a85 := a84 + 1;
+    a86 := a85 + 1;
+    a87 := a86 + 1;
+    a88 := a87 + 1;
+    a89 := a88 + 1;
+    a90 := a89 + 1;
+    a91 := a90 + 1;
+    a92 := a91 + 1;
+    a93 := a92 + 1;
+    a94 := a93 + 1;
+    a95 := a94 + 1;
+    a96 := a95 + 1;
+    a97 := a96 + 1;
+    a98 := a97 + 1;
+    a99 := a98 + 1;
+
+    sum := 0;
+    sum := sum + a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9;
+    sum := sum + a10 + a11 + a12 + a13 + a14 + a15 + a16 + a17 + a18 + a19;
+    sum := sum + a20 + a21 + a22 + a23 + a24 + a25 + a26 + a27 + a28 + a29;
+    sum := sum + a30 + a31 + a32 + a33 + a34 + a35 + a36 + a37 + a38 + a39;
+    sum := sum + a40 + a41 + a42 + a43 + a44 + a45 + a46 + a47 + a48 + a49;
+    sum := sum + a50 + a51 + a52 + a53 + a54 + a55 + a56 + a57 + a58 + a59;
+    sum := sum + a60 + a61 + a62 + a63 + a64 + a65 + a66 + a67 + a68 + a69;
+    sum := sum + a70 + a71 + a72 + a73 + a74 + a75 + a76 + a77 + a78 + a79;
+    sum := sum + a80 + a81 + a82 + a83 + a84 + a85 + a86 + a87 + a88 + a89;
+    sum := sum + a90 + a91 + a92 + a93 + a94 + a95 + a96 + a97 + a98 + a99;
+
+    x := 5;
+    total := 7;
+    DISPLAY outer(x);
+    DISPLAY outer(total);
+    DISPLAY x;
+    DISPLAY total;
+    DISPLAY a0;
+    DISPLAY sum
+END.
@@ -0,0 +1 @@
+BEGIN DISPLAY CONVERT 3.9 TO INTEGER END.
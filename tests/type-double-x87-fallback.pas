@@ -0,0 +1,15 @@
+(* Checks that the opt-in x87 code generation behaves like the default SSE2 one *)
+
+VAR a, b : DOUBLE;
+
+BEGIN
+    a := 2.5;
+    b := 0.5;
+
+    DISPLAY a * b - a;
+    DISPLAY a / b;
+    DISPLAY a % b;
+    DISPLAY CONVERT a TO INTEGER;
+
+    IF a > b THEN DISPLAY 'o' ELSE DISPLAY 'x'
+END.
@@ -0,0 +1,17 @@
+VAR i, s : INTEGER;
+    t : DOUBLE;
+    a : ARRAY [0..99] OF DOUBLE;
+    x : ARRAY [0..99] OF INTEGER;
+
+BEGIN
+    FOR i := 0 TO 99 DO
+        x[i] := i;
+    FOR i := 1 TO 99 DO
+        a[i] := a[i - 1] + 1.0;
+    FOR i := 0 TO 99 DO
+        s := s + x[i];
+    FOR i := 0 TO 99 DO
+        t := t + a[i];
+    DISPLAY s;
+    DISPLAY t
+END.
@@ -0,0 +1,37 @@
+INCLUDE "stdc/math.pas";
+
+VAR i, s : INTEGER;
+    k, m, t : DOUBLE;
+    a, b, c : ARRAY [1..21] OF DOUBLE;
+    x : ARRAY [0..16] OF INTEGER;
+
+BEGIN
+    FOR i := 1 TO 21 DO
+    BEGIN
+        a[i] := CONVERT i TO DOUBLE;
+        b[i] := 100.0 - a[i]
+    END;
+
+    k := 0.5;
+    FOR i := 1 TO 21 DO
+        c[i] := a[i] * k + b[i];
+    DISPLAY c[1];
+    DISPLAY c[21];
+
+    m := 0.0 - 1.0;
+    FOR i := 2 TO 20 DO
+        m := fmax(m, c[i] - a[i - 1]);
+    DISPLAY m;
+
+    FOR i := 0 TO 16 DO
+        x[i] := i * 3;
+    s := 0;
+    FOR i := 0 TO 16 DO
+        s := s + x[i];
+    DISPLAY s;
+
+    t := 0.0;
+    FOR i := 1 TO 21 DO
+        t := t + c[i];
+    DISPLAY t
+END.